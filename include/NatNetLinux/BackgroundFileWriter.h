@@ -0,0 +1,258 @@
+/*
+ * BackgroundFileWriter.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BACKGROUNDFILEWRITER_H
+#define BACKGROUNDFILEWRITER_H
+
+#include <NatNetLinux/NatNet.h>
+#include <boost/thread.hpp>
+#include <vector>
+#include <algorithm>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/*!
+ * \brief Writing thread and bounded buffer pool shared by the file writers.
+ * \author Philip G. Lee
+ *
+ * The producer fills \c _fill under \c _mutex, and calls _queueFill() when
+ * it is full. The writing thread polls for queued buffers every
+ * pollInterval() seconds, hands each to _writeBuffer() without holding the
+ * lock, and reuses it. A partly filled buffer is queued after
+ * \c flushInterval seconds, and at stop(). At most \c maxBuffers buffers
+ * exist, so when the disk falls behind _queueFill() fails and the producer
+ * drops its data rather than growing memory.
+ *
+ * \c Buffer needs \c empty() and \c clear(). Derived classes must stop()
+ * and join() in their destructors, as the thread calls their hooks.
+ *
+ * \sa CaptureWriter, TrajectoryWriter, CompressedWriter, FrameExporter
+ */
+template <class Buffer>
+class BackgroundFileWriter
+{
+public:
+
+   /*!
+    * \brief Stop accepting data. Non-blocking.
+    *
+    * The thread writes everything already accepted, calls _finish() and
+    * exits. Use join() to wait for it.
+    */
+   void stop()
+   {
+      _mutex.lock();
+         _run = false;
+      _mutex.unlock();
+      _cond.notify_one();
+      _room.notify_all();
+   }
+
+   //! \brief Return true iff the writer accepts data. Non-blocking.
+   bool running()
+   {
+      return _run;
+   }
+
+   //! \brief Wait for the writing thread to finish. Blocking.
+   void join()
+   {
+      if(_thread)
+         _thread->join();
+   }
+
+   //! \brief Seconds between checks for full buffers.
+   static double pollInterval() { return 0.01; }
+
+   //! \brief Write all of \c buf to \c fd, retrying if interrupted. Returns false on error.
+   static bool writeAll( int fd, char const* buf, size_t n )
+   {
+      while( n > 0 )
+      {
+         ssize_t ret = ::write(fd, buf, n);
+         if( ret < 0 && errno == EINTR )
+            continue;
+         if( ret <= 0 )
+            return false;
+         buf += ret;
+         n -= static_cast<size_t>(ret);
+      }
+      return true;
+   }
+
+protected:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param maxBuffers buffers that may exist, counting the one being filled
+    * \param flushInterval seconds after which a partly filled buffer is written
+    */
+   BackgroundFileWriter( size_t maxBuffers, double flushInterval ) :
+      _mutex(),
+      _fill(0),
+      _run(false),
+      _thread(0),
+      _maxBuffers(maxBuffers < 2 ? 2 : maxBuffers),
+      _flushInterval(flushInterval),
+      _cond(),
+      _room(),
+      _full(),
+      _free(),
+      _numBuffers(0)
+   {
+   }
+
+   virtual ~BackgroundFileWriter()
+   {
+      delete _thread;
+      delete _fill;
+      for( size_t i = 0; i < _full.size(); ++i )
+         delete _full[i];
+      for( size_t i = 0; i < _free.size(); ++i )
+         delete _free[i];
+   }
+
+   //! \brief A new empty buffer.
+   virtual Buffer* _newBuffer() = 0;
+
+   //! \brief Write a buffer. Called by the writing thread without \c _mutex.
+   virtual void _writeBuffer( Buffer& b ) = 0;
+
+   //! \brief Called with \c _mutex held when \c _fill was queued and replaced.
+   virtual void _queued() {}
+
+   //! \brief Called by the writing thread after the last write, e.g. to close the file.
+   virtual void _finish() {}
+
+   /*!
+    * \brief Allocate the first buffers and start the writing thread.
+    *
+    * A few buffers are allocated and touched now, so the producer does not
+    * take page faults on fresh memory.
+    */
+   void _startThread()
+   {
+      _fill = _newBuffer();
+      _numBuffers = 1;
+      while( _numBuffers < std::min<size_t>(_maxBuffers, 4) )
+      {
+         _free.push_back(_newBuffer());
+         ++_numBuffers;
+      }
+      _run = true;
+      _thread = new boost::thread( &BackgroundFileWriter::_work, this );
+   }
+
+   /*!
+    * \brief Queue \c _fill for writing and continue in an empty buffer.
+    *
+    * Returns false, leaving \c _fill as it is, if \c maxBuffers are in use.
+    * Call with \c _mutex held.
+    */
+   bool _queueFill()
+   {
+      Buffer* next;
+      if( !_free.empty() )
+      {
+         next = _free.back();
+         _free.pop_back();
+      }
+      else if( _numBuffers < _maxBuffers )
+      {
+         next = _newBuffer();
+         ++_numBuffers;
+      }
+      else
+         return false;
+      _full.push_back(_fill);
+      _fill = next;
+      _queued();
+      return true;
+   }
+
+   //! \brief Wait until the writing thread frees buffers, or stop().
+   void _waitForRoom( boost::unique_lock<boost::mutex>& lock )
+   {
+      _room.wait(lock);
+   }
+
+   // Guards _run, the buffers, and the derived class' counters.
+   mutable boost::mutex _mutex;
+   Buffer* _fill;
+   bool _run;
+
+private:
+
+   boost::thread* _thread;
+   size_t _maxBuffers;
+   double _flushInterval;
+   boost::condition_variable _cond;
+   // Notified when buffers are free again.
+   boost::condition_variable _room;
+   std::vector<Buffer*> _full;
+   std::vector<Buffer*> _free;
+   size_t _numBuffers;
+
+   void _work()
+   {
+      std::vector<Buffer*> batch;
+      boost::posix_time::time_duration poll = boost::posix_time::microseconds(static_cast<int64_t>(pollInterval()*1e6));
+      double lastFlush = NatNet::now();
+      boost::unique_lock<boost::mutex> lock(_mutex);
+
+      for(;;)
+      {
+         if( _run )
+            _cond.timed_wait(lock, poll);
+
+         // Take the partly filled buffer too when it is due, or at the end.
+         bool last = !_run;
+         if( !_fill->empty() && _full.empty() && (last || NatNet::now() - lastFlush >= _flushInterval) )
+            _queueFill();
+         if( last && _full.empty() && _fill->empty() )
+            break;
+         if( _full.empty() )
+            continue;
+
+         batch.swap(_full);
+         lock.unlock();
+         for( size_t i = 0; i < batch.size(); ++i )
+            _writeBuffer(*batch[i]);
+         lastFlush = NatNet::now();
+         lock.lock();
+         for( size_t i = 0; i < batch.size(); ++i )
+         {
+            batch[i]->clear();
+            _free.push_back(batch[i]);
+         }
+         batch.clear();
+         _room.notify_all();
+      }
+      lock.unlock();
+
+      _finish();
+   }
+
+   // Not copyable.
+   BackgroundFileWriter( BackgroundFileWriter const& );
+   BackgroundFileWriter& operator=( BackgroundFileWriter const& );
+};
+
+#endif /*BACKGROUNDFILEWRITER_H*/
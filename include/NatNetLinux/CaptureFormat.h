@@ -0,0 +1,193 @@
+/*
+ * CaptureFormat.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CAPTUREFORMAT_H
+#define CAPTUREFORMAT_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/NatNetPacket.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+
+/*!
+ * \brief On-disk layout of packet capture logs.
+ * \author Philip G. Lee
+ *
+ * A capture is a series of segment files \c base.000000.nncap,
+ * \c base.000001.nncap, ... Each segment starts with a FileHeader and is
+ * followed by records. A record is a RecordHeader and the raw datagram,
+ * padded to a multiple of 8 bytes. All fields are in host byte order,
+ * except the sender address and port, which are in network order.
+ *
+ * Each segment has a sparse index \c base.000000.nnidx, written when the
+ * segment is closed: an IndexHeader and one IndexEntry for every
+ * \c interval frames of data, plus the first one in the segment. A
+ * segment without a valid index (e.g. the writer was killed) is indexed
+ * again when it is read.
+ *
+ * \sa CaptureWriter, CaptureReader
+ */
+class CaptureFormat
+{
+public:
+
+   enum
+   {
+      VERSION             = 1,
+      FILE_HEADER_BYTES   = 32,
+      RECORD_HEADER_BYTES = 24,
+      INDEX_HEADER_BYTES  = 40,
+      INDEX_ENTRY_BYTES   = 32
+   };
+
+   //! \brief RecordHeader flags.
+   enum RecordFlag
+   {
+      KERNEL_TIMESTAMP = 1
+   };
+
+   //! \brief Start of every segment file.
+   struct FileHeader
+   {
+      char magic[8];
+      uint32_t version;
+      uint32_t headerBytes;
+      uint32_t segment;
+      uint32_t reserved;
+      int64_t createdNs;
+   };
+
+   //! \brief Start of every record.
+   struct RecordHeader
+   {
+      uint32_t length;
+      uint8_t nnMajor;
+      uint8_t nnMinor;
+      uint16_t flags;
+      int64_t timestampNs;
+      uint32_t srcAddr;
+      uint16_t srcPort;
+      uint16_t reserved;
+   };
+
+   //! \brief Start of every index file.
+   struct IndexHeader
+   {
+      char magic[8];
+      uint32_t version;
+      uint32_t interval;
+      uint64_t count;
+      uint64_t records;
+      uint64_t dataEnd;
+   };
+
+   //! \brief Position and keys of one frame of data.
+   struct IndexEntry
+   {
+      int32_t frameNum;
+      uint32_t timecode;
+      uint32_t subframe;
+      uint32_t segment;
+      int64_t timestampNs;
+      uint64_t offset;
+   };
+
+   static char const* fileMagic() { return "NNCAP\0\0\0"; }
+   static char const* indexMagic() { return "NNIDX\0\0\0"; }
+
+   //! \brief Path of segment \c i of a capture.
+   static std::string segmentPath( std::string const& base, unsigned int i )
+   {
+      char buf[32];
+      snprintf(buf, sizeof(buf), ".%06u.nncap", i);
+      return base + buf;
+   }
+
+   //! \brief Path of the index of segment \c i of a capture.
+   static std::string indexPath( std::string const& base, unsigned int i )
+   {
+      char buf[32];
+      snprintf(buf, sizeof(buf), ".%06u.nnidx", i);
+      return base + buf;
+   }
+
+   //! \brief Bytes taken by a record holding a datagram of \c length bytes.
+   static size_t recordBytes( size_t length )
+   {
+      return (RECORD_HEADER_BYTES + length + 7) & ~static_cast<size_t>(7);
+   }
+
+   //! \brief Nanoseconds since the epoch.
+   static int64_t toNs( struct timespec const& ts )
+   {
+      return static_cast<int64_t>(ts.tv_sec)*1000000000LL + ts.tv_nsec;
+   }
+
+   //! \brief Inverse of toNs().
+   static struct timespec fromNs( int64_t ns )
+   {
+      struct timespec ts;
+      ts.tv_sec = static_cast<time_t>(ns/1000000000LL);
+      ts.tv_nsec = static_cast<long>(ns%1000000000LL);
+      return ts;
+   }
+
+   //! \brief True if the datagram is a frame of data with a frame number.
+   static bool isFrame( char const* data, size_t length )
+   {
+      uint16_t m;
+      if( length < 8 )
+         return false;
+      memcpy(&m, data, 2);
+      return m == NatNetPacket::NAT_FRAMEOFDATA;
+   }
+
+   /*!
+    * \brief Index keys of a record.
+    *
+    * The timecode is unpacked from the frame, through \c scratch, and left
+    * at 0 if the datagram is shorter than its header says or is corrupt.
+    *
+    * \returns false if the record is not a frame of data
+    */
+   static bool frameEntry( RecordHeader const& h, char const* data, NatNetPacket& scratch, IndexEntry& e )
+   {
+      uint16_t nDataBytes;
+      if( !isFrame(data, h.length) )
+         return false;
+
+      memcpy(&e.frameNum, data + 4, 4);
+      memcpy(&nDataBytes, data + 2, 2);
+      e.timestampNs = h.timestampNs;
+      e.timecode = 0;
+      e.subframe = 0;
+      if( h.length >= 4u + nDataBytes && h.length <= scratch.maxLength() )
+      {
+         memcpy(scratch.rawPtr(), data, h.length);
+         MocapFrame frame(h.nnMajor, h.nnMinor);
+         if( frame.unpack(scratch.rawPayloadPtr(), scratch.rawPtr() + h.length) )
+            frame.timecode(e.timecode, e.subframe);
+      }
+      return true;
+   }
+};
+
+#endif /*CAPTUREFORMAT_H*/
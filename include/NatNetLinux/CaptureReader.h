@@ -0,0 +1,448 @@
+/*
+ * CaptureReader.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CAPTUREREADER_H
+#define CAPTUREREADER_H
+
+#include <NatNetLinux/CaptureFormat.h>
+#include <NatNetLinux/PacketHandler.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*!
+ * \brief One datagram of a capture log.
+ * \author Philip G. Lee
+ */
+class CapturePacket
+{
+public:
+
+   //! \brief Default constructor. Empty.
+   CapturePacket() :
+      data(0),
+      length(0),
+      kernelTimestamp(false),
+      srcAddr(0),
+      srcPort(0),
+      nnMajor(0),
+      nnMinor(0)
+   {
+      memset(&ts, 0, sizeof(ts));
+   }
+
+   //! \brief The datagram, inside the mapped log. Valid while the reader is open.
+   char const* data;
+   //! \brief Bytes in \c data.
+   size_t length;
+   //! \brief Receive time, from \c CLOCK_REALTIME.
+   struct timespec ts;
+   //! \brief True if \c ts came from the kernel.
+   bool kernelTimestamp;
+   //! \brief Sender address, in network order.
+   uint32_t srcAddr;
+   //! \brief Sender port, in network order.
+   uint16_t srcPort;
+   //! \brief NatNet major version of the stream.
+   unsigned char nnMajor;
+   //! \brief NatNet minor version of the stream.
+   unsigned char nnMinor;
+
+   //! \brief NatNet message ID, or -1 if too short to have one.
+   int iMessage() const
+   {
+      uint16_t m;
+      if( length < 2 )
+         return -1;
+      memcpy(&m, data, 2);
+      return m;
+   }
+
+   //! \brief True if this is a frame of data.
+   bool isFrame() const { return CaptureFormat::isFrame(data, length); }
+
+   //! \brief Frame number of a frame of data, or -1.
+   int frameNum() const
+   {
+      int32_t ret = -1;
+      if( isFrame() )
+         memcpy(&ret, data + 4, 4);
+      return ret;
+   }
+
+   //! \brief Receive time in seconds.
+   double seconds() const { return ts.tv_sec + 1e-9*ts.tv_nsec; }
+
+   //! \brief Receive time and sender, as a PacketHandler would see them.
+   PacketInfo info() const
+   {
+      PacketInfo ret;
+      ret.ts = ts;
+      ret.kernelTimestamp = kernelTimestamp;
+      ret.from.sin_family = AF_INET;
+      ret.from.sin_addr.s_addr = srcAddr;
+      ret.from.sin_port = srcPort;
+      ret.nnMajor = nnMajor;
+      ret.nnMinor = nnMinor;
+      return ret;
+   }
+};
+
+/*!
+ * \brief Position of a record in a capture log.
+ * \author Philip G. Lee
+ */
+class CaptureCursor
+{
+public:
+
+   //! \brief Constructor
+   CaptureCursor( size_t segment=0, uint64_t offset=CaptureFormat::FILE_HEADER_BYTES ) :
+      segment(segment),
+      offset(offset)
+   {
+   }
+
+   bool operator==( CaptureCursor const& other ) const { return segment == other.segment && offset == other.offset; }
+   bool operator!=( CaptureCursor const& other ) const { return !(*this == other); }
+
+   //! \brief Segment number.
+   size_t segment;
+   //! \brief Byte offset of the record in the segment.
+   uint64_t offset;
+};
+
+/*!
+ * \brief Reads capture logs written by CaptureWriter.
+ * \author Philip G. Lee
+ *
+ * Every segment is memory-mapped, so packets are read in place without
+ * copies and any number of threads may read with their own cursors.
+ *
+ * seekFrame(), seekTime() and seekTimecode() binary search the sparse
+ * index, then scan forward at most one index interval of records. They
+ * assume the key never decreases through the capture. If it does (e.g. the
+ * server restarted and frame numbers began again), they find one of the
+ * matching records, not necessarily the first.
+ *
+ * Records at the end of a segment that were not completely written are
+ * ignored, so a log can be read while it is still being written, up to
+ * the point it had reached when it was opened.
+ */
+class CaptureReader
+{
+public:
+
+   //! \brief Default constructor. Not open.
+   CaptureReader() :
+      _segments(),
+      _index(),
+      _packets(0)
+   {
+   }
+
+   ~CaptureReader()
+   {
+      close();
+   }
+
+   /*!
+    * \brief Map every segment of a capture.
+    *
+    * \param base path prefix given to CaptureWriter
+    * \returns false if there is no valid first segment
+    */
+   bool open( std::string const& base )
+   {
+      close();
+      for( unsigned int i = 0; ; ++i )
+      {
+         Segment s;
+         if( !_map(CaptureFormat::segmentPath(base, i), s) )
+            break;
+         _segments.push_back(s);
+         if( !_loadIndex(CaptureFormat::indexPath(base, i), i) )
+            _buildIndex(i);
+         _packets += _segments[i].records;
+      }
+      return !_segments.empty();
+   }
+
+   //! \brief Unmap the capture. Invalidates every CapturePacket read from it.
+   void close()
+   {
+      for( size_t i = 0; i < _segments.size(); ++i )
+         munmap(const_cast<char*>(_segments[i].data), _segments[i].size);
+      _segments.clear();
+      _index.clear();
+      _packets = 0;
+   }
+
+   //! \brief True if a capture is open.
+   bool isOpen() const { return !_segments.empty(); }
+   //! \brief Number of segments.
+   size_t numSegments() const { return _segments.size(); }
+   //! \brief Number of datagrams in the capture.
+   uint64_t numPackets() const { return _packets; }
+   //! \brief Number of index entries.
+   size_t numIndexEntries() const { return _index.size(); }
+
+   //! \brief Cursor at the first record.
+   CaptureCursor begin() const { return CaptureCursor(0); }
+   //! \brief Cursor past the last record.
+   CaptureCursor end() const { return CaptureCursor(_segments.size()); }
+
+   /*!
+    * \brief Read the record at \c c and advance \c c to the next one.
+    *
+    * \returns false at the end of the capture
+    */
+   bool next( CaptureCursor& c, CapturePacket& p ) const
+   {
+      CaptureFormat::RecordHeader h;
+      while( c.segment < _segments.size() )
+      {
+         Segment const& s = _segments[c.segment];
+         if( c.offset + sizeof(h) <= s.end )
+         {
+            memcpy(&h, s.data + c.offset, sizeof(h));
+            if( c.offset + sizeof(h) + h.length <= s.end )
+            {
+               p.data = s.data + c.offset + sizeof(h);
+               p.length = h.length;
+               p.ts = CaptureFormat::fromNs(h.timestampNs);
+               p.kernelTimestamp = (h.flags & CaptureFormat::KERNEL_TIMESTAMP) != 0;
+               p.srcAddr = h.srcAddr;
+               p.srcPort = h.srcPort;
+               p.nnMajor = h.nnMajor;
+               p.nnMinor = h.nnMinor;
+               c.offset += CaptureFormat::recordBytes(h.length);
+               return true;
+            }
+         }
+         c = CaptureCursor(c.segment + 1);
+      }
+      return false;
+   }
+
+   //! \brief Cursor at the first frame of data numbered \c frameNum or later.
+   CaptureCursor seekFrame( int frameNum ) const
+   {
+      return _seek(FRAME, frameNum);
+   }
+
+   //! \brief Cursor at the first record received at \c ts (\c CLOCK_REALTIME) or later.
+   CaptureCursor seekTime( struct timespec const& ts ) const
+   {
+      return _seek(TIME, CaptureFormat::toNs(ts));
+   }
+
+   //! \brief seekTime() from seconds, e.g. NatNet::seconds(). Good to about a microsecond.
+   CaptureCursor seekTime( double seconds ) const
+   {
+      return _seek(TIME, static_cast<int64_t>(seconds*1e9));
+   }
+
+   //! \brief Cursor at the first frame of data with this SMPTE timecode and subframe or later.
+   CaptureCursor seekTimecode( uint32_t timecode, uint32_t subframe=0 ) const
+   {
+      return _seek(TIMECODE, (static_cast<int64_t>(timecode) << 32) | subframe);
+   }
+
+private:
+
+   enum Key
+   {
+      FRAME,
+      TIME,
+      TIMECODE
+   };
+
+   struct Segment
+   {
+      char const* data;
+      size_t size;
+      // End of the last complete record.
+      size_t end;
+      uint64_t records;
+   };
+
+   std::vector<Segment> _segments;
+   std::vector<CaptureFormat::IndexEntry> _index;
+   uint64_t _packets;
+
+   static int64_t _key( Key k, CaptureFormat::IndexEntry const& e )
+   {
+      if( k == FRAME )
+         return e.frameNum;
+      if( k == TIME )
+         return e.timestampNs;
+      return (static_cast<int64_t>(e.timecode) << 32) | e.subframe;
+   }
+
+   static bool _map( std::string const& path, Segment& s )
+   {
+      struct stat st;
+      CaptureFormat::FileHeader fh;
+
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if( fd < 0 )
+         return false;
+      if( fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(fh) )
+      {
+         ::close(fd);
+         return false;
+      }
+      void* p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if( p == MAP_FAILED )
+         return false;
+
+      memcpy(&fh, p, sizeof(fh));
+      if( memcmp(fh.magic, CaptureFormat::fileMagic(), sizeof(fh.magic)) != 0 || fh.version != CaptureFormat::VERSION )
+      {
+         munmap(p, st.st_size);
+         return false;
+      }
+      s.data = static_cast<char const*>(p);
+      s.size = st.st_size;
+      s.end = s.size;
+      s.records = 0;
+      return true;
+   }
+
+   // Read the index written by CaptureWriter. Returns false if there is
+   // none or it does not match the segment.
+   bool _loadIndex( std::string const& path, unsigned int segment )
+   {
+      CaptureFormat::IndexHeader ih;
+      Segment& s = _segments[segment];
+
+      FILE* f = fopen(path.c_str(), "rb");
+      if( !f )
+         return false;
+      bool ok = fread(&ih, sizeof(ih), 1, f) == 1
+         && memcmp(ih.magic, CaptureFormat::indexMagic(), sizeof(ih.magic)) == 0
+         && ih.version == CaptureFormat::VERSION
+         && ih.dataEnd == s.size
+         && ih.count <= ih.records
+         && ih.records <= s.size/CaptureFormat::RECORD_HEADER_BYTES;
+      if( ok )
+      {
+         size_t first = _index.size();
+         _index.resize(first + ih.count);
+         ok = ih.count == 0 || fread(&_index[first], sizeof(_index[0]), ih.count, f) == ih.count;
+         if( !ok )
+            _index.resize(first);
+         for( size_t i = first; ok && i < _index.size(); ++i )
+            _index[i].segment = segment;
+      }
+      fclose(f);
+      if( ok )
+         s.records = ih.records;
+      return ok;
+   }
+
+   // Index a segment by scanning it, as CaptureWriter would have.
+   void _buildIndex( unsigned int segment )
+   {
+      Segment& s = _segments[segment];
+      NatNetPacket scratch;
+      CaptureFormat::RecordHeader h;
+      uint64_t frames = 0;
+      size_t off = CaptureFormat::FILE_HEADER_BYTES;
+
+      s.records = 0;
+      while( off + sizeof(h) <= s.size )
+      {
+         memcpy(&h, s.data + off, sizeof(h));
+         if( off + sizeof(h) + h.length > s.size )
+            break;
+         CaptureFormat::IndexEntry e;
+         if( CaptureFormat::isFrame(s.data + off + sizeof(h), h.length) && frames++ % indexInterval() == 0 )
+         {
+            CaptureFormat::frameEntry(h, s.data + off + sizeof(h), scratch, e);
+            e.segment = segment;
+            e.offset = off;
+            _index.push_back(e);
+         }
+         ++s.records;
+         off += CaptureFormat::recordBytes(h.length);
+      }
+      s.end = std::min(off, s.size);
+   }
+
+   // Index interval used for segments that have to be indexed again.
+   static unsigned int indexInterval() { return 64; }
+
+   struct KeyLess
+   {
+      KeyLess( Key k ) : k(k) {}
+      bool operator()( CaptureFormat::IndexEntry const& e, int64_t key ) const { return _key(k, e) < key; }
+      Key k;
+   };
+
+   CaptureCursor _seek( Key k, int64_t key ) const
+   {
+      // Last index entry before the key. Keys repeat (a timecode of 0
+      // without SMPTE, a stalled frame number), so an entry equal to the
+      // key may have matching records before it.
+      std::vector<CaptureFormat::IndexEntry>::const_iterator it =
+         std::lower_bound(_index.begin(), _index.end(), key, KeyLess(k));
+      CaptureCursor c = begin();
+      if( it != _index.begin() )
+      {
+         --it;
+         c = CaptureCursor(it->segment, it->offset);
+      }
+
+      // Scan to the first record at or past the key.
+      NatNetPacket scratch;
+      CapturePacket p;
+      CaptureCursor at = c;
+      while( next(c, p) )
+      {
+         if( k == TIME )
+         {
+            if( CaptureFormat::toNs(p.ts) >= key )
+               return at;
+         }
+         else if( p.isFrame() )
+         {
+            CaptureFormat::RecordHeader h;
+            CaptureFormat::IndexEntry e;
+            memset(&e, 0, sizeof(e));
+            memcpy(&h, p.data - sizeof(h), sizeof(h));
+            if( k == FRAME )
+               e.frameNum = p.frameNum();
+            else
+               CaptureFormat::frameEntry(h, p.data, scratch, e);
+            if( _key(k, e) >= key )
+               return at;
+         }
+         at = c;
+      }
+      return end();
+   }
+};
+
+#endif /*CAPTUREREADER_H*/
@@ -0,0 +1,405 @@
+/*
+ * CaptureWriter.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CAPTUREWRITER_H
+#define CAPTUREWRITER_H
+
+#include <NatNetLinux/CaptureFormat.h>
+#include <NatNetLinux/PacketHandler.h>
+#include <NatNetLinux/Metrics.h>
+#include <NatNetLinux/BackgroundFileWriter.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*!
+ * \brief Counters of a CaptureWriter.
+ * \author Philip G. Lee
+ */
+class CaptureStats
+{
+public:
+
+   //! \brief Default constructor. All zero.
+   CaptureStats() :
+      packets(0),
+      bytes(0),
+      dropped(0),
+      segments(0),
+      writeErrors(0)
+   {
+   }
+
+   //! \brief Datagrams written to disk.
+   uint64_t packets;
+   //! \brief Bytes written to disk, including headers.
+   uint64_t bytes;
+   //! \brief Datagrams dropped because the writer fell behind, or had no segment to write to.
+   uint64_t dropped;
+   //! \brief Segment files opened.
+   uint64_t segments;
+   //! \brief Failed writes. The data of a failed write is lost.
+   uint64_t writeErrors;
+};
+
+/*!
+ * \brief In-memory block of records of a CaptureWriter.
+ * \author Philip G. Lee
+ */
+class CaptureBlock
+{
+public:
+
+   //! \brief Constructor. Allocates and touches \c n bytes.
+   CaptureBlock( size_t n ) : data(new char[n]), size(n), used(0) { memset(data, 0, n); }
+   ~CaptureBlock() { delete[] data; }
+
+   //! \brief True if no records were copied in.
+   bool empty() const { return used == 0; }
+   //! \brief Make it empty, keeping the memory.
+   void clear() { used = 0; }
+
+   char* data;
+   size_t size;
+   size_t used;
+
+private:
+
+   // Not copyable.
+   CaptureBlock( CaptureBlock const& );
+   CaptureBlock& operator=( CaptureBlock const& );
+};
+
+/*!
+ * \brief Records raw datagrams to a segmented capture log.
+ * \author Philip G. Lee
+ *
+ * Register with \c FrameListener::addPacketHandler() to record everything
+ * the listener reads, with its receive time, sender and NatNet version.
+ * See CaptureFormat for the files written and CaptureReader to read them.
+ *
+ * handlePacket() only copies the datagram into an in-memory block under a
+ * short lock, without any system call. A background thread polls for full
+ * blocks every pollInterval() seconds, writes them with large sequential
+ * writes, splits them into segments of about \c segmentBytes, and builds
+ * each segment's index. A partly filled block is written after
+ * \c flushInterval seconds. If the disk falls behind until \c maxBlocks
+ * blocks are queued, datagrams are dropped and counted rather than
+ * delaying the listener. If a new segment cannot be created, the writer
+ * reports it on stderr and stops, so running() returns false.
+ *
+ * Counters are also kept in MetricsRegistry under \c natnet_capture_*.
+ */
+class CaptureWriter : public PacketHandler, public BackgroundFileWriter<CaptureBlock>
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param base path prefix of the segment and index files
+    * \param segmentBytes size at which to start a new segment
+    * \param blockBytes size of each in-memory block. At least 256 KiB.
+    * \param maxBlocks blocks that may be queued for writing
+    * \param indexInterval frames of data between index entries
+    * \param flushInterval seconds after which a partly filled block is written
+    */
+   CaptureWriter(
+      std::string const& base,
+      uint64_t segmentBytes=256u<<20,
+      size_t blockBytes=1u<<20,
+      size_t maxBlocks=64,
+      unsigned int indexInterval=64,
+      double flushInterval=0.5
+   ) :
+      BackgroundFileWriter<CaptureBlock>(maxBlocks, flushInterval),
+      _base(base),
+      _segmentBytes(segmentBytes),
+      _blockBytes(blockBytes < (256u<<10) ? (256u<<10) : blockBytes),
+      _indexInterval(indexInterval < 1 ? 1 : indexInterval),
+      _stats(),
+      _fd(-1),
+      _segment(0),
+      _segOffset(0),
+      _segRecords(0),
+      _segFrames(0),
+      _index(),
+      _scratch(),
+      _metrics()
+   {
+   }
+
+   ~CaptureWriter()
+   {
+      if( running() )
+         stop();
+      join();
+      if( _fd >= 0 )
+         _closeSegment();
+   }
+
+   /*!
+    * \brief Open the first segment and start writing in a new thread. Non-blocking.
+    *
+    * \returns false if the first segment could not be created
+    */
+   bool start()
+   {
+      if( _fill )
+         return false;
+      if( !_openSegment() )
+         return false;
+      _startThread();
+      return true;
+   }
+
+   //! \brief Copy a datagram into the log. Thread-safe, never waits for the disk.
+   virtual void handlePacket( char const* data, size_t length, PacketInfo const& info )
+   {
+      CaptureFormat::RecordHeader h;
+      size_t n = CaptureFormat::recordBytes(length);
+
+      memset(&h, 0, sizeof(h));
+      h.length = static_cast<uint32_t>(length);
+      h.nnMajor = info.nnMajor;
+      h.nnMinor = info.nnMinor;
+      h.flags = info.kernelTimestamp ? CaptureFormat::KERNEL_TIMESTAMP : 0;
+      h.timestampNs = CaptureFormat::toNs(info.ts);
+      h.srcAddr = info.from.sin_addr.s_addr;
+      h.srcPort = info.from.sin_port;
+
+      _mutex.lock();
+      if( !_run )
+      {
+         _mutex.unlock();
+         return;
+      }
+      if( _fill->used + n > _fill->size && (n > _blockBytes || !_queueFill()) )
+      {
+         ++_stats.dropped;
+         _mutex.unlock();
+         _metrics.dropped.inc();
+         return;
+      }
+      char* p = _fill->data + _fill->used;
+      memcpy(p, &h, sizeof(h));
+      memcpy(p + sizeof(h), data, length);
+      memset(p + sizeof(h) + length, 0, n - sizeof(h) - length);
+      _fill->used += n;
+      _mutex.unlock();
+   }
+
+   //! \brief Counters so far. Thread-safe.
+   CaptureStats stats() const
+   {
+      _mutex.lock();
+         CaptureStats ret = _stats;
+      _mutex.unlock();
+      return ret;
+   }
+
+private:
+
+   struct Metrics
+   {
+      Metrics()
+      {
+         MetricsRegistry& r = MetricsRegistry::instance();
+         packets = r.counter("natnet_capture_packets_total", "Datagrams written to capture logs.");
+         bytes = r.counter("natnet_capture_bytes_total", "Bytes written to capture logs.");
+         dropped = r.counter("natnet_capture_dropped_total", "Datagrams dropped because a capture writer fell behind.");
+         segments = r.counter("natnet_capture_segments_total", "Capture segment files opened.");
+         writeErrors = r.counter("natnet_capture_write_errors_total", "Failed writes to capture logs.");
+      }
+
+      Counter packets, bytes, dropped, segments, writeErrors;
+   };
+
+   std::string _base;
+   uint64_t _segmentBytes;
+   size_t _blockBytes;
+   unsigned int _indexInterval;
+
+   // Guarded by _mutex.
+   CaptureStats _stats;
+
+   // Only used by the writing thread once started.
+   int _fd;
+   unsigned int _segment;
+   uint64_t _segOffset;
+   uint64_t _segRecords;
+   uint64_t _segFrames;
+   std::vector<CaptureFormat::IndexEntry> _index;
+   NatNetPacket _scratch;
+
+   Metrics _metrics;
+
+   virtual CaptureBlock* _newBuffer()
+   {
+      return new CaptureBlock(_blockBytes);
+   }
+
+   void _writeError()
+   {
+      _mutex.lock();
+         ++_stats.writeErrors;
+      _mutex.unlock();
+      _metrics.writeErrors.inc();
+   }
+
+   bool _openSegment()
+   {
+      CaptureFormat::FileHeader fh;
+      struct timespec now;
+
+      std::string path = CaptureFormat::segmentPath(_base, _segment);
+      _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if( _fd < 0 )
+      {
+         std::cerr << "ERROR: Could not create capture segment " << path << ". Error: " << errno << std::endl;
+         return false;
+      }
+
+      clock_gettime( CLOCK_REALTIME, &now );
+      memset(&fh, 0, sizeof(fh));
+      memcpy(fh.magic, CaptureFormat::fileMagic(), sizeof(fh.magic));
+      fh.version = CaptureFormat::VERSION;
+      fh.headerBytes = CaptureFormat::FILE_HEADER_BYTES;
+      fh.segment = _segment;
+      fh.createdNs = CaptureFormat::toNs(now);
+      if( !writeAll(_fd, reinterpret_cast<char const*>(&fh), sizeof(fh)) )
+      {
+         ::close(_fd);
+         _fd = -1;
+         return false;
+      }
+
+      _segOffset = sizeof(fh);
+      _segRecords = 0;
+      _segFrames = 0;
+      _index.clear();
+      _mutex.lock();
+         ++_stats.segments;
+      _mutex.unlock();
+      _metrics.segments.inc();
+      return true;
+   }
+
+   // Close the current segment and write its index.
+   void _closeSegment()
+   {
+      CaptureFormat::IndexHeader ih;
+
+      if( ::close(_fd) != 0 )
+         _writeError();
+      _fd = -1;
+
+      memset(&ih, 0, sizeof(ih));
+      memcpy(ih.magic, CaptureFormat::indexMagic(), sizeof(ih.magic));
+      ih.version = CaptureFormat::VERSION;
+      ih.interval = _indexInterval;
+      ih.count = _index.size();
+      ih.records = _segRecords;
+      ih.dataEnd = _segOffset;
+
+      std::string path = CaptureFormat::indexPath(_base, _segment);
+      int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      bool ok = fd >= 0
+         && writeAll(fd, reinterpret_cast<char const*>(&ih), sizeof(ih))
+         && (_index.empty() || writeAll(fd, reinterpret_cast<char const*>(&_index[0]), _index.size()*sizeof(_index[0])));
+      if( fd >= 0 && ::close(fd) != 0 )
+         ok = false;
+      if( !ok )
+         _writeError();
+      ++_segment;
+   }
+
+   // Write the records of a block, starting new segments as needed.
+   virtual void _writeBuffer( CaptureBlock& b )
+   {
+      char const* run = b.data;
+      char const* p = b.data;
+      char const* end = b.data + b.used;
+      uint64_t packets = 0, bytes = 0, lost = 0;
+
+      while( p < end )
+      {
+         CaptureFormat::RecordHeader h;
+         memcpy(&h, p, sizeof(h));
+         size_t n = CaptureFormat::recordBytes(h.length);
+
+         if( _fd >= 0 && _segOffset > CaptureFormat::FILE_HEADER_BYTES && _segOffset + n > _segmentBytes )
+         {
+            if( p > run && !writeAll(_fd, run, p - run) )
+               _writeError();
+            run = p;
+            _closeSegment();
+            if( !_openSegment() )
+            {
+               // Stop rather than lose every later datagram unnoticed.
+               _writeError();
+               stop();
+            }
+         }
+         if( _fd < 0 )
+         {
+            // Nowhere to write: the rest of the block is lost.
+            ++lost;
+            p += n;
+            run = p;
+            continue;
+         }
+
+         CaptureFormat::IndexEntry e;
+         if( CaptureFormat::isFrame(p + sizeof(h), h.length) && _segFrames++ % _indexInterval == 0 )
+         {
+            CaptureFormat::frameEntry(h, p + sizeof(h), _scratch, e);
+            e.segment = _segment;
+            e.offset = _segOffset;
+            _index.push_back(e);
+         }
+         _segOffset += n;
+         ++_segRecords;
+         ++packets;
+         bytes += n;
+         p += n;
+      }
+      if( p > run && !writeAll(_fd, run, p - run) )
+         _writeError();
+
+      _mutex.lock();
+         _stats.packets += packets;
+         _stats.bytes += bytes;
+         _stats.dropped += lost;
+      _mutex.unlock();
+      _metrics.packets.inc(packets);
+      _metrics.bytes.inc(bytes);
+      _metrics.dropped.inc(lost);
+   }
+
+   virtual void _finish()
+   {
+      if( _fd >= 0 )
+         _closeSegment();
+   }
+};
+
+#endif /*CAPTUREWRITER_H*/
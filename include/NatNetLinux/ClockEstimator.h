@@ -0,0 +1,374 @@
+/*
+ * ClockEstimator.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLOCKESTIMATOR_H
+#define CLOCKESTIMATOR_H
+
+#include <NatNetLinux/NatNet.h>
+#include <boost/circular_buffer.hpp>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <time.h>
+
+/*!
+ * \brief Linear map from server time to the local clock.
+ * \author Philip G. Lee
+ */
+class ClockFit
+{
+public:
+
+   //! \brief Default constructor. Invalid until enough frames are seen.
+   ClockFit() :
+      valid(false),
+      offset(0.0),
+      rate(1.0),
+      delay(0.0),
+      samples(0),
+      used(0)
+   {
+   }
+
+   //! \brief Local time, in seconds, of a server time.
+   double toLocal( double serverTime ) const { return offset + rate*serverTime; }
+   //! \brief Server clock drift relative to the local clock, in parts per million.
+   double driftPpm() const { return (rate - 1.0)*1e6; }
+
+   //! \brief True once the fit is usable.
+   bool valid;
+   //! \brief Local time, in seconds, of server time 0.
+   double offset;
+   //! \brief Local seconds per server second.
+   double rate;
+   //! \brief Median time, in seconds, by which frames arrive after the fitted line.
+   double delay;
+   //! \brief Frames in the window.
+   size_t samples;
+   //! \brief Window bins that contributed to the fit.
+   size_t used;
+};
+
+/*!
+ * \brief Estimates the offset and drift between server and local time.
+ * \author Philip G. Lee
+ *
+ * Each frame gives a server time (the frame number times the camera period,
+ * or the decoded SMPTE timecode) and a local receive time. The receive time
+ * is the capture time on the local clock, plus a delay. The delay is never
+ * negative, but a packet can be late by any amount.
+ * The estimator therefore fits the lower envelope of a sliding window of
+ * (server, local) pairs rather than a plain regression. The window is split
+ * into bins along server time, and each bin keeps only its earliest
+ * arrival. A line is fitted to those minima. Bins whose minimum is far from
+ * the line (a bin where every packet was delayed) are rejected, and the line
+ * is fitted again. Until the window spans minSpan() seconds, the rate is
+ * held at 1 and only the offset is estimated.
+ *
+ * The fitted line maps server time to the earliest possible arrival, so
+ * captureTime() includes the smallest delay seen. If the server reports
+ * MocapFrame::latency() in seconds, setUseLatency() subtracts it from each
+ * receive time, which takes server processing out of the estimate.
+ *
+ * The line is refitted on every frame while the window fills, and every
+ * refitInterval() frames after that.
+ *
+ * A few consecutive frames far from the line (a server restart, a timecode
+ * wrap, a step of the local clock) restart the estimate.
+ *
+ * Not thread-safe; FrameListener serializes access when installed with
+ * \c FrameListener::setClockEstimator().
+ */
+class ClockEstimator
+{
+public:
+
+   //! \brief Where server time comes from.
+   enum Source
+   {
+      FRAME_NUMBER = 0,
+      TIMECODE     = 1
+   };
+
+   /*!
+    * \brief Constructor
+    *
+    * \param source where server time comes from
+    * \param period camera frame period in seconds
+    * \param timecodeRate SMPTE timecode frames per second. Only used with \c TIMECODE.
+    * \param window number of frames in the sliding window
+    */
+   ClockEstimator( Source source=FRAME_NUMBER, double period=1.0/120.0, double timecodeRate=30.0, size_t window=1024 ) :
+      _source(source),
+      _period(period),
+      _timecodeRate(timecodeRate),
+      _useLatency(false),
+      _samples(window < 8 ? 8 : window),
+      _fit(),
+      _sRef(0.0),
+      _rRef(0.0),
+      _outliers(0),
+      _sinceFit(0),
+      _scratch(),
+      _excess()
+   {
+   }
+
+   //! \brief Server time from frame numbers.
+   static ClockEstimator frameNumber( double period, size_t window=1024 )
+   {
+      return ClockEstimator(FRAME_NUMBER, period, 30.0, window);
+   }
+
+   //! \brief Server time from SMPTE timecode and subframe.
+   static ClockEstimator timecode( double timecodeRate, double period, size_t window=1024 )
+   {
+      return ClockEstimator(TIMECODE, period, timecodeRate, window);
+   }
+
+   //! \brief Time span in seconds the window must cover before drift is estimated.
+   static double minSpan() { return 1.0; }
+   //! \brief Frames between refits once the window is full.
+   static unsigned int refitInterval() { return 8; }
+   //! \brief Distance in seconds from the line beyond which a frame is an outlier.
+   static double outlierDistance() { return 0.5; }
+
+   //! \brief Subtract MocapFrame::latency(), in seconds, from receive times.
+   void setUseLatency( bool useLatency ) { _useLatency = useLatency; }
+
+   //! \brief Server time of a frame in seconds.
+   double serverTime( MocapFrame const& frame ) const
+   {
+      if( _source == FRAME_NUMBER )
+         return _period * frame.frameNum();
+
+      int hour, minute, second, tcFrame, subFrame;
+      frame.timecode(hour, minute, second, tcFrame, subFrame);
+      return (hour*60.0 + minute)*60.0 + second + tcFrame/_timecodeRate + subFrame*_period;
+   }
+
+   /*!
+    * \brief Add a frame to the estimate and set its MocapFrame::captureTime().
+    *
+    * The capture time is left at 0 until the fit is valid.
+    *
+    * \param frame the frame
+    * \param ts time at which the frame was read, from \c CLOCK_REALTIME
+    */
+   void annotate( MocapFrame& frame, struct timespec const& ts )
+   {
+      double s = serverTime(frame);
+      update(s, NatNet::seconds(ts) - (_useLatency ? frame.latency() : 0.0));
+      frame.setCaptureTime(_fit.valid ? _fit.toLocal(s) : 0.0);
+   }
+
+   /*!
+    * \brief Add a (server, local) time pair to the estimate.
+    *
+    * \param serverTime server time in seconds
+    * \param localTime local receive time in seconds
+    */
+   void update( double serverTime, double localTime )
+   {
+      if( _samples.empty() )
+      {
+         _sRef = serverTime;
+         _rRef = localTime;
+      }
+      else if( _fit.valid && fabs(localTime - _fit.toLocal(serverTime)) > outlierDistance() )
+      {
+         // Ignore isolated outliers, restart on a run of them.
+         if( ++_outliers < 3 )
+            return;
+         reset();
+         _sRef = serverTime;
+         _rRef = localTime;
+      }
+      _outliers = 0;
+
+      Sample smp;
+      smp.s = serverTime - _sRef;
+      smp.r = localTime - _rRef;
+      _samples.push_back(smp);
+      if( !_samples.full() || ++_sinceFit >= refitInterval() )
+      {
+         _sinceFit = 0;
+         _refit();
+      }
+   }
+
+   //! \brief Current fit.
+   ClockFit const& fit() const { return _fit; }
+
+   //! \brief Forget every frame.
+   void reset()
+   {
+      _samples.clear();
+      _fit = ClockFit();
+      _outliers = 0;
+      _sinceFit = 0;
+   }
+
+private:
+
+   // Server and local times relative to the first frame.
+   struct Sample
+   {
+      double s;
+      double r;
+   };
+
+   Source _source;
+   double _period;
+   double _timecodeRate;
+   bool _useLatency;
+   boost::circular_buffer<Sample> _samples;
+   ClockFit _fit;
+   double _sRef;
+   double _rRef;
+   unsigned int _outliers;
+   unsigned int _sinceFit;
+   std::vector<Sample> _scratch;
+   std::vector<double> _excess;
+
+   static double _median( std::vector<double>& v )
+   {
+      std::nth_element(v.begin(), v.begin() + v.size()/2, v.end());
+      return v[v.size()/2];
+   }
+
+   // Least squares line r = a + b*s through the points with keep[i].
+   static bool _line( std::vector<Sample> const& p, std::vector<char> const& keep, double& a, double& b )
+   {
+      double n = 0, ms = 0, mr = 0, sss = 0, ssr = 0;
+      size_t i;
+      for( i = 0; i < p.size(); ++i )
+         if( keep[i] )
+         {
+            n += 1;
+            ms += p[i].s;
+            mr += p[i].r;
+         }
+      if( n < 2 )
+         return false;
+      ms /= n;
+      mr /= n;
+      for( i = 0; i < p.size(); ++i )
+         if( keep[i] )
+         {
+            sss += (p[i].s - ms)*(p[i].s - ms);
+            ssr += (p[i].s - ms)*(p[i].r - mr);
+         }
+      if( sss <= 0 )
+         return false;
+      b = ssr/sss;
+      a = mr - b*ms;
+      return true;
+   }
+
+   void _refit()
+   {
+      size_t i, n = _samples.size();
+      _fit.samples = n;
+      if( n < 8 )
+         return;
+
+      double rate = _fit.valid ? _fit.rate : 1.0;
+      double sMin = _samples.front().s, sMax = sMin;
+      for( i = 1; i < n; ++i )
+      {
+         sMin = std::min(sMin, _samples[i].s);
+         sMax = std::max(sMax, _samples[i].s);
+      }
+
+      // Earliest arrival in each bin, after removing the current drift.
+      size_t numBins = std::min<size_t>(16, n/4);
+      double width = (sMax - sMin)/numBins;
+      _scratch.assign(numBins, Sample());
+      std::vector<char> filled(numBins, 0);
+      for( i = 0; i < n; ++i )
+      {
+         Sample const& p = _samples[i];
+         size_t b = width > 0 ? std::min(numBins-1, static_cast<size_t>((p.s - sMin)/width)) : 0;
+         if( !filled[b] || p.r - rate*p.s < _scratch[b].r - rate*_scratch[b].s )
+         {
+            _scratch[b] = p;
+            filled[b] = 1;
+         }
+      }
+
+      std::vector<Sample> minima;
+      for( i = 0; i < numBins; ++i )
+         if( filled[i] )
+            minima.push_back(_scratch[i]);
+
+      double a = 0, b = 1.0;
+      std::vector<char> keep(minima.size(), 1);
+      std::vector<double> res(minima.size());
+      bool line = sMax - sMin >= minSpan() && minima.size() >= 3;
+      if( line )
+         line = _line(minima, keep, a, b);
+
+      if( line )
+      {
+         // Reject bins far from the line, then fit again.
+         for( i = 0; i < minima.size(); ++i )
+            res[i] = minima[i].r - (a + b*minima[i].s);
+         std::vector<double> tmp(res);
+         double med = _median(tmp);
+         for( i = 0; i < tmp.size(); ++i )
+            tmp[i] = fabs(res[i] - med);
+         double tol = 3.0*1.4826*_median(tmp) + 1e-6;
+         for( i = 0; i < minima.size(); ++i )
+            keep[i] = fabs(res[i] - med) <= tol;
+         if( !_line(minima, keep, a, b) )
+            return;
+      }
+      else
+      {
+         // Too short to see drift: offset only.
+         b = 1.0;
+         for( i = 0; i < minima.size(); ++i )
+            res[i] = minima[i].r - minima[i].s;
+         std::vector<double> tmp(res);
+         a = _median(tmp);
+      }
+
+      _fit.used = 0;
+      for( i = 0; i < keep.size(); ++i )
+         _fit.used += keep[i];
+
+      // The line goes through the middle of the bin minima; move it down
+      // onto the envelope.
+      double lowest = HUGE_VAL;
+      for( i = 0; i < minima.size(); ++i )
+         if( keep[i] )
+            lowest = std::min(lowest, minima[i].r - (a + b*minima[i].s));
+      a += lowest;
+      _excess.resize(n);
+      for( i = 0; i < n; ++i )
+         _excess[i] = _samples[i].r - (a + b*_samples[i].s);
+
+      _fit.valid = true;
+      _fit.rate = b;
+      _fit.offset = _rRef + a - b*_sRef;
+      _fit.delay = _median(_excess);
+   }
+};
+
+#endif /*CLOCKESTIMATOR_H*/
@@ -22,6 +22,9 @@
 #include <NatNetLinux/NatNet.h>
 #include <NatNetLinux/NatNetPacket.h>
 #include <NatNetLinux/NatNetSender.h>
+#include <NatNetLinux/DataDescriptions.h>
+#include <NatNetLinux/Metrics.h>
+#include <NatNetLinux/Probes.h>
 #include <boost/thread.hpp>
 #include <boost/circular_buffer.hpp>
 
@@ -31,6 +34,9 @@
  * 
  * This class spawns a new thread to listen for command responses. This class
  * is needed to retrieve the NatNet protocol version in use by the server.
+ * 
+ * Packets by message type, bytes and receive errors are counted in
+ * MetricsRegistry under \c natnet_command_*.
  */
 class CommandListener
 {
@@ -46,7 +52,11 @@ public:
       _thread(0),
       _sd(sd),
       _nnMajor(0),
-      _nnMinor(0)
+      _nnMinor(0),
+      _descriptionsMutex(),
+      _descriptions(),
+      _haveDescriptions(false),
+      _metrics()
    {
       _nnVersionMutex.lock();
    }
@@ -105,6 +115,23 @@ public:
       _nnVersionMutex.unlock();
    }
    
+   /*!
+    * \brief The data set descriptions last received. Non-blocking.
+    * 
+    * Send a NAT_REQUEST_MODELDEF to the server for them, after the ping
+    * response has given the NatNet version they are read with.
+    * 
+    * \param out output descriptions
+    * \returns false if none have been received yet
+    */
+   bool dataDescriptions( DataDescriptions& out ) const
+   {
+      boost::mutex::scoped_lock lock(_descriptionsMutex);
+      if( _haveDescriptions )
+         out = _descriptions;
+      return _haveDescriptions;
+   }
+   
 private:
    
    bool _run;
@@ -113,6 +140,33 @@ private:
    unsigned char _nnMajor;
    unsigned char _nnMinor;
    boost::mutex _nnVersionMutex;
+   mutable boost::mutex _descriptionsMutex;
+   DataDescriptions _descriptions;
+   bool _haveDescriptions;
+   
+   // Handles to the listener metrics.
+   struct Metrics
+   {
+      Metrics()
+      {
+         MetricsRegistry& r = MetricsRegistry::instance();
+         char const* name = "natnet_command_packets_total";
+         char const* help = "Datagrams received by CommandListener, by message type.";
+         pingResponses = r.counter(name, help, "message=\"ping_response\"");
+         responses = r.counter(name, help, "message=\"response\"");
+         modelDefs = r.counter(name, help, "message=\"model_def\"");
+         frames = r.counter(name, help, "message=\"frame_of_data\"");
+         unrecognized = r.counter(name, help, "message=\"unrecognized_request\"");
+         messages = r.counter(name, help, "message=\"message_string\"");
+         other = r.counter(name, help, "message=\"other\"");
+         bytes = r.counter("natnet_command_bytes_total", "Bytes received by CommandListener.");
+         recvErrors = r.counter("natnet_command_recv_errors_total", "Failed or empty receives on the command socket.");
+      }
+      
+      Counter pingResponses, responses, modelDefs, frames, unrecognized, messages, other;
+      Counter bytes, recvErrors;
+   };
+   Metrics _metrics;
    
    void _work(int sd)
    {
@@ -147,17 +201,36 @@ private:
          );
 
          if(len <= 0)
+         {
+            _metrics.recvErrors.inc();
             continue;
+         }
+         _metrics.bytes.inc(static_cast<uint64_t>(len));
+         NATNET_PROBE2(command_received, static_cast<int>(nnp.iMessage()), len);
 
          switch(nnp.iMessage())
          {
          case NatNetPacket::NAT_MODELDEF:
-            //Unpack(nnp.rawPtr());
+            _metrics.modelDefs.inc();
+            if( len >= 4 )
+            {
+               DataDescriptions descriptions;
+               char const* payload = nnp.read<char>(0);
+               size_t n = std::min(static_cast<size_t>(len - 4), static_cast<size_t>(nnp.nDataBytes()));
+               if( descriptions.unpack(payload, payload + n, _nnMajor) )
+               {
+                  boost::mutex::scoped_lock lock(_descriptionsMutex);
+                  _descriptions = descriptions;
+                  _haveDescriptions = true;
+               }
+            }
             break;
          case NatNetPacket::NAT_FRAMEOFDATA:
+            _metrics.frames.inc();
             //Unpack(nnp.rawPtr());
             break;
          case NatNetPacket::NAT_PINGRESPONSE:
+            _metrics.pingResponses.inc();
             sender.unpack(nnp.read<char>(0));
             _nnMajor = sender.natNetVersion()[0];
             _nnMinor = sender.natNetVersion()[1];
@@ -167,17 +240,21 @@ private:
             printf("[Client] ServerVersion: %d.%d\n",sender.version()[0],sender.version()[1]);
             break;
          case NatNetPacket::NAT_RESPONSE:
+            _metrics.responses.inc();
             response = nnp.read<char>(0);
             printf("Response : %s", response);
             break;
          case NatNetPacket::NAT_UNRECOGNIZED_REQUEST:
+            _metrics.unrecognized.inc();
             printf("[Client] received 'unrecognized request'\n");
             break;
          case NatNetPacket::NAT_MESSAGESTRING:
+            _metrics.messages.inc();
             response = nnp.read<char>(0);
             printf("[Client] Received message: %s\n", response);
             break;
          default:
+            _metrics.other.inc();
             break;
         } // end switch(nnp.iMessage)
         
@@ -0,0 +1,301 @@
+/*
+ * CompressedReader.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMPRESSEDREADER_H
+#define COMPRESSEDREADER_H
+
+#include <NatNetLinux/FrameCodec.h>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*!
+ * \brief Position in a compressed file, with the decoder state to go on from it.
+ * \author Philip G. Lee
+ */
+class CompressedCursor
+{
+public:
+
+   //! \brief Constructor
+   CompressedCursor( size_t block=0, FrameDecoder const& decoder=FrameDecoder() ) :
+      block(block),
+      frame(0),
+      pos(0),
+      decoder(decoder)
+   {
+   }
+
+   //! \brief Block being read.
+   size_t block;
+   //! \brief Frames of the block already read.
+   uint32_t frame;
+   //! \brief Next coded frame in the block. Only meaningful when \c frame > 0.
+   char const* pos;
+   //! \brief State left by the frames already read.
+   FrameDecoder decoder;
+};
+
+/*!
+ * \brief Reads files written by CompressedWriter.
+ * \author Philip G. Lee
+ *
+ * The file is memory-mapped and only the block headers are read when it
+ * is opened. Any number of threads may read with their own cursors, e.g.
+ * one block each.
+ *
+ * seekFrame() and seekTime() binary search the block headers, then decode
+ * from the start of the block, so they cost at most one block of frames.
+ * They assume the key increases through the file.
+ *
+ * Blocks at the end that were not completely written are ignored, so a
+ * file can be read while it is still being written.
+ */
+class CompressedReader
+{
+public:
+
+   //! \brief Default constructor. Not open.
+   CompressedReader() :
+      _data(0),
+      _size(0),
+      _codec(),
+      _nnMajor(0),
+      _nnMinor(0),
+      _keyInterval(0),
+      _blocks(),
+      _frames(0)
+   {
+   }
+
+   ~CompressedReader()
+   {
+      close();
+   }
+
+   /*!
+    * \brief Map a file and read its block headers.
+    *
+    * \returns false if it is not a compressed file
+    */
+   bool open( std::string const& path )
+   {
+      struct stat st;
+      FrameCodec::FileHeader fh;
+
+      close();
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if( fd < 0 )
+         return false;
+      if( fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(fh) )
+      {
+         ::close(fd);
+         return false;
+      }
+      void* p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if( p == MAP_FAILED )
+         return false;
+
+      memcpy(&fh, p, sizeof(fh));
+      if( memcmp(fh.magic, FrameCodec::fileMagic(), sizeof(fh.magic)) != 0 || fh.version != FrameCodec::VERSION )
+      {
+         munmap(p, st.st_size);
+         return false;
+      }
+      _data = static_cast<char const*>(p);
+      _size = st.st_size;
+      _codec = FrameCodec(
+         static_cast<FrameCodec::Mode>(fh.mode),
+         fh.positionResolution,
+         fh.quaternionBits,
+         fh.errorResolution
+      );
+      _nnMajor = fh.nnMajor;
+      _nnMinor = fh.nnMinor;
+      _keyInterval = fh.keyInterval;
+
+      size_t off = FrameCodec::FILE_HEADER_BYTES;
+      while( off + FrameCodec::BLOCK_HEADER_BYTES <= _size )
+      {
+         Block b;
+         memcpy(&b.header, _data + off, sizeof(b.header));
+         off += FrameCodec::BLOCK_HEADER_BYTES;
+         if( b.header.frames == 0 || b.header.bytes > _size - off )
+            break;
+         b.data = _data + off;
+         _blocks.push_back(b);
+         _frames += b.header.frames;
+         off += b.header.bytes;
+      }
+      return true;
+   }
+
+   //! \brief Unmap the file. Invalidates every cursor.
+   void close()
+   {
+      if( _data )
+         munmap(const_cast<char*>(_data), _size);
+      _data = 0;
+      _size = 0;
+      _blocks.clear();
+      _frames = 0;
+   }
+
+   //! \brief True if a file is open.
+   bool isOpen() const { return _data != 0; }
+   //! \brief Coding of the frames.
+   FrameCodec const& codec() const { return _codec; }
+   //! \brief NatNet major version of the recorded frames.
+   unsigned char nnMajor() const { return _nnMajor; }
+   //! \brief NatNet minor version of the recorded frames.
+   unsigned char nnMinor() const { return _nnMinor; }
+   //! \brief Frames per block the file was written with.
+   uint32_t keyInterval() const { return _keyInterval; }
+   //! \brief Number of complete blocks.
+   size_t numBlocks() const { return _blocks.size(); }
+   //! \brief Number of frames in the complete blocks.
+   uint64_t numFrames() const { return _frames; }
+   //! \brief Bytes of the file.
+   size_t size() const { return _size; }
+   //! \brief Header of block \c i, with its frame and time ranges.
+   FrameCodec::BlockHeader const& blockHeader( size_t i ) const { return _blocks[i].header; }
+
+   //! \brief A decoder for this file, e.g. for FrameDecoder::decode() of a whole block.
+   FrameDecoder decoder() const { return FrameDecoder(_codec, _nnMajor, _nnMinor); }
+   //! \brief Coded frames of block \c i, \c blockHeader(i).bytes long.
+   char const* blockData( size_t i ) const { return _blocks[i].data; }
+
+   //! \brief Cursor at the first frame of block \c i.
+   CompressedCursor begin( size_t i=0 ) const { return CompressedCursor(i, decoder()); }
+
+   /*!
+    * \brief Decode the frame at \c c and advance \c c to the next one.
+    *
+    * A block that turns out to be corrupt is skipped from there on.
+    *
+    * \returns false at the end of the file
+    */
+   bool next( CompressedCursor& c, MocapFrame& frame, struct timespec& ts ) const
+   {
+      while( c.block < _blocks.size() )
+      {
+         Block const& b = _blocks[c.block];
+         if( c.frame == 0 )
+         {
+            c.pos = b.data;
+            c.decoder.reset();
+         }
+         if( c.frame < b.header.frames )
+         {
+            char const* p = c.decoder.decode(c.pos, b.data + b.header.bytes, frame, ts);
+            if( p )
+            {
+               c.pos = p;
+               ++c.frame;
+               return true;
+            }
+         }
+         ++c.block;
+         c.frame = 0;
+      }
+      return false;
+   }
+
+   //! \brief Cursor at the first frame numbered \c frameNum or later.
+   CompressedCursor seekFrame( int frameNum ) const
+   {
+      return _seek(FRAME, frameNum);
+   }
+
+   //! \brief Cursor at the first frame received at \c ts (\c CLOCK_REALTIME) or later.
+   CompressedCursor seekTime( struct timespec const& ts ) const
+   {
+      return _seek(TIME, static_cast<int64_t>(ts.tv_sec)*1000000000LL + ts.tv_nsec);
+   }
+
+   //! \brief seekTime() from seconds, e.g. NatNet::seconds(). Good to about a microsecond.
+   CompressedCursor seekTime( double seconds ) const
+   {
+      return _seek(TIME, static_cast<int64_t>(seconds*1e9));
+   }
+
+private:
+
+   enum Key
+   {
+      FRAME,
+      TIME
+   };
+
+   struct Block
+   {
+      FrameCodec::BlockHeader header;
+      char const* data;
+   };
+
+   char const* _data;
+   size_t _size;
+   FrameCodec _codec;
+   unsigned char _nnMajor;
+   unsigned char _nnMinor;
+   uint32_t _keyInterval;
+   std::vector<Block> _blocks;
+   uint64_t _frames;
+
+   CompressedCursor _seek( Key k, int64_t key ) const
+   {
+      // First block that ends at or past the key.
+      size_t lo = 0, hi = _blocks.size();
+      while( lo < hi )
+      {
+         size_t mid = lo + (hi - lo)/2;
+         FrameCodec::BlockHeader const& h = _blocks[mid].header;
+         if( (k == FRAME ? h.lastFrame : h.lastTimeNs) < key )
+            lo = mid + 1;
+         else
+            hi = mid;
+      }
+
+      // A cursor can not be backed up, and copying one copies its decoder's
+      // state, so count the frames before the match, then decode them again.
+      CompressedCursor c = begin(lo);
+      MocapFrame frame;
+      struct timespec ts;
+      uint32_t n;
+      for( n = 0; c.block == lo; ++n )
+      {
+         if( !next(c, frame, ts) )
+            break;
+         int64_t at = k == FRAME ? frame.frameNum() : static_cast<int64_t>(ts.tv_sec)*1000000000LL + ts.tv_nsec;
+         if( at >= key )
+         {
+            c = begin(lo);
+            while( n-- > 0 )
+               next(c, frame, ts);
+            return c;
+         }
+      }
+      return c;
+   }
+};
+
+#endif /*COMPRESSEDREADER_H*/
@@ -0,0 +1,317 @@
+/*
+ * CompressedWriter.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMPRESSEDWRITER_H
+#define COMPRESSEDWRITER_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameHandler.h>
+#include <NatNetLinux/FrameCodec.h>
+#include <NatNetLinux/BackgroundFileWriter.h>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*!
+ * \brief Counters of a CompressedWriter.
+ * \author Philip G. Lee
+ */
+class CompressedStats
+{
+public:
+
+   //! \brief Default constructor. All zero.
+   CompressedStats() :
+      frames(0),
+      blocks(0),
+      bytes(0),
+      dropped(0),
+      writeErrors(0)
+   {
+   }
+
+   //! \brief Frames written to disk.
+   uint64_t frames;
+   //! \brief Blocks written to disk.
+   uint64_t blocks;
+   //! \brief Bytes written to disk, including headers.
+   uint64_t bytes;
+   //! \brief Frames dropped because the writer fell behind.
+   uint64_t dropped;
+   //! \brief Failed writes. The frames of a failed write are lost.
+   uint64_t writeErrors;
+};
+
+/*!
+ * \brief In-memory block of coded frames of a CompressedWriter.
+ * \author Philip G. Lee
+ */
+class CompressedBlock
+{
+public:
+
+   //! \brief Constructor. Empty, with room for about \c frames frames.
+   CompressedBlock( size_t frames ) :
+      nnMajor(0),
+      nnMinor(0)
+   {
+      memset(&header, 0, sizeof(header));
+      // Room for a few dozen bodies per frame without reallocating.
+      data.reserve(frames*512);
+   }
+
+   //! \brief True if it has no frames.
+   bool empty() const { return header.frames == 0; }
+
+   //! \brief Make it empty, keeping the memory.
+   void clear()
+   {
+      memset(&header, 0, sizeof(header));
+      nnMajor = 0;
+      nnMinor = 0;
+      data.clear();
+   }
+
+   FrameCodec::BlockHeader header;
+   unsigned char nnMajor;
+   unsigned char nnMinor;
+   std::vector<char> data;
+};
+
+/*!
+ * \brief Records frames to a compressed file.
+ * \author Philip G. Lee
+ *
+ * Register with \c FrameListener::addHandler() to record every frame, as
+ * coded by FrameEncoder. See FrameCodec for what is kept and the file
+ * layout, and CompressedReader to read it back.
+ *
+ * handleFrame() codes the frame into the block being built in memory,
+ * which takes about a microsecond for a few dozen bodies. Every
+ * \c keyInterval frames the block is queued for a background thread that
+ * writes it, so the listener never waits for the disk. A partly filled
+ * block is written after \c flushInterval seconds, so blocks may be
+ * shorter. If the disk falls behind until \c maxBlocks blocks are queued,
+ * frames are dropped and counted.
+ */
+class CompressedWriter : public FrameHandler, public BackgroundFileWriter<CompressedBlock>
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param path file to create
+    * \param codec coding of the frames
+    * \param keyInterval frames per block. Reading starts at a block, so
+    *    smaller blocks seek faster and larger ones compress a little better.
+    * \param maxBlocks blocks that may be queued for writing
+    * \param flushInterval seconds after which a partly filled block is written
+    */
+   CompressedWriter(
+      std::string const& path,
+      FrameCodec const& codec=FrameCodec(),
+      uint32_t keyInterval=256,
+      size_t maxBlocks=64,
+      double flushInterval=2.0
+   ) :
+      BackgroundFileWriter<CompressedBlock>(maxBlocks, flushInterval),
+      _path(path),
+      _codec(codec),
+      _keyInterval(keyInterval < 1 ? 1 : keyInterval),
+      _encoder(codec),
+      _stats(),
+      _fd(-1),
+      _end(0),
+      _versioned(false)
+   {
+   }
+
+   ~CompressedWriter()
+   {
+      if( running() )
+         stop();
+      join();
+      if( _fd >= 0 )
+         ::close(_fd);
+   }
+
+   /*!
+    * \brief Create the file and start writing in a new thread. Non-blocking.
+    *
+    * \returns false if the file could not be created
+    */
+   bool start()
+   {
+      if( _fill )
+         return false;
+      _fd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if( _fd < 0 )
+         return false;
+      if( !_writeHeader(0, 0) )
+      {
+         ::close(_fd);
+         _fd = -1;
+         return false;
+      }
+      _end = sizeof(FrameCodec::FileHeader);
+
+      _startThread();
+      return true;
+   }
+
+   //! \brief Code a frame. Thread-safe, never waits for the disk.
+   virtual void handleFrame( MocapFrame const& frame, struct timespec const& ts )
+   {
+      int64_t timeNs = static_cast<int64_t>(ts.tv_sec)*1000000000LL + ts.tv_nsec;
+
+      _mutex.lock();
+      if( !_run )
+      {
+         _mutex.unlock();
+         return;
+      }
+      // A block left full because none was free is queued first.
+      if( _fill->header.frames >= _keyInterval && !_queueFill() )
+      {
+         ++_stats.dropped;
+         _mutex.unlock();
+         return;
+      }
+      CompressedBlock& b = *_fill;
+      if( b.header.frames == 0 )
+      {
+         b.header.firstFrame = frame.frameNum();
+         b.header.firstTimeNs = timeNs;
+         b.nnMajor = frame.nnMajor();
+         b.nnMinor = frame.nnMinor();
+      }
+      _encoder.encode(frame, ts, b.data);
+      ++b.header.frames;
+      b.header.lastFrame = frame.frameNum();
+      b.header.lastTimeNs = timeNs;
+
+      if( b.header.frames >= _keyInterval )
+         _queueFill();
+      _mutex.unlock();
+   }
+
+   //! \brief Counters so far. Thread-safe.
+   CompressedStats stats() const
+   {
+      _mutex.lock();
+         CompressedStats ret = _stats;
+      _mutex.unlock();
+      return ret;
+   }
+
+private:
+
+   std::string _path;
+   FrameCodec _codec;
+   uint32_t _keyInterval;
+
+   // Guarded by _mutex.
+   FrameEncoder _encoder;
+   CompressedStats _stats;
+
+   // Only used by the writing thread once started.
+   int _fd;
+   // End of the last complete block.
+   off_t _end;
+   // True once the header has the NatNet version of the frames.
+   bool _versioned;
+
+   virtual CompressedBlock* _newBuffer()
+   {
+      return new CompressedBlock(_keyInterval);
+   }
+
+   // Each block decodes on its own, so the next starts from a reset encoder.
+   virtual void _queued()
+   {
+      _encoder.reset();
+   }
+
+   // Write the file header at the start of the file.
+   bool _writeHeader( unsigned char nnMajor, unsigned char nnMinor )
+   {
+      FrameCodec::FileHeader fh;
+      struct timespec now;
+
+      clock_gettime( CLOCK_REALTIME, &now );
+      memset(&fh, 0, sizeof(fh));
+      memcpy(fh.magic, FrameCodec::fileMagic(), sizeof(fh.magic));
+      fh.version = FrameCodec::VERSION;
+      fh.mode = static_cast<uint8_t>(_codec.mode);
+      fh.nnMajor = nnMajor;
+      fh.nnMinor = nnMinor;
+      fh.quaternionBits = static_cast<uint8_t>(_codec.quaternionBits);
+      fh.positionResolution = _codec.positionResolution;
+      fh.errorResolution = _codec.errorResolution;
+      fh.keyInterval = _keyInterval;
+      fh.createdNs = static_cast<int64_t>(now.tv_sec)*1000000000LL + now.tv_nsec;
+      return pwrite(_fd, &fh, sizeof(fh), 0) == static_cast<ssize_t>(sizeof(fh))
+         && lseek(_fd, 0, SEEK_END) >= 0;
+   }
+
+   virtual void _writeBuffer( CompressedBlock& b )
+   {
+      bool ok = true;
+      b.header.bytes = static_cast<uint32_t>(b.data.size());
+      if( !_versioned )
+      {
+         // Readers build frames with the version of the first one.
+         ok = _writeHeader(b.nnMajor, b.nnMinor);
+         _versioned = true;
+      }
+      ok = ok
+         && writeAll(_fd, reinterpret_cast<char const*>(&b.header), sizeof(b.header))
+         && writeAll(_fd, &b.data[0], b.data.size());
+      // CompressedReader stops at a short block, so drop any part of one.
+      if( ok )
+         _end += sizeof(b.header) + b.data.size();
+      else if( ftruncate(_fd, _end) == 0 )
+         lseek(_fd, _end, SEEK_SET);
+
+      _mutex.lock();
+      if( ok )
+      {
+         _stats.frames += b.header.frames;
+         ++_stats.blocks;
+         _stats.bytes += sizeof(b.header) + b.data.size();
+      }
+      else
+         ++_stats.writeErrors;
+      _mutex.unlock();
+   }
+
+   virtual void _finish()
+   {
+      if( ::close(_fd) != 0 )
+      {
+         _mutex.lock();
+            ++_stats.writeErrors;
+         _mutex.unlock();
+      }
+      _fd = -1;
+   }
+};
+
+#endif /*COMPRESSEDWRITER_H*/
@@ -0,0 +1,396 @@
+/*
+ * DataDescriptions.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DATADESCRIPTIONS_H
+#define DATADESCRIPTIONS_H
+
+#include <NatNetLinux/NatNet.h>
+#include <vector>
+#include <string>
+#include <string.h>
+
+/*!
+ * \brief Description of a marker set: its name and the names of its markers.
+ * \author Philip G. Lee
+ */
+class MarkerSetDescription
+{
+public:
+   //! \brief Name of the set, as in \c MarkerSet::name().
+   std::string name;
+   //! \brief Name of each marker, in the order of \c MarkerSet::markers().
+   std::vector<std::string> markerNames;
+};
+
+/*!
+ * \brief Description of a rigid body: its name, ID, parent and markers.
+ * \author Philip G. Lee
+ */
+class RigidBodyDescription
+{
+public:
+   //! \brief Default constructor. No parent, no offset, no markers.
+   RigidBodyDescription() :
+      name(),
+      id(0),
+      parentId(-1),
+      offset(),
+      markerOffsets(),
+      markerLabels()
+   {
+   }
+
+   //! \brief Name of the body. Empty before NatNet 2.0.
+   std::string name;
+   //! \brief ID of the body, as in \c RigidBody::id().
+   int id;
+   //! \brief ID of the parent body, or -1 for none.
+   int parentId;
+   //! \brief Offset from the parent.
+   Point3f offset;
+   //! \brief Marker positions in the body frame. Used in NatNet version >= 3.0.
+   std::vector<Point3f> markerOffsets;
+   //! \brief Active label of each marker, 0 if none. Used in NatNet version >= 3.0.
+   std::vector<int> markerLabels;
+};
+
+/*!
+ * \brief Description of a skeleton: its name, ID and bodies.
+ * \author Philip G. Lee
+ */
+class SkeletonDescription
+{
+public:
+   //! \brief Default constructor
+   SkeletonDescription() :
+      name(),
+      id(0),
+      rigidBodies()
+   {
+   }
+
+   //! \brief Name of the skeleton.
+   std::string name;
+   //! \brief ID of the skeleton, as in \c Skeleton::id().
+   int id;
+   //! \brief Bodies of the skeleton, in the order of \c Skeleton::rigidBodies().
+   std::vector<RigidBodyDescription> rigidBodies;
+};
+
+/*!
+ * \brief The data set descriptions a server sends in a NAT_MODELDEF.
+ * \author Philip G. Lee
+ *
+ * Frames carry only rigid body and skeleton IDs; the descriptions give
+ * their names. Ask for them with a NAT_REQUEST_MODELDEF on the command
+ * socket; CommandListener keeps the last ones received. The layouts are
+ * those of NatNet 1.x to 3.x, where rigid bodies also describe their
+ * markers from 3.0. unpack() rejects later versions rather than misread
+ * them, and pack() writes the 3.x layout for them.
+ */
+class DataDescriptions
+{
+public:
+
+   //! \brief Data set types.
+   enum DatasetType
+   {
+      MARKER_SET  = 0,
+      RIGID_BODY  = 1,
+      SKELETON    = 2
+   };
+
+   //! \brief Marker set descriptions.
+   std::vector<MarkerSetDescription> markerSets;
+   //! \brief Rigid body descriptions, not counting skeleton bodies.
+   std::vector<RigidBodyDescription> rigidBodies;
+   //! \brief Skeleton descriptions.
+   std::vector<SkeletonDescription> skeletons;
+
+   //! \brief Remove every description.
+   void clear()
+   {
+      markerSets.clear();
+      rigidBodies.clear();
+      skeletons.clear();
+   }
+
+   //! \brief ID of the rigid body with this name, or -1 if there is none.
+   int rigidBodyId( std::string const& name ) const
+   {
+      for( size_t i = 0; i < rigidBodies.size(); ++i )
+         if( rigidBodies[i].name == name )
+            return rigidBodies[i].id;
+      return -1;
+   }
+
+   //! \brief ID of the skeleton with this name, or -1 if there is none.
+   int skeletonId( std::string const& name ) const
+   {
+      for( size_t i = 0; i < skeletons.size(); ++i )
+         if( skeletons[i].name == name )
+            return skeletons[i].id;
+      return -1;
+   }
+
+   //! \brief Name of the rigid body with this ID, or empty if there is none.
+   std::string rigidBodyName( int id ) const
+   {
+      for( size_t i = 0; i < rigidBodies.size(); ++i )
+         if( rigidBodies[i].id == id )
+            return rigidBodies[i].name;
+      return std::string();
+   }
+
+   //! \brief Name of the skeleton with this ID, or empty if there is none.
+   std::string skeletonName( int id ) const
+   {
+      for( size_t i = 0; i < skeletons.size(); ++i )
+         if( skeletons[i].id == id )
+            return skeletons[i].name;
+      return std::string();
+   }
+
+   //! \brief Bytes that pack() writes.
+   size_t packedSize( char nnMajor ) const
+   {
+      size_t i, j;
+      size_t n = 4;
+      for( i = 0; i < markerSets.size(); ++i )
+      {
+         n += 4 + markerSets[i].name.size() + 1 + 4;
+         for( j = 0; j < markerSets[i].markerNames.size(); ++j )
+            n += markerSets[i].markerNames[j].size() + 1;
+      }
+      for( i = 0; i < rigidBodies.size(); ++i )
+         n += 4 + _bodySize(rigidBodies[i], nnMajor);
+      for( i = 0; i < skeletons.size(); ++i )
+      {
+         n += 4 + skeletons[i].name.size() + 1 + 8;
+         for( j = 0; j < skeletons[i].rigidBodies.size(); ++j )
+            n += _bodySize(skeletons[i].rigidBodies[j], nnMajor);
+      }
+      return n;
+   }
+
+   /*!
+    * \brief Pack the descriptions the way unpack() reads them.
+    *
+    * Marker sets come first, then rigid bodies, then skeletons.
+    *
+    * \param data output buffer, with at least packedSize() bytes
+    * \param nnMajor major version of NatNet to pack for
+    * \returns pointer to data immediately following the descriptions
+    */
+   char* pack( char* data, char nnMajor ) const
+   {
+      size_t i, j;
+      int n = static_cast<int>(markerSets.size() + rigidBodies.size() + skeletons.size());
+
+      memcpy(data,&n,4); data += 4;
+      for( i = 0; i < markerSets.size(); ++i )
+      {
+         data = _putInt(data, MARKER_SET);
+         data = _putString(data, markerSets[i].name);
+         data = _putInt(data, static_cast<int>(markerSets[i].markerNames.size()));
+         for( j = 0; j < markerSets[i].markerNames.size(); ++j )
+            data = _putString(data, markerSets[i].markerNames[j]);
+      }
+      for( i = 0; i < rigidBodies.size(); ++i )
+      {
+         data = _putInt(data, RIGID_BODY);
+         data = _packBody(data, rigidBodies[i], nnMajor);
+      }
+      for( i = 0; i < skeletons.size(); ++i )
+      {
+         data = _putInt(data, SKELETON);
+         data = _putString(data, skeletons[i].name);
+         data = _putInt(data, skeletons[i].id);
+         data = _putInt(data, static_cast<int>(skeletons[i].rigidBodies.size()));
+         for( j = 0; j < skeletons[i].rigidBodies.size(); ++j )
+            data = _packBody(data, skeletons[i].rigidBodies[j], nnMajor);
+      }
+      return data;
+   }
+
+   /*!
+    * \brief Unpack the payload of a NAT_MODELDEF, replacing the descriptions.
+    *
+    * Unlike the frame classes, this checks every read against \c end since
+    * descriptions are read rarely and hold strings.
+    *
+    * \param data start of the payload
+    * \param end one past the end of the payload
+    * \param nnMajor major version of NatNet the payload is packed with
+    * \returns pointer to data immediately following the descriptions, or
+    *    0 if the payload is truncated, has an unknown data set type or
+    *    comes from a NatNet version after 3.x, whose layout is not known
+    */
+   char const* unpack( char const* data, char const* end, char nnMajor )
+   {
+      int n, type, count, i, j;
+
+      clear();
+      if( nnMajor > 3 || !_getInt(data, end, n) || n < 0 )
+         return 0;
+      for( i = 0; i < n; ++i )
+      {
+         if( !_getInt(data, end, type) )
+            return 0;
+         if( type == MARKER_SET )
+         {
+            MarkerSetDescription set;
+            // Every name takes a byte at least, which bounds count.
+            if( !_getString(data, end, set.name) || !_getInt(data, end, count) ||
+                count < 0 || count > end - data )
+               return 0;
+            set.markerNames.resize(count);
+            for( j = 0; j < count; ++j )
+               if( !_getString(data, end, set.markerNames[j]) )
+                  return 0;
+            markerSets.push_back(set);
+         }
+         else if( type == RIGID_BODY )
+         {
+            RigidBodyDescription body;
+            if( !_unpackBody(data, end, body, nnMajor) )
+               return 0;
+            rigidBodies.push_back(body);
+         }
+         else if( type == SKELETON )
+         {
+            SkeletonDescription skeleton;
+            if( !_getString(data, end, skeleton.name) || !_getInt(data, end, skeleton.id) ||
+                !_getInt(data, end, count) || count < 0 || count > end - data )
+               return 0;
+            skeleton.rigidBodies.resize(count);
+            for( j = 0; j < count; ++j )
+               if( !_unpackBody(data, end, skeleton.rigidBodies[j], nnMajor) )
+                  return 0;
+            skeletons.push_back(skeleton);
+         }
+         else
+            return 0;
+      }
+      return data;
+   }
+
+private:
+
+   static size_t _bodySize( RigidBodyDescription const& body, char nnMajor )
+   {
+      return (nnMajor >= 2 ? body.name.size() + 1 : 0) + 20 +
+         (nnMajor >= 3 ? 4 + 16*body.markerOffsets.size() : 0);
+   }
+
+   static char* _putInt( char* data, int v )
+   {
+      memcpy(data,&v,4);
+      return data + 4;
+   }
+
+   static char* _putString( char* data, std::string const& s )
+   {
+      memcpy(data, s.c_str(), s.size() + 1);
+      return data + s.size() + 1;
+   }
+
+   static char* _packBody( char* data, RigidBodyDescription const& body, char nnMajor )
+   {
+      if( nnMajor >= 2 )
+         data = _putString(data, body.name);
+      data = _putInt(data, body.id);
+      data = _putInt(data, body.parentId);
+      memcpy(data,&body.offset.x,4); data += 4;
+      memcpy(data,&body.offset.y,4); data += 4;
+      memcpy(data,&body.offset.z,4); data += 4;
+      if( nnMajor >= 3 )
+      {
+         // Markers without a label in markerLabels get 0.
+         size_t i, n = body.markerOffsets.size();
+         data = _putInt(data, static_cast<int>(n));
+         for( i = 0; i < n; ++i )
+         {
+            memcpy(data,&body.markerOffsets[i].x,4); data += 4;
+            memcpy(data,&body.markerOffsets[i].y,4); data += 4;
+            memcpy(data,&body.markerOffsets[i].z,4); data += 4;
+         }
+         for( i = 0; i < n; ++i )
+            data = _putInt(data, i < body.markerLabels.size() ? body.markerLabels[i] : 0);
+      }
+      return data;
+   }
+
+   static bool _getInt( char const*& data, char const* end, int& v )
+   {
+      if( end - data < 4 )
+         return false;
+      memcpy(&v,data,4); data += 4;
+      return true;
+   }
+
+   static bool _getFloat( char const*& data, char const* end, float& v )
+   {
+      if( end - data < 4 )
+         return false;
+      memcpy(&v,data,4); data += 4;
+      return true;
+   }
+
+   static bool _getString( char const*& data, char const* end, std::string& s )
+   {
+      char const* nul = static_cast<char const*>(memchr(data, '\0', end - data));
+      if( !nul )
+         return false;
+      s.assign(data, nul);
+      data = nul + 1;
+      return true;
+   }
+
+   static bool _unpackBody( char const*& data, char const* end, RigidBodyDescription& body, char nnMajor )
+   {
+      int count, i;
+      if( nnMajor >= 2 && !_getString(data, end, body.name) )
+         return false;
+      if( !_getInt(data, end, body.id) ||
+          !_getInt(data, end, body.parentId) ||
+          !_getFloat(data, end, body.offset.x) ||
+          !_getFloat(data, end, body.offset.y) ||
+          !_getFloat(data, end, body.offset.z) )
+         return false;
+      if( nnMajor < 3 )
+         return true;
+
+      // A position and a label are 16 bytes, which bounds count.
+      if( !_getInt(data, end, count) || count < 0 || count > (end - data)/16 )
+         return false;
+      body.markerOffsets.resize(count);
+      body.markerLabels.resize(count);
+      for( i = 0; i < count; ++i )
+         if( !_getFloat(data, end, body.markerOffsets[i].x) ||
+             !_getFloat(data, end, body.markerOffsets[i].y) ||
+             !_getFloat(data, end, body.markerOffsets[i].z) )
+            return false;
+      for( i = 0; i < count; ++i )
+         if( !_getInt(data, end, body.markerLabels[i]) )
+            return false;
+      return true;
+   }
+};
+
+#endif /*DATADESCRIPTIONS_H*/
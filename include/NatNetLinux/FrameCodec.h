@@ -0,0 +1,1005 @@
+/*
+ * FrameCodec.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMECODEC_H
+#define FRAMECODEC_H
+
+#include <NatNetLinux/NatNet.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+
+/*!
+ * \brief Settings and on-disk layout of compressed frame streams.
+ * \author Philip G. Lee
+ *
+ * FrameEncoder and FrameDecoder compress whole frames: the frame number,
+ * receive time, timecode, latency and capture time of each frame, the ID,
+ * position, orientation, mean marker error and validity of each rigid
+ * body, and the other sections (see Section). Replayed frames therefore
+ * feed marker trackers and solvers as well as pose consumers.
+ *
+ * Every value is coded as the difference from the same value in the
+ * previous frame (per body, matched by ID), as a zigzag varint, so a
+ * still or slowly moving body costs a few bytes. Validity is coded as the
+ * run lengths between bodies whose flag changed, usually a single 0.
+ *
+ * Each other section is flattened into a list of 32-bit words (counts,
+ * IDs, float bit patterns and name bytes), and each word is differenced
+ * against the word at the same index in the previous frame. Sections are
+ * stored exactly in both modes, and an empty section costs nothing but
+ * a bit of the frame's section mask.
+ *
+ * In \c LOSSLESS mode the bit patterns of the floats are differenced, and
+ * every value decodes exactly. In \c LOSSY mode positions are rounded to
+ * \c positionResolution, marker errors to \c errorResolution, and
+ * quaternions are normalized and stored as their three smallest components
+ * in \c quaternionBits bits each (smallest-three), with the index of the
+ * largest. The error of each value is bounded (see maxPositionError() and
+ * maxQuaternionError()) and does not accumulate, as the differences are
+ * taken between rounded values. A decoded quaternion may be the negation
+ * of the original, which is the same rotation.
+ *
+ * A compressed file is a FileHeader followed by blocks. A block is a
+ * BlockHeader and up to \c keyInterval frames coded from a reset encoder, so
+ * each block decodes on its own. All values are in host byte order.
+ *
+ * \sa CompressedWriter, CompressedReader
+ */
+class FrameCodec
+{
+public:
+
+   enum
+   {
+      VERSION            = 2,
+      FILE_HEADER_BYTES  = 48,
+      BLOCK_HEADER_BYTES = 40
+   };
+
+   //! \brief Coding of poses.
+   enum Mode
+   {
+      LOSSLESS = 0,
+      LOSSY    = 1
+   };
+
+   /*!
+    * \brief Frame sections coded as word lists, in the order they are written.
+    *
+    * \c BODY_MARKERS holds the markers, marker IDs and marker sizes of the
+    * rigid bodies, and \c SKELETONS every field of every bone.
+    */
+   enum Section
+   {
+      MARKER_SETS = 0,
+      UNID_MARKERS,
+      BODY_MARKERS,
+      SKELETONS,
+      LABELED_MARKERS,
+      NUM_SECTIONS
+   };
+
+   //! \brief Start of a compressed file.
+   struct FileHeader
+   {
+      char magic[8];
+      uint32_t version;
+      uint8_t mode;
+      uint8_t nnMajor;
+      uint8_t nnMinor;
+      uint8_t quaternionBits;
+      float positionResolution;
+      float errorResolution;
+      uint32_t keyInterval;
+      uint32_t reserved0;
+      int64_t createdNs;
+      uint64_t reserved;
+   };
+
+   //! \brief Start of every block.
+   struct BlockHeader
+   {
+      //! Bytes of coded frames after this header.
+      uint32_t bytes;
+      uint32_t frames;
+      int32_t firstFrame;
+      int32_t lastFrame;
+      int64_t firstTimeNs;
+      int64_t lastTimeNs;
+      uint64_t reserved;
+   };
+
+   static char const* fileMagic() { return "NNZFR\0\0\0"; }
+
+   /*!
+    * \brief Constructor
+    *
+    * \param mode \c LOSSLESS or \c LOSSY
+    * \param positionResolution step positions are rounded to in \c LOSSY mode
+    * \param quaternionBits bits per quaternion component in \c LOSSY mode, 4 to 30
+    * \param errorResolution step marker errors are rounded to in \c LOSSY mode
+    */
+   FrameCodec(
+      Mode mode=LOSSLESS,
+      float positionResolution=1e-5f,
+      int quaternionBits=16,
+      float errorResolution=1e-6f
+   ) :
+      mode(mode),
+      positionResolution(positionResolution > 0.f ? positionResolution : 1e-5f),
+      quaternionBits(quaternionBits < 4 ? 4 : (quaternionBits > 30 ? 30 : quaternionBits)),
+      errorResolution(errorResolution > 0.f ? errorResolution : 1e-6f)
+   {
+   }
+
+   Mode mode;
+   float positionResolution;
+   int quaternionBits;
+   float errorResolution;
+
+   //! \brief Largest error of a decoded position coordinate, apart from float rounding.
+   double maxPositionError() const
+   {
+      return mode == LOSSY ? 0.5*positionResolution : 0.0;
+   }
+
+   //! \brief Largest error of a decoded quaternion component, up to sign.
+   double maxQuaternionError() const
+   {
+      if( mode != LOSSY )
+         return 0.0;
+      // Each of the three is off by half a step at most. The largest one is
+      // at least 1/2 and is recomputed from them, so it is off by at most
+      // three times that.
+      double step = 2.0*smallestThreeBound()/((1u << quaternionBits) - 1);
+      return 1.5*step;
+   }
+
+   //! \brief Magnitude bound of all but the largest component of a unit quaternion, 1/sqrt(2).
+   static double smallestThreeBound() { return 0.70710678118654752440; }
+
+   //! \brief Append \c v to \c out as a varint.
+   static void putVarint( std::vector<char>& out, uint64_t v )
+   {
+      while( v >= 0x80 )
+      {
+         out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+         v >>= 7;
+      }
+      out.push_back(static_cast<char>(v));
+   }
+
+   //! \brief Read a varint. Returns false if it runs past \c end.
+   static bool getVarint( char const*& p, char const* end, uint64_t& v )
+   {
+      v = 0;
+      for( int shift = 0; shift < 64 && p < end; shift += 7 )
+      {
+         uint8_t b = static_cast<uint8_t>(*p++);
+         v |= static_cast<uint64_t>(b & 0x7F) << shift;
+         if( !(b & 0x80) )
+            return true;
+      }
+      return false;
+   }
+
+   //! \brief Zigzag code of a two's complement difference, so small magnitudes are small.
+   static uint64_t zigzag( uint64_t d ) { return (d << 1) ^ (0 - (d >> 63)); }
+   //! \brief Inverse of zigzag().
+   static uint64_t unzigzag( uint64_t z ) { return (z >> 1) ^ (0 - (z & 1)); }
+   //! \brief zigzag() of a 32 bit difference.
+   static uint32_t zigzag32( uint32_t d ) { return (d << 1) ^ (0 - (d >> 31)); }
+   //! \brief Inverse of zigzag32().
+   static uint32_t unzigzag32( uint32_t z ) { return (z >> 1) ^ (0 - (z & 1)); }
+
+   //! \brief Bit pattern of a float.
+   static uint32_t floatBits( float f )
+   {
+      uint32_t u;
+      memcpy(&u, &f, 4);
+      return u;
+   }
+
+   //! \brief Float with the bit pattern \c u.
+   static float bitsFloat( uint32_t u )
+   {
+      float f;
+      memcpy(&f, &u, 4);
+      return f;
+   }
+
+   //! \brief \c v in steps of \c step, saturated to 32 bits, as two's complement.
+   static uint32_t quantize( float v, float step )
+   {
+      double q = floor(static_cast<double>(v)/step + 0.5);
+      if( !(q > -2147483647.0) )
+         q = -2147483647.0; // Also NaN.
+      else if( q > 2147483647.0 )
+         q = 2147483647.0;
+      return static_cast<uint32_t>(static_cast<int32_t>(q));
+   }
+
+   //! \brief Inverse of quantize().
+   static float dequantize( uint32_t q, float step )
+   {
+      return static_cast<float>(static_cast<int32_t>(q)*static_cast<double>(step));
+   }
+};
+
+/*!
+ * \brief Per-body state shared by FrameEncoder and FrameDecoder.
+ * \author Philip G. Lee
+ *
+ * The last coded values of each body, as bit patterns or quantized
+ * steps, and the word list of each FrameCodec::Section, which the next
+ * frame is differenced against.
+ */
+class FrameCodecState
+{
+public:
+
+   //! \brief Values of one body.
+   struct Body
+   {
+      Body() :
+         err(0),
+         quatIndex(3),
+         valid(1)
+      {
+         p[0] = p[1] = p[2] = 0;
+         q[0] = q[1] = q[2] = q[3] = 0;
+      }
+
+      uint32_t p[3];
+      // LOSSLESS: four bit patterns. LOSSY: three smallest components.
+      uint32_t q[4];
+      uint32_t err;
+      int quatIndex;
+      uint8_t valid;
+   };
+
+   FrameCodecState() :
+      frameNum(0),
+      timeNs(0),
+      timeDelta(0),
+      timecode(0),
+      subframe(0),
+      latency(0),
+      captureTime(0),
+      captureTimeDelta(0),
+      bodies(),
+      layout()
+   {
+   }
+
+   //! \brief Forget everything, as at the start of a block.
+   void reset()
+   {
+      *this = FrameCodecState();
+   }
+
+   //! \brief State of body \c id, created if new.
+   Body* body( int id )
+   {
+      return &bodies[id];
+   }
+
+   uint32_t frameNum;
+   uint64_t timeNs;
+   uint64_t timeDelta;
+   uint32_t timecode;
+   uint32_t subframe;
+   uint32_t latency;
+   uint64_t captureTime;
+   uint64_t captureTimeDelta;
+   //! Every body seen since the reset, so one that comes back is still differenced.
+   std::map<int,Body> bodies;
+   //! IDs of the bodies in the previous frame, in order.
+   std::vector<int> layout;
+   //! Word list of each FrameCodec::Section in the previous frame.
+   std::vector<uint32_t> words[FrameCodec::NUM_SECTIONS];
+};
+
+/*!
+ * \brief Compresses frames as described in FrameCodec.
+ * \author Philip G. Lee
+ */
+class FrameEncoder
+{
+public:
+
+   //! \brief Constructor
+   FrameEncoder( FrameCodec const& codec=FrameCodec() ) :
+      _codec(codec),
+      _state(),
+      _slots(),
+      _ids(),
+      _changes()
+   {
+   }
+
+   //! \brief Settings in use.
+   FrameCodec const& codec() const { return _codec; }
+
+   //! \brief Code the next frame independently of the previous ones.
+   void reset()
+   {
+      _state.reset();
+   }
+
+   //! \brief Append \c frame, received at \c ts, to \c out.
+   void encode( MocapFrame const& frame, struct timespec const& ts, std::vector<char>& out )
+   {
+      std::vector<RigidBody> const& bodies = frame.rigidBodies();
+      uint32_t tc, sub;
+      size_t i;
+
+      uint32_t frameNum = static_cast<uint32_t>(frame.frameNum());
+      FrameCodec::putVarint(out, FrameCodec::zigzag32(frameNum - _state.frameNum - 1));
+      _state.frameNum = frameNum;
+
+      uint64_t timeNs = static_cast<uint64_t>(static_cast<int64_t>(ts.tv_sec)*1000000000LL + ts.tv_nsec);
+      uint64_t timeDelta = timeNs - _state.timeNs;
+      FrameCodec::putVarint(out, FrameCodec::zigzag(timeDelta - _state.timeDelta));
+      _state.timeNs = timeNs;
+      _state.timeDelta = timeDelta;
+
+      frame.timecode(tc, sub);
+      FrameCodec::putVarint(out, FrameCodec::zigzag32(tc - _state.timecode));
+      FrameCodec::putVarint(out, FrameCodec::zigzag32(sub - _state.subframe));
+      _state.timecode = tc;
+      _state.subframe = sub;
+
+      uint32_t latency = FrameCodec::floatBits(frame.latency());
+      FrameCodec::putVarint(out, FrameCodec::zigzag32(latency - _state.latency));
+      _state.latency = latency;
+
+      double t = frame.captureTime();
+      uint64_t captureTime;
+      memcpy(&captureTime, &t, 8);
+      uint64_t captureTimeDelta = captureTime - _state.captureTime;
+      FrameCodec::putVarint(out, FrameCodec::zigzag(captureTimeDelta - _state.captureTimeDelta));
+      _state.captureTime = captureTime;
+      _state.captureTimeDelta = captureTimeDelta;
+
+      // Layout: 0 if the IDs are those of the previous frame, else their
+      // number + 1 and the differences between consecutive IDs.
+      _ids.resize(bodies.size());
+      for( i = 0; i < bodies.size(); ++i )
+         _ids[i] = bodies[i].id();
+      if( _ids == _state.layout )
+         FrameCodec::putVarint(out, 0);
+      else
+      {
+         FrameCodec::putVarint(out, _ids.size() + 1);
+         uint32_t prev = 0;
+         for( i = 0; i < _ids.size(); ++i )
+         {
+            FrameCodec::putVarint(out, FrameCodec::zigzag32(static_cast<uint32_t>(_ids[i]) - prev));
+            prev = static_cast<uint32_t>(_ids[i]);
+         }
+         _state.layout = _ids;
+      }
+
+      _slots.resize(bodies.size());
+      for( i = 0; i < bodies.size(); ++i )
+         _slots[i] = _state.body(_ids[i]);
+
+      // Validity: the gaps between bodies whose flag changed. An ID that
+      // appears twice shares its slot, so each is compared with the flag
+      // left by the one before.
+      _changes.clear();
+      for( i = 0; i < bodies.size(); ++i )
+      {
+         uint8_t valid = bodies[i].trackingValid() ? 1 : 0;
+         if( valid == _slots[i]->valid )
+            continue;
+         _changes.push_back(i);
+         _slots[i]->valid = valid;
+      }
+      FrameCodec::putVarint(out, _changes.size());
+      size_t last = 0;
+      for( i = 0; i < _changes.size(); ++i )
+      {
+         FrameCodec::putVarint(out, _changes[i] - last);
+         last = _changes[i] + 1;
+      }
+
+      for( i = 0; i < bodies.size(); ++i )
+      {
+         if( _codec.mode == FrameCodec::LOSSY )
+            _encodeLossy(bodies[i], *_slots[i], out);
+         else
+            _encodeLossless(bodies[i], *_slots[i], out);
+      }
+
+      // The other sections: a mask of those that are not empty, then the
+      // length of each and its words differenced against the last frame.
+      _flatten(frame);
+      uint32_t mask = 0;
+      int k;
+      for( k = 0; k < FrameCodec::NUM_SECTIONS; ++k )
+         if( !_words[k].empty() )
+            mask |= 1u << k;
+      FrameCodec::putVarint(out, mask);
+      for( k = 0; k < FrameCodec::NUM_SECTIONS; ++k )
+      {
+         std::vector<uint32_t> const& w = _words[k];
+         std::vector<uint32_t> const& prev = _state.words[k];
+         if( !w.empty() )
+         {
+            FrameCodec::putVarint(out, w.size());
+            for( i = 0; i < w.size(); ++i )
+               FrameCodec::putVarint(out, FrameCodec::zigzag32(w[i] - (i < prev.size() ? prev[i] : 0)));
+         }
+         _state.words[k].swap(_words[k]);
+      }
+   }
+
+private:
+
+   FrameCodec _codec;
+   FrameCodecState _state;
+   std::vector<FrameCodecState::Body*> _slots;
+   std::vector<int> _ids;
+   // Bodies whose validity changed in the frame being coded.
+   std::vector<size_t> _changes;
+   // Word lists of the frame being coded.
+   std::vector<uint32_t> _words[FrameCodec::NUM_SECTIONS];
+
+   static void _putPoints( std::vector<Point3f> const& points, std::vector<uint32_t>& w )
+   {
+      w.push_back(points.size());
+      for( size_t i = 0; i < points.size(); ++i )
+      {
+         w.push_back(FrameCodec::floatBits(points[i].x));
+         w.push_back(FrameCodec::floatBits(points[i].y));
+         w.push_back(FrameCodec::floatBits(points[i].z));
+      }
+   }
+
+   static void _putMarkers( RigidBody const& b, std::vector<uint32_t>& w )
+   {
+      size_t i;
+      _putPoints(b.markers(), w);
+      w.push_back(b.markerIds().size());
+      w.insert(w.end(), b.markerIds().begin(), b.markerIds().end());
+      w.push_back(b.markerSizes().size());
+      for( i = 0; i < b.markerSizes().size(); ++i )
+         w.push_back(FrameCodec::floatBits(b.markerSizes()[i]));
+   }
+
+   // Fill _words from every section of frame but the rigid body poses.
+   void _flatten( MocapFrame const& frame )
+   {
+      size_t i, j;
+      for( int k = 0; k < FrameCodec::NUM_SECTIONS; ++k )
+         _words[k].clear();
+
+      std::vector<uint32_t>& sets = _words[FrameCodec::MARKER_SETS];
+      for( i = 0; i < frame.markerSets().size(); ++i )
+      {
+         MarkerSet const& set = frame.markerSets()[i];
+         std::string const& name = set.name();
+         sets.push_back(name.size());
+         for( j = 0; j < name.size(); j += 4 )
+         {
+            uint32_t u = 0;
+            memcpy(&u, name.data() + j, std::min<size_t>(4, name.size() - j));
+            sets.push_back(u);
+         }
+         _putPoints(set.markers(), sets);
+      }
+
+      if( !frame.unIdMarkers().empty() )
+         _putPoints(frame.unIdMarkers(), _words[FrameCodec::UNID_MARKERS]);
+
+      // Bodies without markers are the common case; they leave the list
+      // empty rather than a count of 0 per body.
+      std::vector<RigidBody> const& bodies = frame.rigidBodies();
+      for( i = 0; i < bodies.size(); ++i )
+         if( !bodies[i].markers().empty() || !bodies[i].markerIds().empty() || !bodies[i].markerSizes().empty() )
+            break;
+      if( i < bodies.size() )
+         for( i = 0; i < bodies.size(); ++i )
+            _putMarkers(bodies[i], _words[FrameCodec::BODY_MARKERS]);
+
+      std::vector<uint32_t>& skel = _words[FrameCodec::SKELETONS];
+      for( i = 0; i < frame.skeletons().size(); ++i )
+      {
+         std::vector<RigidBody> const& bones = frame.skeletons()[i].rigidBodies();
+         skel.push_back(static_cast<uint32_t>(frame.skeletons()[i].id()));
+         skel.push_back(bones.size());
+         for( j = 0; j < bones.size(); ++j )
+         {
+            RigidBody const& b = bones[j];
+            skel.push_back(static_cast<uint32_t>(b.id()));
+            skel.push_back(FrameCodec::floatBits(b.location().x));
+            skel.push_back(FrameCodec::floatBits(b.location().y));
+            skel.push_back(FrameCodec::floatBits(b.location().z));
+            skel.push_back(FrameCodec::floatBits(b.orientation().qx));
+            skel.push_back(FrameCodec::floatBits(b.orientation().qy));
+            skel.push_back(FrameCodec::floatBits(b.orientation().qz));
+            skel.push_back(FrameCodec::floatBits(b.orientation().qw));
+            skel.push_back(FrameCodec::floatBits(b.meanMarkerError()));
+            skel.push_back(b.trackingValid() ? 1 : 0);
+            _putMarkers(b, skel);
+         }
+      }
+
+      std::vector<uint32_t>& labeled = _words[FrameCodec::LABELED_MARKERS];
+      for( i = 0; i < frame.labeledMarkers().size(); ++i )
+      {
+         LabeledMarker const& m = frame.labeledMarkers()[i];
+         labeled.push_back(static_cast<uint32_t>(m.id()));
+         labeled.push_back(FrameCodec::floatBits(m.location().x));
+         labeled.push_back(FrameCodec::floatBits(m.location().y));
+         labeled.push_back(FrameCodec::floatBits(m.location().z));
+         labeled.push_back(FrameCodec::floatBits(m.size()));
+      }
+   }
+
+   static void _put( std::vector<char>& out, uint32_t v, uint32_t& prev )
+   {
+      FrameCodec::putVarint(out, FrameCodec::zigzag32(v - prev));
+      prev = v;
+   }
+
+   void _encodeLossless( RigidBody const& b, FrameCodecState::Body& s, std::vector<char>& out )
+   {
+      Point3f p = b.location();
+      Quaternion4f q = b.orientation();
+      _put(out, FrameCodec::floatBits(p.x), s.p[0]);
+      _put(out, FrameCodec::floatBits(p.y), s.p[1]);
+      _put(out, FrameCodec::floatBits(p.z), s.p[2]);
+      _put(out, FrameCodec::floatBits(q.qx), s.q[0]);
+      _put(out, FrameCodec::floatBits(q.qy), s.q[1]);
+      _put(out, FrameCodec::floatBits(q.qz), s.q[2]);
+      _put(out, FrameCodec::floatBits(q.qw), s.q[3]);
+      _put(out, FrameCodec::floatBits(b.meanMarkerError()), s.err);
+   }
+
+   void _encodeLossy( RigidBody const& b, FrameCodecState::Body& s, std::vector<char>& out )
+   {
+      Point3f p = b.location();
+      Quaternion4f q = b.orientation();
+      float res = _codec.positionResolution;
+      _put(out, FrameCodec::quantize(p.x, res), s.p[0]);
+      _put(out, FrameCodec::quantize(p.y, res), s.p[1]);
+      _put(out, FrameCodec::quantize(p.z, res), s.p[2]);
+
+      // Smallest three: drop the largest component, made positive.
+      float c[4] = { q.qx, q.qy, q.qz, q.qw };
+      double norm = sqrt(static_cast<double>(c[0])*c[0] + c[1]*c[1] + c[2]*c[2] + c[3]*c[3]);
+      int largest = 3;
+      for( int k = 0; k < 3; ++k )
+         if( fabsf(c[k]) > fabsf(c[largest]) )
+            largest = k;
+      double scale = norm > 0.0 ? (c[largest] < 0.f ? -1.0 : 1.0)/norm : 0.0;
+      uint32_t steps = (1u << _codec.quaternionBits) - 1;
+      double bound = FrameCodec::smallestThreeBound();
+      uint32_t three[3];
+      for( int k = 0, j = 0; k < 4; ++k )
+      {
+         if( k == largest )
+            continue;
+         double v = (c[k]*scale + bound)/(2.0*bound)*steps;
+         v = v < 0.0 ? 0.0 : (v > steps ? steps : v);
+         three[j++] = static_cast<uint32_t>(v + 0.5);
+      }
+      // The index rides in the low bits of the first difference. A new
+      // index starts the components over from 0.
+      if( largest != s.quatIndex )
+      {
+         s.q[0] = s.q[1] = s.q[2] = 0;
+         s.quatIndex = largest;
+      }
+      FrameCodec::putVarint(out, (static_cast<uint64_t>(FrameCodec::zigzag32(three[0] - s.q[0])) << 2) | largest);
+      s.q[0] = three[0];
+      _put(out, three[1], s.q[1]);
+      _put(out, three[2], s.q[2]);
+
+      _put(out, FrameCodec::quantize(b.meanMarkerError(), _codec.errorResolution), s.err);
+   }
+};
+
+/*!
+ * \brief Decompresses frames written by FrameEncoder.
+ * \author Philip G. Lee
+ */
+class FrameDecoder
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param codec settings the frames were coded with
+    * \param nnMajor NatNet major version to give the decoded frames
+    * \param nnMinor NatNet minor version to give the decoded frames
+    */
+   FrameDecoder( FrameCodec const& codec=FrameCodec(), unsigned char nnMajor=0, unsigned char nnMinor=0 ) :
+      _codec(codec),
+      _nnMajor(nnMajor),
+      _nnMinor(nnMinor),
+      _state(),
+      _slots(),
+      _changes(),
+      _name()
+   {
+   }
+
+   //! \brief Decode the next frame as the first after FrameEncoder::reset().
+   void reset()
+   {
+      _state.reset();
+   }
+
+   /*!
+    * \brief Decode one frame.
+    *
+    * \param data start of the coded frame
+    * \param end end of the coded data
+    * \param frame receives the frame
+    * \param ts receives the time the frame was received
+    * \returns the start of the next frame, or 0 if the data is cut short
+    */
+   char const* decode( char const* data, char const* end, MocapFrame& frame, struct timespec& ts )
+   {
+      uint64_t v, n;
+      size_t i;
+
+      if( frame.nnMajor() != _nnMajor || frame.nnMinor() != _nnMinor )
+         frame = MocapFrame(_nnMajor, _nnMinor);
+
+      if( !FrameCodec::getVarint(data, end, v) )
+         return 0;
+      _state.frameNum += FrameCodec::unzigzag32(static_cast<uint32_t>(v)) + 1;
+      frame.setFrameNum(static_cast<int32_t>(_state.frameNum));
+
+      if( !FrameCodec::getVarint(data, end, v) )
+         return 0;
+      _state.timeDelta += FrameCodec::unzigzag(v);
+      _state.timeNs += _state.timeDelta;
+      int64_t timeNs = static_cast<int64_t>(_state.timeNs);
+      ts.tv_sec = static_cast<time_t>(timeNs/1000000000LL);
+      ts.tv_nsec = static_cast<long>(timeNs%1000000000LL);
+
+      if( !FrameCodec::getVarint(data, end, v) )
+         return 0;
+      _state.timecode += FrameCodec::unzigzag32(static_cast<uint32_t>(v));
+      if( !FrameCodec::getVarint(data, end, v) )
+         return 0;
+      _state.subframe += FrameCodec::unzigzag32(static_cast<uint32_t>(v));
+      frame.setTimecode(_state.timecode, _state.subframe);
+
+      if( !FrameCodec::getVarint(data, end, v) )
+         return 0;
+      _state.latency += FrameCodec::unzigzag32(static_cast<uint32_t>(v));
+      frame.setLatency(FrameCodec::bitsFloat(_state.latency));
+
+      if( !FrameCodec::getVarint(data, end, v) )
+         return 0;
+      _state.captureTimeDelta += FrameCodec::unzigzag(v);
+      _state.captureTime += _state.captureTimeDelta;
+      double t;
+      memcpy(&t, &_state.captureTime, 8);
+      frame.setCaptureTime(t);
+
+      if( !FrameCodec::getVarint(data, end, n) )
+         return 0;
+      if( n > 0 )
+      {
+         // More IDs than bytes left is corrupt.
+         if( n - 1 > static_cast<uint64_t>(end - data) )
+            return 0;
+         _state.layout.resize(n - 1);
+         uint32_t prev = 0;
+         for( i = 0; i < _state.layout.size(); ++i )
+         {
+            if( !FrameCodec::getVarint(data, end, v) )
+               return 0;
+            prev += FrameCodec::unzigzag32(static_cast<uint32_t>(v));
+            _state.layout[i] = static_cast<int32_t>(prev);
+         }
+      }
+
+      std::vector<RigidBody>& bodies = frame.rigidBodies();
+      size_t numBodies = _state.layout.size();
+      bodies.resize(numBodies);
+      _slots.resize(numBodies);
+      for( i = 0; i < numBodies; ++i )
+      {
+         _slots[i] = _state.body(_state.layout[i]);
+         bodies[i].setId(_state.layout[i]);
+      }
+
+      if( !FrameCodec::getVarint(data, end, n) )
+         return 0;
+      _changes.clear();
+      for( i = 0; n > 0; --n )
+      {
+         if( !FrameCodec::getVarint(data, end, v) || v >= numBodies - i )
+            return 0;
+         i += v;
+         _changes.push_back(i);
+         ++i;
+      }
+
+      // Flip the flags in order, as the encoder compared them.
+      size_t c = 0;
+      for( i = 0; i < numBodies; ++i )
+      {
+         if( c < _changes.size() && _changes[c] == i )
+         {
+            _slots[i]->valid ^= 1;
+            ++c;
+         }
+         bodies[i].setTrackingValid(_slots[i]->valid != 0);
+         bool ok = _codec.mode == FrameCodec::LOSSY
+            ? _decodeLossy(data, end, bodies[i], *_slots[i])
+            : _decodeLossless(data, end, bodies[i], *_slots[i]);
+         if( !ok )
+            return 0;
+      }
+
+      if( !FrameCodec::getVarint(data, end, v) )
+         return 0;
+      uint64_t mask = v;
+      for( int k = 0; k < FrameCodec::NUM_SECTIONS; ++k )
+      {
+         std::vector<uint32_t>& w = _state.words[k];
+         if( !(mask & (1u << k)) )
+         {
+            w.clear();
+            continue;
+         }
+         // More words than bytes left is corrupt. Words past the end of
+         // the last frame's list are differenced against 0.
+         if( !FrameCodec::getVarint(data, end, n) || n > static_cast<uint64_t>(end - data) )
+            return 0;
+         w.resize(n);
+         for( i = 0; i < w.size(); ++i )
+            if( !_get(data, end, w[i]) )
+               return 0;
+      }
+      if( !_unflatten(frame) )
+         return 0;
+      return data;
+   }
+
+private:
+
+   FrameCodec _codec;
+   unsigned char _nnMajor;
+   unsigned char _nnMinor;
+   FrameCodecState _state;
+   std::vector<FrameCodecState::Body*> _slots;
+   // Bodies whose validity changed in the frame being decoded.
+   std::vector<size_t> _changes;
+   std::string _name;
+
+   static bool _word( std::vector<uint32_t> const& w, size_t& pos, uint32_t& v )
+   {
+      if( pos >= w.size() )
+         return false;
+      v = w[pos++];
+      return true;
+   }
+
+   // A count of items of at least per words each, that fit in the rest of w.
+   static bool _count( std::vector<uint32_t> const& w, size_t& pos, size_t per, uint32_t& n )
+   {
+      return _word(w, pos, n) && n <= (w.size() - pos)/per;
+   }
+
+   static bool _getPoints( std::vector<uint32_t> const& w, size_t& pos, std::vector<Point3f>& points )
+   {
+      uint32_t n;
+      if( !_count(w, pos, 3, n) )
+         return false;
+      points.resize(n);
+      for( uint32_t i = 0; i < n; ++i, pos += 3 )
+         points[i] = Point3f(FrameCodec::bitsFloat(w[pos]), FrameCodec::bitsFloat(w[pos+1]), FrameCodec::bitsFloat(w[pos+2]));
+      return true;
+   }
+
+   static bool _getMarkers( std::vector<uint32_t> const& w, size_t& pos, RigidBody& b )
+   {
+      uint32_t n, i;
+      if( !_getPoints(w, pos, b.markers()) || !_count(w, pos, 1, n) )
+         return false;
+      b.markerIds().assign(w.begin() + pos, w.begin() + pos + n);
+      pos += n;
+      if( !_count(w, pos, 1, n) )
+         return false;
+      b.markerSizes().resize(n);
+      for( i = 0; i < n; ++i )
+         b.markerSizes()[i] = FrameCodec::bitsFloat(w[pos++]);
+      return true;
+   }
+
+   // Fill every section of frame but the rigid body poses from the word
+   // lists. Returns false if a list does not parse.
+   bool _unflatten( MocapFrame& frame )
+   {
+      size_t i, pos;
+      uint32_t n, v;
+
+      std::vector<uint32_t> const& sets = _state.words[FrameCodec::MARKER_SETS];
+      std::vector<MarkerSet>& markerSets = frame.markerSets();
+      for( i = 0, pos = 0; pos < sets.size(); ++i )
+      {
+         if( !_word(sets, pos, n) || (static_cast<uint64_t>(n) + 3)/4 > sets.size() - pos )
+            return false;
+         _name.resize(n);
+         for( uint32_t j = 0; j < n; j += 4 )
+            memcpy(&_name[j], &sets[pos++], std::min<uint32_t>(4, n - j));
+         if( i == markerSets.size() )
+            markerSets.push_back(MarkerSet());
+         markerSets[i].setName(_name);
+         if( !_getPoints(sets, pos, markerSets[i].markers()) )
+            return false;
+      }
+      markerSets.resize(i);
+
+      std::vector<uint32_t> const& unId = _state.words[FrameCodec::UNID_MARKERS];
+      pos = 0;
+      if( unId.empty() )
+         frame.unIdMarkers().clear();
+      else if( !_getPoints(unId, pos, frame.unIdMarkers()) || pos != unId.size() )
+         return false;
+
+      std::vector<uint32_t> const& markers = _state.words[FrameCodec::BODY_MARKERS];
+      std::vector<RigidBody>& bodies = frame.rigidBodies();
+      pos = 0;
+      for( i = 0; i < bodies.size(); ++i )
+      {
+         if( !markers.empty() )
+         {
+            if( !_getMarkers(markers, pos, bodies[i]) )
+               return false;
+            continue;
+         }
+         bodies[i].markers().clear();
+         bodies[i].markerIds().clear();
+         bodies[i].markerSizes().clear();
+      }
+      if( pos != markers.size() )
+         return false;
+
+      // A bone is at least 13 words: ID, pose, error, validity and three counts.
+      std::vector<uint32_t> const& skel = _state.words[FrameCodec::SKELETONS];
+      std::vector<Skeleton>& skeletons = frame.skeletons();
+      for( i = 0, pos = 0; pos < skel.size(); ++i )
+      {
+         if( !_word(skel, pos, v) || !_count(skel, pos, 13, n) )
+            return false;
+         if( i == skeletons.size() )
+            skeletons.push_back(Skeleton());
+         skeletons[i].setId(static_cast<int32_t>(v));
+         std::vector<RigidBody>& bones = skeletons[i].rigidBodies();
+         bones.resize(n);
+         for( uint32_t j = 0; j < n; ++j )
+         {
+            if( skel.size() - pos < 13 )
+               return false;
+            uint32_t const* u = &skel[pos];
+            RigidBody& b = bones[j];
+            b.setId(static_cast<int32_t>(u[0]));
+            b.setLocation(Point3f(FrameCodec::bitsFloat(u[1]), FrameCodec::bitsFloat(u[2]), FrameCodec::bitsFloat(u[3])));
+            b.setOrientation(Quaternion4f(FrameCodec::bitsFloat(u[4]), FrameCodec::bitsFloat(u[5]), FrameCodec::bitsFloat(u[6]), FrameCodec::bitsFloat(u[7])));
+            b.setMeanMarkerError(FrameCodec::bitsFloat(u[8]));
+            b.setTrackingValid(u[9] != 0);
+            pos += 10;
+            if( !_getMarkers(skel, pos, b) )
+               return false;
+         }
+      }
+      skeletons.resize(i);
+
+      std::vector<uint32_t> const& labeled = _state.words[FrameCodec::LABELED_MARKERS];
+      if( labeled.size() % 5 != 0 )
+         return false;
+      std::vector<LabeledMarker>& labeledMarkers = frame.labeledMarkers();
+      labeledMarkers.resize(labeled.size()/5);
+      for( i = 0, pos = 0; i < labeledMarkers.size(); ++i, pos += 5 )
+      {
+         LabeledMarker& m = labeledMarkers[i];
+         m.setId(static_cast<int32_t>(labeled[pos]));
+         m.setLocation(Point3f(FrameCodec::bitsFloat(labeled[pos+1]), FrameCodec::bitsFloat(labeled[pos+2]), FrameCodec::bitsFloat(labeled[pos+3])));
+         m.setSize(FrameCodec::bitsFloat(labeled[pos+4]));
+      }
+      return true;
+   }
+
+   static bool _get( char const*& data, char const* end, uint32_t& prev )
+   {
+      uint64_t v;
+      if( !FrameCodec::getVarint(data, end, v) )
+         return false;
+      prev += FrameCodec::unzigzag32(static_cast<uint32_t>(v));
+      return true;
+   }
+
+   static bool _decodeLossless( char const*& data, char const* end, RigidBody& b, FrameCodecState::Body& s )
+   {
+      for( int k = 0; k < 3; ++k )
+         if( !_get(data, end, s.p[k]) )
+            return false;
+      for( int k = 0; k < 4; ++k )
+         if( !_get(data, end, s.q[k]) )
+            return false;
+      if( !_get(data, end, s.err) )
+         return false;
+      b.setLocation(Point3f(FrameCodec::bitsFloat(s.p[0]), FrameCodec::bitsFloat(s.p[1]), FrameCodec::bitsFloat(s.p[2])));
+      b.setOrientation(Quaternion4f(FrameCodec::bitsFloat(s.q[0]), FrameCodec::bitsFloat(s.q[1]), FrameCodec::bitsFloat(s.q[2]), FrameCodec::bitsFloat(s.q[3])));
+      b.setMeanMarkerError(FrameCodec::bitsFloat(s.err));
+      return true;
+   }
+
+   bool _decodeLossy( char const*& data, char const* end, RigidBody& b, FrameCodecState::Body& s ) const
+   {
+      uint64_t v;
+      float res = _codec.positionResolution;
+      for( int k = 0; k < 3; ++k )
+         if( !_get(data, end, s.p[k]) )
+            return false;
+      b.setLocation(Point3f(FrameCodec::dequantize(s.p[0], res), FrameCodec::dequantize(s.p[1], res), FrameCodec::dequantize(s.p[2], res)));
+
+      if( !FrameCodec::getVarint(data, end, v) )
+         return false;
+      int largest = static_cast<int>(v & 3);
+      if( largest != s.quatIndex )
+      {
+         s.q[0] = s.q[1] = s.q[2] = 0;
+         s.quatIndex = largest;
+      }
+      s.q[0] += FrameCodec::unzigzag32(static_cast<uint32_t>(v >> 2));
+      if( !_get(data, end, s.q[1]) || !_get(data, end, s.q[2]) )
+         return false;
+
+      uint32_t steps = (1u << _codec.quaternionBits) - 1;
+      double bound = FrameCodec::smallestThreeBound();
+      float c[4];
+      double sum = 0.0;
+      for( int k = 0, j = 0; k < 4; ++k )
+      {
+         if( k == largest )
+            continue;
+         double x = static_cast<double>(s.q[j++])/steps*2.0*bound - bound;
+         c[k] = static_cast<float>(x);
+         sum += x*x;
+      }
+      c[largest] = static_cast<float>(sum < 1.0 ? sqrt(1.0 - sum) : 0.0);
+      b.setOrientation(Quaternion4f(c[0], c[1], c[2], c[3]));
+
+      if( !_get(data, end, s.err) )
+         return false;
+      b.setMeanMarkerError(FrameCodec::dequantize(s.err, _codec.errorResolution));
+      return true;
+   }
+};
+
+#endif /*FRAMECODEC_H*/
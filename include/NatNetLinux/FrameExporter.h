@@ -0,0 +1,1096 @@
+/*
+ * FrameExporter.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMEEXPORTER_H
+#define FRAMEEXPORTER_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameHandler.h>
+#include <NatNetLinux/BackgroundFileWriter.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*!
+ * \brief Growable character buffer with fast number formatting.
+ * \author Philip G. Lee
+ *
+ * Numbers are formatted directly into the buffer, without iostreams or
+ * locales; printf() is only used for values far outside the usual range.
+ * The buffer keeps its memory when clear()ed, so it can be reused for
+ * every frame without allocating.
+ */
+class TextBuffer
+{
+public:
+
+   //! \brief Constructor. Empty, with room for \c capacity bytes.
+   TextBuffer( size_t capacity=4096 ) :
+      _buf(capacity < 64 ? 64 : capacity),
+      _size(0)
+   {
+   }
+
+   //! \brief Make it empty, keeping the memory.
+   void clear() { _size = 0; }
+   //! \brief Number of bytes.
+   size_t size() const { return _size; }
+   //! \brief True if there are no bytes.
+   bool empty() const { return _size == 0; }
+   //! \brief The bytes. Not null-terminated.
+   char const* data() const { return &_buf[0]; }
+
+   //! \brief Keep only the first \c n bytes.
+   void truncate( size_t n )
+   {
+      if( n < _size )
+         _size = n;
+   }
+
+   //! \brief Append a character.
+   void append( char c )
+   {
+      *_grow(1) = c;
+      ++_size;
+   }
+
+   //! \brief Append \c n bytes.
+   void append( char const* s, size_t n )
+   {
+      memcpy(_grow(n), s, n);
+      _size += n;
+   }
+
+   //! \brief Append a null-terminated string.
+   void append( char const* s )
+   {
+      append(s, strlen(s));
+   }
+
+   //! \brief Append an integer in decimal.
+   void appendInt( int64_t v )
+   {
+      if( v < 0 )
+      {
+         append('-');
+         appendUInt(static_cast<uint64_t>(-(v + 1)) + 1);
+      }
+      else
+         appendUInt(static_cast<uint64_t>(v));
+   }
+
+   //! \brief Append an unsigned integer in decimal.
+   void appendUInt( uint64_t v )
+   {
+      char tmp[20];
+      int n = 0;
+      do
+      {
+         tmp[19 - n++] = static_cast<char>('0' + v%10);
+         v /= 10;
+      } while( v );
+      append(tmp + 20 - n, n);
+   }
+
+   /*!
+    * \brief Append \c v rounded to \c decimals digits after the point, like "%.*f".
+    *
+    * Unlike printf(), exact ties round away from zero and a value that
+    * rounds to zero has no sign.
+    *
+    * \param v value
+    * \param decimals digits after the point, from 0 to 9
+    */
+   void appendFixed( double v, int decimals )
+   {
+      if( decimals < 0 )
+         decimals = 0;
+      if( decimals > 9 )
+         decimals = 9;
+      double scaled = v*_pow10(decimals);
+      if( !finite(v) || fabs(scaled) >= 9e18 )
+      {
+         _printf("%.*f", decimals, v);
+         return;
+      }
+
+      int64_t m = static_cast<int64_t>(scaled < 0.0 ? scaled - 0.5 : scaled + 0.5);
+      if( m < 0 )
+      {
+         append('-');
+         m = -m;
+      }
+      uint64_t unit = static_cast<uint64_t>(_pow10(decimals));
+      appendUInt(static_cast<uint64_t>(m)/unit);
+      if( decimals == 0 )
+         return;
+      append('.');
+      char* p = _grow(decimals);
+      uint64_t frac = static_cast<uint64_t>(m)%unit;
+      for( int i = decimals - 1; i >= 0; --i )
+      {
+         p[i] = static_cast<char>('0' + frac%10);
+         frac /= 10;
+      }
+      _size += decimals;
+   }
+
+   /*!
+    * \brief Append \c v with the fewest significant digits that read back as \c v.
+    *
+    * Gives what trying "%.1g", "%.2g"... up to "%.9g" in turn would, and
+    * strtof() of the text is always \c v. Values from 1e-6 up to 1e16 are
+    * written without an exponent, e.g. 0.0125 or 1500.
+    */
+   void appendShortest( float v )
+   {
+      if( !finite(v) )
+      {
+         _printf("%g", static_cast<double>(v));
+         return;
+      }
+      if( v == 0.f )
+      {
+         append('0');
+         return;
+      }
+
+      char tmp[32];
+      double a = fabs(static_cast<double>(v));
+      if( a < 1e-12 || a >= 1e15 )
+      {
+         for( int p = 1; p <= 9; ++p )
+         {
+            snprintf(tmp, sizeof(tmp), "%.*g", p, static_cast<double>(v));
+            if( strtof(tmp, 0) == v )
+               break;
+         }
+         append(tmp);
+         return;
+      }
+
+      // Decimal exponent of the first digit, from the binary one.
+      uint64_t bits;
+      memcpy(&bits, &a, sizeof(bits));
+      int e = ((static_cast<int>(bits >> 52) & 0x7FF) - 1023)*1233 >> 12;
+      while( _pow10(e + 1) <= a )
+         ++e;
+      while( _pow10(e) > a )
+         --e;
+
+      for( int p = 1; p <= 9; ++p )
+      {
+         int ee = e;
+         uint64_t m = static_cast<uint64_t>(_scale(a, p - 1 - e) + 0.5);
+         if( m >= static_cast<uint64_t>(_pow10(p)) )
+         {
+            m /= 10;
+            ++ee;
+         }
+         // The digits read back as v unless the double nearest to them
+         // rounds to another float. It is exact up to 1e15 if ee >= p - 1,
+         // else rounded once, and that can only change the float if it
+         // lands exactly halfway between two; then let strtof() decide.
+         double d = _scale(static_cast<double>(m), ee - p + 1);
+         if( static_cast<float>(d) != static_cast<float>(a) )
+            continue;
+         int n = _digits(tmp, v < 0.f, m, p, ee);
+         memcpy(&bits, &d, sizeof(bits));
+         if( (bits & 0x1FFFFFFF) == 0x10000000 )
+         {
+            tmp[n] = '\0';
+            if( strtof(tmp, 0) != v )
+               continue;
+         }
+         append(tmp, n);
+         return;
+      }
+      _printf("%.9g", static_cast<double>(v));
+   }
+
+   //! \brief Append a time as seconds with 9 decimals, exactly.
+   void appendTime( struct timespec const& ts )
+   {
+      appendInt(ts.tv_sec);
+      append('.');
+      char* p = _grow(9);
+      long ns = ts.tv_nsec;
+      for( int i = 8; i >= 0; --i )
+      {
+         p[i] = static_cast<char>('0' + ns%10);
+         ns /= 10;
+      }
+      _size += 9;
+   }
+
+   //! \brief Append \c s as a quoted JSON string.
+   void appendJsonString( std::string const& s )
+   {
+      append('"');
+      for( size_t i = 0; i < s.size(); ++i )
+      {
+         unsigned char c = static_cast<unsigned char>(s[i]);
+         if( c == '"' || c == '\\' )
+         {
+            append('\\');
+            append(static_cast<char>(c));
+         }
+         else if( c < 0x20 )
+         {
+            char const* hex = "0123456789abcdef";
+            char u[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+            append(u, 6);
+         }
+         else
+            append(static_cast<char>(c));
+      }
+      append('"');
+   }
+
+   //! \brief Append \c s as a CSV field, quoted only if it has to be.
+   void appendCsvField( std::string const& s )
+   {
+      if( s.find_first_of(",\"\r\n") == std::string::npos )
+      {
+         append(s.data(), s.size());
+         return;
+      }
+      append('"');
+      for( size_t i = 0; i < s.size(); ++i )
+      {
+         if( s[i] == '"' )
+            append('"');
+         append(s[i]);
+      }
+      append('"');
+   }
+
+   //! \brief True unless \c v is infinite or NaN.
+   static bool finite( double v )
+   {
+      return v - v == 0.0;
+   }
+
+private:
+
+   std::vector<char> _buf;
+   size_t _size;
+
+   // Pointer to room for n more bytes, which are not counted yet.
+   char* _grow( size_t n )
+   {
+      if( _size + n > _buf.size() )
+         _buf.resize(std::max(2*_buf.size(), _size + n));
+      return &_buf[_size];
+   }
+
+   void _printf( char const* format, int decimals, double v )
+   {
+      char tmp[512];
+      int n = snprintf(tmp, sizeof(tmp), format, decimals, v);
+      append(tmp, std::min(static_cast<size_t>(n), sizeof(tmp) - 1));
+   }
+
+   void _printf( char const* format, double v )
+   {
+      char tmp[512];
+      int n = snprintf(tmp, sizeof(tmp), format, v);
+      append(tmp, std::min(static_cast<size_t>(n), sizeof(tmp) - 1));
+   }
+
+   // 10^e, exact for |e| <= 22.
+   static double _pow10( int e )
+   {
+      static double const table[] = {
+         1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+         1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+      };
+      int k = e < 0 ? -e : e;
+      if( k > 22 )
+         return pow(10.0, e);
+      return e < 0 ? 1.0/table[k] : table[k];
+   }
+
+   // v times 10^e, with one rounding while 10^|e| is exact.
+   static double _scale( double v, int e )
+   {
+      return e >= 0 ? v*_pow10(e) : v/_pow10(-e);
+   }
+
+   // Write m, which has p significant digits and the first at 10^e, to out.
+   static int _digits( char* out, bool negative, uint64_t m, int p, int e )
+   {
+      char d[10];
+      int n = 0;
+
+      while( p > 1 && m%10 == 0 )
+      {
+         m /= 10;
+         --p;
+      }
+      for( int i = p - 1; i >= 0; --i )
+      {
+         d[i] = static_cast<char>('0' + m%10);
+         m /= 10;
+      }
+
+      if( negative )
+         out[n++] = '-';
+      if( e < -6 || e >= 16 )
+      {
+         // d.ddde-XX
+         out[n++] = d[0];
+         if( p > 1 )
+         {
+            out[n++] = '.';
+            memcpy(out + n, d + 1, p - 1);
+            n += p - 1;
+         }
+         n += sprintf(out + n, "e%+03d", e);
+      }
+      else if( e < 0 )
+      {
+         out[n++] = '0';
+         out[n++] = '.';
+         for( int i = -1; i > e; --i )
+            out[n++] = '0';
+         memcpy(out + n, d, p);
+         n += p;
+      }
+      else if( e >= p - 1 )
+      {
+         memcpy(out + n, d, p);
+         n += p;
+         for( int i = p - 1; i < e; ++i )
+            out[n++] = '0';
+      }
+      else
+      {
+         memcpy(out + n, d, e + 1);
+         n += e + 1;
+         out[n++] = '.';
+         memcpy(out + n, d + e + 1, p - e - 1);
+         n += p - e - 1;
+      }
+      return n;
+   }
+};
+
+/*!
+ * \brief Counters of a FrameExporter.
+ * \author Philip G. Lee
+ */
+class ExportStats
+{
+public:
+
+   //! \brief Default constructor. All zero.
+   ExportStats() :
+      frames(0),
+      bytes(0),
+      dropped(0),
+      writeErrors(0)
+   {
+   }
+
+   //! \brief Frames formatted.
+   uint64_t frames;
+   //! \brief Bytes written.
+   uint64_t bytes;
+   //! \brief Frames dropped because the writer fell behind.
+   uint64_t dropped;
+   //! \brief Failed writes. The text of a failed write is lost.
+   uint64_t writeErrors;
+};
+
+/*!
+ * \brief Writes frames as CSV or JSON lines.
+ * \author Philip G. Lee
+ *
+ * Register with \c FrameListener::addHandler() to export every frame, or
+ * call format() to get the text of one. Every section of the frame can be
+ * exported: marker sets, unidentified markers, rigid bodies, skeletons and
+ * labeled markers, along with the frame number, receive time, latency,
+ * timecode and capture time. setSections() and setColumns() pick which.
+ *
+ * CSV has one row per marker or body, with the frame's columns repeated
+ * on each, and a header row naming the columns. Columns that do not apply
+ * to a row, e.g. the orientation of a marker, are left empty:
+ *
+ * \code
+ * frame,time,latency,timecode,subframe,capture_time,section,parent,id,name,x,y,z,qx,qy,qz,qw,error,valid,size
+ * \endcode
+ *
+ * \c section is one of \c marker_set, \c unidentified_marker,
+ * \c rigid_body, \c skeleton_body and \c labeled_marker. \c parent is the
+ * skeleton of a skeleton body, and \c name the marker set of a marker,
+ * whose \c id is its index in the set.
+ *
+ * JSON lines have one object per frame, e.g. with only rigid bodies:
+ *
+ * \code
+ * {"frame":1201,"time":1700000000.004166667,"rigidBodies":[{"id":1,"position":[0.5,1.25,-0.125],"orientation":[0,0,0,1],"error":0.0001,"valid":true}]}
+ * \endcode
+ *
+ * Floats are written with a fixed number of decimals, or with the fewest
+ * digits that read back exactly (see TextBuffer::appendShortest()). In
+ * JSON, infinite and NaN values are written as null.
+ *
+ * Text is formatted into a large buffer under a mutex, which costs a few
+ * microseconds for a frame of 200 bodies. A background thread polls for
+ * full buffers every pollInterval() seconds and writes them, and writes a
+ * partly filled buffer after \c flushInterval seconds, so slow streams are
+ * not held back. If the output falls behind until \c maxBuffers buffers
+ * are queued, frames are dropped and counted rather than delaying the
+ * listener, unless setBlocking() is on.
+ */
+class FrameExporter : public FrameHandler, public BackgroundFileWriter<TextBuffer>
+{
+public:
+
+   //! \brief Output format.
+   enum Format
+   {
+      CSV,
+      JSON_LINES
+   };
+
+   //! \brief Formatting of floats.
+   enum FloatFormat
+   {
+      //! A fixed number of decimals. See setFloatFormat().
+      FIXED,
+      //! The fewest digits that read back as the same float.
+      SHORTEST
+   };
+
+   //! \brief Sections of a frame, to combine with |.
+   enum Section
+   {
+      MARKER_SETS          = 0x01,
+      UNIDENTIFIED_MARKERS = 0x02,
+      RIGID_BODIES         = 0x04,
+      SKELETONS            = 0x08,
+      LABELED_MARKERS      = 0x10,
+      ALL_SECTIONS         = 0x1F
+   };
+
+   //! \brief Columns, or JSON fields, to combine with |.
+   enum Column
+   {
+      FRAME_NUM    = 0x001,
+      TIME         = 0x002,
+      LATENCY      = 0x004,
+      //! Timecode and subframe.
+      TIMECODE     = 0x008,
+      CAPTURE_TIME = 0x010,
+      //! ID, and parent in CSV.
+      ID           = 0x020,
+      NAME         = 0x040,
+      POSITION     = 0x080,
+      ORIENTATION  = 0x100,
+      MARKER_ERROR = 0x200,
+      VALID        = 0x400,
+      SIZE         = 0x800,
+      ALL_COLUMNS  = 0xFFF
+   };
+
+   /*!
+    * \brief Constructor
+    *
+    * \param fd file descriptor to write to, e.g. of a file or \c STDOUT_FILENO.
+    *    Not closed.
+    * \param format output format
+    * \param bufferBytes text to accumulate before writing it
+    * \param maxBuffers buffers that may be queued for writing
+    * \param flushInterval seconds after which a partly filled buffer is written
+    */
+   FrameExporter(
+      int fd,
+      Format format=CSV,
+      size_t bufferBytes=1<<20,
+      size_t maxBuffers=8,
+      double flushInterval=0.5
+   ) :
+      BackgroundFileWriter<TextBuffer>(maxBuffers, flushInterval),
+      _fd(fd),
+      _format(format),
+      _floatFormat(FIXED),
+      _decimals(6),
+      _sections(ALL_SECTIONS),
+      _columns(ALL_COLUMNS),
+      _bufferBytes(bufferBytes < 4096 ? 4096 : bufferBytes),
+      _blocking(false),
+      _headerDone(false),
+      _stats(),
+      _prefix(256)
+   {
+   }
+
+   ~FrameExporter()
+   {
+      if( running() )
+         stop();
+      join();
+   }
+
+   /*!
+    * \brief Floats with \c decimals digits after the point, or the shortest that read back.
+    *
+    * The default is FIXED with 6 decimals, i.e. micrometers for positions.
+    * Set before start().
+    */
+   void setFloatFormat( FloatFormat f, int decimals=6 )
+   {
+      _floatFormat = f;
+      _decimals = decimals;
+   }
+
+   //! \brief Sections to export, e.g. \c RIGID_BODIES|SKELETONS. All by default. Set before start().
+   void setSections( unsigned int sections ) { _sections = sections; }
+
+   //! \brief Columns to export, e.g. \c FRAME_NUM|ID|POSITION. All by default. Set before start().
+   void setColumns( unsigned int columns ) { _columns = columns; }
+
+   /*!
+    * \brief If true, handleFrame() waits for the output instead of dropping frames.
+    *
+    * For offline conversion, where every frame must be kept. False by
+    * default. Set before start().
+    */
+   void setBlocking( bool blocking ) { _blocking = blocking; }
+
+   //! \brief Start writing in a new thread. Non-blocking.
+   void start()
+   {
+      if( _fill )
+         return;
+      _startThread();
+   }
+
+   /*!
+    * \brief Format a frame. Thread-safe.
+    *
+    * Never waits for the disk, unless setBlocking() is on.
+    */
+   virtual void handleFrame( MocapFrame const& frame, struct timespec const& ts )
+   {
+      boost::unique_lock<boost::mutex> lock(_mutex);
+
+      // A buffer left full because none was free is queued first.
+      while( _run && _fill->size() >= _bufferBytes && !_queueFill() )
+      {
+         if( !_blocking )
+         {
+            ++_stats.dropped;
+            return;
+         }
+         _waitForRoom(lock);
+      }
+      if( !_run )
+         return;
+      if( !_headerDone )
+      {
+         header(*_fill);
+         _headerDone = true;
+      }
+      format(frame, ts, *_fill);
+      ++_stats.frames;
+
+      if( _fill->size() >= _bufferBytes )
+         _queueFill();
+   }
+
+   //! \brief Counters so far. Thread-safe.
+   ExportStats stats() const
+   {
+      _mutex.lock();
+         ExportStats ret = _stats;
+      _mutex.unlock();
+      return ret;
+   }
+
+   //! \brief Append the CSV header row to \c out. Nothing for JSON lines.
+   void header( TextBuffer& out ) const
+   {
+      if( _format != CSV )
+         return;
+
+      _csvName(out, FRAME_NUM, "frame");
+      _csvName(out, TIME, "time");
+      _csvName(out, LATENCY, "latency");
+      _csvName(out, TIMECODE, "timecode,subframe");
+      _csvName(out, CAPTURE_TIME, "capture_time");
+      out.append("section,");
+      _csvName(out, ID, "parent,id");
+      _csvName(out, NAME, "name");
+      _csvName(out, POSITION, "x,y,z");
+      _csvName(out, ORIENTATION, "qx,qy,qz,qw");
+      _csvName(out, MARKER_ERROR, "error");
+      _csvName(out, VALID, "valid");
+      _csvName(out, SIZE, "size");
+      // Replace the comma after the last name.
+      out.truncate(out.size() - 1);
+      out.append('\n');
+   }
+
+   /*!
+    * \brief Append the text of a frame received at \c ts to \c out.
+    *
+    * Uses a scratch buffer of the exporter, so do not call it while the
+    * exporter is running.
+    */
+   void format( MocapFrame const& frame, struct timespec const& ts, TextBuffer& out ) const
+   {
+      if( _format == CSV )
+         _csvFrame(frame, ts, out);
+      else
+         _jsonFrame(frame, ts, out);
+   }
+
+private:
+
+   int _fd;
+   Format _format;
+   FloatFormat _floatFormat;
+   int _decimals;
+   unsigned int _sections;
+   unsigned int _columns;
+   size_t _bufferBytes;
+   bool _blocking;
+
+   // Guarded by _mutex.
+   bool _headerDone;
+   ExportStats _stats;
+   // The CSV columns of the current frame, repeated on every row.
+   mutable TextBuffer _prefix;
+
+   bool _has( unsigned int column ) const { return (_columns & column) != 0; }
+
+   // Room for a frame of text past _bufferBytes without reallocating.
+   virtual TextBuffer* _newBuffer()
+   {
+      return new TextBuffer(_bufferBytes + (_bufferBytes >> 2));
+   }
+
+   void _float( TextBuffer& out, float v ) const
+   {
+      if( _format == JSON_LINES && !TextBuffer::finite(v) )
+         out.append("null", 4);
+      else if( _floatFormat == SHORTEST )
+         out.appendShortest(v);
+      else
+         out.appendFixed(v, _decimals);
+   }
+
+   void _csvName( TextBuffer& out, unsigned int column, char const* names ) const
+   {
+      if( !_has(column) )
+         return;
+      out.append(names);
+      out.append(',');
+   }
+
+   // Write column values or empty fields, each followed by a comma.
+   void _csvFloats( TextBuffer& out, unsigned int column, float const* v, int n ) const
+   {
+      if( !_has(column) )
+         return;
+      for( int i = 0; i < n; ++i )
+      {
+         if( v )
+            _float(out, v[i]);
+         out.append(',');
+      }
+   }
+
+   // The frame's columns and section of a CSV row, up to the parent.
+   void _csvStart( TextBuffer& out, TextBuffer const& prefix, char const* section ) const
+   {
+      out.append(prefix.data(), prefix.size());
+      out.append(section);
+      out.append(',');
+   }
+
+   // End a CSV row, replacing the comma after its last field.
+   static void _csvEnd( TextBuffer& out )
+   {
+      out.truncate(out.size() - 1);
+      out.append('\n');
+   }
+
+   void _csvBody( TextBuffer& out, TextBuffer const& prefix, char const* section, int parent, RigidBody const& b ) const
+   {
+      _csvStart(out, prefix, section);
+      if( _has(ID) )
+      {
+         if( parent >= 0 )
+            out.appendInt(parent);
+         out.append(',');
+         out.appendInt(b.id());
+         out.append(',');
+      }
+      if( _has(NAME) )
+         out.append(',');
+      Point3f p = b.location();
+      Quaternion4f q = b.orientation();
+      float pv[3] = { p.x, p.y, p.z };
+      float qv[4] = { q.qx, q.qy, q.qz, q.qw };
+      float e = b.meanMarkerError();
+      _csvFloats(out, POSITION, pv, 3);
+      _csvFloats(out, ORIENTATION, qv, 4);
+      _csvFloats(out, MARKER_ERROR, &e, 1);
+      if( _has(VALID) )
+      {
+         out.append(b.trackingValid() ? '1' : '0');
+         out.append(',');
+      }
+      if( _has(SIZE) )
+         out.append(',');
+      _csvEnd(out);
+   }
+
+   void _csvMarker( TextBuffer& out, TextBuffer const& prefix, char const* section, int id, std::string const* name, Point3f const& p, float const* size ) const
+   {
+      _csvStart(out, prefix, section);
+      if( _has(ID) )
+      {
+         out.append(',');
+         out.appendInt(id);
+         out.append(',');
+      }
+      if( _has(NAME) )
+      {
+         if( name )
+            out.appendCsvField(*name);
+         out.append(',');
+      }
+      float pv[3] = { p.x, p.y, p.z };
+      _csvFloats(out, POSITION, pv, 3);
+      _csvFloats(out, ORIENTATION, 0, 4);
+      _csvFloats(out, MARKER_ERROR, 0, 1);
+      if( _has(VALID) )
+         out.append(',');
+      _csvFloats(out, SIZE, size, 1);
+      _csvEnd(out);
+   }
+
+   void _csvFrame( MocapFrame const& frame, struct timespec const& ts, TextBuffer& out ) const
+   {
+      TextBuffer& prefix = _prefix;
+      prefix.clear();
+      uint32_t timecode, subframe;
+      frame.timecode(timecode, subframe);
+      if( _has(FRAME_NUM) )
+      {
+         prefix.appendInt(frame.frameNum());
+         prefix.append(',');
+      }
+      if( _has(TIME) )
+      {
+         prefix.appendTime(ts);
+         prefix.append(',');
+      }
+      if( _has(LATENCY) )
+      {
+         _float(prefix, frame.latency());
+         prefix.append(',');
+      }
+      if( _has(TIMECODE) )
+      {
+         prefix.appendUInt(timecode);
+         prefix.append(',');
+         prefix.appendUInt(subframe);
+         prefix.append(',');
+      }
+      if( _has(CAPTURE_TIME) )
+      {
+         prefix.appendFixed(frame.captureTime(), 6);
+         prefix.append(',');
+      }
+
+      size_t i, j;
+      if( _sections & MARKER_SETS )
+      {
+         std::vector<MarkerSet> const& sets = frame.markerSets();
+         for( i = 0; i < sets.size(); ++i )
+            for( j = 0; j < sets[i].markers().size(); ++j )
+               _csvMarker(out, prefix, "marker_set", static_cast<int>(j), &sets[i].name(), sets[i].markers()[j], 0);
+      }
+      if( _sections & UNIDENTIFIED_MARKERS )
+      {
+         std::vector<Point3f> const& markers = frame.unIdMarkers();
+         for( i = 0; i < markers.size(); ++i )
+            _csvMarker(out, prefix, "unidentified_marker", static_cast<int>(i), 0, markers[i], 0);
+      }
+      if( _sections & RIGID_BODIES )
+      {
+         std::vector<RigidBody> const& bodies = frame.rigidBodies();
+         for( i = 0; i < bodies.size(); ++i )
+            _csvBody(out, prefix, "rigid_body", -1, bodies[i]);
+      }
+      if( _sections & SKELETONS )
+      {
+         std::vector<Skeleton> const& skeletons = frame.skeletons();
+         for( i = 0; i < skeletons.size(); ++i )
+            for( j = 0; j < skeletons[i].rigidBodies().size(); ++j )
+               _csvBody(out, prefix, "skeleton_body", skeletons[i].id(), skeletons[i].rigidBodies()[j]);
+      }
+      if( _sections & LABELED_MARKERS )
+      {
+         std::vector<LabeledMarker> const& markers = frame.labeledMarkers();
+         for( i = 0; i < markers.size(); ++i )
+         {
+            float size = markers[i].size();
+            _csvMarker(out, prefix, "labeled_marker", markers[i].id(), 0, markers[i].location(), &size);
+         }
+      }
+   }
+
+   // "name":, preceded by a comma unless first.
+   static void _jsonKey( TextBuffer& out, bool& first, char const* name )
+   {
+      if( !first )
+         out.append(',');
+      first = false;
+      out.append('"');
+      out.append(name);
+      out.append("\":", 2);
+   }
+
+   void _jsonPoint( TextBuffer& out, Point3f const& p ) const
+   {
+      out.append('[');
+      _float(out, p.x);
+      out.append(',');
+      _float(out, p.y);
+      out.append(',');
+      _float(out, p.z);
+      out.append(']');
+   }
+
+   void _jsonBody( TextBuffer& out, RigidBody const& b ) const
+   {
+      bool first = true;
+      out.append('{');
+      if( _has(ID) )
+      {
+         _jsonKey(out, first, "id");
+         out.appendInt(b.id());
+      }
+      if( _has(POSITION) )
+      {
+         _jsonKey(out, first, "position");
+         _jsonPoint(out, b.location());
+      }
+      if( _has(ORIENTATION) )
+      {
+         Quaternion4f q = b.orientation();
+         _jsonKey(out, first, "orientation");
+         out.append('[');
+         _float(out, q.qx);
+         out.append(',');
+         _float(out, q.qy);
+         out.append(',');
+         _float(out, q.qz);
+         out.append(',');
+         _float(out, q.qw);
+         out.append(']');
+      }
+      if( _has(MARKER_ERROR) )
+      {
+         _jsonKey(out, first, "error");
+         _float(out, b.meanMarkerError());
+      }
+      if( _has(VALID) )
+      {
+         _jsonKey(out, first, "valid");
+         out.append(b.trackingValid() ? "true" : "false");
+      }
+      out.append('}');
+   }
+
+   void _jsonBodies( TextBuffer& out, std::vector<RigidBody> const& bodies ) const
+   {
+      out.append('[');
+      for( size_t i = 0; i < bodies.size(); ++i )
+      {
+         if( i > 0 )
+            out.append(',');
+         _jsonBody(out, bodies[i]);
+      }
+      out.append(']');
+   }
+
+   void _jsonPoints( TextBuffer& out, std::vector<Point3f> const& points ) const
+   {
+      out.append('[');
+      for( size_t i = 0; i < points.size(); ++i )
+      {
+         if( i > 0 )
+            out.append(',');
+         _jsonPoint(out, points[i]);
+      }
+      out.append(']');
+   }
+
+   void _jsonFrame( MocapFrame const& frame, struct timespec const& ts, TextBuffer& out ) const
+   {
+      bool first = true;
+      size_t i;
+
+      out.append('{');
+      if( _has(FRAME_NUM) )
+      {
+         _jsonKey(out, first, "frame");
+         out.appendInt(frame.frameNum());
+      }
+      if( _has(TIME) )
+      {
+         _jsonKey(out, first, "time");
+         out.appendTime(ts);
+      }
+      if( _has(LATENCY) )
+      {
+         _jsonKey(out, first, "latency");
+         _float(out, frame.latency());
+      }
+      if( _has(TIMECODE) )
+      {
+         uint32_t timecode, subframe;
+         frame.timecode(timecode, subframe);
+         _jsonKey(out, first, "timecode");
+         out.appendUInt(timecode);
+         _jsonKey(out, first, "subframe");
+         out.appendUInt(subframe);
+      }
+      if( _has(CAPTURE_TIME) )
+      {
+         _jsonKey(out, first, "captureTime");
+         out.appendFixed(frame.captureTime(), 6);
+      }
+
+      if( _sections & MARKER_SETS )
+      {
+         std::vector<MarkerSet> const& sets = frame.markerSets();
+         _jsonKey(out, first, "markerSets");
+         out.append('[');
+         for( i = 0; i < sets.size(); ++i )
+         {
+            bool firstField = true;
+            if( i > 0 )
+               out.append(',');
+            out.append('{');
+            if( _has(NAME) )
+            {
+               _jsonKey(out, firstField, "name");
+               out.appendJsonString(sets[i].name());
+            }
+            if( _has(POSITION) )
+            {
+               _jsonKey(out, firstField, "markers");
+               _jsonPoints(out, sets[i].markers());
+            }
+            out.append('}');
+         }
+         out.append(']');
+      }
+      if( (_sections & UNIDENTIFIED_MARKERS) && _has(POSITION) )
+      {
+         _jsonKey(out, first, "unidentifiedMarkers");
+         _jsonPoints(out, frame.unIdMarkers());
+      }
+      if( _sections & RIGID_BODIES )
+      {
+         _jsonKey(out, first, "rigidBodies");
+         _jsonBodies(out, frame.rigidBodies());
+      }
+      if( _sections & SKELETONS )
+      {
+         std::vector<Skeleton> const& skeletons = frame.skeletons();
+         _jsonKey(out, first, "skeletons");
+         out.append('[');
+         for( i = 0; i < skeletons.size(); ++i )
+         {
+            bool firstField = true;
+            if( i > 0 )
+               out.append(',');
+            out.append('{');
+            if( _has(ID) )
+            {
+               _jsonKey(out, firstField, "id");
+               out.appendInt(skeletons[i].id());
+            }
+            _jsonKey(out, firstField, "rigidBodies");
+            _jsonBodies(out, skeletons[i].rigidBodies());
+            out.append('}');
+         }
+         out.append(']');
+      }
+      if( _sections & LABELED_MARKERS )
+      {
+         std::vector<LabeledMarker> const& markers = frame.labeledMarkers();
+         _jsonKey(out, first, "labeledMarkers");
+         out.append('[');
+         for( i = 0; i < markers.size(); ++i )
+         {
+            bool firstField = true;
+            if( i > 0 )
+               out.append(',');
+            out.append('{');
+            if( _has(ID) )
+            {
+               _jsonKey(out, firstField, "id");
+               out.appendInt(markers[i].id());
+            }
+            if( _has(POSITION) )
+            {
+               _jsonKey(out, firstField, "position");
+               _jsonPoint(out, markers[i].location());
+            }
+            if( _has(SIZE) )
+            {
+               _jsonKey(out, firstField, "size");
+               _float(out, markers[i].size());
+            }
+            out.append('}');
+         }
+         out.append(']');
+      }
+      out.append("}\n", 2);
+   }
+
+   virtual void _writeBuffer( TextBuffer& b )
+   {
+      bool ok = writeAll(_fd, b.data(), b.size());
+      _mutex.lock();
+      if( ok )
+         _stats.bytes += b.size();
+      else
+         ++_stats.writeErrors;
+      _mutex.unlock();
+   }
+};
+
+#endif /*FRAMEEXPORTER_H*/
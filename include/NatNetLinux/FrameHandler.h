@@ -0,0 +1,58 @@
+/*
+ * FrameHandler.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMEHANDLER_H
+#define FRAMEHANDLER_H
+
+#include <NatNetLinux/NatNet.h>
+#include <time.h>
+
+/*!
+ * \brief Interface for processing stages that see every frame.
+ * \author Philip G. Lee
+ *
+ * Register an implementation with \c FrameListener::addHandler(). The
+ * listener calls handleFrame() from its own thread for every frame it
+ * receives, after any FrameTransform and before the frame is buffered for
+ * \c FrameListener::pop(). Because consumers may skip frames when they pop,
+ * this is the place for anything that must not miss one.
+ *
+ * Keep handleFrame() short: it delays delivery of the frame to consumers.
+ * It may query or configure its listener, e.g. with
+ * \c FrameListener::sequenceStats() or \c FrameListener::setTransform(),
+ * but must not add or remove handlers, call
+ * \c FrameListener::setReorderBuffer() or inject frames, which would
+ * deadlock.
+ */
+class FrameHandler
+{
+public:
+
+   virtual ~FrameHandler(){}
+
+   /*!
+    * \brief Process one frame.
+    *
+    * \param frame the frame just received
+    * \param ts the time at which the frame was read from the socket, from
+    *    \c clock_gettime( \c CLOCK_REALTIME, ...)
+    */
+   virtual void handleFrame( MocapFrame const& frame, struct timespec const& ts ) = 0;
+};
+
+#endif /*FRAMEHANDLER_H*/
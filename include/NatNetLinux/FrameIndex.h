@@ -0,0 +1,410 @@
+/*
+ * FrameIndex.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMEINDEX_H
+#define FRAMEINDEX_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameHandler.h>
+#include <NatNetLinux/PoseBatch.h>
+#include <NatNetLinux/SpatialHash.h>
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <vector>
+
+/*!
+ * \brief Where a point in an IndexedFrame came from.
+ * \author Philip G. Lee
+ */
+class IndexedPoint
+{
+public:
+
+   //! \brief Kinds of points. Bit flags, so they can be combined into masks.
+   enum Kind
+   {
+      //! \brief owner is the index in MocapFrame::markerSets(), index the marker.
+      MARKER_SET_MARKER   = 1,
+      //! \brief owner is the RigidBody::id(), index the marker.
+      RIGID_BODY_MARKER   = 2,
+      //! \brief owner is -1, index is the index in MocapFrame::unIdMarkers().
+      UNIDENTIFIED_MARKER = 4,
+      //! \brief owner is the LabeledMarker::id(), index is -1.
+      LABELED_MARKER      = 8,
+      //! \brief owner is the RigidBody::id(), index is -1. Valid bodies only.
+      RIGID_BODY          = 16,
+      //! \brief owner is the Skeleton::id(), index the bone's RigidBody::id(). Valid bones only.
+      SKELETON_BODY       = 32,
+      //! \brief All of the above.
+      ALL                 = 63
+   };
+
+   //! \brief Default constructor
+   IndexedPoint( Kind k=UNIDENTIFIED_MARKER, int o=-1, int i=-1 ) :
+      kind(k),
+      owner(o),
+      index(i)
+   {
+   }
+
+   //! \brief Kind of point.
+   Kind kind;
+   //! \brief Owning marker set, body or skeleton. See Kind.
+   int owner;
+   //! \brief Index within the owner. See Kind.
+   int index;
+
+   //! \brief Same kind, owner and index.
+   bool operator==( IndexedPoint const& other ) const
+   {
+      return kind == other.kind && owner == other.owner && index == other.index;
+   }
+
+   //! \brief Ordering by kind, then owner, then index.
+   bool operator<( IndexedPoint const& other ) const
+   {
+      if( kind != other.kind )
+         return kind < other.kind;
+      if( owner != other.owner )
+         return owner < other.owner;
+      return index < other.index;
+   }
+};
+
+/*!
+ * \brief All the positions in one frame, with a spatial index over them.
+ * \author Philip G. Lee
+ *
+ * Produced by FrameIndex. Immutable once published, so any number of
+ * threads can query it without locking. Query results are indices into
+ * location() and point().
+ */
+class IndexedFrame
+{
+public:
+
+   //! \brief Constructor
+   IndexedFrame( float cellSize=0.05f ) :
+      _frameNum(0),
+      _time(0.0),
+      _points(),
+      _info(),
+      _hash(cellSize)
+   {
+   }
+
+   //! \brief MocapFrame::frameNum() of the frame.
+   int frameNum() const { return _frameNum; }
+   //! \brief Arrival time of the frame in seconds.
+   double time() const { return _time; }
+   //! \brief Number of points indexed.
+   size_t size() const { return _info.size(); }
+   //! \brief Location of point \c i.
+   Point3f location( size_t i ) const { return _points.get(i); }
+   //! \brief Origin of point \c i.
+   IndexedPoint const& point( size_t i ) const { return _info[i]; }
+   //! \brief All locations.
+   PointArray const& locations() const { return _points; }
+   //! \brief The underlying spatial hash.
+   SpatialHash const& hash() const { return _hash; }
+
+   /*!
+    * \brief Collect the positions of the given kinds from a frame.
+    *
+    * \param frame frame to read
+    * \param kinds mask of IndexedPoint::Kind to collect
+    * \param points output locations. Cleared first.
+    * \param info output origins, parallel to \c points. Cleared first.
+    */
+   static void gather( MocapFrame const& frame, unsigned int kinds, PointArray& points, std::vector<IndexedPoint>& info )
+   {
+      size_t i, j;
+
+      points.clear();
+      info.clear();
+
+      if( kinds & IndexedPoint::MARKER_SET_MARKER )
+      {
+         std::vector<MarkerSet> const& sets = frame.markerSets();
+         for( i = 0; i < sets.size(); ++i )
+            for( j = 0; j < sets[i].markers().size(); ++j )
+               _add(points, info, sets[i].markers()[j], IndexedPoint::MARKER_SET_MARKER, static_cast<int>(i), static_cast<int>(j));
+      }
+
+      std::vector<RigidBody> const& bodies = frame.rigidBodies();
+      for( i = 0; i < bodies.size(); ++i )
+      {
+         if( kinds & IndexedPoint::RIGID_BODY_MARKER )
+            for( j = 0; j < bodies[i].markers().size(); ++j )
+               _add(points, info, bodies[i].markers()[j], IndexedPoint::RIGID_BODY_MARKER, bodies[i].id(), static_cast<int>(j));
+         if( (kinds & IndexedPoint::RIGID_BODY) && bodies[i].trackingValid() )
+            _add(points, info, bodies[i].location(), IndexedPoint::RIGID_BODY, bodies[i].id(), -1);
+      }
+
+      if( kinds & IndexedPoint::UNIDENTIFIED_MARKER )
+      {
+         std::vector<Point3f> const& markers = frame.unIdMarkers();
+         for( i = 0; i < markers.size(); ++i )
+            _add(points, info, markers[i], IndexedPoint::UNIDENTIFIED_MARKER, -1, static_cast<int>(i));
+      }
+
+      if( kinds & IndexedPoint::LABELED_MARKER )
+      {
+         std::vector<LabeledMarker> const& labeled = frame.labeledMarkers();
+         for( i = 0; i < labeled.size(); ++i )
+            _add(points, info, labeled[i].location(), IndexedPoint::LABELED_MARKER, labeled[i].id(), -1);
+      }
+
+      if( kinds & IndexedPoint::SKELETON_BODY )
+      {
+         std::vector<Skeleton> const& skeletons = frame.skeletons();
+         for( i = 0; i < skeletons.size(); ++i )
+         {
+            std::vector<RigidBody> const& bones = skeletons[i].rigidBodies();
+            for( j = 0; j < bones.size(); ++j )
+               if( bones[j].trackingValid() )
+                  _add(points, info, bones[j].location(), IndexedPoint::SKELETON_BODY, skeletons[i].id(), bones[j].id());
+         }
+      }
+   }
+
+   /*!
+    * \brief Points within \c radius of \c p.
+    *
+    * \param p query point
+    * \param radius query radius
+    * \param out output point indices, in no particular order. Cleared first.
+    * \param kinds mask of IndexedPoint::Kind to include
+    */
+   void radius( Point3f const& p, float radius, std::vector<uint32_t>& out, unsigned int kinds=IndexedPoint::ALL ) const
+   {
+      out.clear();
+      RadiusVisitor v(out, _info, kinds);
+      _hash.visit(p, radius, v);
+   }
+
+   /*!
+    * \brief The \c k points nearest to \c p, within \c maxDist.
+    *
+    * \param p query point
+    * \param k number of points wanted
+    * \param maxDist search radius
+    * \param out output point indices, nearest first. Cleared first.
+    * \param dist2 if not null, output squared distances, parallel to \c out
+    * \param kinds mask of IndexedPoint::Kind to include
+    * \returns number of points found, at most \c k
+    */
+   size_t nearest( Point3f const& p, size_t k, float maxDist, std::vector<uint32_t>& out, std::vector<float>* dist2=0, unsigned int kinds=IndexedPoint::ALL ) const
+   {
+      return _hash.nearestIf(p, k, maxDist, KindFilter(_info, kinds), out, dist2);
+   }
+
+private:
+
+   friend class FrameIndex;
+
+   // The hash points into _points, so copies would dangle.
+   IndexedFrame( IndexedFrame const& );
+   IndexedFrame& operator=( IndexedFrame const& );
+
+   struct KindFilter
+   {
+      KindFilter( std::vector<IndexedPoint> const& i, unsigned int k ) : info(i), kinds(k) {}
+      bool operator()( uint32_t i ) const { return (info[i].kind & kinds) != 0; }
+      std::vector<IndexedPoint> const& info;
+      unsigned int kinds;
+   };
+
+   struct RadiusVisitor
+   {
+      RadiusVisitor( std::vector<uint32_t>& o, std::vector<IndexedPoint> const& i, unsigned int k ) : out(o), info(i), kinds(k) {}
+      void operator()( uint32_t i, float )
+      {
+         if( info[i].kind & kinds )
+            out.push_back(i);
+      }
+      std::vector<uint32_t>& out;
+      std::vector<IndexedPoint> const& info;
+      unsigned int kinds;
+   };
+
+   int _frameNum;
+   double _time;
+   PointArray _points;
+   std::vector<IndexedPoint> _info;
+   SpatialHash _hash;
+
+   static void _add( PointArray& points, std::vector<IndexedPoint>& info, Point3f const& p, IndexedPoint::Kind kind, int owner, int index )
+   {
+      points.push_back(p);
+      info.push_back(IndexedPoint(kind, owner, index));
+   }
+
+   void _fill( MocapFrame const& frame, double t, unsigned int kinds )
+   {
+      _frameNum = frame.frameNum();
+      _time = t;
+      gather(frame, kinds, _points, _info);
+   }
+};
+
+/*!
+ * \brief Builds a spatial index over every position in each frame.
+ * \author Philip G. Lee
+ *
+ * Register this with \c FrameListener::addHandler() and, once per frame,
+ * it gathers the positions selected by its kind mask (marker set markers,
+ * rigid body markers, unidentified and labeled markers, rigid body and
+ * skeleton bone locations) into an IndexedFrame with a SpatialHash over
+ * them. Radius and k-nearest queries then cost about the number of points
+ * near the query, instead of a scan of the whole frame.
+ *
+ * current() hands out the latest IndexedFrame by shared pointer, so readers
+ * take a lock only to copy the pointer and then query as much as they like,
+ * while the next frame is built on the side. When the last pointer to a
+ * frame is dropped, on whichever thread, the frame is handed back to the
+ * index under a lock, and its storage is reused for a later frame. So steady
+ * state allocates only the shared pointer's count. Large scenes can
+ * be built with several threads, which the index starts once and keeps;
+ * see SpatialHash::build().
+ */
+class FrameIndex : public FrameHandler
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param cellSize grid cell size, about the typical query radius
+    * \param kinds mask of IndexedPoint::Kind to index
+    * \param numThreads threads used to build the index of large frames
+    */
+   FrameIndex( float cellSize=0.05f, unsigned int kinds=IndexedPoint::ALL, unsigned int numThreads=1 ) :
+      _cellSize(cellSize),
+      _kinds(kinds),
+      _pool(numThreads > 1 ? new WorkerPool(numThreads) : 0),
+      _mutex(),
+      _recycler(new _Recycler()),
+      _current(new IndexedFrame(cellSize), _Return(_recycler))
+   {
+   }
+
+   virtual ~FrameIndex(){}
+
+   //! \brief Mask of IndexedPoint::Kind that are indexed.
+   unsigned int kinds() const { return _kinds; }
+
+   //! \brief Index the frame. Called by FrameListener.
+   virtual void handleFrame( MocapFrame const& frame, struct timespec const& ts )
+   {
+      update(frame, NatNet::seconds(ts));
+   }
+
+   /*!
+    * \brief Index \c frame and publish it as current().
+    *
+    * Not safe to call from more than one thread at a time, but safe
+    * against concurrent current() and queries.
+    *
+    * \param frame frame to index
+    * \param t arrival time of the frame in seconds
+    */
+   void update( MocapFrame const& frame, double t )
+   {
+      // Reuse the storage of a frame that every reader has handed back.
+      IndexedFrame* f = _recycler->take();
+      if( !f )
+         f = new IndexedFrame(_cellSize);
+      boost::shared_ptr<IndexedFrame> next(f, _Return(_recycler));
+
+      next->_fill(frame, t, _kinds);
+      next->_hash.build(next->_points, _pool.get());
+
+      {
+         boost::mutex::scoped_lock lock(_mutex);
+         _current.swap(next);
+      }
+      // The old frame goes back to _recycler here, unless a reader holds it.
+   }
+
+   //! \brief The latest indexed frame. Thread-safe.
+   boost::shared_ptr<IndexedFrame const> current() const
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      return _current;
+   }
+
+private:
+
+   // Frames whose last pointer was dropped. The lock orders a reader's last
+   // use of a frame before the writer refills it.
+   class _Recycler
+   {
+   public:
+      _Recycler() : _mutex(), _free() {}
+
+      ~_Recycler()
+      {
+         for( size_t i = 0; i < _free.size(); ++i )
+            delete _free[i];
+      }
+
+      void put( IndexedFrame* f )
+      {
+         boost::mutex::scoped_lock lock(_mutex);
+         // One for the writer to fill and one for a slow reader is enough.
+         if( _free.size() < 2 )
+            _free.push_back(f);
+         else
+            delete f;
+      }
+
+      IndexedFrame* take()
+      {
+         boost::mutex::scoped_lock lock(_mutex);
+         if( _free.empty() )
+            return 0;
+         IndexedFrame* f = _free.back();
+         _free.pop_back();
+         return f;
+      }
+
+   private:
+      boost::mutex _mutex;
+      std::vector<IndexedFrame*> _free;
+   };
+
+   // Deleter that hands a frame back instead. It keeps the recycler alive,
+   // since readers may hold frames after the index is destroyed.
+   struct _Return
+   {
+      _Return( boost::shared_ptr<_Recycler> const& r ) : recycler(r) {}
+      void operator()( IndexedFrame* f ) const { recycler->put(f); }
+      boost::shared_ptr<_Recycler> recycler;
+   };
+
+   float _cellSize;
+   unsigned int _kinds;
+   boost::scoped_ptr<WorkerPool> _pool;
+   mutable boost::mutex _mutex;
+   boost::shared_ptr<_Recycler> _recycler;
+   boost::shared_ptr<IndexedFrame> _current;
+};
+
+#endif /*FRAMEINDEX_H*/
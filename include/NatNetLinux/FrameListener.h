@@ -22,10 +22,21 @@
 #include <NatNetLinux/NatNet.h>
 #include <NatNetLinux/NatNetPacket.h>
 #include <NatNetLinux/NatNetSender.h>
+#include <NatNetLinux/FrameTransform.h>
+#include <NatNetLinux/FrameHandler.h>
+#include <NatNetLinux/PacketHandler.h>
+#include <NatNetLinux/FrameSequencer.h>
+#include <NatNetLinux/ClockEstimator.h>
+#include <NatNetLinux/Metrics.h>
+#include <NatNetLinux/LatencyHistogram.h>
+#include <NatNetLinux/Probes.h>
 #include <boost/thread.hpp>
 #include <boost/circular_buffer.hpp>
 #include <utility>
+#include <vector>
+#include <algorithm>
 #include <time.h>
+#include <sys/socket.h>
 
 /*!
  * \brief Thread to listen for MocapFrame data.
@@ -34,11 +45,45 @@
  * This class listens for MocapFrame data on a given socket.
  * It uses a circular buffer to store the frame data, and provides a
  * thread-safe interface to query for the most recent frames.
+ * 
+ * Frame numbers are checked for gaps, duplicates and reordering as frames
+ * arrive (see sequenceStats()), and setReorderBuffer() can hold frames
+ * briefly to release them in order.
+ * 
+ * Packets, bytes, parse failures, buffer overwrites, pops and the time
+ * spent waiting for the buffer lock in pop() are counted in
+ * MetricsRegistry under \c natnet_frame_*, summed over all listeners.
+ * 
+ * Each frame's path is also timed stage by stage into LatencyHistogram
+ * objects (see LatencyStage and latency()).
+ * 
+ * Raw datagrams can be tapped with addPacketHandler(), e.g. to record them
+ * with a CaptureWriter.
  */
 class FrameListener
 {
 public:
    
+   /*!
+    * \brief Stages of a frame's path through the listener.
+    * 
+    * \c KERNEL_TO_READ uses the kernel receive timestamp
+    * (\c SO_TIMESTAMPNS, enabled by start()) and stays empty if the socket
+    * does not provide one. \c UNPACK_TO_ENQUEUE covers the transform,
+    * clock estimate, reorder buffer and handlers, but not the time a frame
+    * spends held in the reorder buffer. \c INTER_ARRIVAL is the time
+    * between successive datagrams, by kernel timestamp when available.
+    */
+   enum LatencyStage
+   {
+      KERNEL_TO_READ     = 0,
+      READ_TO_UNPACK     = 1,
+      UNPACK_TO_ENQUEUE  = 2,
+      ENQUEUE_TO_POP     = 3,
+      INTER_ARRIVAL      = 4,
+      NUM_LATENCY_STAGES = 5
+   };
+   
    /*!
     * \brief Constructor
     * 
@@ -54,8 +99,25 @@ public:
       _nnMinor(nnMinor),
       _framesMutex(),
       _frames(bufferSize),
-      _run(false)
+      _enqueued(bufferSize),
+      _run(false),
+      _overwritten(0),
+      _stagesMutex(),
+      _sequencer(),
+      _transform(),
+      _useTransform(false),
+      _clock(),
+      _useClock(false),
+      _released(),
+      _handlersMutex(),
+      _handlers(),
+      _packetHandlers(),
+      _dispatching(),
+      _havePrevArrival(false),
+      _injectPacket(0),
+      _metrics()
    {
+      memset(&_prevArrival, 0, sizeof(_prevArrival));
    }
    
    ~FrameListener()
@@ -64,11 +126,16 @@ public:
          stop();
       // I think this may be blocking unless the thread is stopped.
       delete _thread;
+      delete _injectPacket;
    }
    
    //! \brief Begin the listening in new thread. Non-blocking.
    void start()
    {
+      // Ask for kernel receive timestamps, for the KERNEL_TO_READ stage.
+      int on = 1;
+      setsockopt(_sd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+      
       _run = true;
       _thread = new boost::thread( &FrameListener::_work, this, _sd);
    }
@@ -115,16 +182,29 @@ public:
    {
       std::pair<MocapFrame, struct timespec> ret;
       bool retSuccess = false;
+      struct timespec t0, t1;
       
+      clock_gettime( CLOCK_MONOTONIC, &t0 );
       _framesMutex.lock();
+      clock_gettime( CLOCK_MONOTONIC, &t1 );
       if( !_frames.empty() )
       {
          retSuccess = true;
          ret = _frames.back();
          _frames.pop_back();
+         _latency[ENQUEUE_TO_POP].record(_enqueued.back(), t1);
+         _enqueued.pop_back();
+         NATNET_PROBE2(frame_popped, ret.first.frameNum(), _frames.size());
       }
+      _metrics.buffered.set(_frames.size());
       _framesMutex.unlock();
       
+      _metrics.popWait.inc( LatencyHistogram::elapsed(t0, t1) );
+      if( retSuccess )
+         _metrics.pops.inc();
+      else
+         _metrics.emptyPops.inc();
+      
       if( success )
          *success = retSuccess;
       return ret;
@@ -160,18 +240,288 @@ public:
       {
          if( !_frames.empty() )
          {
+            struct timespec now;
+            clock_gettime( CLOCK_MONOTONIC, &now );
             retSuccess = true;
             ret = _frames.back();
             _frames.pop_back();
+            _latency[ENQUEUE_TO_POP].record(_enqueued.back(), now);
+            _enqueued.pop_back();
+            NATNET_PROBE2(frame_popped, ret.first.frameNum(), _frames.size());
          }
+         _metrics.buffered.set(_frames.size());
          _framesMutex.unlock();
+         
+         if( retSuccess )
+            _metrics.pops.inc();
+         else
+            _metrics.emptyPops.inc();
       }
+      else
+         _metrics.busyPops.inc();
       
       if( success )
          *success = retSuccess;
       return ret;
    }
    
+   /*!
+    * \brief Latency histogram of one stage. Thread-safe and lock-free.
+    * 
+    * \param stage which stage
+    * \param out output snapshot
+    * \param reset if true, zero the histogram as it is read
+    */
+   void latency( LatencyStage stage, HistogramSnapshot& out, bool reset=false )
+   {
+      _latency[stage].snapshot(out, reset);
+   }
+   
+   //! \brief Short name of a stage, e.g. "kernel_to_read".
+   static char const* latencyStageName( LatencyStage stage )
+   {
+      static char const* const names[NUM_LATENCY_STAGES] = {
+         "kernel_to_read", "read_to_unpack", "unpack_to_enqueue", "enqueue_to_pop", "inter_arrival"
+      };
+      return names[stage];
+   }
+   
+   /*!
+    * \brief Process a datagram as if it had been read from the socket.
+    * 
+    * This feeds recorded data (see Replayer) to a listener without a
+    * socket: the datagram goes through the packet handlers, unpacking, the
+    * processing stages and the buffer exactly like a live one, and is
+    * unpacked with the listener's NatNet version. Frames held in the
+    * reorder buffer are released by the timestamps of later datagrams.
+    * Call it from one thread at a time, and not while the listening thread
+    * runs.
+    * 
+    * \param data the datagram, starting with the NatNet message ID
+    * \param length bytes in \c data
+    * \param info arrival time and sender. \c info.ts also stamps the frame.
+    */
+   void inject( char const* data, size_t length, PacketInfo const& info )
+   {
+      if( !_injectPacket )
+         _injectPacket = new NatNetPacket();
+      if( length > _injectPacket->maxLength() )
+      {
+         _metrics.parseErrors.inc();
+         return;
+      }
+      memcpy(_injectPacket->rawPtr(), data, length);
+      _process(*_injectPacket, static_cast<ssize_t>(length), info.ts, info);
+      
+      _stagesMutex.lock();
+         _sequencer.flush(NatNet::seconds(info.ts), _released);
+      _stagesMutex.unlock();
+      _dispatch();
+   }
+
+   /*!
+    * \brief Process an already unpacked frame as if it had just been unpacked.
+    *
+    * Like inject(), for recordings that hold frames rather than datagrams
+    * (see CompressedReader): the frame skips the packet handlers and
+    * unpacking, and goes through the processing stages and the buffer.
+    * Call it from one thread at a time, and not while the listening thread
+    * runs.
+    *
+    * \param frame the frame
+    * \param ts arrival time, from \c CLOCK_REALTIME
+    */
+   void injectFrame( MocapFrame const& frame, struct timespec const& ts )
+   {
+      MocapFrame mFrame(frame);
+      _metrics.frames.inc();
+
+      _stagesMutex.lock();
+         if( _useTransform )
+            _transform.apply(mFrame);
+         if( _useClock )
+            _clock.annotate(mFrame, ts);
+         _sequencer.push(mFrame, ts, _released);
+         _sequencer.flush(NatNet::seconds(ts), _released);
+      _stagesMutex.unlock();
+      _dispatch();
+   }
+
+   //--------------------------------------------------------------------------
+   
+   // Processing ==============================================================
+   
+   /*!
+    * \brief Transform every frame before it is buffered. Thread-safe.
+    * 
+    * The transform is applied in the listening thread, right after each
+    * frame is unpacked, so every consumer sees frames already expressed in
+    * the target frame.
+    * 
+    * \sa clearTransform()
+    */
+   void setTransform( FrameTransform const& transform )
+   {
+      _stagesMutex.lock();
+      _transform = transform;
+      _useTransform = true;
+      _stagesMutex.unlock();
+   }
+   
+   //! \brief Stop transforming frames. Thread-safe.
+   void clearTransform()
+   {
+      _stagesMutex.lock();
+      _useTransform = false;
+      _stagesMutex.unlock();
+   }
+   
+   /*!
+    * \brief Estimate the server clock and set every frame's capture time. Thread-safe.
+    * 
+    * Each frame is added to a copy of \c estimator as it is read, and its
+    * \c MocapFrame::captureTime() is set from the current fit.
+    * 
+    * \sa clockFit(), clearClockEstimator()
+    */
+   void setClockEstimator( ClockEstimator const& estimator )
+   {
+      _stagesMutex.lock();
+      _clock = estimator;
+      _useClock = true;
+      _stagesMutex.unlock();
+   }
+   
+   //! \brief Stop estimating the server clock. Thread-safe.
+   void clearClockEstimator()
+   {
+      _stagesMutex.lock();
+      _useClock = false;
+      _stagesMutex.unlock();
+   }
+   
+   //! \brief Current server to local clock fit. Thread-safe.
+   ClockFit clockFit() const
+   {
+      _stagesMutex.lock();
+         ClockFit ret = _clock.fit();
+      _stagesMutex.unlock();
+      return ret;
+   }
+   
+   /*!
+    * \brief Have \c handler process every frame. Thread-safe.
+    * 
+    * Handlers are called in the order they were added, from the listening
+    * thread. The listener does not take ownership, so \c handler must
+    * outlive the listener or be removed with removeHandler() first.
+    * 
+    * Handlers run without the lock that guards the processing stages, so
+    * handleFrame() may call the listener's other thread-safe methods, such
+    * as sequenceStats(), clockFit() or setTransform(). It must not add or
+    * remove handlers, or call setReorderBuffer(), inject() or
+    * injectFrame(): those wait for the running handler and would deadlock.
+    */
+   void addHandler( FrameHandler* handler )
+   {
+      _handlersMutex.lock();
+      _handlers.push_back(handler);
+      _handlersMutex.unlock();
+   }
+   
+   /*!
+    * \brief Stop calling \c handler. Thread-safe.
+    * 
+    * Waits for handlers that are running, so \c handler is not called once
+    * this returns.
+    */
+   void removeHandler( FrameHandler* handler )
+   {
+      _handlersMutex.lock();
+      _handlers.erase( std::remove(_handlers.begin(), _handlers.end(), handler), _handlers.end() );
+      _handlersMutex.unlock();
+   }
+   
+   /*!
+    * \brief Have \c handler see every raw datagram. Thread-safe.
+    * 
+    * Packet handlers are called in the order they were added, from the
+    * listening thread, before the datagram is unpacked. The listener does
+    * not take ownership, so \c handler must outlive the listener or be
+    * removed with removePacketHandler() first. The same calls are
+    * forbidden from handlePacket() as from a FrameHandler (see
+    * addHandler()).
+    * 
+    * \sa CaptureWriter
+    */
+   void addPacketHandler( PacketHandler* handler )
+   {
+      _handlersMutex.lock();
+      _packetHandlers.push_back(handler);
+      _handlersMutex.unlock();
+   }
+   
+   //! \brief Stop calling \c handler. Thread-safe.
+   void removePacketHandler( PacketHandler* handler )
+   {
+      _handlersMutex.lock();
+      _packetHandlers.erase( std::remove(_packetHandlers.begin(), _packetHandlers.end(), handler), _packetHandlers.end() );
+      _handlersMutex.unlock();
+   }
+   
+   /*!
+    * \brief Hold frames to release them in frame number order. Thread-safe.
+    * 
+    * Frames that arrive out of order are held until the frames before them
+    * arrive, for at most \c maxLatency seconds and \c depth frames. Frames
+    * arriving after that are counted as late and dropped, as are duplicates.
+    * A frame number that stops advancing is detected and passed through
+    * (see FrameSequencer).
+    * Handlers and the \c pop() buffer both see the reordered stream.
+    * 
+    * \param depth maximum number of frames held. 0 (the default) disables
+    *    the buffer: frames are released as they arrive, and only counted.
+    * \param maxLatency maximum time in seconds a frame is held
+    * 
+    * \sa FrameSequencer
+    */
+   void setReorderBuffer( size_t depth, double maxLatency=0.005 )
+   {
+      _stagesMutex.lock();
+         _sequencer.configure(depth, maxLatency, NatNet::now(), _released);
+      _stagesMutex.unlock();
+      _dispatch();
+   }
+   
+   /*!
+    * \brief Frame continuity counters. Thread-safe.
+    * 
+    * Frames missing, late or duplicated point at the network; frames
+    * overwritten point at a consumer that does not pop fast enough.
+    */
+   SequenceStats sequenceStats() const
+   {
+      SequenceStats ret;
+      _stagesMutex.lock();
+         ret = _sequencer.stats();
+      _stagesMutex.unlock();
+      _framesMutex.lock();
+         ret.overwritten = _overwritten;
+      _framesMutex.unlock();
+      return ret;
+   }
+   
+   //! \brief Zero the sequenceStats() counters. Thread-safe.
+   void resetSequenceStats()
+   {
+      _stagesMutex.lock();
+         _sequencer.resetStats();
+      _stagesMutex.unlock();
+      _framesMutex.lock();
+         _overwritten = 0;
+      _framesMutex.unlock();
+   }
+   
    //--------------------------------------------------------------------------
    
 private:
@@ -182,13 +532,150 @@ private:
    unsigned char _nnMinor;
    mutable boost::mutex _framesMutex;
    boost::circular_buffer< std::pair<MocapFrame, struct timespec> > _frames;
+   // CLOCK_MONOTONIC time each frame in _frames was buffered.
+   boost::circular_buffer<struct timespec> _enqueued;
+   LatencyHistogram _latency[NUM_LATENCY_STAGES];
    bool _run;
+   uint64_t _overwritten;
+   // Guards the processing stages below.
+   mutable boost::mutex _stagesMutex;
+   FrameSequencer _sequencer;
+   FrameTransform _transform;
+   bool _useTransform;
+   ClockEstimator _clock;
+   bool _useClock;
+   // Frames released by _sequencer, waiting for _dispatch().
+   std::vector<FrameSequencer::Entry> _released;
+   // Guards the handler lists below, and is held while handlers run, so
+   // that a handler that was removed is no longer called. Never taken
+   // with _stagesMutex held.
+   mutable boost::mutex _handlersMutex;
+   std::vector<FrameHandler*> _handlers;
+   std::vector<PacketHandler*> _packetHandlers;
+   std::vector<FrameSequencer::Entry> _dispatching;
+   // Previous arrival, for INTER_ARRIVAL.
+   struct timespec _prevArrival;
+   bool _havePrevArrival;
+   // Buffer for inject().
+   NatNetPacket* _injectPacket;
+   
+   // Handles to the listener metrics.
+   struct Metrics
+   {
+      Metrics()
+      {
+         MetricsRegistry& r = MetricsRegistry::instance();
+         packets = r.counter("natnet_frame_packets_total", "Datagrams read by FrameListener.");
+         bytes = r.counter("natnet_frame_bytes_total", "Bytes read by FrameListener.");
+         frames = r.counter("natnet_frame_frames_total", "Frames of data unpacked by FrameListener.");
+         otherPackets = r.counter("natnet_frame_other_packets_total", "Datagrams that were not frames of data.");
+         readErrors = r.counter("natnet_frame_read_errors_total", "Failed reads on the data socket.");
+         parseErrors = r.counter("natnet_frame_parse_errors_total", "Frames dropped because they were truncated, or their counts ran past the end of the datagram.");
+         overwrites = r.counter("natnet_frame_overwrites_total", "Frames overwritten in the FrameListener buffer before being popped.");
+         pops = r.counter("natnet_frame_pops_total", "Frames popped from the FrameListener buffer.");
+         emptyPops = r.counter("natnet_frame_empty_pops_total", "Pops that found the FrameListener buffer empty.");
+         busyPops = r.counter("natnet_frame_busy_pops_total", "tryPop() calls that found the FrameListener buffer locked.");
+         popWait = r.counter("natnet_frame_pop_wait_seconds_total", "Time pop() spent waiting for the buffer lock.", "", 1e-9);
+         buffered = r.gauge("natnet_frame_buffered", "Frames in the FrameListener buffer.");
+      }
+      
+      Counter packets, bytes, frames, otherPackets, readErrors, parseErrors;
+      Counter overwrites, pops, emptyPops, busyPops, popWait;
+      Gauge buffered;
+   };
+   Metrics _metrics;
+   
+   /*
+    * Run handlers on the frames in _released, in release order, and buffer
+    * them. Call without _stagesMutex held, so handlers may use the
+    * listener's stage methods. Whichever thread holds _handlersMutex takes
+    * every frame released meanwhile, so frames never overtake each other.
+    */
+   void _dispatch()
+   {
+      size_t i, j;
+      struct timespec now;
+      std::vector<FrameSequencer::Entry>& ready = _dispatching;
+      
+      _handlersMutex.lock();
+      for(;;)
+      {
+         _stagesMutex.lock();
+            ready.swap(_released);
+         _stagesMutex.unlock();
+         if( ready.empty() )
+            break;
+         
+         for( i = 0; i < ready.size(); ++i )
+            for( j = 0; j < _handlers.size(); ++j )
+               _handlers[j]->handleFrame(ready[i].first, ready[i].second);
+         
+         clock_gettime( CLOCK_MONOTONIC, &now );
+         _framesMutex.lock();
+            for( i = 0; i < ready.size(); ++i )
+            {
+               if( _frames.full() )
+               {
+                  ++_overwritten;
+                  _metrics.overwrites.inc();
+                  NATNET_PROBE1(frame_overwritten, _frames.front().first.frameNum());
+               }
+               _frames.push_back(ready[i]);
+               _enqueued.push_back(now);
+               NATNET_PROBE2(frame_enqueued, ready[i].first.frameNum(), _frames.size());
+            }
+            _metrics.buffered.set(_frames.size());
+         _framesMutex.unlock();
+         ready.clear();
+      }
+      _handlersMutex.unlock();
+   }
+   
+   /*
+    * Read one datagram and its sender, with its kernel receive timestamp
+    * if there is one. Returns what recvmsg() returns.
+    */
+   static ssize_t _receive( int sd, NatNetPacket& nnp, struct sockaddr_in& from, struct timespec& kernelTs, bool& haveKernelTs )
+   {
+      struct iovec iov;
+      struct msghdr msg;
+      char control[CMSG_SPACE(sizeof(struct timespec))];
+      
+      iov.iov_base = nnp.rawPtr();
+      iov.iov_len = nnp.maxLength();
+      memset(&msg, 0, sizeof(msg));
+      memset(&from, 0, sizeof(from));
+      msg.msg_name = &from;
+      msg.msg_namelen = sizeof(from);
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      
+      ssize_t ret = recvmsg(sd, &msg, 0);
+      haveKernelTs = false;
+      for( struct cmsghdr* c = CMSG_FIRSTHDR(&msg); ret >= 0 && c; c = CMSG_NXTHDR(&msg, c) )
+      {
+         if( c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS )
+         {
+            memcpy(&kernelTs, CMSG_DATA(c), sizeof(kernelTs));
+            haveKernelTs = true;
+         }
+      }
+      return ret;
+   }
    
    void _work(int sd)
    {
       NatNetPacket nnp;
       struct timespec ts;
-      size_t dataBytes;
+      // Kernel receive time and end of read, from CLOCK_REALTIME.
+      struct timespec kernelTs, readTs;
+      bool haveKernelTs;
+      ssize_t dataBytes;
+      PacketInfo info;
+      info.nnMajor = _nnMajor;
+      info.nnMinor = _nnMinor;
       
       fd_set rfds;
       struct timeval timeout;
@@ -197,22 +684,115 @@ private:
       {
          // Wait for at most 1 second until the socket has data (read()
          // will not block). Otherwise, continue. This gives outside threads
-         // a chance to kill this thread every second.
+         // a chance to kill this thread every second. Wake up sooner if a
+         // held frame is due.
          timeout.tv_sec = 1; timeout.tv_usec = 0;
+         _stagesMutex.lock();
+            double deadline = _sequencer.deadline();
+         _stagesMutex.unlock();
+         if( deadline >= 0.0 )
+         {
+            double wait = std::max(0.0, std::min(1.0, deadline - NatNet::now()));
+            timeout.tv_sec = 0;
+            timeout.tv_usec = static_cast<suseconds_t>(wait*1e6);
+            if( timeout.tv_usec >= 1000000 )
+            {
+               timeout.tv_sec = 1;
+               timeout.tv_usec = 0;
+            }
+         }
          FD_ZERO(&rfds); FD_SET(sd, &rfds);
-         if( !select(sd+1, &rfds, 0, 0, &timeout) )
+         if( select(sd+1, &rfds, 0, 0, &timeout) <= 0 )
+         {
+            _stagesMutex.lock();
+               _sequencer.flush(NatNet::now(), _released);
+            _stagesMutex.unlock();
+            _dispatch();
             continue;
+         }
          
          clock_gettime( CLOCK_REALTIME, &ts );
-         dataBytes = read( sd, nnp.rawPtr(), nnp.maxLength() );
+         dataBytes = _receive( sd, nnp, info.from, kernelTs, haveKernelTs );
+         clock_gettime( CLOCK_REALTIME, &readTs );
+         
+         if( dataBytes < 0 )
+         {
+            _metrics.readErrors.inc();
+            continue;
+         }
+         
+         if( haveKernelTs )
+            _latency[KERNEL_TO_READ].record(kernelTs, readTs);
+         info.ts = haveKernelTs ? kernelTs : ts;
+         info.kernelTimestamp = haveKernelTs;
+         _process(nnp, dataBytes, ts, info);
+      }
+      
+      // Nothing more is coming for held frames.
+      _stagesMutex.lock();
+         _sequencer.drain(_released);
+      _stagesMutex.unlock();
+      _dispatch();
+   }
+   
+   /*
+    * Everything after the read: counting, packet handlers, unpacking, the
+    * processing stages and buffering. ts stamps the frame, info.ts is the
+    * arrival time.
+    */
+   void _process( NatNetPacket& nnp, ssize_t dataBytes, struct timespec const& ts, PacketInfo const& info )
+   {
+      // CLOCK_MONOTONIC times of the end of read, unpack and enqueue.
+      struct timespec readMono, unpackMono, enqueueMono;
+      clock_gettime( CLOCK_MONOTONIC, &readMono );
+      
+      if( _havePrevArrival )
+         _latency[INTER_ARRIVAL].record(_prevArrival, info.ts);
+      _prevArrival = info.ts;
+      _havePrevArrival = true;
+      _metrics.packets.inc();
+      _metrics.bytes.inc(static_cast<uint64_t>(dataBytes));
+      NATNET_PROBE2(packet_received, dataBytes, dataBytes >= 2 ? static_cast<int>(nnp.iMessage()) : -1);
+      
+      _handlersMutex.lock();
+         for( size_t i = 0; i < _packetHandlers.size(); ++i )
+            _packetHandlers[i]->handlePacket(nnp.rawPtr(), static_cast<size_t>(dataBytes), info);
+      _handlersMutex.unlock();
+      
+      if( dataBytes >= 4 && nnp.iMessage() != NatNetPacket::NAT_FRAMEOFDATA )
+         _metrics.otherPackets.inc();
+      else if( dataBytes < 4 || dataBytes < 4 + nnp.nDataBytes() )
+         _metrics.parseErrors.inc();
+      else
+      {
+         MocapFrame mFrame(_nnMajor,_nnMinor);
+         // A frame whose counts run past the end of the datagram is corrupt:
+         // count it and drop it.
+         if( !mFrame.unpack(nnp.rawPayloadPtr(), nnp.rawPtr() + dataBytes) )
+         {
+            _metrics.parseErrors.inc();
+            return;
+         }
+         _metrics.frames.inc();
+         clock_gettime( CLOCK_MONOTONIC, &unpackMono );
+         _latency[READ_TO_UNPACK].record(readMono, unpackMono);
+         NATNET_PROBE3(frame_unpacked, mFrame.frameNum(), mFrame.rigidBodies().size(), dataBytes);
+         
+         _stagesMutex.lock();
+            if( _useTransform )
+               _transform.apply(mFrame);
+            if( _useClock )
+               _clock.annotate(mFrame, ts);
+            size_t held = _released.size();
+            _sequencer.push(mFrame, ts, _released);
+            bool released = _released.size() > held;
+         _stagesMutex.unlock();
+         _dispatch();
          
-         if( dataBytes > 0 && nnp.iMessage() == NatNetPacket::NAT_FRAMEOFDATA )
+         if( released )
          {
-            MocapFrame mFrame(_nnMajor,_nnMinor);
-            mFrame.unpack(nnp.rawPayloadPtr());
-            _framesMutex.lock();
-               _frames.push_back(std::make_pair(mFrame,ts));
-            _framesMutex.unlock();
+            clock_gettime( CLOCK_MONOTONIC, &enqueueMono );
+            _latency[UNPACK_TO_ENQUEUE].record(unpackMono, enqueueMono);
          }
       }
    }
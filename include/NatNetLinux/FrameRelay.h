@@ -0,0 +1,458 @@
+/*
+ * FrameRelay.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMERELAY_H
+#define FRAMERELAY_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/NatNetPacket.h>
+#include <NatNetLinux/FrameHandler.h>
+#include <NatNetLinux/PacketHandler.h>
+#include <NatNetLinux/DataDescriptions.h>
+#include <NatNetLinux/LatencyHistogram.h>
+#include <boost/thread.hpp>
+#include <vector>
+#include <set>
+#include <string>
+#include <stdio.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/*!
+ * \brief Progress of a FrameRelay.
+ * \author Philip G. Lee
+ */
+class RelayStats
+{
+public:
+
+   //! \brief Default constructor. Nothing relayed.
+   RelayStats() :
+      framesIn(0),
+      framesOut(0),
+      bytesIn(0),
+      bytesOut(0),
+      sendErrors(0),
+      oversize(0),
+      elapsed(0.0),
+      latency(),
+      processing()
+   {
+   }
+
+   //! \brief Frames handed to the relay.
+   uint64_t framesIn;
+   //! \brief Datagrams sent, one per frame and destination.
+   uint64_t framesOut;
+   /*!
+    * \brief Bytes of the frame datagrams read.
+    *
+    * Counted by handlePacket(), so only if the relay is also registered
+    * with \c FrameListener::addPacketHandler().
+    */
+   uint64_t bytesIn;
+   //! \brief Bytes of datagrams sent.
+   uint64_t bytesOut;
+   //! \brief Datagrams that failed to send.
+   uint64_t sendErrors;
+   //! \brief Filtered frames too large for one datagram, not sent.
+   uint64_t oversize;
+   //! \brief Seconds since the first frame, or the last reset.
+   double elapsed;
+   /*!
+    * \brief Time from receiving each frame to the last of its datagrams being sent.
+    *
+    * From the frame's receive time, which is the kernel's when the socket
+    * provides it, so includes the listener's read and unpack.
+    */
+   HistogramSnapshot latency;
+   //! \brief Time spent filtering, packing and sending each frame.
+   HistogramSnapshot processing;
+
+   //! \brief Frames handed to the relay per second.
+   double rate() const { return elapsed > 0.0 ? framesIn/elapsed : 0.0; }
+   //! \brief Bytes sent per byte received.
+   double ratio() const { return bytesIn ? static_cast<double>(bytesOut)/bytesIn : 0.0; }
+
+   //! \brief One line with the frame counts, rates, size ratio and latencies.
+   std::string summary() const
+   {
+      char buf[512];
+      int n = snprintf(buf, sizeof(buf), "frames=%llu rate=%.1f/s in=%.3f MB/s out=%.3f MB/s ratio=%.3f",
+         static_cast<unsigned long long>(framesIn), rate(),
+         elapsed > 0.0 ? 1e-6*bytesIn/elapsed : 0.0,
+         elapsed > 0.0 ? 1e-6*bytesOut/elapsed : 0.0,
+         ratio());
+      if( sendErrors )
+         n += snprintf(buf + n, sizeof(buf) - n, " send_errors=%llu", static_cast<unsigned long long>(sendErrors));
+      if( oversize )
+         n += snprintf(buf + n, sizeof(buf) - n, " oversize=%llu", static_cast<unsigned long long>(oversize));
+      if( latency.count )
+         n += snprintf(buf + n, sizeof(buf) - n, " latency: %s", latency.summary().c_str());
+      if( processing.count && n < static_cast<int>(sizeof(buf)) )
+         snprintf(buf + n, sizeof(buf) - n, " processing: %s", processing.summary().c_str());
+      return buf;
+   }
+};
+
+/*!
+ * \brief Republishes a subset of every frame, re-encoded, to other destinations.
+ * \author Philip G. Lee
+ *
+ * Register with \c FrameListener::addHandler(). For every frame, the relay
+ * keeps the sections chosen with setSections() and, within the rigid body,
+ * skeleton and marker set sections, only the items selected by ID or name
+ * if any are selected in that section. The result is packed as a
+ * NAT_FRAMEOFDATA with the frame's own number, latency and timecode,
+ * for the input's NatNet version or the one given to setOutputVersion(),
+ * and sent with \c sendto() to every destination, e.g. another multicast
+ * group, port or a list of unicast clients. A frame with nothing selected
+ * is still sent, so clients keep the frame cadence.
+ *
+ * Everything happens in the listener's thread as the frame arrives, with no
+ * queue to wait in. Names are resolved through the server's
+ * DataDescriptions (see \c CommandListener::dataDescriptions()); selecting
+ * a rigid body or skeleton, by name or by ID, also selects the marker set
+ * of its name, which is how Motive names a body's markers. A body selected
+ * by ID that the descriptions do not name selects no marker set. Configure
+ * the relay before registering it.
+ *
+ * How long each frame took from arrival to republication, and to filter,
+ * pack and send, is in RelayStats. Register the relay with
+ * \c FrameListener::addPacketHandler() too to count the bytes read.
+ */
+class FrameRelay : public FrameHandler, public PacketHandler
+{
+public:
+
+   //! \brief Sections of a frame.
+   enum Section
+   {
+      MARKER_SETS          = 0x01,
+      UNIDENTIFIED_MARKERS = 0x02,
+      RIGID_BODIES         = 0x04,
+      SKELETONS            = 0x08,
+      LABELED_MARKERS      = 0x10,
+      ALL_SECTIONS         = 0x1F
+   };
+
+   /*!
+    * \brief Constructor
+    *
+    * \param sd socket to send on. For multicast, set \c IP_MULTICAST_TTL,
+    *    \c IP_MULTICAST_LOOP and \c IP_MULTICAST_IF on it as needed.
+    */
+   FrameRelay( int sd=-1 ) :
+      _sd(sd),
+      _destinations(),
+      _sections(ALL_SECTIONS),
+      _bodyIds(),
+      _bodyNames(),
+      _skeletonIds(),
+      _skeletonNames(),
+      _markerSetNames(),
+      _descriptions(),
+      _resolvedBodyIds(),
+      _resolvedSkeletonIds(),
+      _resolvedMarkerSets(),
+      _filterBodies(false),
+      _filterSkeletons(false),
+      _filterMarkerSets(false),
+      _outMajor(0),
+      _outMinor(0),
+      _out(),
+      _packet(),
+      _statsMutex(),
+      _stats(),
+      _started(false),
+      _begin(0.0),
+      _latency(),
+      _processing()
+   {
+   }
+
+   virtual ~FrameRelay(){}
+
+   //! \brief Send on socket \c sd.
+   void setSocket( int sd ) { _sd = sd; }
+
+   //! \brief Send every frame to \c dest too.
+   void addDestination( struct sockaddr_in const& dest ) { _destinations.push_back(dest); }
+
+   //! \brief Sections relayed, a combination of Section.
+   unsigned int sections() const { return _sections; }
+   //! \brief Set the sections() relayed.
+   void setSections( unsigned int sections ) { _sections = sections & ALL_SECTIONS; }
+
+   //! \brief Relay the rigid body with this ID, and its marker set.
+   void selectRigidBody( int id ) { _bodyIds.insert(id); _resolve(); }
+   //! \brief Relay the rigid body with this name, and its marker set.
+   void selectRigidBody( std::string const& name ) { _bodyNames.insert(name); _resolve(); }
+   //! \brief Relay the skeleton with this ID, and its marker set.
+   void selectSkeleton( int id ) { _skeletonIds.insert(id); _resolve(); }
+   //! \brief Relay the skeleton with this name, and its marker set.
+   void selectSkeleton( std::string const& name ) { _skeletonNames.insert(name); _resolve(); }
+   //! \brief Relay the marker set with this name.
+   void selectMarkerSet( std::string const& name ) { _markerSetNames.insert(name); _resolve(); }
+
+   //! \brief Forget every selection, relaying whole sections again.
+   void clearSelection()
+   {
+      _bodyIds.clear();
+      _bodyNames.clear();
+      _skeletonIds.clear();
+      _skeletonNames.clear();
+      _markerSetNames.clear();
+      _resolve();
+   }
+
+   //! \brief Resolve names selected, before or after, through these descriptions.
+   void setDescriptions( DataDescriptions const& descriptions )
+   {
+      _descriptions = descriptions;
+      _resolve();
+   }
+
+   //! \brief Rigid body and skeleton names selected that the descriptions do not have.
+   std::vector<std::string> unresolved() const
+   {
+      std::vector<std::string> ret;
+      std::set<std::string>::const_iterator it;
+      for( it = _bodyNames.begin(); it != _bodyNames.end(); ++it )
+         if( _descriptions.rigidBodyId(*it) < 0 )
+            ret.push_back(*it);
+      for( it = _skeletonNames.begin(); it != _skeletonNames.end(); ++it )
+         if( _descriptions.skeletonId(*it) < 0 )
+            ret.push_back(*it);
+      return ret;
+   }
+
+   /*!
+    * \brief Pack frames for this NatNet version instead of the input's.
+    *
+    * E.g. 2.0 for clients too old for skeletons and labeled markers, which
+    * are then left out. 0.0 packs for the input's version.
+    */
+   void setOutputVersion( unsigned char nnMajor, unsigned char nnMinor )
+   {
+      _outMajor = nnMajor;
+      _outMinor = nnMinor;
+   }
+
+   /*!
+    * \brief Copy the selected parts of \c in to \c out.
+    *
+    * \c out keeps its NatNet version and reuses its storage.
+    */
+   void filter( MocapFrame const& in, MocapFrame& out ) const
+   {
+      size_t i;
+
+      out.setFrameNum(in.frameNum());
+      out.setLatency(in.latency());
+      uint32_t timecode, subframe;
+      in.timecode(timecode, subframe);
+      out.setTimecode(timecode, subframe);
+      out.setCaptureTime(in.captureTime());
+
+      std::vector<MarkerSet>& sets = out.markerSets();
+      sets.clear();
+      if( _sections & MARKER_SETS )
+         for( i = 0; i < in.markerSets().size(); ++i )
+            if( !_filterMarkerSets || _resolvedMarkerSets.count(in.markerSets()[i].name()) )
+               sets.push_back(in.markerSets()[i]);
+
+      if( _sections & UNIDENTIFIED_MARKERS )
+         out.unIdMarkers() = in.unIdMarkers();
+      else
+         out.unIdMarkers().clear();
+
+      std::vector<RigidBody>& bodies = out.rigidBodies();
+      bodies.clear();
+      if( _sections & RIGID_BODIES )
+         for( i = 0; i < in.rigidBodies().size(); ++i )
+            if( !_filterBodies || _resolvedBodyIds.count(in.rigidBodies()[i].id()) )
+               bodies.push_back(in.rigidBodies()[i]);
+
+      std::vector<Skeleton>& skeletons = out.skeletons();
+      skeletons.clear();
+      if( _sections & SKELETONS )
+         for( i = 0; i < in.skeletons().size(); ++i )
+            if( !_filterSkeletons || _resolvedSkeletonIds.count(in.skeletons()[i].id()) )
+               skeletons.push_back(in.skeletons()[i]);
+
+      if( _sections & LABELED_MARKERS )
+         out.labeledMarkers() = in.labeledMarkers();
+      else
+         out.labeledMarkers().clear();
+   }
+
+   //! \brief Filter, pack and send one frame. Called by the FrameListener.
+   virtual void handleFrame( MocapFrame const& frame, struct timespec const& ts )
+   {
+      struct timespec start, sent;
+      clock_gettime( CLOCK_MONOTONIC, &start );
+
+      unsigned char major = _outMajor ? _outMajor : frame.nnMajor();
+      unsigned char minor = _outMajor ? _outMinor : frame.nnMinor();
+      if( _out.nnMajor() != major || _out.nnMinor() != minor )
+         _out = MocapFrame(major, minor);
+      filter(frame, _out);
+
+      uint64_t out = 0, bytes = 0, errors = 0;
+      size_t n = _out.packedSize();
+      bool fits = _packet.fits(n);
+      if( fits )
+      {
+         _out.pack(_packet.read<char>(0));
+         _packet.setHeader(NatNetPacket::NAT_FRAMEOFDATA, static_cast<unsigned short>(n));
+         for( size_t i = 0; i < _destinations.size(); ++i )
+         {
+            int ret = _packet.send(_sd, _destinations[i]);
+            if( ret < 0 )
+               ++errors;
+            else
+            {
+               ++out;
+               bytes += static_cast<uint64_t>(ret);
+            }
+         }
+      }
+
+      clock_gettime( CLOCK_MONOTONIC, &sent );
+      _processing.record(start, sent);
+      clock_gettime( CLOCK_REALTIME, &sent );
+      _latency.record(ts, sent);
+
+      double now = NatNet::now();
+      _statsMutex.lock();
+         if( !_started )
+         {
+            _started = true;
+            _begin = now;
+         }
+         ++_stats.framesIn;
+         _stats.framesOut += out;
+         _stats.bytesOut += bytes;
+         _stats.sendErrors += errors;
+         _stats.oversize += fits ? 0 : 1;
+         _stats.elapsed = now - _begin;
+      _statsMutex.unlock();
+   }
+
+   //! \brief Count the bytes of frame datagrams. Called by the FrameListener.
+   virtual void handlePacket( char const* data, size_t length, PacketInfo const& /*info*/ )
+   {
+      uint16_t message;
+      if( length < 4 )
+         return;
+      memcpy(&message, data, sizeof(message));
+      if( message != NatNetPacket::NAT_FRAMEOFDATA )
+         return;
+      _statsMutex.lock();
+         _stats.bytesIn += length;
+      _statsMutex.unlock();
+   }
+
+   //! \brief Progress so far, optionally starting over. Thread-safe.
+   RelayStats stats( bool reset=false )
+   {
+      _statsMutex.lock();
+         RelayStats ret = _stats;
+         if( reset )
+         {
+            _stats = RelayStats();
+            _begin = NatNet::now();
+         }
+      _statsMutex.unlock();
+      _latency.snapshot(ret.latency, reset);
+      _processing.snapshot(ret.processing, reset);
+      return ret;
+   }
+
+private:
+
+   int _sd;
+   std::vector<struct sockaddr_in> _destinations;
+   unsigned int _sections;
+   std::set<int> _bodyIds;
+   std::set<std::string> _bodyNames;
+   std::set<int> _skeletonIds;
+   std::set<std::string> _skeletonNames;
+   std::set<std::string> _markerSetNames;
+   DataDescriptions _descriptions;
+   // Selections with names replaced by IDs where known.
+   std::set<int> _resolvedBodyIds;
+   std::set<int> _resolvedSkeletonIds;
+   std::set<std::string> _resolvedMarkerSets;
+   // True if the section is narrowed to a selection, even one not yet resolved.
+   bool _filterBodies;
+   bool _filterSkeletons;
+   bool _filterMarkerSets;
+   unsigned char _outMajor;
+   unsigned char _outMinor;
+   MocapFrame _out;
+   NatNetPacket _packet;
+   mutable boost::mutex _statsMutex;
+   RelayStats _stats;
+   bool _started;
+   double _begin;
+   LatencyHistogram _latency;
+   LatencyHistogram _processing;
+
+   // Recompute the resolved selections.
+   void _resolve()
+   {
+      std::set<std::string>::const_iterator it;
+      int id;
+
+      _resolvedBodyIds = _bodyIds;
+      _resolvedSkeletonIds = _skeletonIds;
+      _resolvedMarkerSets = _markerSetNames;
+      _filterBodies = !_bodyIds.empty() || !_bodyNames.empty();
+      _filterSkeletons = !_skeletonIds.empty() || !_skeletonNames.empty();
+      _filterMarkerSets = !_markerSetNames.empty() || _filterBodies || _filterSkeletons;
+      for( std::set<int>::const_iterator i = _bodyIds.begin(); i != _bodyIds.end(); ++i )
+      {
+         std::string name = _descriptions.rigidBodyName(*i);
+         if( !name.empty() )
+            _resolvedMarkerSets.insert(name);
+      }
+      for( std::set<int>::const_iterator i = _skeletonIds.begin(); i != _skeletonIds.end(); ++i )
+      {
+         std::string name = _descriptions.skeletonName(*i);
+         if( !name.empty() )
+            _resolvedMarkerSets.insert(name);
+      }
+      for( it = _bodyNames.begin(); it != _bodyNames.end(); ++it )
+      {
+         _resolvedMarkerSets.insert(*it);
+         if( (id = _descriptions.rigidBodyId(*it)) >= 0 )
+            _resolvedBodyIds.insert(id);
+      }
+      for( it = _skeletonNames.begin(); it != _skeletonNames.end(); ++it )
+      {
+         _resolvedMarkerSets.insert(*it);
+         if( (id = _descriptions.skeletonId(*it)) >= 0 )
+            _resolvedSkeletonIds.insert(id);
+      }
+   }
+};
+
+#endif /*FRAMERELAY_H*/
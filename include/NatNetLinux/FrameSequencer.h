@@ -0,0 +1,331 @@
+/*
+ * FrameSequencer.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMESEQUENCER_H
+#define FRAMESEQUENCER_H
+
+#include <NatNetLinux/NatNet.h>
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <time.h>
+
+/*!
+ * \brief Counters describing the continuity of a frame stream.
+ * \author Philip G. Lee
+ *
+ * \c missing, \c duplicates, \c late and \c reordered describe the network.
+ * \c overwritten describes the consumer: it counts frames that were received
+ * but pushed out of the FrameListener buffer before anyone popped them.
+ */
+class SequenceStats
+{
+public:
+
+   //! \brief Default constructor
+   SequenceStats() :
+      received(0),
+      gaps(0),
+      missing(0),
+      duplicates(0),
+      late(0),
+      reordered(0),
+      resyncs(0),
+      stalled(0),
+      overwritten(0)
+   {
+   }
+
+   //! \brief Frames received.
+   uint64_t received;
+   //! \brief Times one or more frame numbers were skipped.
+   uint64_t gaps;
+   /*!
+    * \brief Frame numbers skipped and never received since.
+    *
+    * A frame more than 64 numbers behind the highest one cannot be told
+    * from a duplicate, so it counts as late but is not taken off missing.
+    */
+   uint64_t missing;
+   //! \brief Frames received more than once.
+   uint64_t duplicates;
+   //! \brief Frames received after frames following them were released.
+   uint64_t late;
+   //! \brief Frames received out of order, but put back in order by the buffer.
+   uint64_t reordered;
+   //! \brief Times the frame number jumped back far enough to restart tracking.
+   uint64_t resyncs;
+   //! \brief Frames released as they arrived because the frame number stopped advancing.
+   uint64_t stalled;
+   //! \brief Frames overwritten in the FrameListener buffer before being popped.
+   uint64_t overwritten;
+};
+
+/*!
+ * \brief Tracks frame number continuity and optionally restores frame order.
+ * \author Philip G. Lee
+ *
+ * Every frame goes through push(), which updates the SequenceStats and
+ * appends the frames that are ready, in release order, to its output.
+ *
+ * With a depth of 0 the sequencer only observes: every frame is released as
+ * soon as it arrives, duplicates and late ones included, exactly as it
+ * would have been without it.
+ *
+ * With a positive depth, up to \c depth frames are held so that frames
+ * arriving out of order can be released in order. A frame is held while an
+ * earlier frame number is still missing, but no frame is held longer than
+ * \c maxLatency seconds after it arrived, and only while the buffer has
+ * room. Releasing a frame releases the frames before it too. Once it is released, the
+ * missing frames are counted as lost. If one of them turns up later, it is
+ * counted as late and dropped, along with duplicates, so that released
+ * frame numbers only increase.
+ *
+ * A backward jump of more than resyncFrames() frame numbers is taken to be
+ * a server restart: the buffer is released and tracking starts over.
+ *
+ * Some server configurations stream a frame number that never advances
+ * (e.g. always 0). After stallFrames() repeats of the highest frame number
+ * in a row, the number is taken to carry no order: the buffer is released
+ * and each further repeat is released as it arrives and counted as
+ * stalled rather than as a duplicate. Only the repeats before that are
+ * dropped. Tracking resumes once the number advances.
+ *
+ * Not thread-safe; FrameListener serializes access.
+ */
+class FrameSequencer
+{
+public:
+
+   //! \brief A frame and the time it was read from the socket.
+   typedef std::pair<MocapFrame, struct timespec> Entry;
+
+   /*!
+    * \brief Constructor
+    *
+    * \param depth maximum number of frames held for reordering. 0 only observes.
+    * \param maxLatency maximum time in seconds a frame is held
+    */
+   FrameSequencer( size_t depth=0, double maxLatency=0.005 ) :
+      _depth(depth),
+      _maxLatency(maxLatency),
+      _stats(),
+      _started(false),
+      _highest(0),
+      _seen(0),
+      _next(0),
+      _repeats(0),
+      _held()
+   {
+   }
+
+   //! \brief Maximum number of frames held for reordering.
+   size_t depth() const { return _depth; }
+   //! \brief Maximum time in seconds a frame is held.
+   double maxLatency() const { return _maxLatency; }
+   //! \brief Backward jump in frame number taken as a server restart.
+   static int resyncFrames() { return 1000; }
+   //! \brief Repeats of the highest frame number in a row taken as a frame number that does not advance.
+   static int stallFrames() { return 4; }
+
+   /*!
+    * \brief Change the buffer limits.
+    *
+    * Frames already held are released if they no longer fit.
+    *
+    * \param depth maximum number of frames held. 0 only observes.
+    * \param maxLatency maximum time in seconds a frame is held
+    * \param now current time in seconds
+    * \param ready output, appended with any frames released
+    */
+   void configure( size_t depth, double maxLatency, double now, std::vector<Entry>& ready )
+   {
+      _depth = depth;
+      _maxLatency = maxLatency;
+      _release(now, ready);
+   }
+
+   /*!
+    * \brief Process an incoming frame.
+    *
+    * \param frame the frame
+    * \param ts time at which the frame was read
+    * \param ready output, appended with the frames released, in order
+    */
+   void push( MocapFrame const& frame, struct timespec const& ts, std::vector<Entry>& ready )
+   {
+      int f = frame.frameNum();
+      ++_stats.received;
+
+      if( !_started )
+         _restart(f);
+      else
+      {
+         int64_t d = static_cast<int64_t>(f) - _highest;
+         if( d != 0 )
+            _repeats = 0;
+         if( d > 0 )
+         {
+            _seen = d < 64 ? (_seen << d) | 1 : 1;
+            _highest = f;
+         }
+         else if( -d < 64 )
+         {
+            uint64_t bit = static_cast<uint64_t>(1) << -d;
+            if( _seen & bit )
+            {
+               if( d == 0 && ++_repeats >= stallFrames() )
+               {
+                  ++_stats.stalled;
+                  drain(ready);
+                  ready.push_back(Entry(frame, ts));
+                  return;
+               }
+               ++_stats.duplicates;
+               if( _depth == 0 )
+                  ready.push_back(Entry(frame, ts));
+               return;
+            }
+            _seen |= bit;
+         }
+         else if( -d > resyncFrames() )
+         {
+            ++_stats.resyncs;
+            drain(ready);
+            _restart(f);
+         }
+
+         if( f < _next )
+         {
+            ++_stats.late;
+            // Counted missing when it was skipped, unless it may be a
+            // duplicate too old for _seen.
+            if( -d < 64 && _stats.missing > 0 )
+               --_stats.missing;
+            if( _depth == 0 )
+               ready.push_back(Entry(frame, ts));
+            return;
+         }
+         if( f < _highest )
+            ++_stats.reordered;
+      }
+
+      _held.insert(std::upper_bound(_held.begin(), _held.end(), f, _Before()), Entry(frame, ts));
+      _release(NatNet::seconds(ts), ready);
+   }
+
+   /*!
+    * \brief Release frames held longer than maxLatency().
+    *
+    * \param now current time in seconds
+    * \param ready output, appended with the frames released, in order
+    */
+   void flush( double now, std::vector<Entry>& ready )
+   {
+      _release(now, ready);
+   }
+
+   //! \brief Release every held frame, in order.
+   void drain( std::vector<Entry>& ready )
+   {
+      while( !_held.empty() )
+         _pop(ready);
+   }
+
+   //! \brief Time in seconds at which flush() will release a frame, or a negative value if none is held.
+   double deadline() const
+   {
+      if( _held.empty() )
+         return -1.0;
+      return _oldest() + _maxLatency;
+   }
+
+   //! \brief Counters since construction or resetStats().
+   SequenceStats const& stats() const { return _stats; }
+
+   //! \brief Zero the counters.
+   void resetStats() { _stats = SequenceStats(); }
+
+private:
+
+   struct _Before
+   {
+      bool operator()( int f, Entry const& e ) const { return f < e.first.frameNum(); }
+   };
+
+   size_t _depth;
+   double _maxLatency;
+   SequenceStats _stats;
+   bool _started;
+   // Highest frame number seen, and which of the 64 up to it were seen.
+   int _highest;
+   uint64_t _seen;
+   // Next frame number to release.
+   int _next;
+   // Repeats of _highest in a row.
+   int _repeats;
+   std::deque<Entry> _held;
+
+   void _restart( int f )
+   {
+      _started = true;
+      _highest = f;
+      _seen = 1;
+      _next = f;
+      _repeats = 0;
+   }
+
+   // Arrival time in seconds of the longest-held frame, which need not be
+   // the first to be released. The buffer is small, so just look.
+   double _oldest() const
+   {
+      double t = NatNet::seconds(_held.front().second);
+      for( size_t i = 1; i < _held.size(); ++i )
+         t = std::min(t, NatNet::seconds(_held[i].second));
+      return t;
+   }
+
+   void _release( double now, std::vector<Entry>& ready )
+   {
+      while( !_held.empty() )
+      {
+         if( _held.front().first.frameNum() != _next &&
+             _held.size() <= _depth &&
+             now - _oldest() < _maxLatency )
+            break;
+         _pop(ready);
+      }
+   }
+
+   void _pop( std::vector<Entry>& ready )
+   {
+      int f = _held.front().first.frameNum();
+      if( f > _next )
+      {
+         ++_stats.gaps;
+         _stats.missing += static_cast<uint64_t>(f - _next);
+      }
+      _next = f + 1;
+      ready.push_back(_held.front());
+      _held.pop_front();
+   }
+};
+
+#endif /*FRAMESEQUENCER_H*/
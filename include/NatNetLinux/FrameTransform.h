@@ -0,0 +1,313 @@
+/*
+ * FrameTransform.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMETRANSFORM_H
+#define FRAMETRANSFORM_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/PoseBatch.h>
+#include <vector>
+#include <stdlib.h>
+
+/*!
+ * \brief Re-expresses every position and orientation of a MocapFrame in another frame.
+ * \author Philip G. Lee
+ *
+ * The transform is, in order of application:
+ * -# an optional axis remap (a signed permutation, e.g. y-up to z-up),
+ * -# an optional uniform scale (e.g. meters to millimeters),
+ * -# a rigid pose (e.g. the mocap world expressed in a robot base frame).
+ *
+ * So a point p goes to rotation*(scale*remap*p) + translation. The axis
+ * remap is a change of basis for both the world and the body frames, so an
+ * orientation q goes to rotation*remap*q*remap^-1.
+ *
+ * apply() gathers every point of a frame into one structure-of-arrays pass
+ * through PoseBatch, and every orientation into another, so the cost is
+ * roughly that of the copy. Install one on a FrameListener with
+ * \c FrameListener::setTransform() to have it run once per frame at decode
+ * time, rather than once per consumer.
+ */
+class FrameTransform
+{
+public:
+
+   //! \brief Default constructor. The identity transform.
+   FrameTransform() :
+      _translation(),
+      _rotation(),
+      _scale(1.f),
+      _remapQ(),
+      _points(),
+      _poses()
+   {
+      _remap[0] = 1; _remap[1] = 2; _remap[2] = 3;
+      _update();
+   }
+
+   /*!
+    * \brief Constructor.
+    *
+    * \param translation location of the mocap origin in the target frame
+    * \param rotation orientation of the mocap axes in the target frame
+    * \param scale uniform scale applied before the pose
+    */
+   FrameTransform( Point3f const& translation, Quaternion4f const& rotation, float scale=1.f ) :
+      _translation(translation),
+      _rotation(rotation),
+      _scale(scale),
+      _remapQ(),
+      _points(),
+      _poses()
+   {
+      _remap[0] = 1; _remap[1] = 2; _remap[2] = 3;
+      _update();
+   }
+
+   //! \brief Copy constructor. Does not copy scratch space.
+   FrameTransform( FrameTransform const& other ) :
+      _translation(other._translation),
+      _rotation(other._rotation),
+      _scale(other._scale),
+      _remapQ(other._remapQ),
+      _points(),
+      _poses()
+   {
+      memcpy(_remap, other._remap, sizeof(_remap));
+      memcpy(_m, other._m, sizeof(_m));
+   }
+
+   ~FrameTransform(){}
+
+   //! \brief Assignment operator. Does not copy scratch space.
+   FrameTransform& operator=( FrameTransform const& other )
+   {
+      _translation = other._translation;
+      _rotation = other._rotation;
+      _scale = other._scale;
+      _remapQ = other._remapQ;
+      memmove(_remap, other._remap, sizeof(_remap));
+      memmove(_m, other._m, sizeof(_m));
+      return *this;
+   }
+
+   //! \brief Set the rigid part of the transform.
+   void setPose( Point3f const& translation, Quaternion4f const& rotation )
+   {
+      _translation = translation;
+      _rotation = rotation;
+      _update();
+   }
+
+   //! \brief Set the uniform scale.
+   void setScale( float scale )
+   {
+      _scale = scale;
+      _update();
+   }
+
+   /*!
+    * \brief Set the axis remap.
+    *
+    * Each argument is a 1-based signed source axis: output x is
+    * sign(\c x) times input axis |\c x|, and so on. For example, Motive's
+    * y-up frame becomes a z-up frame with setAxisRemap(1,-3,2), and
+    * setAxisRemap(1,2,3) removes the remap.
+    *
+    * \returns false, leaving the remap unchanged, if the arguments are not
+    *    a signed permutation of 1,2,3
+    */
+   bool setAxisRemap( int x, int y, int z )
+   {
+      int const a[3] = {x, y, z};
+      int seen = 0;
+      for( int i = 0; i < 3; ++i )
+      {
+         int k = abs(a[i]);
+         if( k < 1 || k > 3 || (seen & (1<<k)) )
+            return false;
+         seen |= 1<<k;
+      }
+
+      memcpy(_remap, a, sizeof(_remap));
+      _update();
+      return true;
+   }
+
+   //! \brief Transform a single point.
+   Point3f apply( Point3f const& p ) const
+   {
+      return Point3f(
+         _m[0]*p.x + _m[1]*p.y + _m[2]*p.z + _translation.x,
+         _m[3]*p.x + _m[4]*p.y + _m[5]*p.z + _translation.y,
+         _m[6]*p.x + _m[7]*p.y + _m[8]*p.z + _translation.z
+      );
+   }
+
+   //! \brief Transform a single orientation.
+   Quaternion4f apply( Quaternion4f const& q ) const
+   {
+      return _rotation * _remapQ * q * _remapQ.conjugate();
+   }
+
+   /*!
+    * \brief Transform every position and orientation in \c frame in place.
+    *
+    * This covers marker sets, unidentified markers, rigid bodies and their
+    * markers, skeleton bodies and their markers, and labeled markers.
+    * Not thread-safe, since it reuses internal scratch space.
+    */
+   void apply( MocapFrame& frame )
+   {
+      _points.clear();
+      _poses.clear();
+      _gather(frame);
+
+      PoseBatch::transformPoints(_m, _translation, _points, _points);
+      PoseBatch::rotateOrientations(_rotation*_remapQ, _remapQ.conjugate(), _poses);
+
+      _next = 0;
+      _nextPose = 0;
+      _scatter(frame);
+   }
+
+private:
+
+   Point3f _translation;
+   Quaternion4f _rotation;
+   float _scale;
+   int _remap[3];
+   // Proper rotation with the same conjugation action as the remap.
+   Quaternion4f _remapQ;
+   // Row-major rotation*scale*remap.
+   float _m[9];
+
+   // Scratch space.
+   PointArray _points;
+   PoseArray _poses;
+   size_t _next;
+   size_t _nextPose;
+
+   void _update()
+   {
+      float a[9];
+      float r[9];
+      int i, j, k;
+
+      memset(a, 0, sizeof(a));
+      for( i = 0; i < 3; ++i )
+         a[3*i + abs(_remap[i])-1] = _remap[i] < 0 ? -1.f : 1.f;
+
+      // A reflection and its negation conjugate rotations identically, and
+      // one of the two is a proper rotation.
+      float det =
+         a[0]*(a[4]*a[8]-a[5]*a[7])
+         - a[1]*(a[3]*a[8]-a[5]*a[6])
+         + a[2]*(a[3]*a[7]-a[4]*a[6]);
+      Matrix3Array ma(1);
+      for( k = 0; k < 9; ++k )
+         ma.m[k][0] = det < 0.f ? -a[k] : a[k];
+      PoseArray qa(1);
+      PoseBatch::fromMatrices(ma, qa);
+      _remapQ = qa.orientation(0);
+
+      PoseArray rot(1);
+      rot.set(0, Point3f(), _rotation);
+      PoseBatch::toMatrices(rot, ma);
+      for( k = 0; k < 9; ++k )
+         r[k] = ma.m[k][0];
+
+      for( i = 0; i < 3; ++i )
+         for( j = 0; j < 3; ++j )
+            _m[3*i+j] = _scale*(r[3*i]*a[j] + r[3*i+1]*a[3+j] + r[3*i+2]*a[6+j]);
+   }
+
+   void _gather( MocapFrame const& frame )
+   {
+      size_t i, j;
+
+      std::vector<MarkerSet> const& sets = frame.markerSets();
+      for( i = 0; i < sets.size(); ++i )
+         _gatherPoints(sets[i].markers());
+
+      _gatherPoints(frame.unIdMarkers());
+      _gatherBodies(frame.rigidBodies());
+
+      std::vector<Skeleton> const& skel = frame.skeletons();
+      for( i = 0; i < skel.size(); ++i )
+         _gatherBodies(skel[i].rigidBodies());
+
+      std::vector<LabeledMarker> const& lm = frame.labeledMarkers();
+      for( j = 0; j < lm.size(); ++j )
+         _points.push_back(lm[j].location());
+   }
+
+   void _gatherPoints( std::vector<Point3f> const& p )
+   {
+      for( size_t i = 0; i < p.size(); ++i )
+         _points.push_back(p[i]);
+   }
+
+   void _gatherBodies( std::vector<RigidBody> const& bodies )
+   {
+      for( size_t i = 0; i < bodies.size(); ++i )
+      {
+         _points.push_back(bodies[i].location());
+         _poses.push_back(Point3f(), bodies[i].orientation());
+         _gatherPoints(bodies[i].markers());
+      }
+   }
+
+   void _scatter( MocapFrame& frame )
+   {
+      size_t i, j;
+
+      std::vector<MarkerSet>& sets = frame.markerSets();
+      for( i = 0; i < sets.size(); ++i )
+         _scatterPoints(sets[i].markers());
+
+      _scatterPoints(frame.unIdMarkers());
+      _scatterBodies(frame.rigidBodies());
+
+      std::vector<Skeleton>& skel = frame.skeletons();
+      for( i = 0; i < skel.size(); ++i )
+         _scatterBodies(skel[i].rigidBodies());
+
+      std::vector<LabeledMarker>& lm = frame.labeledMarkers();
+      for( j = 0; j < lm.size(); ++j )
+         lm[j].setLocation(_points.get(_next++));
+   }
+
+   void _scatterPoints( std::vector<Point3f>& p )
+   {
+      for( size_t i = 0; i < p.size(); ++i )
+         p[i] = _points.get(_next++);
+   }
+
+   void _scatterBodies( std::vector<RigidBody>& bodies )
+   {
+      for( size_t i = 0; i < bodies.size(); ++i )
+      {
+         bodies[i].setLocation(_points.get(_next++));
+         bodies[i].setOrientation(_poses.orientation(_nextPose++));
+         _scatterPoints(bodies[i].markers());
+      }
+   }
+};
+
+#endif /*FRAMETRANSFORM_H*/
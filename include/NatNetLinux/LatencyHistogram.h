@@ -0,0 +1,245 @@
+/*
+ * LatencyHistogram.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <boost/atomic.hpp>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <time.h>
+
+/*!
+ * \brief Copy of a LatencyHistogram, for reporting.
+ * \author Philip G. Lee
+ */
+class HistogramSnapshot
+{
+public:
+
+   //! \brief Default constructor. Empty.
+   HistogramSnapshot() : counts(), count(0), sum(0), max(0) {}
+
+   //! \brief Count in each bucket. See LatencyHistogram::bucket().
+   std::vector<uint64_t> counts;
+   //! \brief Number of values recorded.
+   uint64_t count;
+   //! \brief Sum of the values in nanoseconds.
+   uint64_t sum;
+   //! \brief Largest value in nanoseconds.
+   uint64_t max;
+
+   //! \brief Mean in seconds, or 0 if empty.
+   double mean() const { return count ? 1e-9*static_cast<double>(sum)/count : 0.0; }
+
+   //! \brief Largest value in seconds.
+   double maxSeconds() const { return 1e-9*static_cast<double>(max); }
+
+   /*!
+    * \brief Value in seconds below which a fraction \c q of the values fall.
+    *
+    * Returns the upper edge of the bucket holding that value, never more
+    * than max(), so it is at most about 3% high.
+    *
+    * \param q fraction in [0,1], e.g. 0.999 for p99.9
+    */
+   double percentile( double q ) const;
+
+   //! \brief Add the counts of \c other.
+   void merge( HistogramSnapshot const& other )
+   {
+      if( counts.size() < other.counts.size() )
+         counts.resize(other.counts.size(), 0);
+      for( size_t i = 0; i < other.counts.size(); ++i )
+         counts[i] += other.counts[i];
+      count += other.count;
+      sum += other.sum;
+      if( other.max > max )
+         max = other.max;
+   }
+
+   //! \brief One line with the count, p50, p99, p99.9 and max in microseconds.
+   std::string summary() const
+   {
+      char buf[160];
+      snprintf(buf, sizeof(buf), "n=%llu p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus",
+         static_cast<unsigned long long>(count),
+         1e6*percentile(0.5), 1e6*percentile(0.99), 1e6*percentile(0.999), 1e6*maxSeconds());
+      return buf;
+   }
+};
+
+/*!
+ * \brief Lock-free histogram of durations with logarithmic buckets.
+ * \author Philip G. Lee
+ *
+ * Durations are recorded in nanoseconds. Values below 32 ns get a bucket
+ * each. Above that, every power of two is split into 32 buckets, so
+ * each bucket is at most about 3% wide relative to its values, as in HDR
+ * histograms. Any 64-bit value fits, in 1920 buckets.
+ *
+ * record() is a few relaxed atomic adds, so any number of threads can
+ * record while another takes a snapshot(). A snapshot is not atomic as a
+ * whole: a value recorded during it may be missing from some of the totals.
+ * With \c reset, each bucket is read and zeroed in one step, so no value
+ * is lost between successive snapshots.
+ */
+class LatencyHistogram
+{
+public:
+
+   //! \brief Number of buckets.
+   static size_t numBuckets() { return NUM_BUCKETS; }
+
+   //! \brief Bucket of a value in nanoseconds.
+   static size_t bucket( uint64_t ns )
+   {
+      if( ns < SUB_BUCKETS )
+         return static_cast<size_t>(ns);
+      int e = 63 - __builtin_clzll(ns);
+      return static_cast<size_t>((e - SUB_BITS + 1)*SUB_BUCKETS) + static_cast<size_t>((ns >> (e - SUB_BITS)) & (SUB_BUCKETS-1));
+   }
+
+   //! \brief Largest value in nanoseconds that falls in bucket \c b.
+   static uint64_t bucketUpper( size_t b )
+   {
+      if( b < SUB_BUCKETS )
+         return b;
+      int e = static_cast<int>(b/SUB_BUCKETS) + SUB_BITS - 1;
+      uint64_t sub = b % SUB_BUCKETS;
+      uint64_t lower = (static_cast<uint64_t>(1) << e) + (sub << (e - SUB_BITS));
+      return lower + (static_cast<uint64_t>(1) << (e - SUB_BITS)) - 1;
+   }
+
+   //! \brief Nanoseconds from \c a to \c b, or 0 if \c b is earlier.
+   static uint64_t elapsed( struct timespec const& a, struct timespec const& b )
+   {
+      int64_t ns = (static_cast<int64_t>(b.tv_sec) - a.tv_sec)*1000000000LL + (b.tv_nsec - a.tv_nsec);
+      return ns > 0 ? static_cast<uint64_t>(ns) : 0;
+   }
+
+   //! \brief Constructor. Empty.
+   LatencyHistogram()
+   {
+      for( size_t i = 0; i < NUM_BUCKETS; ++i )
+         _counts[i].store(0, boost::memory_order_relaxed);
+      _count.store(0, boost::memory_order_relaxed);
+      _sum.store(0, boost::memory_order_relaxed);
+      _max.store(0, boost::memory_order_relaxed);
+   }
+
+   //! \brief Record a duration in nanoseconds. Lock-free.
+   void record( uint64_t ns )
+   {
+      _counts[bucket(ns)].fetch_add(1, boost::memory_order_relaxed);
+      _count.fetch_add(1, boost::memory_order_relaxed);
+      _sum.fetch_add(ns, boost::memory_order_relaxed);
+      uint64_t m = _max.load(boost::memory_order_relaxed);
+      while( ns > m && !_max.compare_exchange_weak(m, ns, boost::memory_order_relaxed) )
+         ;
+   }
+
+   //! \brief Record the time from \c a to \c b. Lock-free.
+   void record( struct timespec const& a, struct timespec const& b )
+   {
+      record(elapsed(a, b));
+   }
+
+   /*!
+    * \brief Copy the histogram. Lock-free.
+    *
+    * \param out output snapshot
+    * \param reset if true, zero the histogram as it is read
+    */
+   void snapshot( HistogramSnapshot& out, bool reset=false )
+   {
+      out.counts.resize(NUM_BUCKETS);
+      for( size_t i = 0; i < NUM_BUCKETS; ++i )
+         out.counts[i] = reset ? _counts[i].exchange(0, boost::memory_order_relaxed) : _counts[i].load(boost::memory_order_relaxed);
+      if( reset )
+      {
+         out.count = _count.exchange(0, boost::memory_order_relaxed);
+         out.sum = _sum.exchange(0, boost::memory_order_relaxed);
+         out.max = _max.exchange(0, boost::memory_order_relaxed);
+      }
+      else
+      {
+         out.count = _count.load(boost::memory_order_relaxed);
+         out.sum = _sum.load(boost::memory_order_relaxed);
+         out.max = _max.load(boost::memory_order_relaxed);
+      }
+   }
+
+   //! \brief Zero the histogram. Lock-free.
+   void reset()
+   {
+      HistogramSnapshot discard;
+      snapshot(discard, true);
+   }
+
+private:
+
+   enum
+   {
+      SUB_BITS = 5,
+      SUB_BUCKETS = 1 << SUB_BITS,
+      NUM_BUCKETS = (64 - SUB_BITS + 1)*SUB_BUCKETS
+   };
+
+   boost::atomic<uint64_t> _counts[NUM_BUCKETS];
+   boost::atomic<uint64_t> _count;
+   boost::atomic<uint64_t> _sum;
+   boost::atomic<uint64_t> _max;
+
+   // Not copyable.
+   LatencyHistogram( LatencyHistogram const& );
+   LatencyHistogram& operator=( LatencyHistogram const& );
+};
+
+inline double HistogramSnapshot::percentile( double q ) const
+{
+   uint64_t total = 0;
+   size_t i;
+   for( i = 0; i < counts.size(); ++i )
+      total += counts[i];
+   if( total == 0 )
+      return 0.0;
+
+   // Rank of the value, 1-based.
+   uint64_t rank = static_cast<uint64_t>(q*total + 0.5);
+   if( rank < 1 )
+      rank = 1;
+   if( rank > total )
+      rank = total;
+
+   uint64_t seen = 0;
+   for( i = 0; i < counts.size(); ++i )
+   {
+      seen += counts[i];
+      if( seen >= rank )
+         break;
+   }
+   uint64_t ns = LatencyHistogram::bucketUpper(i);
+   if( max && ns > max )
+      ns = max;
+   return 1e-9*static_cast<double>(ns);
+}
+
+#endif /*LATENCYHISTOGRAM_H*/
@@ -0,0 +1,288 @@
+/*
+ * MarkerTracker.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MARKERTRACKER_H
+#define MARKERTRACKER_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameHandler.h>
+#include <NatNetLinux/SpatialHash.h>
+#include <boost/thread.hpp>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+/*!
+ * \brief An unidentified marker with an identity that persists across frames.
+ * \author Philip G. Lee
+ */
+class TrackedMarker
+{
+public:
+
+   //! \brief Default constructor
+   TrackedMarker() :
+      id(-1),
+      location(),
+      velocity(),
+      hits(0),
+      missed(0)
+   {
+   }
+
+   //! \brief Persistent ID. Never reused.
+   int id;
+   //! \brief Last measured location, or the prediction if missed this frame.
+   Point3f location;
+   //! \brief Estimated velocity in units per second.
+   Point3f velocity;
+   //! \brief Number of frames in which the marker was seen.
+   unsigned int hits;
+   //! \brief Number of consecutive frames in which the marker was not seen.
+   unsigned int missed;
+};
+
+/*!
+ * \brief Assigns persistent IDs to unidentified markers.
+ * \author Philip G. Lee
+ *
+ * MocapFrame::unIdMarkers() carries no identity from one frame to the
+ * next. Register this with \c FrameListener::addHandler() (or call update()
+ * yourself) and it tracks every unidentified marker:
+ *
+ * - Each track predicts its location from its velocity.
+ * - The new markers are put in a SpatialHash with cells twice the gate,
+ *   so the ball of radius gate around each track's prediction touches at
+ *   most 8 cells, and the track only looks at the markers in those
+ *   instead of at all of them.
+ * - Track/marker pairs within the gate are assigned greedily, closest
+ *   first, so each marker and each track is used at most once.
+ * - An unassigned marker starts a new track. A track is confirmed after
+ *   minHits() hits, and dies after maxMissed() consecutive misses.
+ *
+ * The whole update is O(n log n) in the number of markers, dominated by
+ * sorting the candidate pairs.
+ */
+class MarkerTracker : public FrameHandler
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param gate maximum distance between a prediction and its marker
+    * \param minHits hits before a track is reported by tracks()
+    * \param maxMissed consecutive misses before a track dies
+    */
+   MarkerTracker( float gate=0.02f, unsigned int minHits=3, unsigned int maxMissed=5 ) :
+      _gate(gate),
+      _minHits(minHits),
+      _maxMissed(maxMissed),
+      _mutex(),
+      _tracks(),
+      _nextId(0),
+      _lastTime(0.0),
+      _points(),
+      _hash(2.f*gate),
+      _pairs(),
+      _markerTaken(),
+      _assignment()
+   {
+   }
+
+   virtual ~MarkerTracker(){}
+
+   //! \brief Gate distance.
+   float gate() const { return _gate; }
+   //! \brief Hits before a track is confirmed.
+   unsigned int minHits() const { return _minHits; }
+   //! \brief Consecutive misses before a track dies.
+   unsigned int maxMissed() const { return _maxMissed; }
+
+   //! \brief Track the unidentified markers. Called by FrameListener.
+   virtual void handleFrame( MocapFrame const& frame, struct timespec const& ts )
+   {
+      update(frame.unIdMarkers(), NatNet::seconds(ts));
+   }
+
+   /*!
+    * \brief Track a new set of markers. Thread-safe.
+    *
+    * \param markers markers of the new frame
+    * \param t time of the frame in seconds
+    */
+   void update( std::vector<Point3f> const& markers, double t )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      _points.assign(markers);
+      _update(t);
+   }
+
+   /*!
+    * \brief Confirmed tracks. Thread-safe.
+    *
+    * \param out output tracks. Cleared first.
+    */
+   void tracks( std::vector<TrackedMarker>& out ) const
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      out.clear();
+      for( size_t i = 0; i < _tracks.size(); ++i )
+         if( _tracks[i].hits >= _minHits )
+            out.push_back(_tracks[i]);
+   }
+
+   /*!
+    * \brief Track ID of each marker passed to the last update(). Thread-safe.
+    *
+    * \param out output IDs, parallel to the markers. -1 for markers whose
+    *    track is not confirmed yet. Cleared first.
+    */
+   void assignment( std::vector<int>& out ) const
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      out = _assignment;
+   }
+
+   //! \brief Drop all tracks. Thread-safe.
+   void clear()
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      _tracks.clear();
+      _assignment.clear();
+   }
+
+private:
+
+   // A candidate track/marker pair.
+   struct Pair
+   {
+      float d2;
+      uint32_t track;
+      uint32_t marker;
+
+      bool operator<( Pair const& o ) const { return d2 < o.d2; }
+   };
+
+   // Collects candidate pairs for one track.
+   struct PairVisitor
+   {
+      PairVisitor( std::vector<Pair>& p, uint32_t t ) : pairs(p), track(t) {}
+      void operator()( uint32_t marker, float d2 )
+      {
+         Pair p;
+         p.d2 = d2;
+         p.track = track;
+         p.marker = marker;
+         pairs.push_back(p);
+      }
+      std::vector<Pair>& pairs;
+      uint32_t track;
+   };
+
+   float _gate;
+   unsigned int _minHits;
+   unsigned int _maxMissed;
+   mutable boost::mutex _mutex;
+   std::vector<TrackedMarker> _tracks;
+   int _nextId;
+   double _lastTime;
+
+   // Scratch space, kept to avoid allocating every frame.
+   PointArray _points;
+   SpatialHash _hash;
+   std::vector<Pair> _pairs;
+   std::vector<char> _markerTaken;
+   std::vector<int> _assignment;
+
+   void _update( double t )
+   {
+      size_t i, n = _points.size();
+      float dt = _tracks.empty() ? 0.f : static_cast<float>(t - _lastTime);
+      _lastTime = t;
+
+      _hash.build(_points);
+
+      // Gather candidate pairs around each track's prediction.
+      _pairs.clear();
+      for( i = 0; i < _tracks.size(); ++i )
+      {
+         TrackedMarker const& tr = _tracks[i];
+         Point3f pred(tr.location.x + tr.velocity.x*dt, tr.location.y + tr.velocity.y*dt, tr.location.z + tr.velocity.z*dt);
+         PairVisitor v(_pairs, static_cast<uint32_t>(i));
+         _hash.visit(pred, _gate, v);
+      }
+      std::sort(_pairs.begin(), _pairs.end());
+
+      // Greedy assignment, closest first.
+      std::vector<char> trackTaken(_tracks.size(), 0);
+      _markerTaken.assign(n, 0);
+      _assignment.assign(n, -1);
+      for( i = 0; i < _pairs.size(); ++i )
+      {
+         Pair const& p = _pairs[i];
+         if( trackTaken[p.track] || _markerTaken[p.marker] )
+            continue;
+         trackTaken[p.track] = 1;
+         _markerTaken[p.marker] = 1;
+
+         TrackedMarker& tr = _tracks[p.track];
+         Point3f m = _points.get(p.marker);
+         if( dt > 0.f && tr.hits > 0 )
+            tr.velocity = Point3f((m.x-tr.location.x)/dt, (m.y-tr.location.y)/dt, (m.z-tr.location.z)/dt);
+         tr.location = m;
+         ++tr.hits;
+         tr.missed = 0;
+         if( tr.hits >= _minHits )
+            _assignment[p.marker] = tr.id;
+      }
+
+      // Misses and deaths.
+      size_t kept = 0;
+      for( i = 0; i < _tracks.size(); ++i )
+      {
+         TrackedMarker& tr = _tracks[i];
+         if( !trackTaken[i] )
+         {
+            ++tr.missed;
+            tr.location = Point3f(tr.location.x + tr.velocity.x*dt, tr.location.y + tr.velocity.y*dt, tr.location.z + tr.velocity.z*dt);
+            // A tentative track that misses is probably noise.
+            if( tr.missed > _maxMissed || tr.hits < _minHits )
+               continue;
+         }
+         _tracks[kept++] = tr;
+      }
+      _tracks.resize(kept);
+
+      // Births.
+      for( i = 0; i < n; ++i )
+      {
+         if( _markerTaken[i] )
+            continue;
+         TrackedMarker tr;
+         tr.id = _nextId++;
+         tr.location = _points.get(i);
+         tr.hits = 1;
+         _tracks.push_back(tr);
+         if( _minHits <= 1 )
+            _assignment[i] = tr.id;
+      }
+   }
+};
+
+#endif /*MARKERTRACKER_H*/
@@ -0,0 +1,425 @@
+/*
+ * Metrics.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+class MetricsRegistry;
+
+/*!
+ * \brief Handle to a monotonically increasing counter.
+ * \author Philip G. Lee
+ *
+ * Get one from \c MetricsRegistry::counter(). Handles are cheap to copy.
+ * inc() writes a slot owned by the calling thread, so it never contends
+ * with other threads and costs a thread-local lookup and an add.
+ */
+class Counter
+{
+public:
+
+   //! \brief Default constructor. An unregistered counter ignores inc().
+   Counter() : _index(static_cast<size_t>(-1)) {}
+
+   //! \brief Add \c n to the counter.
+   inline void inc( uint64_t n=1 ) const;
+
+private:
+
+   friend class MetricsRegistry;
+   explicit Counter( size_t index ) : _index(index) {}
+
+   size_t _index;
+};
+
+/*!
+ * \brief Handle to a value that can go up and down.
+ * \author Philip G. Lee
+ *
+ * Get one from \c MetricsRegistry::gauge(). Unlike Counter, a gauge is a
+ * single shared value, so set() from several threads is last-write-wins.
+ */
+class Gauge
+{
+public:
+
+   //! \brief Default constructor. An unregistered gauge ignores set() and add().
+   Gauge() : _index(static_cast<size_t>(-1)) {}
+
+   //! \brief Set the value.
+   inline void set( double value ) const;
+   //! \brief Add \c delta to the value.
+   inline void add( double delta ) const;
+
+private:
+
+   friend class MetricsRegistry;
+   explicit Gauge( size_t index ) : _index(index) {}
+
+   size_t _index;
+};
+
+/*!
+ * \brief One metric value, as read from the registry.
+ * \author Philip G. Lee
+ */
+class MetricSample
+{
+public:
+
+   //! \brief Metric kinds.
+   enum Type
+   {
+      COUNTER = 0,
+      GAUGE   = 1
+   };
+
+   //! \brief Default constructor
+   MetricSample() : name(), labels(), help(), type(COUNTER), value(0.0) {}
+
+   //! \brief Metric name, e.g. \c natnet_frame_packets_total.
+   std::string name;
+   //! \brief Prometheus label set without braces, e.g. <tt>message="ping"</tt>. May be empty.
+   std::string labels;
+   //! \brief Help text.
+   std::string help;
+   //! \brief Counter or gauge.
+   Type type;
+   //! \brief Value, summed over threads for counters.
+   double value;
+};
+
+/*!
+ * \brief Process-wide registry of counters and gauges.
+ * \author Philip G. Lee
+ *
+ * Register a metric once with counter() or gauge() and keep the handle.
+ * Registering the same name and labels again returns the same metric, so
+ * several FrameListener objects share their metrics.
+ *
+ * Every thread that increments a counter gets its own array of slots,
+ * and a read sums the arrays of every thread, so increments need no atomic
+ * read-modify-write and never share cache lines across threads. When a
+ * thread exits, its counts are folded into a shared total.
+ *
+ * The library registers its own metrics under the \c natnet_ prefix:
+ * packets, bytes, parse failures, buffer overwrites, pops and their lock
+ * wait for FrameListener and CommandListener, and creation and error
+ * counts for the socket helpers. Read them with snapshot() or value(), or
+ * export them with MetricsServer or MetricsDumper.
+ *
+ * At most capacity() counters and capacity() gauges can be registered.
+ * Beyond that, the returned handles do nothing.
+ */
+class MetricsRegistry
+{
+public:
+
+   //! \brief Maximum number of counters, and of gauges.
+   static size_t capacity() { return CAPACITY; }
+
+   //! \brief The registry. Never destroyed, so it can be used during exit.
+   static MetricsRegistry& instance()
+   {
+      static MetricsRegistry* registry = new MetricsRegistry();
+      return *registry;
+   }
+
+   /*!
+    * \brief Register a counter, or get the one already registered. Thread-safe.
+    *
+    * \param name metric name
+    * \param help help text
+    * \param labels label set without braces, e.g. <tt>op="bind"</tt>
+    * \param scale factor applied to the raw count when reading, e.g. 1e-9
+    *    for a counter of nanoseconds reported in seconds
+    */
+   Counter counter( std::string const& name, std::string const& help, std::string const& labels="", double scale=1.0 )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      size_t i = _find(name, labels, MetricSample::COUNTER, help);
+      if( i == static_cast<size_t>(-1) )
+         return Counter();
+      _scale[_info[i].slot] = scale;
+      return Counter(_info[i].slot);
+   }
+
+   //! \brief Register a gauge, or get the one already registered. Thread-safe.
+   Gauge gauge( std::string const& name, std::string const& help, std::string const& labels="" )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      size_t i = _find(name, labels, MetricSample::GAUGE, help);
+      if( i == static_cast<size_t>(-1) )
+         return Gauge();
+      return Gauge(_info[i].slot);
+   }
+
+   /*!
+    * \brief Read every metric, sorted by name and labels. Thread-safe.
+    *
+    * Counters are summed over threads under a lock that increments never
+    * take, so the sums are consistent per counter but not across counters.
+    */
+   void snapshot( std::vector<MetricSample>& out ) const
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      size_t i, j;
+      out.resize(_info.size());
+      for( i = 0; i < _info.size(); ++i )
+      {
+         Info const& info = _info[i];
+         MetricSample& s = out[i];
+         s.name = info.name;
+         s.labels = info.labels;
+         s.help = info.help;
+         s.type = info.type;
+         if( info.type == MetricSample::COUNTER )
+         {
+            uint64_t sum = _retired[info.slot];
+            for( j = 0; j < _shards.size(); ++j )
+               sum += _shards[j]->cells[info.slot].load(boost::memory_order_relaxed);
+            s.value = _scale[info.slot] * static_cast<double>(sum);
+         }
+         else
+            s.value = _gaugeValue(info.slot);
+      }
+   }
+
+   //! \brief Value of one metric, or 0 if it is not registered. Thread-safe.
+   double value( std::string const& name, std::string const& labels="" ) const
+   {
+      std::vector<MetricSample> all;
+      snapshot(all);
+      for( size_t i = 0; i < all.size(); ++i )
+         if( all[i].name == name && all[i].labels == labels )
+            return all[i].value;
+      return 0.0;
+   }
+
+   //! \brief Every metric in the Prometheus text exposition format. Thread-safe.
+   std::string prometheusText() const
+   {
+      std::vector<MetricSample> all;
+      std::string ret;
+      char buf[64];
+      snapshot(all);
+      for( size_t i = 0; i < all.size(); ++i )
+      {
+         MetricSample const& s = all[i];
+         if( i == 0 || all[i-1].name != s.name )
+         {
+            ret += "# HELP " + s.name + " " + s.help + "\n";
+            ret += "# TYPE " + s.name + (s.type == MetricSample::COUNTER ? " counter\n" : " gauge\n");
+         }
+         ret += s.name;
+         if( !s.labels.empty() )
+            ret += "{" + s.labels + "}";
+         snprintf(buf, sizeof(buf), " %.17g\n", s.value);
+         ret += buf;
+      }
+      return ret;
+   }
+
+private:
+
+   friend class Counter;
+   friend class Gauge;
+
+   enum { CAPACITY = 512 };
+
+   // One thread's counter slots.
+   struct Shard
+   {
+      boost::atomic<uint64_t> cells[CAPACITY];
+
+      Shard()
+      {
+         for( size_t i = 0; i < capacity(); ++i )
+            cells[i].store(0, boost::memory_order_relaxed);
+      }
+   };
+
+   struct Info
+   {
+      std::string name;
+      std::string labels;
+      std::string help;
+      MetricSample::Type type;
+      size_t slot;
+
+      bool operator<( Info const& other ) const
+      {
+         return name < other.name || (name == other.name && labels < other.labels);
+      }
+   };
+
+   mutable boost::mutex _mutex;
+   // Sorted by name and labels.
+   std::vector<Info> _info;
+   size_t _numCounters;
+   size_t _numGauges;
+   std::vector<Shard*> _shards;
+   boost::thread_specific_ptr<Shard> _local;
+   // Counts of threads that exited.
+   uint64_t _retired[CAPACITY];
+   double _scale[CAPACITY];
+   // Gauge values, as the bits of a double.
+   boost::atomic<uint64_t> _gauges[CAPACITY];
+
+   MetricsRegistry() :
+      _mutex(),
+      _info(),
+      _numCounters(0),
+      _numGauges(0),
+      _shards(),
+      _local(&MetricsRegistry::_retire)
+   {
+      for( size_t i = 0; i < capacity(); ++i )
+      {
+         _retired[i] = 0;
+         _scale[i] = 1.0;
+         _gauges[i].store(_bits(0.0), boost::memory_order_relaxed);
+      }
+   }
+
+   // Not copyable.
+   MetricsRegistry( MetricsRegistry const& );
+   MetricsRegistry& operator=( MetricsRegistry const& );
+
+   // Index into _info of the metric, registering it if needed. Call with _mutex held.
+   size_t _find( std::string const& name, std::string const& labels, MetricSample::Type type, std::string const& help )
+   {
+      Info key;
+      key.name = name;
+      key.labels = labels;
+      key.help = help;
+      key.type = type;
+      std::vector<Info>::iterator it = std::lower_bound(_info.begin(), _info.end(), key);
+      if( it != _info.end() && it->name == name && it->labels == labels )
+         return it->type == type ? static_cast<size_t>(it - _info.begin()) : static_cast<size_t>(-1);
+
+      size_t& used = type == MetricSample::COUNTER ? _numCounters : _numGauges;
+      if( used >= capacity() )
+         return static_cast<size_t>(-1);
+      key.slot = used++;
+      size_t i = static_cast<size_t>(it - _info.begin());
+      _info.insert(it, key);
+      return i;
+   }
+
+   Shard* _shard()
+   {
+#ifdef __GNUC__
+      if( _cached() )
+         return _cached();
+#endif
+      Shard* s = _local.get();
+      if( !s )
+      {
+         s = new Shard();
+         boost::mutex::scoped_lock lock(_mutex);
+         _shards.push_back(s);
+         _local.reset(s);
+      }
+#ifdef __GNUC__
+      _cached() = s;
+#endif
+      return s;
+   }
+
+#ifdef __GNUC__
+   // The calling thread's shard, in a plain thread-local to skip
+   // pthread_getspecific().
+   static Shard*& _cached()
+   {
+      static __thread Shard* cached = 0;
+      return cached;
+   }
+#endif
+
+   // Called when a thread with a shard exits.
+   static void _retire( Shard* s )
+   {
+      MetricsRegistry& r = instance();
+      boost::mutex::scoped_lock lock(r._mutex);
+      for( size_t i = 0; i < capacity(); ++i )
+         r._retired[i] += s->cells[i].load(boost::memory_order_relaxed);
+      r._shards.erase(std::remove(r._shards.begin(), r._shards.end(), s), r._shards.end());
+      delete s;
+#ifdef __GNUC__
+      _cached() = 0;
+#endif
+   }
+
+   static uint64_t _bits( double v )
+   {
+      uint64_t b;
+      memcpy(&b, &v, sizeof(b));
+      return b;
+   }
+
+   double _gaugeValue( size_t slot ) const
+   {
+      uint64_t b = _gauges[slot].load(boost::memory_order_relaxed);
+      double v;
+      memcpy(&v, &b, sizeof(v));
+      return v;
+   }
+};
+
+inline void Counter::inc( uint64_t n ) const
+{
+   if( _index >= MetricsRegistry::capacity() )
+      return;
+   // Only this thread writes its own slot, so no read-modify-write is needed.
+   boost::atomic<uint64_t>& cell = MetricsRegistry::instance()._shard()->cells[_index];
+   cell.store(cell.load(boost::memory_order_relaxed) + n, boost::memory_order_relaxed);
+}
+
+inline void Gauge::set( double value ) const
+{
+   if( _index >= MetricsRegistry::capacity() )
+      return;
+   MetricsRegistry::instance()._gauges[_index].store(MetricsRegistry::_bits(value), boost::memory_order_relaxed);
+}
+
+inline void Gauge::add( double delta ) const
+{
+   if( _index >= MetricsRegistry::capacity() )
+      return;
+   MetricsRegistry& r = MetricsRegistry::instance();
+   uint64_t expected = r._gauges[_index].load(boost::memory_order_relaxed);
+   for(;;)
+   {
+      double v;
+      memcpy(&v, &expected, sizeof(v));
+      if( r._gauges[_index].compare_exchange_weak(expected, MetricsRegistry::_bits(v + delta), boost::memory_order_relaxed) )
+         break;
+   }
+}
+
+#endif /*METRICS_H*/
@@ -0,0 +1,268 @@
+/*
+ * MetricsExporter.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METRICSEXPORTER_H
+#define METRICSEXPORTER_H
+
+#include <NatNetLinux/Metrics.h>
+#include <boost/thread.hpp>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*!
+ * \brief Thread serving MetricsRegistry as Prometheus text over HTTP.
+ * \author Philip G. Lee
+ *
+ * Every request on the port, whatever its path, gets the current
+ * \c MetricsRegistry::prometheusText(). Binds to the loopback interface
+ * unless told otherwise.
+ */
+class MetricsServer
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param port TCP port to listen on
+    * \param inAddr address to bind, in network order. Defaults to 127.0.0.1.
+    */
+   MetricsServer( uint16_t port=9464, uint32_t inAddr=htonl(INADDR_LOOPBACK) ) :
+      _thread(0),
+      _port(port),
+      _inAddr(inAddr),
+      _sd(-1),
+      _run(false)
+   {
+   }
+
+   ~MetricsServer()
+   {
+      if( running() )
+         stop();
+      if( _thread )
+         _thread->join();
+      delete _thread;
+      if( _sd >= 0 )
+         close(_sd);
+   }
+
+   /*!
+    * \brief Bind the port and start serving in a new thread. Non-blocking.
+    *
+    * \returns false if the port could not be bound
+    */
+   bool start()
+   {
+      struct sockaddr_in addr;
+      int value = 1;
+
+      _sd = socket(AF_INET, SOCK_STREAM, 0);
+      if( _sd < 0 )
+         return false;
+      setsockopt(_sd, SOL_SOCKET, SO_REUSEADDR, (char*)&value, sizeof(value));
+
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(_port);
+      addr.sin_addr.s_addr = _inAddr;
+      if( bind(_sd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(_sd, 4) < 0 )
+      {
+         close(_sd);
+         _sd = -1;
+         return false;
+      }
+
+      _run = true;
+      _thread = new boost::thread( &MetricsServer::_work, this );
+      return true;
+   }
+
+   //! \brief Cause the thread to stop. Non-blocking.
+   void stop()
+   {
+      _run = false;
+   }
+
+   //! \brief Return true iff the serving thread is running. Non-blocking.
+   bool running()
+   {
+      return _run;
+   }
+
+   //! \brief Wait for the serving thread to stop. Blocking.
+   void join()
+   {
+      if(_thread)
+         _thread->join();
+   }
+
+private:
+
+   boost::thread* _thread;
+   uint16_t _port;
+   uint32_t _inAddr;
+   int _sd;
+   bool _run;
+
+   void _work()
+   {
+      fd_set rfds;
+      struct timeval timeout;
+      char request[1024];
+
+      while(_run)
+      {
+         // Wake up every second to check whether we were stopped.
+         timeout.tv_sec = 1; timeout.tv_usec = 0;
+         FD_ZERO(&rfds); FD_SET(_sd, &rfds);
+         if( select(_sd+1, &rfds, 0, 0, &timeout) <= 0 )
+            continue;
+
+         int client = accept(_sd, 0, 0);
+         if( client < 0 )
+            continue;
+
+         // Wait briefly for the request, but answer whatever it was.
+         timeout.tv_sec = 1; timeout.tv_usec = 0;
+         FD_ZERO(&rfds); FD_SET(client, &rfds);
+         if( select(client+1, &rfds, 0, 0, &timeout) > 0 )
+            recv(client, request, sizeof(request), 0);
+
+         std::string body = MetricsRegistry::instance().prometheusText();
+         char header[128];
+         snprintf(header, sizeof(header),
+            "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %lu\r\n\r\n",
+            static_cast<unsigned long>(body.size()));
+         std::string response = header + body;
+
+         size_t sent = 0;
+         while( sent < response.size() )
+         {
+            ssize_t n = ::send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if( n <= 0 )
+               break;
+            sent += static_cast<size_t>(n);
+         }
+         close(client);
+      }
+   }
+};
+
+/*!
+ * \brief Thread writing MetricsRegistry to a file periodically.
+ * \author Philip G. Lee
+ *
+ * The file holds the Prometheus text of the registry, e.g. for the
+ * node_exporter textfile collector. Each dump is written to a temporary
+ * file and renamed over the target, so readers never see a partial one.
+ */
+class MetricsDumper
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param path file to write
+    * \param period seconds between dumps
+    */
+   MetricsDumper( std::string const& path, double period=10.0 ) :
+      _thread(0),
+      _path(path),
+      _period(period),
+      _run(false)
+   {
+   }
+
+   ~MetricsDumper()
+   {
+      if( running() )
+         stop();
+      if( _thread )
+         _thread->join();
+      delete _thread;
+   }
+
+   //! \brief Begin dumping in a new thread. Non-blocking.
+   void start()
+   {
+      _run = true;
+      _thread = new boost::thread( &MetricsDumper::_work, this );
+   }
+
+   //! \brief Cause the thread to stop after a last dump. Non-blocking.
+   void stop()
+   {
+      _run = false;
+   }
+
+   //! \brief Return true iff the dumping thread is running. Non-blocking.
+   bool running()
+   {
+      return _run;
+   }
+
+   //! \brief Wait for the dumping thread to stop. Blocking.
+   void join()
+   {
+      if(_thread)
+         _thread->join();
+   }
+
+   //! \brief Write the registry to the file now. Returns false on error.
+   bool dump() const
+   {
+      std::string tmp = _path + ".tmp";
+      std::string text = MetricsRegistry::instance().prometheusText();
+      FILE* f = fopen(tmp.c_str(), "w");
+      if( !f )
+         return false;
+      bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+      ok = (fclose(f) == 0) && ok;
+      return ok && rename(tmp.c_str(), _path.c_str()) == 0;
+   }
+
+private:
+
+   boost::thread* _thread;
+   std::string _path;
+   double _period;
+   bool _run;
+
+   void _work()
+   {
+      while(_run)
+      {
+         dump();
+         // Sleep in short steps so stop() takes effect quickly.
+         for( double slept = 0.0; _run && slept < _period; slept += 0.1 )
+            usleep(100000);
+      }
+      dump();
+   }
+};
+
+#endif /*METRICSEXPORTER_H*/
@@ -0,0 +1,445 @@
+/*
+ * MotionEstimator.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MOTIONESTIMATOR_H
+#define MOTIONESTIMATOR_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameHandler.h>
+#include <boost/atomic.hpp>
+#include <limits.h>
+#include <math.h>
+
+/*!
+ * \brief Velocity and acceleration of one rigid body.
+ * \author Philip G. Lee
+ */
+class BodyMotion
+{
+public:
+
+   //! \brief Default constructor
+   BodyMotion() :
+      time(0.0),
+      frameNum(0),
+      samples(0),
+      gaps(0),
+      linearVelocity(),
+      angularVelocity(),
+      linearAcceleration(),
+      angularAcceleration()
+   {
+   }
+
+   //! \brief Time in seconds of the last valid pose.
+   double time;
+   //! \brief MocapFrame::frameNum() of the last valid pose.
+   int frameNum;
+   /*!
+    * \brief Valid poses since the estimate (re)started.
+    *
+    * Velocities need at least 2, accelerations at least 3.
+    */
+   unsigned int samples;
+   //! \brief Number of times frames were missed or tracking was lost.
+   unsigned int gaps;
+   //! \brief Linear velocity in units per second.
+   Point3f linearVelocity;
+   //! \brief Angular velocity in rad/s about world axes.
+   Point3f angularVelocity;
+   //! \brief Linear acceleration in units per second^2.
+   Point3f linearAcceleration;
+   //! \brief Angular acceleration in rad/s^2 about world axes.
+   Point3f angularAcceleration;
+};
+
+/*!
+ * \brief Incremental per-body velocity and acceleration estimates.
+ * \author Philip G. Lee
+ *
+ * Register this with \c FrameListener::addHandler() and it maintains, for
+ * every rigid body, smoothed finite-difference linear and angular velocity
+ * and acceleration. Each frame costs O(1) per body.
+ *
+ * The time step between two poses is their frame number difference times
+ * the frame period if setFramePeriod() was given one, else the difference
+ * of their MocapFrame::captureTime() if a ClockEstimator sets it, else the
+ * difference of their arrival times. Skipped frames just mean a longer time
+ * step, and are counted as gaps. A step longer than the arrival times
+ * allow, by more than half a step plus maxJitter(), means the frame numbers
+ * jumped and restarts the body's estimate, as does a gap longer than
+ * maxGap(). A shorter one is just a delayed packet. Poses with invalid
+ * tracking are ignored.
+ *
+ * Once two frames have different frame numbers, a pose within maxGap()
+ * whose frame number does not advance (a duplicate or reordered frame) is
+ * ignored too. Until then, as with servers that leave frame numbers
+ * undefined in live mode, arrival order is trusted. So it is again after
+ * stallFrames() repeats of a frame number in a row (e.g. a paused server),
+ * with time steps from capture or arrival times, until the number changes.
+ *
+ * Readers never block the listener or each other: each body's estimate is
+ * published through a sequence lock, and the body index is a fixed-size
+ * open-addressed table, so motion() is lock-free. The price is a fixed
+ * capacity, set at construction.
+ */
+class MotionEstimator : public FrameHandler
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param capacity maximum number of distinct rigid bodies
+    * \param smoothing weight in (0,1] of each new finite difference
+    * \param maxGap seconds without a valid pose after which to restart
+    */
+   MotionEstimator( size_t capacity=256, float smoothing=0.5f, double maxGap=0.25 ) :
+      _capacity(capacity),
+      _tableSize(1),
+      _smoothing(smoothing),
+      _maxGap(maxGap),
+      _framePeriod(0.0),
+      _maxJitter(0.05),
+      _numbered(false),
+      _lastFrameNum(0),
+      _repeats(0),
+      _started(false),
+      _bodies(0),
+      _keys(0),
+      _slots(0),
+      _numBodies(0),
+      _dropped(0)
+   {
+      while( _tableSize < 2*capacity )
+         _tableSize <<= 1;
+
+      _bodies = new Body[capacity];
+      _keys = new boost::atomic<int>[_tableSize];
+      _slots = new int[_tableSize];
+      for( size_t i = 0; i < _tableSize; ++i )
+         _keys[i].store(_emptyKey(), boost::memory_order_relaxed);
+   }
+
+   virtual ~MotionEstimator()
+   {
+      delete[] _bodies;
+      delete[] _keys;
+      delete[] _slots;
+   }
+
+   /*!
+    * \brief Set the camera frame period in seconds.
+    *
+    * If 0 (the default), time steps come from arrival times only. Call
+    * this before the listener starts.
+    */
+   void setFramePeriod( double period ) { _framePeriod = period; }
+   //! \brief Camera frame period in seconds, or 0 if unknown.
+   double framePeriod() const { return _framePeriod; }
+   //! \brief Seconds without a valid pose after which a body restarts.
+   double maxGap() const { return _maxGap; }
+   /*!
+    * \brief Set the arrival jitter in seconds tolerated beyond half a time step.
+    *
+    * Call this before the listener starts.
+    */
+   void setMaxJitter( double seconds ) { _maxJitter = seconds; }
+   //! \brief Arrival jitter in seconds tolerated beyond half a time step.
+   double maxJitter() const { return _maxJitter; }
+   //! \brief Repeats of a frame number in a row after which frame numbers are not trusted.
+   static int stallFrames() { return 4; }
+   //! \brief Bodies ignored because the capacity was exceeded.
+   unsigned long droppedBodies() const { return _dropped.load(boost::memory_order_relaxed); }
+
+   //! \brief Update estimates. Called by FrameListener.
+   virtual void handleFrame( MocapFrame const& frame, struct timespec const& ts )
+   {
+      update(frame, NatNet::seconds(ts));
+   }
+
+   /*!
+    * \brief Update estimates from \c frame.
+    *
+    * Not safe to call from more than one thread at a time, but safe
+    * against concurrent motion().
+    *
+    * \param frame new frame
+    * \param t arrival time of the frame in seconds
+    */
+   void update( MocapFrame const& frame, double t )
+   {
+      std::vector<RigidBody> const& bodies = frame.rigidBodies();
+      size_t i;
+
+      // Frame numbers are trusted once two frames differ, and until one
+      // repeats stallFrames() times in a row.
+      if( _started && frame.frameNum() == _lastFrameNum )
+      {
+         if( ++_repeats >= stallFrames() )
+            _numbered = false;
+      }
+      else
+      {
+         if( _started )
+            _numbered = true;
+         _repeats = 0;
+      }
+      _lastFrameNum = frame.frameNum();
+      _started = true;
+
+      for( i = 0; i < bodies.size(); ++i )
+      {
+         Body* b = _findOrAdd(bodies[i].id());
+         if( !b )
+            continue;
+
+         if( !bodies[i].trackingValid() )
+         {
+            b->lost = true;
+            continue;
+         }
+
+         // Duplicate or reordered: differencing it would give a zero or
+         // backwards step. After a long gap, the server may have restarted.
+         if( _numbered && b->motion.samples > 0 && frame.frameNum() - b->motion.frameNum <= 0 &&
+             t - b->motion.time <= _maxGap )
+            continue;
+
+         b->begin();
+         b->update(t, frame.captureTime(), frame.frameNum(), bodies[i].location(), bodies[i].orientation(), *this);
+         b->end();
+      }
+   }
+
+   /*!
+    * \brief Latest estimate for a rigid body. Lock-free and thread-safe.
+    *
+    * \param id RigidBody::id() of the body
+    * \param out output estimate
+    * \returns false if the body has never been seen
+    */
+   bool motion( int id, BodyMotion& out ) const
+   {
+      int slot = _find(id);
+      if( slot < 0 )
+         return false;
+
+      Body const& b = _bodies[slot];
+      unsigned int s1, s2;
+      do
+      {
+         s1 = b.seq.load(boost::memory_order_acquire);
+         out = b.motion;
+         boost::atomic_thread_fence(boost::memory_order_acquire);
+         s2 = b.seq.load(boost::memory_order_relaxed);
+      } while( (s1 & 1) || s1 != s2 );
+
+      return true;
+   }
+
+private:
+
+   class Body
+   {
+   public:
+      Body() : seq(0), motion(), capture(0.0), loc(), ori(), rawVel(), rawAngVel(), lost(false) {}
+
+      // Sequence lock: odd while the writer is updating motion.
+      boost::atomic<unsigned int> seq;
+      BodyMotion motion;
+
+      // Writer-only state.
+      double capture;
+      Point3f loc;
+      Quaternion4f ori;
+      Point3f rawVel;
+      Point3f rawAngVel;
+      bool lost;
+
+      void begin()
+      {
+         seq.store(seq.load(boost::memory_order_relaxed)+1, boost::memory_order_relaxed);
+         boost::atomic_thread_fence(boost::memory_order_release);
+      }
+
+      void end()
+      {
+         seq.store(seq.load(boost::memory_order_relaxed)+1, boost::memory_order_release);
+      }
+
+      void update( double t, double c, int frameNum, Point3f const& l, Quaternion4f const& q, MotionEstimator const& est )
+      {
+         BodyMotion& m = motion;
+         double dtArrival = t - m.time;
+         int dFrames = frameNum - m.frameNum;
+         double dt = dtArrival;
+         bool restart = m.samples == 0 || dtArrival > est._maxGap || dtArrival <= 0.0;
+
+         if( !restart && est._numbered && est._framePeriod > 0.0 )
+            dt = dFrames*est._framePeriod;
+         else if( !restart && c > 0.0 && capture > 0.0 )
+            dt = c - capture;
+         // Frame numbers or capture times that ran this far ahead of the
+         // arrival times have jumped.
+         if( !restart && (dt <= 0.0 || dt - dtArrival > 0.5*dt + est._maxJitter) )
+            restart = true;
+
+         if( restart )
+         {
+            unsigned int gaps = m.gaps + (m.samples > 0 ? 1 : 0);
+            m = BodyMotion();
+            m.gaps = gaps;
+            _set(t, c, frameNum, l, q);
+            m.samples = 1;
+            return;
+         }
+
+         bool skipped = est._numbered && dFrames > 1;
+         if( lost || skipped )
+            ++m.gaps;
+
+         float fdt = static_cast<float>(dt);
+         float g = est._smoothing;
+
+         Point3f v((l.x-loc.x)/fdt, (l.y-loc.y)/fdt, (l.z-loc.z)/fdt);
+         Point3f w = _angularVelocity(ori, q, fdt);
+
+         if( m.samples >= 2 )
+         {
+            Point3f a((v.x-rawVel.x)/fdt, (v.y-rawVel.y)/fdt, (v.z-rawVel.z)/fdt);
+            Point3f aa((w.x-rawAngVel.x)/fdt, (w.y-rawAngVel.y)/fdt, (w.z-rawAngVel.z)/fdt);
+            if( m.samples == 2 )
+            {
+               m.linearAcceleration = a;
+               m.angularAcceleration = aa;
+            }
+            else
+            {
+               _blend(m.linearAcceleration, a, g);
+               _blend(m.angularAcceleration, aa, g);
+            }
+            _blend(m.linearVelocity, v, g);
+            _blend(m.angularVelocity, w, g);
+         }
+         else
+         {
+            m.linearVelocity = v;
+            m.angularVelocity = w;
+         }
+
+         rawVel = v;
+         rawAngVel = w;
+         _set(t, c, frameNum, l, q);
+         ++m.samples;
+      }
+
+   private:
+      void _set( double t, double c, int frameNum, Point3f const& l, Quaternion4f const& q )
+      {
+         motion.time = t;
+         capture = c;
+         motion.frameNum = frameNum;
+         loc = l;
+         ori = q;
+         lost = false;
+      }
+
+      static void _blend( Point3f& a, Point3f const& b, float g )
+      {
+         a.x += g*(b.x-a.x);
+         a.y += g*(b.y-a.y);
+         a.z += g*(b.z-a.z);
+      }
+
+      // World-frame angular velocity taking q0 to q1 in dt.
+      static Point3f _angularVelocity( Quaternion4f const& q0, Quaternion4f const& q1, float dt )
+      {
+         Quaternion4f dq = q1 * q0.conjugate();
+         float s = dq.qw < 0.f ? -1.f : 1.f;
+         float sinHalf = sqrtf(dq.qx*dq.qx + dq.qy*dq.qy + dq.qz*dq.qz);
+         float angle = 2.f*atan2f(sinHalf, s*dq.qw);
+         float k = s*(sinHalf > 1e-9f ? angle/(sinHalf*dt) : 2.f/dt);
+         return Point3f(k*dq.qx, k*dq.qy, k*dq.qz);
+      }
+   };
+
+   size_t _capacity;
+   size_t _tableSize;
+   float _smoothing;
+   double _maxGap;
+   double _framePeriod;
+   double _maxJitter;
+   // Whether frame numbers are trusted, the last one, how many times in a
+   // row it has repeated, and whether there has been a frame at all.
+   bool _numbered;
+   int _lastFrameNum;
+   int _repeats;
+   bool _started;
+
+   Body* _bodies;
+   // Open-addressed id -> slot table. A key is published only after its slot.
+   boost::atomic<int>* _keys;
+   int* _slots;
+   size_t _numBodies;
+   boost::atomic<unsigned long> _dropped;
+
+   static int _emptyKey() { return INT_MIN; }
+
+   size_t _hash( int id ) const
+   {
+      return (static_cast<unsigned int>(id) * 2654435761u) & (_tableSize-1);
+   }
+
+   int _find( int id ) const
+   {
+      size_t h = _hash(id);
+      for( size_t n = 0; n < _tableSize; ++n, h = (h+1) & (_tableSize-1) )
+      {
+         int k = _keys[h].load(boost::memory_order_acquire);
+         if( k == id )
+            return _slots[h];
+         if( k == _emptyKey() )
+            return -1;
+      }
+      return -1;
+   }
+
+   Body* _findOrAdd( int id )
+   {
+      size_t h = _hash(id);
+      for( size_t n = 0; n < _tableSize; ++n, h = (h+1) & (_tableSize-1) )
+      {
+         int k = _keys[h].load(boost::memory_order_relaxed);
+         if( k == id )
+            return &_bodies[_slots[h]];
+         if( k == _emptyKey() )
+         {
+            if( _numBodies >= _capacity )
+               break;
+            _slots[h] = static_cast<int>(_numBodies);
+            _keys[h].store(id, boost::memory_order_release);
+            return &_bodies[_numBodies++];
+         }
+      }
+      _dropped.fetch_add(1, boost::memory_order_relaxed);
+      return 0;
+   }
+};
+
+#endif /*MOTIONESTIMATOR_H*/
@@ -23,10 +23,13 @@
 #include <iomanip>
 #include <ios>
 #include <vector>
+#include <algorithm>
 #include <cmath>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <time.h>
 
 #include <unistd.h>
 #include <errno.h>
@@ -35,6 +38,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <NatNetLinux/Metrics.h>
 
 /*!
  * \brief Encapsulates basic NatNet communication functionality
@@ -96,6 +100,7 @@ public:
       if( sd < 0 )
       {
          std::cerr << "Could not open socket. Error: " << errno << std::endl;
+         _countSocketError("socket");
          exit(1);
       }
       
@@ -104,6 +109,7 @@ public:
       if( tmp < 0 )
       {
          std::cerr << "Could not bind socket. Error: " << errno << std::endl;
+         _countSocketError("bind");
          close(sd);
          exit(1);
       }
@@ -113,6 +119,7 @@ public:
       if( tmp < 0 )
       {
          std::cerr << "Could not set socket to broadcast mode. Error: " << errno << std::endl;
+         _countSocketError("setsockopt");
          close(sd);
          exit(1);
       }
@@ -125,6 +132,7 @@ public:
             << rcvBufSize << "B got " << tmp << "B" << std::endl;
       }
       
+      _countSocket("command", sd);
       return sd;
    }
    
@@ -154,12 +162,14 @@ public:
       if( tmp < 0 )
       {
          std::cerr << "ERROR: Could not set socket option." << std::endl;
+         _countSocketError("setsockopt");
          close(sd);
          return -1;
       }
       
       // Bind the socket to a port.
-      bind(sd, (struct sockaddr*)&localSock, sizeof(localSock));
+      if( bind(sd, (struct sockaddr*)&localSock, sizeof(localSock)) < 0 )
+         _countSocketError("bind");
       
       // Connect a local interface address to the multicast interface address.
       group.imr_multiaddr.s_addr = multicastAddr;
@@ -168,12 +178,71 @@ public:
       if( tmp < 0 )
       {
          std::cerr << "ERROR: Could not add the interface to the multicast group." << std::endl;
+         _countSocketError("membership");
          close(sd);
          return -1;
       }
       
+      _countSocket("data", sd);
       return sd;
    }
+   
+   //! \brief Convert a timestamp to seconds.
+   static double seconds( struct timespec const& ts )
+   {
+      return static_cast<double>(ts.tv_sec) + 1e-9*static_cast<double>(ts.tv_nsec);
+   }
+   
+   /*!
+    * \brief Current time in seconds.
+    * 
+    * Uses \c CLOCK_REALTIME, the same clock that stamps frames in
+    * FrameListener.
+    */
+   static double now()
+   {
+      struct timespec ts;
+      clock_gettime( CLOCK_REALTIME, &ts );
+      return seconds(ts);
+   }
+   
+   /*!
+    * \brief Copy \c n packed bytes to \c out and advance \c data past them.
+    * 
+    * \returns false, leaving \c data alone, if fewer than \c n bytes are
+    *    left before \c end
+    */
+   static bool unpackBytes( char const*& data, char const* end, void* out, size_t n )
+   {
+      if( end - data < static_cast<ptrdiff_t>(n) )
+         return false;
+      memcpy(out, data, n);
+      data += n;
+      return true;
+   }
+   
+private:
+   
+   // Count a socket created by the helpers above, and record its receive buffer size.
+   static void _countSocket( char const* kind, int sd )
+   {
+      std::string labels = std::string("kind=\"") + kind + "\"";
+      int rcvBuf = 0;
+      socklen_t len = sizeof(rcvBuf);
+      MetricsRegistry& metrics = MetricsRegistry::instance();
+      metrics.counter("natnet_sockets_created_total", "Sockets created by the NatNet helpers.", labels).inc();
+      if( getsockopt(sd, SOL_SOCKET, SO_RCVBUF, (char*)&rcvBuf, &len) == 0 )
+         metrics.gauge("natnet_socket_receive_buffer_bytes", "Kernel receive buffer size of the last socket created.", labels).set(rcvBuf);
+   }
+   
+   // Count a failed socket call in the helpers above.
+   static void _countSocketError( char const* op )
+   {
+      MetricsRegistry::instance().counter(
+         "natnet_socket_errors_total", "Failed socket calls in the NatNet helpers.",
+         std::string("op=\"") + op + "\""
+      ).inc();
+   }
 };
 
 /*!
@@ -285,10 +354,10 @@ public:
    {
       float x,y,z,w;
       
-      x = qw*rhs.qw - qx*rhs.qx - qy*rhs.qy - qz*rhs.qz;
-      y = qw*rhs.qx + qx*rhs.qw + qy*rhs.qz - qz*rhs.qy;
-      z = qw*rhs.qy - qx*rhs.qz + qy*rhs.qw + qz*rhs.qx;
-      w = qw*rhs.qz + qx*rhs.qy - qy*rhs.qx + qz*rhs.qw;
+      w = qw*rhs.qw - qx*rhs.qx - qy*rhs.qy - qz*rhs.qz;
+      x = qw*rhs.qx + qx*rhs.qw + qy*rhs.qz - qz*rhs.qy;
+      y = qw*rhs.qy - qx*rhs.qz + qy*rhs.qw + qz*rhs.qx;
+      z = qw*rhs.qz + qx*rhs.qy - qy*rhs.qx + qz*rhs.qw;
       
       qx = x;
       qy = y;
@@ -313,9 +382,8 @@ public:
    //! \brief Quaternion division/assignment
    Quaternion4f& operator/=(Quaternion4f const& rhs)
    {
-      // Create the conjugate and multiply.
-      Quaternion4f rhsConj(-rhs.qx, -rhs.qy, -rhs.qy, rhs.qw);
-      *this *= rhsConj;
+      // Multiply by the conjugate.
+      *this *= rhs.conjugate();
       return *this;
    }
    
@@ -333,12 +401,65 @@ public:
       Point3f pout;
       
       pout.x = (1.f-2.f*qy*qy-2.f*qz*qz)*p.x + (2.f*qx*qy-2.f*qw*qz)*p.y + (2.f*qx*qz+2.f*qw*qy)*p.z;
-      pout.y = (2.f*qx*qy+2.f*qw*qz)*p.x + (1.f-2.f*qx*qx-2.f*qz*qz)*p.y + (2.f*qy*qz+2.f*qw*qx)*p.z;
-      pout.z = (2.f*qx*qz-2.f*qw*qy)*p.x + (2.f*qy*qz-2.f*qw*qx)*p.y + (1.f-2.f*qx*qx-2.f*qy*qy)*p.z;
+      pout.y = (2.f*qx*qy+2.f*qw*qz)*p.x + (1.f-2.f*qx*qx-2.f*qz*qz)*p.y + (2.f*qy*qz-2.f*qw*qx)*p.z;
+      pout.z = (2.f*qx*qz-2.f*qw*qy)*p.x + (2.f*qy*qz+2.f*qw*qx)*p.y + (1.f-2.f*qx*qx-2.f*qy*qy)*p.z;
       
       return pout;
    }
    
+   //! \brief Conjugate, which is also the inverse of a unit quaternion.
+   Quaternion4f conjugate() const
+   {
+      return Quaternion4f(-qx, -qy, -qz, qw);
+   }
+   
+   //! \brief Dot product of the two quaternions as 4-vectors.
+   float dot( Quaternion4f const& rhs ) const
+   {
+      return qx*rhs.qx + qy*rhs.qy + qz*rhs.qz + qw*rhs.qw;
+   }
+   
+   /*!
+    * \brief Spherical linear interpolation along the shortest arc.
+    * 
+    * \param a orientation at \c t = 0
+    * \param b orientation at \c t = 1
+    * \param t interpolation parameter, usually in [0,1]
+    */
+   static Quaternion4f slerp( Quaternion4f const& a, Quaternion4f const& b, float t )
+   {
+      float d = a.dot(b);
+      float s = 1.f;
+      if( d < 0.f )
+      {
+         d = -d;
+         s = -1.f;
+      }
+      
+      float wa, wb;
+      // Fall back to linear interpolation when the angle is tiny.
+      if( d > 0.9995f )
+      {
+         wa = 1.f - t;
+         wb = t;
+      }
+      else
+      {
+         float theta = acosf(d);
+         float sinTheta = sinf(theta);
+         wa = sinf((1.f-t)*theta) / sinTheta;
+         wb = sinf(t*theta) / sinTheta;
+      }
+      wb *= s;
+      
+      return Quaternion4f(
+         wa*a.qx + wb*b.qx,
+         wa*a.qy + wb*b.qy,
+         wa*a.qz + wb*b.qz,
+         wa*a.qw + wb*b.qw
+      );
+   }
+   
 private:
    
    // If the magnitude of the quaternion exceeds a tolerance, renormalize it
@@ -442,37 +563,66 @@ public:
    Quaternion4f orientation() const { return _ori; }
    //! \brief Vector of markers that make up this RigidBody
    std::vector<Point3f> const& markers() const { return _markers; }
+   //! \brief Mutable vector of markers that make up this RigidBody
+   std::vector<Point3f>& markers() { return _markers; }
+   //! \brief IDs of the markers(). Used in NatNet version >= 2.0.
+   std::vector<uint32_t> const& markerIds() const { return _mId; }
+   //! \brief Mutable IDs of the markers().
+   std::vector<uint32_t>& markerIds() { return _mId; }
+   //! \brief Sizes of the markers(). Used in NatNet version >= 2.0.
+   std::vector<float> const& markerSizes() const { return _mSize; }
+   //! \brief Mutable sizes of the markers().
+   std::vector<float>& markerSizes() { return _mSize; }
    //! \brief True if the tracking is valid. Used in NatNet version >= 2.6.
    bool trackingValid() const { return _trackingValid; }
+   //! \brief Mean marker error. Used in NatNet version >= 2.0.
+   float meanMarkerError() const { return _mErr; }
+   
+   //! \brief Set the location of this RigidBody
+   void setLocation( Point3f const& loc ) { _loc = loc; }
+   //! \brief Set the ID of this RigidBody
+   void setId( int id ) { _id = id; }
+   //! \brief Set the orientation of this RigidBody
+   void setOrientation( Quaternion4f const& ori ) { _ori = ori; }
+   //! \brief Set whether the tracking is valid.
+   void setTrackingValid( bool valid ) { _trackingValid = valid; }
+   //! \brief Set the mean marker error.
+   void setMeanMarkerError( float err ) { _mErr = err; }
    
    /*!
     * \brief Unpack rigid body data from raw packed data.
     * 
     * \param data pointer to packed data representing a RigidBody
+    * \param end one past the end of the packed data
     * \param nnMajor major version of NatNet used to construct the packed data
     * \param nnMinor Minor version of NatNet packets used to read this frame
-    * \returns pointer to data immediately following the RigidBody data
+    * \returns pointer to data immediately following the RigidBody data, or
+    *    0 if it would run past \c end
     */
-   char const* unpack(char const* data, char nnMajor, char nnMinor)
+   char const* unpack(char const* data, char const* end, char nnMajor, char nnMinor)
    {
       int i;
       float x,y,z;
       
-      // Rigid body ID
-      memcpy(&_id,data,4); data += 4;
+      // Rigid body ID, location, orientation and number of markers.
+      int nMarkers = 0;
+      if( !NatNet::unpackBytes(data, end, &_id, 4) ||
+          !NatNet::unpackBytes(data, end, &_loc.x, 4) ||
+          !NatNet::unpackBytes(data, end, &_loc.y, 4) ||
+          !NatNet::unpackBytes(data, end, &_loc.z, 4) ||
+          !NatNet::unpackBytes(data, end, &_ori.qx, 4) ||
+          !NatNet::unpackBytes(data, end, &_ori.qy, 4) ||
+          !NatNet::unpackBytes(data, end, &_ori.qz, 4) ||
+          !NatNet::unpackBytes(data, end, &_ori.qw, 4) ||
+          !NatNet::unpackBytes(data, end, &nMarkers, 4) )
+         return 0;
       
-      // Location and orientation.
-      memcpy(&_loc.x,data,4); data += 4;
-      memcpy(&_loc.y,data,4); data += 4;
-      memcpy(&_loc.z,data,4); data += 4;
-      memcpy(&_ori.qx,data,4); data += 4;
-      memcpy(&_ori.qy,data,4); data += 4;
-      memcpy(&_ori.qz,data,4); data += 4;
-      memcpy(&_ori.qw,data,4); data += 4;
+      // Each marker's location, and from 2.0 its ID and size, must fit.
+      int markerBytes = nnMajor >= 2 ? 20 : 12;
+      if( nMarkers < 0 || nMarkers > (end - data)/markerBytes )
+         return 0;
       
       // Associated markers
-      int nMarkers = 0;
-      memcpy(&nMarkers,data,4); data += 4;
       for( i = 0; i < nMarkers; ++i )
       {
          memcpy(&x,data,4); data += 4;
@@ -502,11 +652,84 @@ public:
          if( ((nnMajor==2) && (nnMinor >= 6)) || (nnMajor > 2) || (nnMajor == 0) )
          {
             uint16_t tmp;
-            memcpy(&tmp, data, 2); data += 2;
+            if( !NatNet::unpackBytes(data, end, &tmp, 2) )
+               return 0;
             _trackingValid = tmp & 0x01;
          }
          // Mean marker error
-         memcpy(&_mErr,data,4); data += 4;
+         if( !NatNet::unpackBytes(data, end, &_mErr, 4) )
+            return 0;
+      }
+      
+      return data;
+   }
+   
+   //! \brief Bytes that pack() writes.
+   size_t packedSize( char nnMajor, char nnMinor ) const
+   {
+      size_t n = 36 + 12*_markers.size();
+      if( nnMajor >= 2 )
+      {
+         n += 8*_markers.size() + 4;
+         if( ((nnMajor==2) && (nnMinor >= 6)) || (nnMajor > 2) || (nnMajor == 0) )
+            n += 2;
+      }
+      return n;
+   }
+   
+   /*!
+    * \brief Pack rigid body data the way unpack() reads it.
+    * 
+    * Markers without an ID or size in markerIds() or markerSizes() get 0.
+    * 
+    * \param data output buffer, with at least packedSize() bytes
+    * \param nnMajor major version of NatNet to pack for
+    * \param nnMinor minor version of NatNet to pack for
+    * \returns pointer to data immediately following the RigidBody data
+    */
+   char* pack( char* data, char nnMajor, char nnMinor ) const
+   {
+      size_t i;
+      int nMarkers = static_cast<int>(_markers.size());
+      
+      memcpy(data,&_id,4); data += 4;
+      memcpy(data,&_loc.x,4); data += 4;
+      memcpy(data,&_loc.y,4); data += 4;
+      memcpy(data,&_loc.z,4); data += 4;
+      memcpy(data,&_ori.qx,4); data += 4;
+      memcpy(data,&_ori.qy,4); data += 4;
+      memcpy(data,&_ori.qz,4); data += 4;
+      memcpy(data,&_ori.qw,4); data += 4;
+      
+      memcpy(data,&nMarkers,4); data += 4;
+      for( i = 0; i < _markers.size(); ++i )
+      {
+         memcpy(data,&_markers[i].x,4); data += 4;
+         memcpy(data,&_markers[i].y,4); data += 4;
+         memcpy(data,&_markers[i].z,4); data += 4;
+      }
+      
+      if( nnMajor >= 2 )
+      {
+         uint32_t id;
+         float size;
+         for( i = 0; i < _markers.size(); ++i )
+         {
+            id = i < _mId.size() ? _mId[i] : 0;
+            memcpy(data,&id,4); data += 4;
+         }
+         for( i = 0; i < _markers.size(); ++i )
+         {
+            size = i < _mSize.size() ? _mSize[i] : 0.f;
+            memcpy(data,&size,4); data += 4;
+         }
+         
+         if( ((nnMajor==2) && (nnMinor >= 6)) || (nnMajor > 2) || (nnMajor == 0) )
+         {
+            uint16_t tmp = _trackingValid ? 0x01 : 0x00;
+            memcpy(data,&tmp,2); data += 2;
+         }
+         memcpy(data,&_mErr,4); data += 4;
       }
       
       return data;
@@ -575,27 +798,37 @@ public:
    
    //! \brief The name of the set
    std::string const& name() const { return _name; }
+   //! \brief Set the name().
+   void setName( std::string const& name ) { _name = name; }
    //! \brief Vector of markers making up the set
    std::vector<Point3f> const& markers() const { return _markers; }
+   //! \brief Mutable vector of markers making up the set
+   std::vector<Point3f>& markers() { return _markers; }
    
    /*!
     * \brief Unpack the set from raw packed data
     * 
     * \param data pointer to packed data representing the MarkerSet
-    * \returns pointer to data immediately following the MarkerSet data
+    * \param end one past the end of the packed data
+    * \returns pointer to data immediately following the MarkerSet data, or
+    *    0 if it would run past \c end
     */
-   char const* unpack(char const* data)
+   char const* unpack(char const* data, char const* end)
    {
-      char n[256]; n[255] = '\0';
       int numMarkers;
       int i;
       float x,y,z;
       
-      strncpy(n,data,sizeof(n)-1);
-      _name = n;
-      data += strlen(n)+1;
+      // Names are kept to the 255 characters that pack() writes.
+      char const* nul = static_cast<char const*>(memchr(data, '\0', end - data));
+      if( !nul )
+         return 0;
+      _name.assign(data, std::min(nul - data, static_cast<ptrdiff_t>(255)));
+      data = nul + 1;
       
-      memcpy(&numMarkers, data, 4); data += 4;
+      if( !NatNet::unpackBytes(data, end, &numMarkers, 4) ||
+          numMarkers < 0 || numMarkers > (end - data)/12 )
+         return 0;
       for( i = 0; i < numMarkers; ++i )
       {
          memcpy(&x,data,4); data += 4;
@@ -607,6 +840,37 @@ public:
       return data;
    }
    
+   //! \brief Bytes that pack() writes.
+   size_t packedSize() const
+   {
+      return std::min(_name.size(), static_cast<size_t>(255)) + 5 + 12*_markers.size();
+   }
+   
+   /*!
+    * \brief Pack the set the way unpack() reads it.
+    * 
+    * \param data output buffer, with at least packedSize() bytes
+    * \returns pointer to data immediately following the MarkerSet data
+    */
+   char* pack(char* data) const
+   {
+      size_t len = std::min(_name.size(), static_cast<size_t>(255));
+      int numMarkers = static_cast<int>(_markers.size());
+      
+      memcpy(data,_name.data(),len); data += len;
+      *data++ = '\0';
+      
+      memcpy(data,&numMarkers,4); data += 4;
+      for( size_t i = 0; i < _markers.size(); ++i )
+      {
+         memcpy(data,&_markers[i].x,4); data += 4;
+         memcpy(data,&_markers[i].y,4); data += 4;
+         memcpy(data,&_markers[i].z,4); data += 4;
+      }
+      
+      return data;
+   }
+   
 private:
    
    std::string _name;
@@ -656,34 +920,74 @@ public:
    
    //! \brief ID of this skeleton.
    int id() const { return _id; }
+   //! \brief Set the id().
+   void setId( int id ) { _id = id; }
    //! \brief Vector of rigid bodies in this skeleton.
    std::vector<RigidBody> const& rigidBodies() const { return _rBodies; }
+   //! \brief Mutable vector of rigid bodies in this skeleton.
+   std::vector<RigidBody>& rigidBodies() { return _rBodies; }
    
    /*!
     * \brief Unpack skeleton data from raw packed data.
     * 
     * \param data pointer to packed data representing a Skeleton
+    * \param end one past the end of the packed data
     * \param nnMajor major version of NatNet used to construct the packed data
     * \param nnMinor Minor version of NatNet packets used to read this frame
-    * \returns pointer to data immediately following the Skeleton data
+    * \returns pointer to data immediately following the Skeleton data, or
+    *    0 if it would run past \c end
     */
-   char const* unpack( char const* data, char nnMajor, char nnMinor )
+   char const* unpack( char const* data, char const* end, char nnMajor, char nnMinor )
    {
       int i;
       int numRigid = 0;
       
-      memcpy(&_id,data,4); data += 4;
-      memcpy(&numRigid,data,4); data += 4;
+      // A rigid body takes 36 bytes at least, which bounds numRigid.
+      if( !NatNet::unpackBytes(data, end, &_id, 4) ||
+          !NatNet::unpackBytes(data, end, &numRigid, 4) ||
+          numRigid < 0 || numRigid > (end - data)/36 )
+         return 0;
       for( i = 0; i < numRigid; ++i )
       {
          RigidBody b;
-         data = b.unpack( data, nnMajor, nnMinor );
+         data = b.unpack( data, end, nnMajor, nnMinor );
+         if( !data )
+            return 0;
          _rBodies.push_back(b);
       }
       
       return data;
    }
    
+   //! \brief Bytes that pack() writes.
+   size_t packedSize( char nnMajor, char nnMinor ) const
+   {
+      size_t n = 8;
+      for( size_t i = 0; i < _rBodies.size(); ++i )
+         n += _rBodies[i].packedSize(nnMajor, nnMinor);
+      return n;
+   }
+   
+   /*!
+    * \brief Pack skeleton data the way unpack() reads it.
+    * 
+    * \param data output buffer, with at least packedSize() bytes
+    * \param nnMajor major version of NatNet to pack for
+    * \param nnMinor minor version of NatNet to pack for
+    * \returns pointer to data immediately following the Skeleton data
+    */
+   char* pack( char* data, char nnMajor, char nnMinor ) const
+   {
+      int numRigid = static_cast<int>(_rBodies.size());
+      
+      memcpy(data,&_id,4); data += 4;
+      memcpy(data,&numRigid,4); data += 4;
+      for( size_t i = 0; i < _rBodies.size(); ++i )
+         data = _rBodies[i].pack( data, nnMajor, nnMinor );
+      
+      return data;
+   }
+   
 private:
    int _id;
    std::vector<RigidBody> _rBodies;
@@ -726,19 +1030,29 @@ public:
    
    //! \brief ID of this marker.
    int id() const { return _id; }
+   //! \brief Set the id().
+   void setId( int id ) { _id = id; }
    //! \brief Location of this marker.
    Point3f location() const { return _p; }
+   //! \brief Set the location of this marker.
+   void setLocation( Point3f const& p ) { _p = p; }
    //! \brief Size of this marker.
    float size() const { return _size; }
+   //! \brief Set the size().
+   void setSize( float size ) { _size = size; }
    
    /*!
     * \brief Unpack the marker from packed data.
     * 
     * \param data pointer to packed data representing a labeled marker
-    * \returns pointer to data immediately following the labeled marker data
+    * \param end one past the end of the packed data
+    * \returns pointer to data immediately following the labeled marker data,
+    *    or 0 if it would run past \c end
     */
-   char const* unpack( char const* data )
+   char const* unpack( char const* data, char const* end )
    {
+      if( end - data < static_cast<ptrdiff_t>(packedSize()) )
+         return 0;
       memcpy(&_id,data,4); data += 4;
       memcpy(&_p.x,data,4); data += 4;
       memcpy(&_p.y,data,4); data += 4;
@@ -748,6 +1062,26 @@ public:
       return data;
    }
    
+   //! \brief Bytes that pack() writes.
+   static size_t packedSize() { return 20; }
+   
+   /*!
+    * \brief Pack the marker the way unpack() reads it.
+    * 
+    * \param data output buffer, with at least packedSize() bytes
+    * \returns pointer to data immediately following the labeled marker data
+    */
+   char* pack( char* data ) const
+   {
+      memcpy(data,&_id,4); data += 4;
+      memcpy(data,&_p.x,4); data += 4;
+      memcpy(data,&_p.y,4); data += 4;
+      memcpy(data,&_p.z,4); data += 4;
+      memcpy(data,&_size,4); data += 4;
+      
+      return data;
+   }
+   
 private:
    int _id;
    Point3f _p;
@@ -776,7 +1110,11 @@ public:
       _nnMinor(nnMinor),
       _frameNum(0),
       _numMarkerSets(0),
-      _numRigidBodies(0)
+      _numRigidBodies(0),
+      _latency(0.f),
+      _timecode(0),
+      _subTimecode(0),
+      _captureTime(0.0)
    {
       
    }
@@ -796,7 +1134,8 @@ public:
       _labeledMarkers(other._labeledMarkers),
       _latency(other._latency),
       _timecode(other._timecode),
-      _subTimecode(other._subTimecode)
+      _subTimecode(other._subTimecode),
+      _captureTime(other._captureTime)
    {
       
    }
@@ -817,6 +1156,7 @@ public:
       _latency = other._latency;
       _timecode = other._timecode;
       _subTimecode = other._subTimecode;
+      _captureTime = other._captureTime;
       
       return *this;
    }
@@ -828,12 +1168,32 @@ public:
     * and is the actual frame number in playback mode.
     */
    int frameNum() const { return _frameNum; }
+   //! \brief Set the frameNum().
+   void setFrameNum( int frameNum ) { _frameNum = frameNum; }
+   //! \brief Major version of NatNet this frame is read with.
+   unsigned char nnMajor() const { return _nnMajor; }
+   //! \brief Minor version of NatNet this frame is read with.
+   unsigned char nnMinor() const { return _nnMinor; }
    //! \brief All the sets of markers except unidentified ones.
    std::vector<MarkerSet> const& markerSets() const { return _markerSet; }
+   //! \brief Mutable sets of markers except unidentified ones.
+   std::vector<MarkerSet>& markerSets() { return _markerSet; }
    //! \brief Set of unidentified markers.
    std::vector<Point3f> const& unIdMarkers() const { return _uidMarker; }
+   //! \brief Mutable set of unidentified markers.
+   std::vector<Point3f>& unIdMarkers() { return _uidMarker; }
    //! \brief All the rigid bodies.
    std::vector<RigidBody> const& rigidBodies() const { return _rBodies; }
+   //! \brief Mutable rigid bodies.
+   std::vector<RigidBody>& rigidBodies() { return _rBodies; }
+   //! \brief All the skeletons. Used in NatNet version >= 2.1.
+   std::vector<Skeleton> const& skeletons() const { return _skel; }
+   //! \brief Mutable skeletons.
+   std::vector<Skeleton>& skeletons() { return _skel; }
+   //! \brief All the labeled markers. Used in NatNet version >= 2.3.
+   std::vector<LabeledMarker> const& labeledMarkers() const { return _labeledMarkers; }
+   //! \brief Mutable labeled markers.
+   std::vector<LabeledMarker>& labeledMarkers() { return _labeledMarkers; }
    /*!
     * \brief Either latency or timecode for the current frame.
     * 
@@ -842,6 +1202,8 @@ public:
     * arrived from all the cameras.
     */
    float latency() const { return _latency; }
+   //! \brief Set the latency().
+   void setLatency( float latency ) { _latency = latency; }
    /*!
     * \brief SMTPE timecode and sub-timecode.
     * 
@@ -853,6 +1215,12 @@ public:
       timecode = _timecode;
       subframe = _subTimecode;
    }
+   //! \brief Set the timecode() and subframe.
+   void setTimecode( uint32_t timecode, uint32_t subframe )
+   {
+      _timecode = timecode;
+      _subTimecode = subframe;
+   }
    /*!
     * \brief Timecode decoded.
     * 
@@ -876,6 +1244,15 @@ public:
       frame = _timecode&0xFF;
       subFrame = _subTimecode;
    }
+   /*!
+    * \brief Estimated capture time in seconds on the local clock, or 0 if unknown.
+    * 
+    * Set by a ClockEstimator, e.g. via \c FrameListener::setClockEstimator().
+    * Comparable with \c NatNet::now().
+    */
+   double captureTime() const { return _captureTime; }
+   //! \brief Set the captureTime().
+   void setCaptureTime( double t ) { _captureTime = t; }
    
    /*!
     * \brief Unpack frame data from a packed buffer
@@ -884,33 +1261,44 @@ public:
     * specified in the constructor for this function to properly read the
     * data, as the data format depends on those version numbers.
     * 
+    * Every count is checked against what is left before \c end, so a
+    * truncated or corrupt buffer is never read past.
+    * 
     * \param data input data buffer
-    * \returns pointer to data immediately following the frame data
+    * \param end one past the end of the input data
+    * \returns pointer to data immediately following the frame data, or 0
+    *    if it would run past \c end, in which case the frame is partly
+    *    filled and should be discarded
     */
-   char const* unpack(char const* data)
+   char const* unpack(char const* data, char const* end)
    {
       int i;
       int numUidMarkers;
       float x,y,z;
       
-      //char const* const dataBeg = data;
-      
       // NOTE: need to worry about network order here?
       
       // Get frame number.
-      memcpy(&_frameNum, data, 4); data += 4;
+      if( !NatNet::unpackBytes(data, end, &_frameNum, 4) )
+         return 0;
       
-      // Get marker sets.
-      memcpy(&_numMarkerSets, data, 4); data += 4;
+      // Get marker sets. Each takes 5 bytes at least.
+      if( !NatNet::unpackBytes(data, end, &_numMarkerSets, 4) ||
+          _numMarkerSets < 0 || _numMarkerSets > (end - data)/5 )
+         return 0;
       for( i = 0; i < _numMarkerSets; ++i )
       {
          MarkerSet set;
-         data = set.unpack(data);
+         data = set.unpack(data, end);
+         if( !data )
+            return 0;
          _markerSet.push_back(set);
       }
       
       // Get unidentified markers.
-      memcpy(&numUidMarkers,data,4); data += 4;
+      if( !NatNet::unpackBytes(data, end, &numUidMarkers, 4) ||
+          numUidMarkers < 0 || numUidMarkers > (end - data)/12 )
+         return 0;
       for( i = 0; i < numUidMarkers; ++i )
       {
          memcpy(&x,data,4); data += 4;
@@ -919,25 +1307,33 @@ public:
          _uidMarker.push_back(Point3f(x,y,z));
       }
       
-      // Get rigid bodies
+      // Get rigid bodies. Each takes 36 bytes at least.
       _numRigidBodies = 0;
-      memcpy(&_numRigidBodies,data,4); data += 4;
+      if( !NatNet::unpackBytes(data, end, &_numRigidBodies, 4) ||
+          _numRigidBodies < 0 || _numRigidBodies > (end - data)/36 )
+         return 0;
       for( i = 0; i < _numRigidBodies; ++i )
       {
          RigidBody b;
-         data = b.unpack(data, _nnMajor, _nnMinor);
+         data = b.unpack(data, end, _nnMajor, _nnMinor);
+         if( !data )
+            return 0;
          _rBodies.push_back(b);
       }
       
-      // Get skeletons (NatNet 2.1 and later)
+      // Get skeletons (NatNet 2.1 and later). Each takes 8 bytes at least.
       if( _nnMajor > 2 || (_nnMajor==2 && _nnMinor >= 1) )
       {
          int numSkel = 0;
-         memcpy(&numSkel,data,4); data += 4;
+         if( !NatNet::unpackBytes(data, end, &numSkel, 4) ||
+             numSkel < 0 || numSkel > (end - data)/8 )
+            return 0;
          for( i = 0; i < numSkel; ++i )
          {
             Skeleton s;
-            data = s.unpack( data, _nnMajor, _nnMinor );
+            data = s.unpack( data, end, _nnMajor, _nnMinor );
+            if( !data )
+               return 0;
             _skel.push_back(s);
          }
       }
@@ -946,25 +1342,105 @@ public:
       if( _nnMajor > 2 || (_nnMajor==2 && _nnMinor >= 3) )
       {
          int numLabMark = 0;
-         memcpy(&numLabMark,data,4); data += 4;
+         if( !NatNet::unpackBytes(data, end, &numLabMark, 4) || numLabMark < 0 ||
+             numLabMark > (end - data)/static_cast<ptrdiff_t>(LabeledMarker::packedSize()) )
+            return 0;
          for( i = 0; i < numLabMark; ++i )
          {
             LabeledMarker lm;
-            data = lm.unpack(data);
+            data = lm.unpack(data, end);
             _labeledMarkers.push_back(lm);
          }
       }
       
-      // Get latency/timecode
-      memcpy(&_latency,data,4); data += 4;
+      // Get latency, timecode and the "end of data" tag.
+      int eod = 0;
+      if( !NatNet::unpackBytes(data, end, &_latency, 4) ||
+          !NatNet::unpackBytes(data, end, &_timecode, 4) ||
+          !NatNet::unpackBytes(data, end, &_subTimecode, 4) ||
+          !NatNet::unpackBytes(data, end, &eod, 4) )
+         return 0;
+      
+      return data;
+   }
+   
+   //! \brief Bytes that pack() writes.
+   size_t packedSize() const
+   {
+      size_t i;
+      size_t n = 16 + 12*_uidMarker.size() + 16;
+      for( i = 0; i < _markerSet.size(); ++i )
+         n += _markerSet[i].packedSize();
+      for( i = 0; i < _rBodies.size(); ++i )
+         n += _rBodies[i].packedSize(_nnMajor, _nnMinor);
+      if( _nnMajor > 2 || (_nnMajor==2 && _nnMinor >= 1) )
+      {
+         n += 4;
+         for( i = 0; i < _skel.size(); ++i )
+            n += _skel[i].packedSize(_nnMajor, _nnMinor);
+      }
+      if( _nnMajor > 2 || (_nnMajor==2 && _nnMinor >= 3) )
+         n += 4 + _labeledMarkers.size()*LabeledMarker::packedSize();
+      return n;
+   }
+   
+   /*!
+    * \brief Pack frame data the way unpack() reads it, e.g. for a NAT_FRAMEOFDATA payload.
+    * 
+    * Sections the frame's NatNet version does not have, such as skeletons
+    * before 2.1, are left out.
+    * 
+    * \param data output buffer, with at least packedSize() bytes
+    * \returns pointer to data immediately following the frame data
+    */
+   char* pack(char* data) const
+   {
+      size_t i;
+      int n;
+      
+      memcpy(data, &_frameNum, 4); data += 4;
+      
+      n = static_cast<int>(_markerSet.size());
+      memcpy(data, &n, 4); data += 4;
+      for( i = 0; i < _markerSet.size(); ++i )
+         data = _markerSet[i].pack(data);
+      
+      n = static_cast<int>(_uidMarker.size());
+      memcpy(data, &n, 4); data += 4;
+      for( i = 0; i < _uidMarker.size(); ++i )
+      {
+         memcpy(data,&_uidMarker[i].x,4); data += 4;
+         memcpy(data,&_uidMarker[i].y,4); data += 4;
+         memcpy(data,&_uidMarker[i].z,4); data += 4;
+      }
+      
+      n = static_cast<int>(_rBodies.size());
+      memcpy(data, &n, 4); data += 4;
+      for( i = 0; i < _rBodies.size(); ++i )
+         data = _rBodies[i].pack(data, _nnMajor, _nnMinor);
+      
+      if( _nnMajor > 2 || (_nnMajor==2 && _nnMinor >= 1) )
+      {
+         n = static_cast<int>(_skel.size());
+         memcpy(data, &n, 4); data += 4;
+         for( i = 0; i < _skel.size(); ++i )
+            data = _skel[i].pack(data, _nnMajor, _nnMinor);
+      }
+      
+      if( _nnMajor > 2 || (_nnMajor==2 && _nnMinor >= 3) )
+      {
+         n = static_cast<int>(_labeledMarkers.size());
+         memcpy(data, &n, 4); data += 4;
+         for( i = 0; i < _labeledMarkers.size(); ++i )
+            data = _labeledMarkers[i].pack(data);
+      }
       
-      // Get timecode
-      memcpy(&_timecode,data,4); data += 4;
-      memcpy(&_subTimecode,data,4); data += 4;
+      memcpy(data,&_latency,4); data += 4;
+      memcpy(data,&_timecode,4); data += 4;
+      memcpy(data,&_subTimecode,4); data += 4;
       
-      // Get "end of data" tag
       int eod = 0;
-      memcpy(&eod,data,4); data += 4;
+      memcpy(data,&eod,4); data += 4;
       
       return data;
    }
@@ -992,6 +1468,8 @@ private:
    // Timestamp;
    uint32_t _timecode;
    uint32_t _subTimecode;
+   // Estimated capture time on the local clock.
+   double _captureTime;
 };
 
 //! \brief For displaying human-readable MocapFrame data.
@@ -23,6 +23,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <string.h>
+#include <NatNetLinux/Metrics.h>
+#include <NatNetLinux/Probes.h>
 
 /*!
  * \brief Encapsulates NatNet packets.
@@ -99,6 +101,20 @@ public:
       return packet;
    }
    
+   /*!
+    * \brief Set the header of a packet whose payload is already written.
+    * \param m message ID
+    * \param nDataBytes bytes of payload after the 4-byte header
+    */
+   void setHeader( NatNetMessageID m, unsigned short nDataBytes )
+   {
+      uint16_t msg = m;
+      uint16_t len = nDataBytes;
+      
+      *reinterpret_cast<uint16_t*>(_data)   = msg;
+      *reinterpret_cast<uint16_t*>(_data+2) = len;
+   }
+   
    /*!
     * \brief Send packet over the series of tubes.
     * \param sd Socket to use (already bound to an address)
@@ -106,7 +122,7 @@ public:
    int send(int sd) const
    {
       // Have to prepend '::' to avoid conflicting with NatNetPacket::send().
-      return ::send(sd, _data, 4+nDataBytes(), 0);
+      return _countSent( iMessage(), ::send(sd, _data, 4+nDataBytes(), 0) );
    }
    
    /*! \brief Send packet over the series of tubes.
@@ -115,7 +131,7 @@ public:
     */
    int send(int sd, struct sockaddr_in destAddr) const
    {
-      return sendto(sd, _data, 4+nDataBytes(), 0, (sockaddr*)&destAddr, sizeof(destAddr));
+      return _countSent( iMessage(), sendto(sd, _data, 4+nDataBytes(), 0, (sockaddr*)&destAddr, sizeof(destAddr)) );
    }
    
    //! \brief Return a raw pointer to the packet data. Careful.
@@ -144,6 +160,18 @@ public:
       return _dataLen;
    }
    
+   //! \brief Largest UDP payload over IPv4, so the largest packet that can be sent.
+   static size_t maxDatagram()
+   {
+      return 65507;
+   }
+   
+   //! \brief True if a payload of \c n bytes fits the 16-bit length, one datagram and this packet.
+   bool fits( size_t n ) const
+   {
+      return n <= 0xFFFF && 4 + n <= maxDatagram() && 4 + n <= maxLength();
+   }
+   
    //! \brief Get the message type.
    NatNetMessageID iMessage() const
    {
@@ -179,6 +207,43 @@ public:
    
 private:
    
+   // Update the send metrics and probe with the result of send() or sendto().
+   // Frames of data are counted apart from command traffic.
+   static int _countSent( int message, ssize_t ret )
+   {
+      MetricsRegistry& registry = MetricsRegistry::instance();
+      static Counter packets[2] = {
+         registry.counter("natnet_packets_sent_total", "NatNet packets sent.", "kind=\"command\""),
+         registry.counter("natnet_packets_sent_total", "NatNet packets sent.", "kind=\"frame\"")
+      };
+      static Counter bytes[2] = {
+         registry.counter("natnet_bytes_sent_total", "Bytes of NatNet packets sent.", "kind=\"command\""),
+         registry.counter("natnet_bytes_sent_total", "Bytes of NatNet packets sent.", "kind=\"frame\"")
+      };
+      static Counter errors[2] = {
+         registry.counter("natnet_send_errors_total", "NatNet packets that failed to send.", "kind=\"command\""),
+         registry.counter("natnet_send_errors_total", "NatNet packets that failed to send.", "kind=\"frame\"")
+      };
+      int kind = message == NAT_FRAMEOFDATA ? 1 : 0;
+
+      if( kind )
+      {
+         NATNET_PROBE1(frame_sent, ret);
+      }
+      else
+      {
+         NATNET_PROBE2(command_sent, message, ret);
+      }
+      if( ret < 0 )
+         errors[kind].inc();
+      else
+      {
+         packets[kind].inc();
+         bytes[kind].inc(static_cast<uint64_t>(ret));
+      }
+      return static_cast<int>(ret);
+   }
+   
    char* _data;
    size_t _dataLen;
 
@@ -78,6 +78,47 @@ public:
       return _natNetVersion;
    }
    
+   //! \brief Set the name(), truncated to fit.
+   void setName( std::string const& name )
+   {
+      memset(_name, 0, MAX_NAMELENGTH);
+      strncpy(_name, name.c_str(), MAX_NAMELENGTH-1);
+   }
+   
+   //! \brief Set the version() as major.minor.build.revision.
+   void setVersion( unsigned char major, unsigned char minor, unsigned char build=0, unsigned char revision=0 )
+   {
+      _version[0] = major;
+      _version[1] = minor;
+      _version[2] = build;
+      _version[3] = revision;
+   }
+   
+   //! \brief Set the natNetVersion() as major.minor.build.revision.
+   void setNatNetVersion( unsigned char major, unsigned char minor, unsigned char build=0, unsigned char revision=0 )
+   {
+      _natNetVersion[0] = major;
+      _natNetVersion[1] = minor;
+      _natNetVersion[2] = build;
+      _natNetVersion[3] = revision;
+   }
+   
+   //! \brief Bytes that pack() writes.
+   static size_t packedSize() { return MAX_NAMELENGTH + 8; }
+   
+   /*!
+    * \brief Pack the class the way unpack() reads it.
+    * \returns pointer to data immediately following the sender data
+    */
+   char* pack(char* data) const
+   {
+      memcpy( data, _name, MAX_NAMELENGTH );
+      data += MAX_NAMELENGTH;
+      memcpy( data, _version, 4 );
+      memcpy( data+4, _natNetVersion, 4 );
+      return data + 8;
+   }
+   
    //! \brief Unpack the class from raw pointer.
    void unpack(char const* data)
    {
@@ -0,0 +1,90 @@
+/*
+ * PacketHandler.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACKETHANDLER_H
+#define PACKETHANDLER_H
+
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+
+/*!
+ * \brief Where and when a datagram was received.
+ * \author Philip G. Lee
+ */
+class PacketInfo
+{
+public:
+
+   //! \brief Default constructor. Zero time, unknown sender.
+   PacketInfo() :
+      kernelTimestamp(false),
+      nnMajor(0),
+      nnMinor(0)
+   {
+      memset(&ts, 0, sizeof(ts));
+      memset(&from, 0, sizeof(from));
+   }
+
+   /*!
+    * \brief Receive time, from \c CLOCK_REALTIME.
+    *
+    * The kernel receive timestamp if \c kernelTimestamp, otherwise the
+    * time just before the datagram was read.
+    */
+   struct timespec ts;
+   //! \brief True if \c ts came from the kernel (\c SO_TIMESTAMPNS).
+   bool kernelTimestamp;
+   //! \brief Sender address.
+   struct sockaddr_in from;
+   //! \brief NatNet major version of the stream.
+   unsigned char nnMajor;
+   //! \brief NatNet minor version of the stream.
+   unsigned char nnMinor;
+};
+
+/*!
+ * \brief Interface for stages that see every raw datagram.
+ * \author Philip G. Lee
+ *
+ * Register an implementation with \c FrameListener::addPacketHandler().
+ * The listener calls handlePacket() from its own thread for every datagram
+ * it reads, before it is unpacked, including datagrams that are not frames
+ * of data or that fail to unpack.
+ *
+ * Keep handlePacket() short: it delays delivery of the frame to consumers.
+ * The listener calls it under the same rules as \c FrameHandler.
+ */
+class PacketHandler
+{
+public:
+
+   virtual ~PacketHandler(){}
+
+   /*!
+    * \brief Process one datagram.
+    *
+    * \param data the datagram, starting with the NatNet message ID. Only
+    *    valid during the call.
+    * \param length bytes in \c data
+    * \param info receive time and sender
+    */
+   virtual void handlePacket( char const* data, size_t length, PacketInfo const& info ) = 0;
+};
+
+#endif /*PACKETHANDLER_H*/
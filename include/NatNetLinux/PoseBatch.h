@@ -0,0 +1,708 @@
+/*
+ * PoseBatch.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POSEBATCH_H
+#define POSEBATCH_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/Simd.h>
+#include <vector>
+#include <math.h>
+
+/*!
+ * \brief Structure-of-arrays storage for 3D points.
+ * \author Philip G. Lee
+ */
+class PointArray
+{
+public:
+
+   //! \brief Construct \c n points at the origin.
+   PointArray( size_t n=0 ) :
+      x(n), y(n), z(n)
+   {
+   }
+
+   //! \brief Copy a vector of points.
+   PointArray( std::vector<Point3f> const& points ) :
+      x(), y(), z()
+   {
+      assign(points);
+   }
+
+   //! \brief Number of points.
+   size_t size() const { return x.size(); }
+
+   //! \brief Change the number of points.
+   void resize( size_t n )
+   {
+      x.resize(n);
+      y.resize(n);
+      z.resize(n);
+   }
+
+   //! \brief Remove all points.
+   void clear() { resize(0); }
+
+   //! \brief Append a point.
+   void push_back( Point3f const& p )
+   {
+      x.push_back(p.x);
+      y.push_back(p.y);
+      z.push_back(p.z);
+   }
+
+   //! \brief Replace the contents with \c points.
+   void assign( std::vector<Point3f> const& points )
+   {
+      size_t i, n = points.size();
+      resize(n);
+      for( i = 0; i < n; ++i )
+         set(i, points[i]);
+   }
+
+   //! \brief Set the i'th point.
+   void set( size_t i, Point3f const& p )
+   {
+      x[i] = p.x;
+      y[i] = p.y;
+      z[i] = p.z;
+   }
+
+   //! \brief The i'th point.
+   Point3f get( size_t i ) const
+   {
+      return Point3f(x[i], y[i], z[i]);
+   }
+
+   std::vector<float> x;
+   std::vector<float> y;
+   std::vector<float> z;
+};
+
+/*!
+ * \brief Structure-of-arrays storage for rigid poses.
+ * \author Philip G. Lee
+ *
+ * Element \c i is the pose whose location is (x[i],y[i],z[i]) and whose
+ * orientation is the quaternion (qx[i],qy[i],qz[i],qw[i]). Unlike
+ * Quaternion4f, nothing here renormalizes behind your back. Call
+ * PoseBatch::normalize() when you need to.
+ */
+class PoseArray
+{
+public:
+
+   //! \brief Construct \c n identity poses.
+   PoseArray( size_t n=0 ) :
+      x(n), y(n), z(n), qx(n), qy(n), qz(n), qw(n, 1.f)
+   {
+   }
+
+   //! \brief Number of poses.
+   size_t size() const { return x.size(); }
+
+   //! \brief Change the number of poses. New poses are the identity.
+   void resize( size_t n )
+   {
+      x.resize(n);
+      y.resize(n);
+      z.resize(n);
+      qx.resize(n);
+      qy.resize(n);
+      qz.resize(n);
+      qw.resize(n, 1.f);
+   }
+
+   //! \brief Remove all poses.
+   void clear() { resize(0); }
+
+   //! \brief Append a pose.
+   void push_back( Point3f const& loc, Quaternion4f const& ori )
+   {
+      x.push_back(loc.x);
+      y.push_back(loc.y);
+      z.push_back(loc.z);
+      qx.push_back(ori.qx);
+      qy.push_back(ori.qy);
+      qz.push_back(ori.qz);
+      qw.push_back(ori.qw);
+   }
+
+   //! \brief Replace the contents with the poses of \c bodies.
+   void assign( std::vector<RigidBody> const& bodies )
+   {
+      size_t i, n = bodies.size();
+      resize(n);
+      for( i = 0; i < n; ++i )
+         set(i, bodies[i].location(), bodies[i].orientation());
+   }
+
+   //! \brief Set the i'th pose.
+   void set( size_t i, Point3f const& loc, Quaternion4f const& ori )
+   {
+      x[i] = loc.x;
+      y[i] = loc.y;
+      z[i] = loc.z;
+      qx[i] = ori.qx;
+      qy[i] = ori.qy;
+      qz[i] = ori.qz;
+      qw[i] = ori.qw;
+   }
+
+   //! \brief Location of the i'th pose.
+   Point3f location( size_t i ) const
+   {
+      return Point3f(x[i], y[i], z[i]);
+   }
+
+   //! \brief Orientation of the i'th pose.
+   Quaternion4f orientation( size_t i ) const
+   {
+      return Quaternion4f(qx[i], qy[i], qz[i], qw[i]);
+   }
+
+   std::vector<float> x;
+   std::vector<float> y;
+   std::vector<float> z;
+   std::vector<float> qx;
+   std::vector<float> qy;
+   std::vector<float> qz;
+   std::vector<float> qw;
+};
+
+/*!
+ * \brief Structure-of-arrays storage for 3x3 matrices.
+ * \author Philip G. Lee
+ *
+ * \c m[3*r+c][i] is row \c r, column \c c of the i'th matrix.
+ */
+class Matrix3Array
+{
+public:
+
+   //! \brief Construct \c n zero matrices.
+   Matrix3Array( size_t n=0 )
+   {
+      resize(n);
+   }
+
+   //! \brief Number of matrices.
+   size_t size() const { return m[0].size(); }
+
+   //! \brief Change the number of matrices.
+   void resize( size_t n )
+   {
+      for( int k = 0; k < 9; ++k )
+         m[k].resize(n);
+   }
+
+   std::vector<float> m[9];
+};
+
+/*!
+ * \brief Batch kernels over arrays of poses and points.
+ * \author Philip G. Lee
+ *
+ * Every kernel processes four elements at a time with Float4, which maps to
+ * SSE2 when available. Quaternion inputs are assumed to be unit length and
+ * outputs are never renormalized, so that renormalization happens once,
+ * when the caller decides, instead of after every operation. Output arrays
+ * are resized to fit, and may be the same object as an input.
+ *
+ * The pose (p,q) maps a point v to q*v + p. Composition follows the
+ * Quaternion4f convention: compose(A,B) means apply B, then A.
+ */
+class PoseBatch
+{
+public:
+
+   //! \brief out[i] = a[i]*b[i].
+   static void compose( PoseArray const& a, PoseArray const& b, PoseArray& out )
+   {
+      size_t i, n = a.size();
+      out.resize(n);
+      for( i = 0; i < n; i += Float4::width )
+      {
+         size_t r = n-i;
+         Quat q1 = _loadQuat(a, i, r);
+         Quat q2 = _loadQuat(b, i, r);
+         Float4 px = _ld(&a.x[i], r), py = _ld(&a.y[i], r), pz = _ld(&a.z[i], r);
+         Float4 vx = _ld(&b.x[i], r), vy = _ld(&b.y[i], r), vz = _ld(&b.z[i], r);
+
+         _rotate(q1, vx, vy, vz);
+         _storeQuat(_mul(q1, q2), out, i, r);
+         _st(px+vx, &out.x[i], r);
+         _st(py+vy, &out.y[i], r);
+         _st(pz+vz, &out.z[i], r);
+      }
+   }
+
+   //! \brief out[i] = a[i]^-1.
+   static void inverse( PoseArray const& a, PoseArray& out )
+   {
+      size_t i, n = a.size();
+      out.resize(n);
+      for( i = 0; i < n; i += Float4::width )
+      {
+         size_t r = n-i;
+         Quat q = _conj(_loadQuat(a, i, r));
+         Float4 px = _ld(&a.x[i], r), py = _ld(&a.y[i], r), pz = _ld(&a.z[i], r);
+
+         _rotate(q, px, py, pz);
+         _storeQuat(q, out, i, r);
+         _st(-px, &out.x[i], r);
+         _st(-py, &out.y[i], r);
+         _st(-pz, &out.z[i], r);
+      }
+   }
+
+   /*!
+    * \brief out[i] = a[i]^-1 * b[i].
+    *
+    * This is the pose of b[i] expressed in the frame of a[i].
+    */
+   static void relative( PoseArray const& a, PoseArray const& b, PoseArray& out )
+   {
+      size_t i, n = a.size();
+      out.resize(n);
+      for( i = 0; i < n; i += Float4::width )
+      {
+         size_t r = n-i;
+         Quat qa = _conj(_loadQuat(a, i, r));
+         Quat qb = _loadQuat(b, i, r);
+         Float4 dx = _ld(&b.x[i], r) - _ld(&a.x[i], r);
+         Float4 dy = _ld(&b.y[i], r) - _ld(&a.y[i], r);
+         Float4 dz = _ld(&b.z[i], r) - _ld(&a.z[i], r);
+
+         _rotate(qa, dx, dy, dz);
+         _storeQuat(_mul(qa, qb), out, i, r);
+         _st(dx, &out.x[i], r);
+         _st(dy, &out.y[i], r);
+         _st(dz, &out.z[i], r);
+      }
+   }
+
+   //! \brief Scale every orientation in \c a to unit length.
+   static void normalize( PoseArray& a )
+   {
+      size_t i, n = a.size();
+      for( i = 0; i < n; i += Float4::width )
+      {
+         size_t r = n-i;
+         Quat q = _loadQuat(a, i, r);
+         Float4 mag = sqrt(q.x*q.x + q.y*q.y + q.z*q.z + q.w*q.w);
+         // Leave zero quaternions alone instead of producing NaNs.
+         mag = select(mag > Float4(0.f), mag, Float4(1.f));
+         q.x = q.x/mag; q.y = q.y/mag; q.z = q.z/mag; q.w = q.w/mag;
+         _storeQuat(q, a, i, r);
+      }
+   }
+
+   //! \brief Rotate every point in \c in by \c q.
+   static void rotatePoints( Quaternion4f const& q, PointArray const& in, PointArray& out )
+   {
+      transformPoints(Point3f(), q, in, out);
+   }
+
+   //! \brief Transform every point in \c in by the pose (\c loc, \c ori).
+   static void transformPoints( Point3f const& loc, Quaternion4f const& ori, PointArray const& in, PointArray& out )
+   {
+      float m[9];
+      Float4 mm[9];
+      int k;
+
+      // The rotation matrix is cheaper than the sandwich product once it is
+      // amortized over many points.
+      _matrix(Quat(ori), mm);
+      for( k = 0; k < 9; ++k )
+         m[k] = mm[k].lane(0);
+      transformPoints(m, loc, in, out);
+   }
+
+   /*!
+    * \brief Apply the affine map v -> m*v + t to every point in \c in.
+    *
+    * \param m row-major 3x3 matrix. Need not be a rotation.
+    * \param t translation
+    * \param in input points
+    * \param out output points
+    */
+   static void transformPoints( float const* m, Point3f const& t, PointArray const& in, PointArray& out )
+   {
+      size_t i, n = in.size();
+      Float4 m0(m[0]), m1(m[1]), m2(m[2]);
+      Float4 m3(m[3]), m4(m[4]), m5(m[5]);
+      Float4 m6(m[6]), m7(m[7]), m8(m[8]);
+      Float4 tx(t.x), ty(t.y), tz(t.z);
+
+      out.resize(n);
+      for( i = 0; i < n; i += Float4::width )
+      {
+         size_t r = n-i;
+         Float4 vx = _ld(&in.x[i], r), vy = _ld(&in.y[i], r), vz = _ld(&in.z[i], r);
+         _st(m0*vx + m1*vy + m2*vz + tx, &out.x[i], r);
+         _st(m3*vx + m4*vy + m5*vz + ty, &out.y[i], r);
+         _st(m6*vx + m7*vy + m8*vz + tz, &out.z[i], r);
+      }
+   }
+
+   /*!
+    * \brief Replace each orientation q in \c a with \c left*q*\c right.
+    *
+    * Locations in \c a are not touched.
+    */
+   static void rotateOrientations( Quaternion4f const& left, Quaternion4f const& right, PoseArray& a )
+   {
+      size_t i, n = a.size();
+      Quat ql(left), qr(right);
+
+      for( i = 0; i < n; i += Float4::width )
+      {
+         size_t r = n-i;
+         _storeQuat(_mul(_mul(ql, _loadQuat(a, i, r)), qr), a, i, r);
+      }
+   }
+
+   //! \brief out[i] = poses[i] applied to in[i].
+   static void transformPoints( PoseArray const& poses, PointArray const& in, PointArray& out )
+   {
+      size_t i, n = in.size();
+      out.resize(n);
+      for( i = 0; i < n; i += Float4::width )
+      {
+         size_t r = n-i;
+         Quat q = _loadQuat(poses, i, r);
+         Float4 vx = _ld(&in.x[i], r), vy = _ld(&in.y[i], r), vz = _ld(&in.z[i], r);
+
+         _rotate(q, vx, vy, vz);
+         _st(vx + _ld(&poses.x[i], r), &out.x[i], r);
+         _st(vy + _ld(&poses.y[i], r), &out.y[i], r);
+         _st(vz + _ld(&poses.z[i], r), &out.z[i], r);
+      }
+   }
+
+   //! \brief Convert each orientation in \c a to a rotation matrix.
+   static void toMatrices( PoseArray const& a, Matrix3Array& out )
+   {
+      size_t i, n = a.size();
+      int k;
+      Float4 m[9];
+
+      out.resize(n);
+      for( i = 0; i < n; i += Float4::width )
+      {
+         size_t r = n-i;
+         _matrix(_loadQuat(a, i, r), m);
+         for( k = 0; k < 9; ++k )
+            _st(m[k], &out.m[k][i], r);
+      }
+   }
+
+   /*!
+    * \brief Convert each rotation matrix in \c in to an orientation in \c out.
+    *
+    * Locations in \c out are left alone (or zero if \c out grows). Each lane
+    * takes the largest of the trace and the diagonal (Shepperd's method),
+    * so rotations near 180 degrees are as exact as any other. The result
+    * has \c qw >= 0.
+    */
+   static void fromMatrices( Matrix3Array const& in, PoseArray& out )
+   {
+      size_t i, n = in.size();
+      Float4 const one(1.f), quarter(0.25f);
+
+      out.resize(n);
+      for( i = 0; i < n; i += Float4::width )
+      {
+         size_t r = n-i;
+         Float4 m00 = _ld(&in.m[0][i], r), m01 = _ld(&in.m[1][i], r), m02 = _ld(&in.m[2][i], r);
+         Float4 m10 = _ld(&in.m[3][i], r), m11 = _ld(&in.m[4][i], r), m12 = _ld(&in.m[5][i], r);
+         Float4 m20 = _ld(&in.m[6][i], r), m21 = _ld(&in.m[7][i], r), m22 = _ld(&in.m[8][i], r);
+         Float4 trace = m00 + m11 + m22;
+
+         // Differences give w times x, y, z; sums give the products of x, y, z.
+         Float4 wx = m21 - m12, wy = m02 - m20, wz = m10 - m01;
+         Float4 xy = m01 + m10, xz = m02 + m20, yz = m12 + m21;
+
+         // Which component is largest, ties going to w, then x, then y, and
+         // 4 times that component.
+         Float4 big = max(trace, max(m00, max(m11, m22)));
+         Float4 useW = trace >= big, useX = m00 >= big, useY = m11 >= big;
+         Float4 d = select(useW, trace, select(useX, m00 - m11 - m22, select(useY, m11 - m00 - m22, m22 - m00 - m11)));
+         Float4 s = Float4(2.f)*sqrt(one + d);
+         Float4 inv = one/s, c = quarter*s;
+
+         Quat q;
+         q.w = select(useW, c, select(useX, wx, select(useY, wy, wz))*inv);
+         q.x = select(useW, wx*inv, select(useX, c, select(useY, xy, xz)*inv));
+         q.y = select(useW, wy*inv, select(useX, xy*inv, select(useY, c, yz*inv)));
+         q.z = select(useW, wz*inv, select(useX, xz*inv, select(useY, yz*inv, c)));
+
+         Float4 sign = copysign(one, q.w);
+         q.x = q.x*sign;
+         q.y = q.y*sign;
+         q.z = q.z*sign;
+         q.w = q.w*sign;
+         _storeQuat(q, out, i, r);
+      }
+   }
+
+   /*!
+    * \brief Convert each orientation in \c a to Euler angles in radians.
+    *
+    * The convention is intrinsic Z-Y'-X'': rotate by \c yaw about z, then
+    * \c pitch about the new y, then \c roll about the newest x. The
+    * arguments of the inverse trig functions are computed in packed form;
+    * the trig itself is scalar.
+    */
+   static void toEuler(
+      PoseArray const& a,
+      std::vector<float>& roll,
+      std::vector<float>& pitch,
+      std::vector<float>& yaw
+   )
+   {
+      size_t i, n = a.size();
+      int k;
+      Float4 const one(1.f), two(2.f);
+      float sr[4], cr[4], sp[4], sy[4], cy[4];
+
+      roll.resize(n);
+      pitch.resize(n);
+      yaw.resize(n);
+      for( i = 0; i < n; i += Float4::width )
+      {
+         size_t r = n-i;
+         Quat q = _loadQuat(a, i, r);
+
+         (two*(q.w*q.x + q.y*q.z)).store(sr);
+         (one - two*(q.x*q.x + q.y*q.y)).store(cr);
+         min(one, max(-one, two*(q.w*q.y - q.z*q.x))).store(sp);
+         (two*(q.w*q.z + q.x*q.y)).store(sy);
+         (one - two*(q.y*q.y + q.z*q.z)).store(cy);
+
+         for( k = 0; k < 4 && static_cast<size_t>(k) < r; ++k )
+         {
+            roll[i+k] = atan2f(sr[k], cr[k]);
+            pitch[i+k] = asinf(sp[k]);
+            yaw[i+k] = atan2f(sy[k], cy[k]);
+         }
+      }
+   }
+
+   /*!
+    * \brief Convert Euler angles in radians to orientations in \c out.
+    *
+    * Uses the same convention as toEuler(). Locations in \c out are left
+    * alone (or zero if \c out grows).
+    */
+   static void fromEuler(
+      std::vector<float> const& roll,
+      std::vector<float> const& pitch,
+      std::vector<float> const& yaw,
+      PoseArray& out
+   )
+   {
+      size_t i, n = roll.size();
+      int k;
+      float s[3][4], c[3][4];
+
+      out.resize(n);
+      for( i = 0; i < n; i += Float4::width )
+      {
+         size_t r = n-i;
+         for( k = 0; k < 4; ++k )
+         {
+            size_t j = static_cast<size_t>(k) < r ? i+k : i;
+            s[0][k] = sinf(0.5f*roll[j]);  c[0][k] = cosf(0.5f*roll[j]);
+            s[1][k] = sinf(0.5f*pitch[j]); c[1][k] = cosf(0.5f*pitch[j]);
+            s[2][k] = sinf(0.5f*yaw[j]);   c[2][k] = cosf(0.5f*yaw[j]);
+         }
+         Float4 sr = Float4::load(s[0]), cr = Float4::load(c[0]);
+         Float4 sp = Float4::load(s[1]), cp = Float4::load(c[1]);
+         Float4 sy = Float4::load(s[2]), cy = Float4::load(c[2]);
+
+         Quat q;
+         q.w = cr*cp*cy + sr*sp*sy;
+         q.x = sr*cp*cy - cr*sp*sy;
+         q.y = cr*sp*cy + sr*cp*sy;
+         q.z = cr*cp*sy - sr*sp*cy;
+         _storeQuat(q, out, i, r);
+      }
+   }
+
+   /*!
+    * \brief Interpolate between pose arrays.
+    *
+    * Locations are interpolated linearly and orientations by spherical
+    * linear interpolation along the shortest arc, matching
+    * Quaternion4f::slerp(). The dot products and the blend are packed; the
+    * weights' \c acosf and \c sinf are scalar, per lane, as in toEuler().
+    *
+    * \param a poses at \c t = 0
+    * \param b poses at \c t = 1
+    * \param t interpolation parameter
+    * \param out interpolated poses
+    */
+   static void slerp( PoseArray const& a, PoseArray const& b, float t, PoseArray& out )
+   {
+      std::vector<float> tt(a.size(), t);
+      slerp(a, b, tt, out);
+   }
+
+   //! \brief Like slerp() above, but with a separate parameter per pose.
+   static void slerp( PoseArray const& a, PoseArray const& b, std::vector<float> const& t, PoseArray& out )
+   {
+      size_t i, n = a.size();
+      int k;
+      float d[4], tl[4], wa[4], wb[4];
+
+      out.resize(n);
+      for( i = 0; i < n; i += Float4::width )
+      {
+         size_t r = n-i;
+         Quat q1 = _loadQuat(a, i, r);
+         Quat q2 = _loadQuat(b, i, r);
+         Float4 tv = _ld(&t[i], r);
+         Float4 dot = q1.x*q2.x + q1.y*q2.y + q1.z*q2.z + q1.w*q2.w;
+
+         abs(dot).store(d);
+         tv.store(tl);
+         for( k = 0; k < 4; ++k )
+         {
+            if( d[k] > 0.9995f )
+            {
+               wa[k] = 1.f - tl[k];
+               wb[k] = tl[k];
+            }
+            else
+            {
+               float theta = acosf(d[k]);
+               float sinTheta = sinf(theta);
+               wa[k] = sinf((1.f-tl[k])*theta) / sinTheta;
+               wb[k] = sinf(tl[k]*theta) / sinTheta;
+            }
+         }
+
+         Float4 fa = Float4::load(wa);
+         // Take the shortest arc.
+         Float4 fb = copysign(Float4::load(wb), dot);
+         Quat q;
+         q.x = fa*q1.x + fb*q2.x;
+         q.y = fa*q1.y + fb*q2.y;
+         q.z = fa*q1.z + fb*q2.z;
+         q.w = fa*q1.w + fb*q2.w;
+         _storeQuat(q, out, i, r);
+
+         Float4 ax = _ld(&a.x[i], r), ay = _ld(&a.y[i], r), az = _ld(&a.z[i], r);
+         _st(ax + tv*(_ld(&b.x[i], r)-ax), &out.x[i], r);
+         _st(ay + tv*(_ld(&b.y[i], r)-ay), &out.y[i], r);
+         _st(az + tv*(_ld(&b.z[i], r)-az), &out.z[i], r);
+      }
+   }
+
+private:
+
+   // Four quaternions in packed form.
+   struct Quat
+   {
+      Float4 x, y, z, w;
+
+      Quat() : x(), y(), z(), w() {}
+      Quat( Quaternion4f const& q ) : x(q.qx), y(q.qy), z(q.qz), w(q.qw) {}
+   };
+
+   // Load up to 4 elements starting at p, where r is the number remaining.
+   static Float4 _ld( float const* p, size_t r )
+   {
+      return r >= Float4::width ? Float4::load(p) : Float4::loadPartial(p, r);
+   }
+
+   static void _st( Float4 const& a, float* p, size_t r )
+   {
+      if( r >= Float4::width )
+         a.store(p);
+      else
+         a.storePartial(p, r);
+   }
+
+   static Quat _loadQuat( PoseArray const& a, size_t i, size_t r )
+   {
+      Quat q;
+      q.x = _ld(&a.qx[i], r);
+      q.y = _ld(&a.qy[i], r);
+      q.z = _ld(&a.qz[i], r);
+      q.w = _ld(&a.qw[i], r);
+      return q;
+   }
+
+   static void _storeQuat( Quat const& q, PoseArray& a, size_t i, size_t r )
+   {
+      _st(q.x, &a.qx[i], r);
+      _st(q.y, &a.qy[i], r);
+      _st(q.z, &a.qz[i], r);
+      _st(q.w, &a.qw[i], r);
+   }
+
+   static Quat _conj( Quat q )
+   {
+      q.x = -q.x;
+      q.y = -q.y;
+      q.z = -q.z;
+      return q;
+   }
+
+   // Hamilton product a*b.
+   static Quat _mul( Quat const& a, Quat const& b )
+   {
+      Quat q;
+      q.w = a.w*b.w - a.x*b.x - a.y*b.y - a.z*b.z;
+      q.x = a.w*b.x + a.x*b.w + a.y*b.z - a.z*b.y;
+      q.y = a.w*b.y - a.x*b.z + a.y*b.w + a.z*b.x;
+      q.z = a.w*b.z + a.x*b.y - a.y*b.x + a.z*b.w;
+      return q;
+   }
+
+   // v <- q*v*q^-1, via v + 2w(u x v) + 2u x (u x v) with u = (x,y,z).
+   static void _rotate( Quat const& q, Float4& vx, Float4& vy, Float4& vz )
+   {
+      Float4 const two(2.f);
+      Float4 tx = two*(q.y*vz - q.z*vy);
+      Float4 ty = two*(q.z*vx - q.x*vz);
+      Float4 tz = two*(q.x*vy - q.y*vx);
+      vx = vx + q.w*tx + (q.y*tz - q.z*ty);
+      vy = vy + q.w*ty + (q.z*tx - q.x*tz);
+      vz = vz + q.w*tz + (q.x*ty - q.y*tx);
+   }
+
+   // Row-major rotation matrix of a unit quaternion.
+   static void _matrix( Quat const& q, Float4* m )
+   {
+      Float4 const one(1.f), two(2.f);
+      Float4 xx = q.x*q.x, yy = q.y*q.y, zz = q.z*q.z;
+      Float4 xy = q.x*q.y, xz = q.x*q.z, yz = q.y*q.z;
+      Float4 wx = q.w*q.x, wy = q.w*q.y, wz = q.w*q.z;
+
+      m[0] = one - two*(yy+zz); m[1] = two*(xy-wz);       m[2] = two*(xz+wy);
+      m[3] = two*(xy+wz);       m[4] = one - two*(xx+zz); m[5] = two*(yz-wx);
+      m[6] = two*(xz-wy);       m[7] = two*(yz+wx);       m[8] = one - two*(xx+yy);
+   }
+};
+
+#endif /*POSEBATCH_H*/
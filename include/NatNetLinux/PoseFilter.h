@@ -0,0 +1,603 @@
+/*
+ * PoseFilter.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POSEFILTER_H
+#define POSEFILTER_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameHandler.h>
+#include <NatNetLinux/Simd.h>
+#include <boost/thread.hpp>
+#include <map>
+#include <vector>
+
+/*!
+ * \brief Parameters of the smoothing filter for one rigid body.
+ * \author Philip G. Lee
+ *
+ * Use the named constructors oneEuro() and kalman().
+ */
+class FilterParams
+{
+public:
+
+   //! \brief Filter types
+   enum Type
+   {
+      ONE_EURO = 0,
+      KALMAN   = 1
+   };
+
+   /*!
+    * \brief One-Euro filter parameters.
+    *
+    * See Casiez et al., "1 Euro Filter", CHI 2012. The cutoff frequency
+    * rises with speed, so the filter smooths heavily at rest and lags little
+    * in fast motion.
+    *
+    * \param minCutoff cutoff in Hz at rest
+    * \param beta cutoff increase in Hz per unit/s of linear speed
+    * \param dCutoff cutoff in Hz of the speed estimate
+    * \param betaRot cutoff increase in Hz per rad/s of angular speed
+    */
+   static FilterParams oneEuro( float minCutoff=1.f, float beta=1.f, float dCutoff=1.f, float betaRot=0.1f )
+   {
+      FilterParams p;
+      p.type = ONE_EURO;
+      p.minCutoff = minCutoff;
+      p.beta = beta;
+      p.dCutoff = dCutoff;
+      p.betaRot = betaRot;
+      return p;
+   }
+
+   /*!
+    * \brief Constant-velocity Kalman filter parameters.
+    *
+    * Location and orientation each have a position/velocity state driven
+    * by white-noise acceleration.
+    *
+    * \param accelNoise linear acceleration noise density, units^2/s^3
+    * \param measNoise location measurement variance, units^2
+    * \param angAccelNoise angular acceleration noise density, rad^2/s^3
+    * \param angMeasNoise orientation measurement variance, rad^2
+    */
+   static FilterParams kalman( float accelNoise=10.f, float measNoise=1e-6f, float angAccelNoise=10.f, float angMeasNoise=1e-4f )
+   {
+      FilterParams p;
+      p.type = KALMAN;
+      p.accelNoise = accelNoise;
+      p.measNoise = measNoise;
+      p.angAccelNoise = angAccelNoise;
+      p.angMeasNoise = angMeasNoise;
+      return p;
+   }
+
+   Type type;
+
+   //! \name One-Euro parameters
+   //@{
+   float minCutoff;
+   float beta;
+   float dCutoff;
+   float betaRot;
+   //@}
+
+   //! \name Kalman parameters
+   //@{
+   float accelNoise;
+   float measNoise;
+   float angAccelNoise;
+   float angMeasNoise;
+   //@}
+
+private:
+   FilterParams() :
+      type(ONE_EURO),
+      minCutoff(1.f), beta(1.f), dCutoff(1.f), betaRot(0.1f),
+      accelNoise(10.f), measNoise(1e-6f), angAccelNoise(10.f), angMeasNoise(1e-4f)
+   {
+   }
+};
+
+/*!
+ * \brief Per-rigid-body smoothing filters shared by all consumers.
+ * \author Philip G. Lee
+ *
+ * Register this with \c FrameListener::addHandler() and every rigid body is
+ * filtered once per frame, instead of once per consumer. Each body uses
+ * either a One-Euro or a constant-velocity Kalman filter, configured per
+ * RigidBody::id() with setParams(), or setDefaultParams() otherwise.
+ *
+ * The state of all bodies using the same filter type lives in one
+ * structure-of-arrays bank, so a frame costs one Float4 pass per filter
+ * type. Bodies missing from a frame, or with invalid tracking, keep their
+ * state, and the next update uses the real elapsed time.
+ *
+ * Both the filtered and the raw (last measured) pose are available.
+ */
+class PoseFilter : public FrameHandler
+{
+public:
+
+   //! \brief Constructor. \c defaults applies to bodies without setParams().
+   PoseFilter( FilterParams const& defaults = FilterParams::oneEuro() ) :
+      _mutex(),
+      _defaults(defaults),
+      _params(),
+      _slots()
+   {
+      _banks[0].type = FilterParams::ONE_EURO;
+      _banks[1].type = FilterParams::KALMAN;
+   }
+
+   virtual ~PoseFilter(){}
+
+   //! \brief Parameters for bodies without setParams(). Thread-safe.
+   void setDefaultParams( FilterParams const& params )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      _defaults = params;
+      std::map<int,Slot>::iterator it;
+      for( it = _slots.begin(); it != _slots.end(); ++it )
+         if( _params.find(it->first) == _params.end() )
+            _configure(it->first, params);
+   }
+
+   /*!
+    * \brief Parameters for the body \c id. Thread-safe.
+    *
+    * Switching filter type restarts the body's filter.
+    */
+   void setParams( int id, FilterParams const& params )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      _params.erase(id);
+      _params.insert(std::make_pair(id, params));
+      if( _slots.find(id) != _slots.end() )
+         _configure(id, params);
+   }
+
+   //! \brief Filter the frame. Called by FrameListener.
+   virtual void handleFrame( MocapFrame const& frame, struct timespec const& ts )
+   {
+      update(frame, NatNet::seconds(ts));
+   }
+
+   /*!
+    * \brief Filter every rigid body in \c frame. Thread-safe.
+    *
+    * \param frame new frame
+    * \param t time of the frame in seconds
+    */
+   void update( MocapFrame const& frame, double t )
+   {
+      std::vector<RigidBody> const& bodies = frame.rigidBodies();
+      size_t i;
+
+      boost::mutex::scoped_lock lock(_mutex);
+      for( i = 0; i < bodies.size(); ++i )
+      {
+         if( !bodies[i].trackingValid() )
+            continue;
+
+         int id = bodies[i].id();
+         std::map<int,Slot>::iterator it = _slots.find(id);
+         if( it == _slots.end() )
+         {
+            std::map<int,FilterParams>::const_iterator p = _params.find(id);
+            _add(id, p == _params.end() ? _defaults : p->second);
+            it = _slots.find(id);
+         }
+         _banks[it->second.bank].measure(it->second.index, t, bodies[i].location(), bodies[i].orientation());
+      }
+
+      _banks[0].step();
+      _banks[1].step();
+   }
+
+   /*!
+    * \brief Filtered pose of a rigid body. Thread-safe.
+    *
+    * \returns false if the body has never been seen
+    */
+   bool filtered( int id, Point3f& loc, Quaternion4f& ori ) const
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      std::map<int,Slot>::const_iterator it = _slots.find(id);
+      if( it == _slots.end() )
+         return false;
+      _banks[it->second.bank].get(it->second.index, Bank::FX, loc, ori);
+      return true;
+   }
+
+   /*!
+    * \brief Last measured (unfiltered) pose of a rigid body. Thread-safe.
+    *
+    * \returns false if the body has never been seen
+    */
+   bool raw( int id, Point3f& loc, Quaternion4f& ori ) const
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      std::map<int,Slot>::const_iterator it = _slots.find(id);
+      if( it == _slots.end() )
+         return false;
+      _banks[it->second.bank].get(it->second.index, Bank::MX, loc, ori);
+      return true;
+   }
+
+   //! \brief Forget all filter state. Parameters are kept. Thread-safe.
+   void clear()
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      _slots.clear();
+      _banks[0].clear();
+      _banks[1].clear();
+   }
+
+private:
+
+   // Location of a body's state: which bank, and which index in it.
+   struct Slot
+   {
+      int bank;
+      size_t index;
+   };
+
+   // Structure-of-arrays state of every body using one filter type. Every
+   // per-body quantity is a column, so that adding and removing bodies is
+   // generic over the columns.
+   class Bank
+   {
+   public:
+      enum Column
+      {
+         // Measurement, filtered pose.
+         MX, MY, MZ, MQX, MQY, MQZ, MQW,
+         FX, FY, FZ, FQX, FQY, FQZ, FQW,
+         // 1 if measured this frame, and the time since the last measurement.
+         MASK, DT,
+         // Filter parameters.
+         P0, P1, P2, P3,
+         // One-Euro: smoothed linear velocity and angular speed.
+         // Kalman: linear and angular velocity, and the two covariances.
+         S0, S1, S2, S3, S4, S5, S6, S7, S8, S9, S10, S11,
+         NUM_COLUMNS
+      };
+
+      Bank() : type(FilterParams::ONE_EURO), ids(), last(), initialized()
+      {
+      }
+
+      size_t size() const { return ids.size(); }
+
+      void clear()
+      {
+         ids.clear();
+         last.clear();
+         initialized.clear();
+         for( int k = 0; k < NUM_COLUMNS; ++k )
+            col[k].clear();
+      }
+
+      size_t add( int id, FilterParams const& p )
+      {
+         ids.push_back(id);
+         last.push_back(0.0);
+         initialized.push_back(false);
+         for( int k = 0; k < NUM_COLUMNS; ++k )
+            col[k].push_back(0.f);
+
+         size_t i = ids.size()-1;
+         if( type == FilterParams::ONE_EURO )
+         {
+            col[P0][i] = p.minCutoff;
+            col[P1][i] = p.beta;
+            col[P2][i] = p.dCutoff;
+            col[P3][i] = p.betaRot;
+         }
+         else
+         {
+            col[P0][i] = p.accelNoise;
+            col[P1][i] = p.measNoise;
+            col[P2][i] = p.angAccelNoise;
+            col[P3][i] = p.angMeasNoise;
+         }
+         return i;
+      }
+
+      // Swap-remove slot i. The last body, if any, moves into slot i.
+      void remove( size_t i )
+      {
+         size_t j = ids.size()-1;
+         ids[i] = ids[j];
+         last[i] = last[j];
+         initialized[i] = initialized[j];
+         ids.pop_back();
+         last.pop_back();
+         initialized.pop_back();
+         for( int k = 0; k < NUM_COLUMNS; ++k )
+         {
+            col[k][i] = col[k][j];
+            col[k].pop_back();
+         }
+      }
+
+      void measure( size_t i, double t, Point3f const& loc, Quaternion4f const& ori )
+      {
+         float const m[7] = {loc.x, loc.y, loc.z, ori.qx, ori.qy, ori.qz, ori.qw};
+         int k;
+         for( k = 0; k < 7; ++k )
+            col[MX+k][i] = m[k];
+
+         if( !initialized[i] || t <= last[i] )
+         {
+            // Start from the measurement.
+            if( !initialized[i] )
+            {
+               for( k = 0; k < 7; ++k )
+                  col[FX+k][i] = m[k];
+               for( k = S0; k <= S11; ++k )
+                  col[k][i] = 0.f;
+               if( type == FilterParams::KALMAN )
+               {
+                  col[S3][i] = col[P1][i]; col[S5][i] = 1.f;
+                  col[S9][i] = col[P3][i]; col[S11][i] = 10.f;
+               }
+               initialized[i] = true;
+               last[i] = t;
+            }
+            return;
+         }
+
+         col[MASK][i] = 1.f;
+         col[DT][i] = static_cast<float>(t - last[i]);
+         last[i] = t;
+      }
+
+      void get( size_t i, int base, Point3f& loc, Quaternion4f& ori ) const
+      {
+         loc = Point3f(col[base][i], col[base+1][i], col[base+2][i]);
+         ori = Quaternion4f(col[base+3][i], col[base+4][i], col[base+5][i], col[base+6][i]);
+      }
+
+      void step()
+      {
+         size_t i, n = size();
+         for( i = 0; i < n; i += Float4::width )
+         {
+            size_t r = n-i;
+            if( type == FilterParams::ONE_EURO )
+               _stepOneEuro(i, r);
+            else
+               _stepKalman(i, r);
+         }
+         for( i = 0; i < n; ++i )
+            col[MASK][i] = 0.f;
+      }
+
+      FilterParams::Type type;
+      std::vector<int> ids;
+      std::vector<double> last;
+      std::vector<bool> initialized;
+      std::vector<float> col[NUM_COLUMNS];
+
+   private:
+
+      Float4 _ld( int k, size_t i, size_t r ) const
+      {
+         return r >= Float4::width ? Float4::load(&col[k][i]) : Float4::loadPartial(&col[k][i], r);
+      }
+
+      // Store only the lanes in mask.
+      void _st( int k, size_t i, size_t r, Float4 const& mask, Float4 const& a )
+      {
+         Float4 v = select(mask, a, _ld(k, i, r));
+         if( r >= Float4::width )
+            v.store(&col[k][i]);
+         else
+            v.storePartial(&col[k][i], r);
+      }
+
+      // Smoothing factor of a first-order low-pass filter.
+      static Float4 _alpha( Float4 const& cutoff, Float4 const& dt )
+      {
+         Float4 a = Float4(6.2831853f)*cutoff*dt;
+         return a/(a + Float4(1.f));
+      }
+
+      static void _normalize( Float4& x, Float4& y, Float4& z, Float4& w )
+      {
+         Float4 mag = sqrt(x*x + y*y + z*z + w*w);
+         mag = select(mag > Float4(0.f), mag, Float4(1.f));
+         x = x/mag; y = y/mag; z = z/mag; w = w/mag;
+      }
+
+      // Quaternion measurement, flipped into the hemisphere of the estimate.
+      void _measuredQuat( size_t i, size_t r, Float4 const& qx, Float4 const& qy, Float4 const& qz, Float4 const& qw,
+         Float4& mx, Float4& my, Float4& mz, Float4& mw, Float4& dot ) const
+      {
+         mx = _ld(MQX, i, r); my = _ld(MQY, i, r); mz = _ld(MQZ, i, r); mw = _ld(MQW, i, r);
+         Float4 d = qx*mx + qy*my + qz*mz + qw*mw;
+         Float4 s = copysign(Float4(1.f), d);
+         mx = mx*s; my = my*s; mz = mz*s; mw = mw*s;
+         dot = abs(d);
+      }
+
+      void _stepOneEuro( size_t i, size_t r )
+      {
+         Float4 mask = _ld(MASK, i, r) > Float4(0.5f);
+         if( !any(mask) )
+            return;
+
+         Float4 dt = select(mask, _ld(DT, i, r), Float4(1.f));
+         Float4 minCutoff = _ld(P0, i, r), beta = _ld(P1, i, r), dCutoff = _ld(P2, i, r), betaRot = _ld(P3, i, r);
+         Float4 ad = _alpha(dCutoff, dt);
+
+         // Location.
+         Float4 fx = _ld(FX, i, r), fy = _ld(FY, i, r), fz = _ld(FZ, i, r);
+         Float4 mx = _ld(MX, i, r), my = _ld(MY, i, r), mz = _ld(MZ, i, r);
+         Float4 dx = _ld(S0, i, r), dy = _ld(S1, i, r), dz = _ld(S2, i, r);
+         dx = dx + ad*((mx-fx)/dt - dx);
+         dy = dy + ad*((my-fy)/dt - dy);
+         dz = dz + ad*((mz-fz)/dt - dz);
+         Float4 a = _alpha(minCutoff + beta*sqrt(dx*dx + dy*dy + dz*dz), dt);
+         fx = fx + a*(mx-fx);
+         fy = fy + a*(my-fy);
+         fz = fz + a*(mz-fz);
+
+         // Orientation, by normalized lerp toward the measurement.
+         Float4 qx = _ld(FQX, i, r), qy = _ld(FQY, i, r), qz = _ld(FQZ, i, r), qw = _ld(FQW, i, r);
+         Float4 nx, ny, nz, nw, dot;
+         _measuredQuat(i, r, qx, qy, qz, qw, nx, ny, nz, nw, dot);
+         // 2*sin(angle/2) ~ angle for the small rotations between frames.
+         Float4 angSpeed = Float4(2.f)*sqrt(max(Float4(0.f), Float4(1.f) - dot*dot))/dt;
+         Float4 dAng = _ld(S3, i, r);
+         dAng = dAng + ad*(angSpeed - dAng);
+         Float4 ar = _alpha(minCutoff + betaRot*dAng, dt);
+         qx = qx + ar*(nx-qx);
+         qy = qy + ar*(ny-qy);
+         qz = qz + ar*(nz-qz);
+         qw = qw + ar*(nw-qw);
+         _normalize(qx, qy, qz, qw);
+
+         _st(FX, i, r, mask, fx); _st(FY, i, r, mask, fy); _st(FZ, i, r, mask, fz);
+         _st(S0, i, r, mask, dx); _st(S1, i, r, mask, dy); _st(S2, i, r, mask, dz);
+         _st(S3, i, r, mask, dAng);
+         _st(FQX, i, r, mask, qx); _st(FQY, i, r, mask, qy); _st(FQZ, i, r, mask, qz); _st(FQW, i, r, mask, qw);
+      }
+
+      // Constant-velocity prediction of a 2x2 covariance [p00 p01; p01 p11].
+      static void _predictCov( Float4 const& dt, Float4 const& q, Float4& p00, Float4& p01, Float4& p11 )
+      {
+         Float4 dt2 = dt*dt;
+         p00 = p00 + Float4(2.f)*dt*p01 + dt2*p11 + q*dt2*dt*Float4(1.f/3.f);
+         p01 = p01 + dt*p11 + q*dt2*Float4(0.5f);
+         p11 = p11 + q*dt;
+      }
+
+      // Kalman gain for a position measurement, and the covariance update.
+      static void _updateCov( Float4 const& r, Float4& p00, Float4& p01, Float4& p11, Float4& k0, Float4& k1 )
+      {
+         Float4 s = p00 + r;
+         k0 = p00/s;
+         k1 = p01/s;
+         p11 = p11 - k1*p01;
+         p01 = (Float4(1.f)-k0)*p01;
+         p00 = (Float4(1.f)-k0)*p00;
+      }
+
+      void _stepKalman( size_t i, size_t r )
+      {
+         Float4 mask = _ld(MASK, i, r) > Float4(0.5f);
+         if( !any(mask) )
+            return;
+
+         Float4 dt = select(mask, _ld(DT, i, r), Float4(0.f));
+         Float4 k0, k1;
+
+         // Location: state (f, v), covariance (S3,S4,S5) shared by the axes.
+         Float4 fx = _ld(FX, i, r), fy = _ld(FY, i, r), fz = _ld(FZ, i, r);
+         Float4 vx = _ld(S0, i, r), vy = _ld(S1, i, r), vz = _ld(S2, i, r);
+         Float4 p00 = _ld(S3, i, r), p01 = _ld(S4, i, r), p11 = _ld(S5, i, r);
+         fx = fx + vx*dt; fy = fy + vy*dt; fz = fz + vz*dt;
+         _predictCov(dt, _ld(P0, i, r), p00, p01, p11);
+         _updateCov(_ld(P1, i, r), p00, p01, p11, k0, k1);
+         Float4 ex = _ld(MX, i, r)-fx, ey = _ld(MY, i, r)-fy, ez = _ld(MZ, i, r)-fz;
+         fx = fx + k0*ex; fy = fy + k0*ey; fz = fz + k0*ez;
+         vx = vx + k1*ex; vy = vy + k1*ey; vz = vz + k1*ez;
+
+         // Orientation: error-state filter on the rotation vector, with
+         // world-frame angular velocity (S6,S7,S8) and covariance (S9,S10,S11).
+         Float4 qx = _ld(FQX, i, r), qy = _ld(FQY, i, r), qz = _ld(FQZ, i, r), qw = _ld(FQW, i, r);
+         Float4 wx = _ld(S6, i, r), wy = _ld(S7, i, r), wz = _ld(S8, i, r);
+         Float4 r00 = _ld(S9, i, r), r01 = _ld(S10, i, r), r11 = _ld(S11, i, r);
+         Float4 h = Float4(0.5f)*dt;
+         _smallRotate(wx*h, wy*h, wz*h, qx, qy, qz, qw);
+         _predictCov(dt, _ld(P2, i, r), r00, r01, r11);
+         _updateCov(_ld(P3, i, r), r00, r01, r11, k0, k1);
+
+         Float4 nx, ny, nz, nw, dot;
+         _measuredQuat(i, r, qx, qy, qz, qw, nx, ny, nz, nw, dot);
+         // Rotation vector of meas*conj(estimate), small-angle.
+         Float4 two(2.f);
+         Float4 erx = two*(-nw*qx + nx*qw - ny*qz + nz*qy);
+         Float4 ery = two*(-nw*qy + ny*qw - nz*qx + nx*qz);
+         Float4 erz = two*(-nw*qz + nz*qw - nx*qy + ny*qx);
+         h = Float4(0.5f)*k0;
+         _smallRotate(erx*h, ery*h, erz*h, qx, qy, qz, qw);
+         wx = wx + k1*erx; wy = wy + k1*ery; wz = wz + k1*erz;
+
+         _st(FX, i, r, mask, fx); _st(FY, i, r, mask, fy); _st(FZ, i, r, mask, fz);
+         _st(S0, i, r, mask, vx); _st(S1, i, r, mask, vy); _st(S2, i, r, mask, vz);
+         _st(S3, i, r, mask, p00); _st(S4, i, r, mask, p01); _st(S5, i, r, mask, p11);
+         _st(FQX, i, r, mask, qx); _st(FQY, i, r, mask, qy); _st(FQZ, i, r, mask, qz); _st(FQW, i, r, mask, qw);
+         _st(S6, i, r, mask, wx); _st(S7, i, r, mask, wy); _st(S8, i, r, mask, wz);
+         _st(S9, i, r, mask, r00); _st(S10, i, r, mask, r01); _st(S11, i, r, mask, r11);
+      }
+
+      // q <- (a,1)*q, renormalized. (a) is half a small rotation vector.
+      static void _smallRotate( Float4 const& ax, Float4 const& ay, Float4 const& az,
+         Float4& qx, Float4& qy, Float4& qz, Float4& qw )
+      {
+         Float4 x = qx + ax*qw + ay*qz - az*qy;
+         Float4 y = qy + ay*qw + az*qx - ax*qz;
+         Float4 z = qz + az*qw + ax*qy - ay*qx;
+         Float4 w = qw - ax*qx - ay*qy - az*qz;
+         _normalize(x, y, z, w);
+         qx = x; qy = y; qz = z; qw = w;
+      }
+   };
+
+   mutable boost::mutex _mutex;
+   FilterParams _defaults;
+   std::map<int,FilterParams> _params;
+   std::map<int,Slot> _slots;
+   Bank _banks[2];
+
+   void _add( int id, FilterParams const& params )
+   {
+      Slot s;
+      s.bank = params.type == FilterParams::ONE_EURO ? 0 : 1;
+      s.index = _banks[s.bank].add(id, params);
+      _slots[id] = s;
+   }
+
+   // Move body id to a fresh slot with new parameters. The poses carry
+   // over so that readers see no gap before the next measurement.
+   void _configure( int id, FilterParams const& params )
+   {
+      Slot s = _slots[id];
+      Bank& bank = _banks[s.bank];
+      float poses[14];
+      int k;
+
+      for( k = 0; k < 14; ++k )
+         poses[k] = bank.col[Bank::MX+k][s.index];
+      bank.remove(s.index);
+      if( s.index < bank.size() )
+         _slots[bank.ids[s.index]].index = s.index;
+
+      _add(id, params);
+      s = _slots[id];
+      for( k = 0; k < 14; ++k )
+         _banks[s.bank].col[Bank::MX+k][s.index] = poses[k];
+   }
+};
+
+#endif /*POSEFILTER_H*/
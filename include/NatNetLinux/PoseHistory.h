@@ -0,0 +1,318 @@
+/*
+ * PoseHistory.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POSEHISTORY_H
+#define POSEHISTORY_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameHandler.h>
+#include <NatNetLinux/PoseBatch.h>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+/*!
+ * \brief One timestamped rigid body pose.
+ * \author Philip G. Lee
+ */
+class PoseSample
+{
+public:
+
+   //! \brief Default constructor
+   PoseSample( double tt=0.0, int frame=0, Point3f const& loc=Point3f(), Quaternion4f const& ori=Quaternion4f() ) :
+      time(tt),
+      frameNum(frame),
+      location(loc),
+      orientation(ori)
+   {
+   }
+
+   //! \brief Arrival time in seconds (see NatNet::seconds()).
+   double time;
+   //! \brief MocapFrame::frameNum() of the frame the pose came from.
+   int frameNum;
+   //! \brief Location of the rigid body.
+   Point3f location;
+   //! \brief Orientation of the rigid body.
+   Quaternion4f orientation;
+};
+
+/*!
+ * \brief Time-indexed history of rigid body poses.
+ * \author Philip G. Lee
+ *
+ * Keeps the last duration() seconds of poses of every rigid body, keyed by
+ * RigidBody::id(). Register it with \c FrameListener::addHandler() to have
+ * it record every frame with its arrival timestamp, or feed it yourself with
+ * append().
+ *
+ * Each body's history lives in contiguous, time-sorted arrays, so poseAt()
+ * is a binary search followed by a lerp/slerp between the two neighbouring
+ * samples. Poses whose RigidBody::trackingValid() is false are not
+ * recorded, so queries interpolate across tracking dropouts.
+ *
+ * Any number of threads may query while the listener appends: queries take
+ * a shared lock, and appends take an exclusive lock once per frame.
+ */
+class PoseHistory : public FrameHandler
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param duration seconds of history to keep
+    */
+   PoseHistory( double duration=5.0 ) :
+      _duration(duration),
+      _mutex(),
+      _tracks()
+   {
+   }
+
+   virtual ~PoseHistory(){}
+
+   //! \brief Seconds of history kept.
+   double duration() const { return _duration; }
+
+   //! \brief Record the rigid bodies of \c frame. Called by FrameListener.
+   virtual void handleFrame( MocapFrame const& frame, struct timespec const& ts )
+   {
+      append(frame, NatNet::seconds(ts));
+   }
+
+   /*!
+    * \brief Record the rigid bodies of \c frame at time \c t. Thread-safe.
+    *
+    * \param frame frame whose rigid bodies to record
+    * \param t time of the frame in seconds
+    */
+   void append( MocapFrame const& frame, double t )
+   {
+      std::vector<RigidBody> const& bodies = frame.rigidBodies();
+      size_t i;
+
+      boost::unique_lock<boost::shared_mutex> lock(_mutex);
+      for( i = 0; i < bodies.size(); ++i )
+      {
+         if( !bodies[i].trackingValid() )
+            continue;
+         Track& track = _tracks[bodies[i].id()];
+         track.insert(t, frame.frameNum(), bodies[i].location(), bodies[i].orientation());
+         track.trim(t - _duration);
+      }
+   }
+
+   /*!
+    * \brief Pose of a rigid body at time \c t. Thread-safe.
+    *
+    * \param id RigidBody::id() of the body
+    * \param t query time in seconds
+    * \param loc output location, linearly interpolated
+    * \param ori output orientation, spherically interpolated
+    * \returns false if \c t is outside the recorded history of the body
+    */
+   bool poseAt( int id, double t, Point3f& loc, Quaternion4f& ori ) const
+   {
+      boost::shared_lock<boost::shared_mutex> lock(_mutex);
+      Track const* track = _find(id);
+      if( !track || track->empty() )
+         return false;
+
+      std::vector<double>::const_iterator beg = track->time.begin() + track->head;
+      std::vector<double>::const_iterator it = std::lower_bound(beg, track->time.end(), t);
+      if( it == track->time.end() )
+         return false;
+
+      size_t j = it - track->time.begin();
+      if( *it == t )
+      {
+         loc = track->poses.location(j);
+         ori = track->poses.orientation(j);
+         return true;
+      }
+      if( it == beg )
+         return false;
+
+      size_t i = j-1;
+      float s = static_cast<float>((t - track->time[i]) / (track->time[j] - track->time[i]));
+      Point3f a = track->poses.location(i);
+      Point3f b = track->poses.location(j);
+      loc = Point3f(a.x + s*(b.x-a.x), a.y + s*(b.y-a.y), a.z + s*(b.z-a.z));
+      ori = Quaternion4f::slerp(track->poses.orientation(i), track->poses.orientation(j), s);
+      return true;
+   }
+
+   /*!
+    * \brief All samples of a rigid body with \c t0 <= time <= \c t1. Thread-safe.
+    *
+    * \param id RigidBody::id() of the body
+    * \param t0 start of the window in seconds
+    * \param t1 end of the window in seconds
+    * \param out output samples in time order. Cleared first.
+    * \returns number of samples in \c out
+    */
+   size_t range( int id, double t0, double t1, std::vector<PoseSample>& out ) const
+   {
+      out.clear();
+
+      boost::shared_lock<boost::shared_mutex> lock(_mutex);
+      Track const* track = _find(id);
+      if( !track )
+         return 0;
+
+      std::vector<double>::const_iterator beg = track->time.begin() + track->head;
+      size_t i = std::lower_bound(beg, track->time.end(), t0) - track->time.begin();
+      size_t end = std::upper_bound(beg, track->time.end(), t1) - track->time.begin();
+      for( ; i < end; ++i )
+         out.push_back(track->sample(i));
+      return out.size();
+   }
+
+   /*!
+    * \brief The last \c n samples of a rigid body. Thread-safe.
+    *
+    * \param id RigidBody::id() of the body
+    * \param n maximum number of samples
+    * \param out output samples in time order. Cleared first.
+    * \returns number of samples in \c out
+    */
+   size_t latest( int id, size_t n, std::vector<PoseSample>& out ) const
+   {
+      out.clear();
+
+      boost::shared_lock<boost::shared_mutex> lock(_mutex);
+      Track const* track = _find(id);
+      if( !track )
+         return 0;
+
+      size_t end = track->time.size();
+      size_t i = end - std::min(n, end - track->head);
+      for( ; i < end; ++i )
+         out.push_back(track->sample(i));
+      return out.size();
+   }
+
+   //! \brief IDs of all bodies with recorded history. Thread-safe.
+   std::vector<int> ids() const
+   {
+      std::vector<int> ret;
+      std::map<int,Track>::const_iterator it;
+
+      boost::shared_lock<boost::shared_mutex> lock(_mutex);
+      for( it = _tracks.begin(); it != _tracks.end(); ++it )
+         if( !it->second.empty() )
+            ret.push_back(it->first);
+      return ret;
+   }
+
+   //! \brief Forget everything. Thread-safe.
+   void clear()
+   {
+      boost::unique_lock<boost::shared_mutex> lock(_mutex);
+      _tracks.clear();
+   }
+
+private:
+
+   // History of one body. Entries before head are expired; they are removed
+   // in bulk so that trimming stays amortized O(1).
+   class Track
+   {
+   public:
+      Track() : time(), frame(), poses(), head(0) {}
+
+      bool empty() const { return head == time.size(); }
+
+      PoseSample sample( size_t i ) const
+      {
+         return PoseSample(time[i], frame[i], poses.location(i), poses.orientation(i));
+      }
+
+      void insert( double t, int frameNum, Point3f const& loc, Quaternion4f const& ori )
+      {
+         // Clock steps can deliver an out-of-order time. Keep the arrays sorted.
+         if( empty() || t >= time.back() )
+         {
+            time.push_back(t);
+            frame.push_back(frameNum);
+            poses.push_back(loc, ori);
+            return;
+         }
+
+         size_t i = std::upper_bound(time.begin()+head, time.end(), t) - time.begin();
+         time.insert(time.begin()+i, t);
+         frame.insert(frame.begin()+i, frameNum);
+         poses.x.insert(poses.x.begin()+i, loc.x);
+         poses.y.insert(poses.y.begin()+i, loc.y);
+         poses.z.insert(poses.z.begin()+i, loc.z);
+         poses.qx.insert(poses.qx.begin()+i, ori.qx);
+         poses.qy.insert(poses.qy.begin()+i, ori.qy);
+         poses.qz.insert(poses.qz.begin()+i, ori.qz);
+         poses.qw.insert(poses.qw.begin()+i, ori.qw);
+      }
+
+      void trim( double tMin )
+      {
+         while( head < time.size() && time[head] < tMin )
+            ++head;
+         if( head > 64 && 2*head > time.size() )
+            _compact();
+      }
+
+      std::vector<double> time;
+      std::vector<int> frame;
+      PoseArray poses;
+      size_t head;
+
+   private:
+      void _compact()
+      {
+         time.erase(time.begin(), time.begin()+head);
+         frame.erase(frame.begin(), frame.begin()+head);
+         _erase(poses.x);
+         _erase(poses.y);
+         _erase(poses.z);
+         _erase(poses.qx);
+         _erase(poses.qy);
+         _erase(poses.qz);
+         _erase(poses.qw);
+         head = 0;
+      }
+
+      void _erase( std::vector<float>& v )
+      {
+         v.erase(v.begin(), v.begin()+head);
+      }
+   };
+
+   double _duration;
+   mutable boost::shared_mutex _mutex;
+   std::map<int,Track> _tracks;
+
+   Track const* _find( int id ) const
+   {
+      std::map<int,Track>::const_iterator it = _tracks.find(id);
+      return it == _tracks.end() ? 0 : &it->second;
+   }
+};
+
+#endif /*POSEHISTORY_H*/
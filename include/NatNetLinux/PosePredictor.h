@@ -0,0 +1,287 @@
+/*
+ * PosePredictor.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POSEPREDICTOR_H
+#define POSEPREDICTOR_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameHandler.h>
+#include <boost/thread.hpp>
+#include <map>
+#include <math.h>
+
+/*!
+ * \brief Forward-predicts rigid body poses to compensate for latency.
+ * \author Philip G. Lee
+ *
+ * By the time a consumer uses a pose, the body has moved for the server
+ * latency, the network transit, and however long the consumer sat on the
+ * frame. Register this with \c FrameListener::addHandler() and it tracks
+ * the linear and angular velocity of every rigid body, so that predict()
+ * can extrapolate the last pose to the time it is actually used.
+ *
+ * Each pose is placed at its estimated capture time:
+ *
+ *    capture = arrival - serverLatencyScale()*MocapFrame::latency() - transitDelay()
+ *
+ * The meaning of MocapFrame::latency() differs between server versions, so
+ * serverLatencyScale() (seconds per unit) is 0, i.e. ignored, unless set.
+ *
+ * Velocities are exponentially smoothed finite differences of consecutive
+ * valid poses, using their actual time difference, so dropped frames are
+ * handled naturally and invalid poses (RigidBody::trackingValid()) are
+ * skipped. Every update and prediction is O(1) per body.
+ */
+class PosePredictor : public FrameHandler
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param smoothing weight in (0,1] of each new velocity measurement
+    * \param maxHorizon never predict further than this many seconds
+    * \param transitDelay estimated network transit time in seconds
+    */
+   PosePredictor( float smoothing=0.5f, double maxHorizon=0.05, double transitDelay=0.0 ) :
+      _smoothing(smoothing),
+      _maxHorizon(maxHorizon),
+      _transit(transitDelay),
+      _latencyScale(0.0),
+      _residualScale(0.005f),
+      _mutex(),
+      _bodies()
+   {
+   }
+
+   virtual ~PosePredictor(){}
+
+   //! \brief Set seconds per unit of MocapFrame::latency(). Thread-safe.
+   void setServerLatencyScale( double scale )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      _latencyScale = scale;
+   }
+
+   //! \brief Set the estimated network transit time in seconds. Thread-safe.
+   void setTransitDelay( double transit )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      _transit = transit;
+   }
+
+   /*!
+    * \brief Set the prediction error, in meters, at which confidence halves. Thread-safe.
+    */
+   void setResidualScale( float meters )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      _residualScale = meters;
+   }
+
+   //! \brief Seconds per unit of MocapFrame::latency(). Thread-safe.
+   double serverLatencyScale() const
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      return _latencyScale;
+   }
+
+   //! \brief Estimated network transit time in seconds. Thread-safe.
+   double transitDelay() const
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      return _transit;
+   }
+
+   //! \brief Update velocity estimates. Called by FrameListener.
+   virtual void handleFrame( MocapFrame const& frame, struct timespec const& ts )
+   {
+      update(frame, NatNet::seconds(ts));
+   }
+
+   /*!
+    * \brief Update velocity estimates from \c frame. Thread-safe.
+    *
+    * \param frame new frame
+    * \param arrival local time in seconds at which the frame arrived
+    */
+   void update( MocapFrame const& frame, double arrival )
+   {
+      std::vector<RigidBody> const& bodies = frame.rigidBodies();
+      size_t i;
+
+      boost::mutex::scoped_lock lock(_mutex);
+      double t = arrival - _latencyScale*frame.latency() - _transit;
+      for( i = 0; i < bodies.size(); ++i )
+         if( bodies[i].trackingValid() )
+            _bodies[bodies[i].id()].update(t, bodies[i].location(), bodies[i].orientation(), _smoothing);
+   }
+
+   /*!
+    * \brief Predict the pose of a rigid body at local time \c t. Thread-safe.
+    *
+    * \param id RigidBody::id() of the body
+    * \param t local time in seconds, e.g. NatNet::now()
+    * \param loc output predicted location
+    * \param ori output predicted orientation
+    * \param confidence if not null, set to a value in [0,1]. It is 0 without
+    *    a velocity estimate, falls linearly to 0 as the prediction horizon
+    *    approaches the maximum, and halves when the recent prediction error
+    *    reaches the residual scale.
+    * \returns false if the body has never been seen
+    */
+   bool predict( int id, double t, Point3f& loc, Quaternion4f& ori, float* confidence=0 ) const
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      std::map<int,State>::const_iterator it = _bodies.find(id);
+      if( it == _bodies.end() )
+         return false;
+
+      State const& s = it->second;
+      double dt = t - s.time;
+      if( dt > _maxHorizon )
+         dt = _maxHorizon;
+      s.extrapolate(static_cast<float>(dt), loc, ori);
+
+      if( confidence )
+      {
+         float c = s.samples < 2 ? 0.f : 1.f - static_cast<float>(fabs(t - s.time)/_maxHorizon);
+         if( c < 0.f )
+            c = 0.f;
+         *confidence = c / (1.f + s.residual/_residualScale);
+      }
+      return true;
+   }
+
+   //! \brief Predict the pose of a rigid body now. See predict().
+   bool predictNow( int id, Point3f& loc, Quaternion4f& ori, float* confidence=0 ) const
+   {
+      return predict(id, NatNet::now(), loc, ori, confidence);
+   }
+
+   /*!
+    * \brief Current velocity estimate of a rigid body. Thread-safe.
+    *
+    * \param id RigidBody::id() of the body
+    * \param linear output linear velocity in units per second
+    * \param angular output angular velocity in rad/s, about world axes
+    * \returns false if the body has never been seen
+    */
+   bool velocity( int id, Point3f& linear, Point3f& angular ) const
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      std::map<int,State>::const_iterator it = _bodies.find(id);
+      if( it == _bodies.end() )
+         return false;
+      linear = it->second.v;
+      angular = it->second.w;
+      return true;
+   }
+
+private:
+
+   class State
+   {
+   public:
+      State() : time(0.0), loc(), ori(), v(), w(), residual(0.f), samples(0) {}
+
+      double time;
+      Point3f loc;
+      Quaternion4f ori;
+      // Linear and angular (world axes) velocity.
+      Point3f v;
+      Point3f w;
+      // Smoothed error of the previous prediction.
+      float residual;
+      unsigned int samples;
+
+      void extrapolate( float dt, Point3f& l, Quaternion4f& q ) const
+      {
+         l = Point3f(loc.x + v.x*dt, loc.y + v.y*dt, loc.z + v.z*dt);
+
+         // Rotate by exp(w*dt) about world axes.
+         float ax = w.x*dt, ay = w.y*dt, az = w.z*dt;
+         float angle = sqrtf(ax*ax + ay*ay + az*az);
+         if( angle < 1e-9f )
+         {
+            q = ori;
+            return;
+         }
+         float s = sinf(0.5f*angle)/angle;
+         q = Quaternion4f(s*ax, s*ay, s*az, cosf(0.5f*angle)) * ori;
+      }
+
+      void update( double t, Point3f const& l, Quaternion4f const& q, float gain )
+      {
+         float dt = static_cast<float>(t - time);
+         if( samples == 0 || dt <= 0.f )
+         {
+            if( samples == 0 )
+               samples = 1;
+            time = t;
+            loc = l;
+            ori = q;
+            return;
+         }
+
+         // How well did the old estimate predict this pose?
+         Point3f pl;
+         Quaternion4f pq;
+         extrapolate(dt, pl, pq);
+         float ex = pl.x-l.x, ey = pl.y-l.y, ez = pl.z-l.z;
+         float err = sqrtf(ex*ex + ey*ey + ez*ez);
+         residual = samples < 2 ? err : residual + gain*(err - residual);
+
+         // Finite-difference velocities.
+         Point3f vi((l.x-loc.x)/dt, (l.y-loc.y)/dt, (l.z-loc.z)/dt);
+         Quaternion4f dq = q * ori.conjugate();
+         if( dq.qw < 0.f )
+            dq = Quaternion4f(-dq.qx, -dq.qy, -dq.qz, -dq.qw);
+         float sinHalf = sqrtf(dq.qx*dq.qx + dq.qy*dq.qy + dq.qz*dq.qz);
+         float angle = 2.f*atan2f(sinHalf, dq.qw);
+         float k = sinHalf > 1e-9f ? angle/(sinHalf*dt) : 2.f/dt;
+         Point3f wi(k*dq.qx, k*dq.qy, k*dq.qz);
+
+         if( samples < 2 )
+         {
+            v = vi;
+            w = wi;
+         }
+         else
+         {
+            v = Point3f(v.x + gain*(vi.x-v.x), v.y + gain*(vi.y-v.y), v.z + gain*(vi.z-v.z));
+            w = Point3f(w.x + gain*(wi.x-w.x), w.y + gain*(wi.y-w.y), w.z + gain*(wi.z-w.z));
+         }
+
+         time = t;
+         loc = l;
+         ori = q;
+         ++samples;
+      }
+   };
+
+   float _smoothing;
+   double _maxHorizon;
+   double _transit;
+   double _latencyScale;
+   float _residualScale;
+   mutable boost::mutex _mutex;
+   std::map<int,State> _bodies;
+};
+
+#endif /*POSEPREDICTOR_H*/
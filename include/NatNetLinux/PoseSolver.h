@@ -0,0 +1,585 @@
+/*
+ * PoseSolver.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POSESOLVER_H
+#define POSESOLVER_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameHandler.h>
+#include <NatNetLinux/Simd.h>
+#include <boost/thread.hpp>
+#include <vector>
+#include <map>
+#include <math.h>
+
+/*!
+ * \brief Marker positions of a rigid body, in the body's own coordinates.
+ * \author Philip G. Lee
+ */
+class MarkerTemplate
+{
+public:
+
+   //! \brief Default constructor. An empty template never fits.
+   MarkerTemplate() : _markers() {}
+
+   //! \brief Constructor
+   MarkerTemplate( std::vector<Point3f> const& markers ) : _markers(markers) {}
+
+   //! \brief Marker positions, in body coordinates.
+   std::vector<Point3f> const& markers() const { return _markers; }
+
+private:
+
+   std::vector<Point3f> _markers;
+};
+
+/*!
+ * \brief A rigid body pose fitted to markers, with its residuals.
+ * \author Philip G. Lee
+ */
+class PoseFit
+{
+public:
+
+   //! \brief Default constructor
+   PoseFit() :
+      id(0),
+      valid(false),
+      location(),
+      orientation(0.f,0.f,0.f,1.f),
+      rmsError(0.f),
+      used(0),
+      rejected(0),
+      residuals(),
+      inliers()
+   {
+   }
+
+   //! \brief RigidBody::id() of the body.
+   int id;
+   //! \brief False if fewer than 3 markers were usable.
+   bool valid;
+   //! \brief Fitted location.
+   Point3f location;
+   //! \brief Fitted orientation.
+   Quaternion4f orientation;
+   //! \brief Root mean square distance of the used markers from the template.
+   float rmsError;
+   //! \brief Number of markers used in the fit.
+   unsigned int used;
+   //! \brief Number of markers rejected as outliers.
+   unsigned int rejected;
+   //! \brief Distance of each template marker from its measurement. NaN if not measured.
+   std::vector<float> residuals;
+   //! \brief Whether each template marker was used in the fit.
+   std::vector<char> inliers;
+};
+
+/*!
+ * \brief Re-estimates rigid body poses from their markers, many bodies at once.
+ * \author Philip G. Lee
+ *
+ * Give it a MarkerTemplate for each rigid body of interest with
+ * setTemplate(), and solve() finds, for every body in a frame, the rotation
+ * and translation that best map the template onto the measured markers in
+ * the least squares sense (the absolute orientation problem).
+ *
+ * Measurements come either from RigidBody::markers(), matched to the
+ * template by position in the list, or from MocapFrame::labeledMarkers(),
+ * matched by ID: template marker \c i of body \c b is the labeled marker
+ * with ID <tt>(b << 16) | (i+1)</tt>, which is how NatNet encodes
+ * model and marker IDs. Markers that are not finite are ignored.
+ *
+ * The rotation comes from Horn's quaternion method. Its largest eigenvalue
+ * is found by Newton iteration on the characteristic polynomial, and its
+ * eigenvector from the adjugate, following Theobald's QCP method. The
+ * iteration count is fixed and every step is branch-free, so four bodies
+ * are solved at a time with Float4. Only gathering the
+ * markers into 3x3 covariances is scalar.
+ *
+ * After each fit, if the worst marker is further than outlierThreshold()
+ * from the template, it is dropped and the body is fitted again, up to
+ * maxRejected() times and as long as 3 markers remain.
+ */
+class PoseSolver : public FrameHandler
+{
+public:
+
+   //! \brief Where measured markers come from.
+   enum Source
+   {
+      RIGID_BODY_MARKERS = 0,
+      LABELED_MARKERS    = 1
+   };
+
+   /*!
+    * \brief Constructor
+    *
+    * \param source where measured markers come from
+    * \param outlierThreshold residual beyond which a marker may be rejected
+    * \param maxRejected maximum markers rejected per body
+    */
+   PoseSolver( Source source=RIGID_BODY_MARKERS, float outlierThreshold=0.01f, unsigned int maxRejected=2 ) :
+      _source(source),
+      _outlierThreshold(outlierThreshold),
+      _maxRejected(maxRejected),
+      _onlyInvalid(false),
+      _mutex(),
+      _templates(),
+      _fits(),
+      _problems(),
+      _cols()
+   {
+   }
+
+   virtual ~PoseSolver(){}
+
+   //! \brief Residual beyond which a marker may be rejected.
+   float outlierThreshold() const { return _outlierThreshold; }
+   //! \brief Maximum markers rejected per body.
+   unsigned int maxRejected() const { return _maxRejected; }
+
+   //! \brief Set the template of a rigid body. Thread-safe.
+   void setTemplate( int id, MarkerTemplate const& t )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      _templates[id] = t;
+   }
+
+   //! \brief Stop fitting a rigid body. Thread-safe.
+   void removeTemplate( int id )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      _templates.erase(id);
+   }
+
+   /*!
+    * \brief Only fit bodies the server could not track. Thread-safe.
+    *
+    * If set, bodies in MocapFrame::rigidBodies() with
+    * RigidBody::trackingValid() are skipped.
+    */
+   void setOnlyInvalid( bool onlyInvalid )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      _onlyInvalid = onlyInvalid;
+   }
+
+   //! \brief Fit the frame and keep the results for fits(). Called by FrameListener.
+   virtual void handleFrame( MocapFrame const& frame, struct timespec const& )
+   {
+      std::vector<PoseFit> fits;
+      solve(frame, fits);
+      boost::mutex::scoped_lock lock(_mutex);
+      _fits.swap(fits);
+   }
+
+   //! \brief Results of the last handleFrame(). Thread-safe.
+   void fits( std::vector<PoseFit>& out ) const
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      out = _fits;
+   }
+
+   /*!
+    * \brief Fit every body with a template in \c frame. Thread-safe.
+    *
+    * \param frame frame with the measured markers
+    * \param out output fits, one per body with a template and some markers. Cleared first.
+    */
+   void solve( MocapFrame const& frame, std::vector<PoseFit>& out )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      size_t i, pass;
+
+      out.clear();
+      _problems.clear();
+      _gather(frame, out);
+
+      for( pass = 0; pass <= _maxRejected; ++pass )
+      {
+         std::vector<size_t> todo;
+         for( i = 0; i < _problems.size(); ++i )
+            if( _problems[i].dirty )
+               todo.push_back(i);
+         if( todo.empty() )
+            break;
+
+         _solveBatch(todo, out);
+         for( i = 0; i < todo.size(); ++i )
+            _reject(_problems[todo[i]], out[todo[i]], pass < _maxRejected);
+      }
+   }
+
+   /*!
+    * \brief Write valid fits into the matching bodies of \c frame.
+    *
+    * \param fits output of solve()
+    * \param frame frame to update
+    * \returns number of bodies updated
+    */
+   static size_t apply( std::vector<PoseFit> const& fits, MocapFrame& frame )
+   {
+      std::vector<RigidBody>& bodies = frame.rigidBodies();
+      size_t i, j, n = 0;
+      for( i = 0; i < fits.size(); ++i )
+      {
+         if( !fits[i].valid )
+            continue;
+         for( j = 0; j < bodies.size(); ++j )
+         {
+            if( bodies[j].id() != fits[i].id )
+               continue;
+            bodies[j].setLocation(fits[i].location);
+            bodies[j].setOrientation(fits[i].orientation);
+            ++n;
+            break;
+         }
+      }
+      return n;
+   }
+
+private:
+
+   // One body's correspondences. measured[i] matches template marker i.
+   class Problem
+   {
+   public:
+      Problem() : tmpl(0), measured(), dirty(true) {}
+
+      MarkerTemplate const* tmpl;
+      std::vector<Point3f> measured;
+      bool dirty;
+   };
+
+   // Columns of the batched solve.
+   enum Column
+   {
+      SXX, SXY, SXZ, SYX, SYY, SYZ, SZX, SZY, SZZ, GA, GB,
+      QW, QX, QY, QZ,
+      NUM_COLUMNS
+   };
+
+   Source _source;
+   float _outlierThreshold;
+   unsigned int _maxRejected;
+   bool _onlyInvalid;
+   mutable boost::mutex _mutex;
+   std::map<int,MarkerTemplate> _templates;
+   std::vector<PoseFit> _fits;
+
+   // Scratch: problems parallel to the output fits, and the batch columns.
+   std::vector<Problem> _problems;
+   std::vector<float> _cols[NUM_COLUMNS];
+
+   static bool _finite( Point3f const& p )
+   {
+      return p.x == p.x && p.y == p.y && p.z == p.z &&
+             fabsf(p.x) < HUGE_VALF && fabsf(p.y) < HUGE_VALF && fabsf(p.z) < HUGE_VALF;
+   }
+
+   void _add( int id, MarkerTemplate const& t, std::vector<PoseFit>& out )
+   {
+      size_t n = t.markers().size();
+      PoseFit fit;
+      fit.id = id;
+      fit.residuals.assign(n, NAN);
+      fit.inliers.assign(n, 0);
+      out.push_back(fit);
+
+      Problem p;
+      p.tmpl = &t;
+      p.measured.assign(n, Point3f(NAN, NAN, NAN));
+      _problems.push_back(p);
+   }
+
+   void _gather( MocapFrame const& frame, std::vector<PoseFit>& out )
+   {
+      size_t i, k;
+      std::vector<RigidBody> const& bodies = frame.rigidBodies();
+
+      if( _source == RIGID_BODY_MARKERS )
+      {
+         for( i = 0; i < bodies.size(); ++i )
+         {
+            std::map<int,MarkerTemplate>::const_iterator it = _templates.find(bodies[i].id());
+            if( it == _templates.end() || (_onlyInvalid && bodies[i].trackingValid()) )
+               continue;
+            _add(it->first, it->second, out);
+            Problem& p = _problems.back();
+            std::vector<Point3f> const& m = bodies[i].markers();
+            for( k = 0; k < m.size() && k < p.measured.size(); ++k )
+               p.measured[k] = m[k];
+         }
+      }
+      else
+      {
+         // Bodies to skip, if only fitting invalid ones.
+         std::map<int,bool> skip;
+         if( _onlyInvalid )
+            for( i = 0; i < bodies.size(); ++i )
+               skip[bodies[i].id()] = bodies[i].trackingValid();
+
+         std::map<int,size_t> index;
+         std::map<int,MarkerTemplate>::const_iterator it;
+         for( it = _templates.begin(); it != _templates.end(); ++it )
+         {
+            std::map<int,bool>::const_iterator s = skip.find(it->first);
+            if( s != skip.end() && s->second )
+               continue;
+            index[it->first] = out.size();
+            _add(it->first, it->second, out);
+         }
+
+         std::vector<LabeledMarker> const& labeled = frame.labeledMarkers();
+         for( i = 0; i < labeled.size(); ++i )
+         {
+            int model = labeled[i].id() >> 16;
+            int marker = (labeled[i].id() & 0xFFFF) - 1;
+            std::map<int,size_t>::const_iterator b = index.find(model);
+            if( b == index.end() || marker < 0 || static_cast<size_t>(marker) >= _problems[b->second].measured.size() )
+               continue;
+            _problems[b->second].measured[marker] = labeled[i].location();
+         }
+      }
+
+      // Usable markers start as inliers.
+      for( i = 0; i < _problems.size(); ++i )
+      {
+         unsigned int used = 0;
+         for( k = 0; k < _problems[i].measured.size(); ++k )
+         {
+            bool ok = _finite(_problems[i].measured[k]);
+            out[i].inliers[k] = ok;
+            used += ok;
+         }
+         out[i].used = used;
+         _problems[i].dirty = used >= 3;
+      }
+   }
+
+   // Fit every problem in \c todo, four at a time.
+   void _solveBatch( std::vector<size_t> const& todo, std::vector<PoseFit>& out )
+   {
+      size_t i, c, n = todo.size();
+      size_t padded = (n + Float4::width-1) & ~(Float4::width-1);
+
+      for( c = 0; c < NUM_COLUMNS; ++c )
+         _cols[c].assign(padded, 0.f);
+      // Padding lanes solve an identity problem.
+      for( i = n; i < padded; ++i )
+         _cols[SXX][i] = _cols[SYY][i] = _cols[SZZ][i] = _cols[GA][i] = _cols[GB][i] = 1.f;
+
+      std::vector<Point3f> ca(n), cb(n);
+      for( i = 0; i < n; ++i )
+         _covariance(_problems[todo[i]], out[todo[i]], i, ca[i], cb[i]);
+
+      for( i = 0; i < padded; i += Float4::width )
+         _qcp(i);
+
+      for( i = 0; i < n; ++i )
+      {
+         PoseFit& fit = out[todo[i]];
+         Quaternion4f q(_cols[QX][i], _cols[QY][i], _cols[QZ][i], _cols[QW][i]);
+         Point3f ra = q.rotate(ca[i]);
+         fit.orientation = q;
+         fit.location = Point3f(cb[i].x-ra.x, cb[i].y-ra.y, cb[i].z-ra.z);
+         fit.valid = true;
+      }
+   }
+
+   // Centroids, cross-covariance and inner products of one problem's inliers.
+   void _covariance( Problem const& p, PoseFit const& fit, size_t col, Point3f& ca, Point3f& cb )
+   {
+      std::vector<Point3f> const& a = p.tmpl->markers();
+      std::vector<Point3f> const& b = p.measured;
+      size_t k, m = 0;
+      double s[11] = {0,0,0,0,0,0,0,0,0,0,0};
+      double sa[3] = {0,0,0}, sb[3] = {0,0,0};
+
+      for( k = 0; k < a.size(); ++k )
+      {
+         if( !fit.inliers[k] )
+            continue;
+         sa[0] += a[k].x; sa[1] += a[k].y; sa[2] += a[k].z;
+         sb[0] += b[k].x; sb[1] += b[k].y; sb[2] += b[k].z;
+         ++m;
+      }
+      ca = Point3f(static_cast<float>(sa[0]/m), static_cast<float>(sa[1]/m), static_cast<float>(sa[2]/m));
+      cb = Point3f(static_cast<float>(sb[0]/m), static_cast<float>(sb[1]/m), static_cast<float>(sb[2]/m));
+
+      for( k = 0; k < a.size(); ++k )
+      {
+         if( !fit.inliers[k] )
+            continue;
+         double ax = a[k].x-ca.x, ay = a[k].y-ca.y, az = a[k].z-ca.z;
+         double bx = b[k].x-cb.x, by = b[k].y-cb.y, bz = b[k].z-cb.z;
+         s[SXX] += ax*bx; s[SXY] += ax*by; s[SXZ] += ax*bz;
+         s[SYX] += ay*bx; s[SYY] += ay*by; s[SYZ] += ay*bz;
+         s[SZX] += az*bx; s[SZY] += az*by; s[SZZ] += az*bz;
+         s[GA] += ax*ax + ay*ay + az*az;
+         s[GB] += bx*bx + by*by + bz*bz;
+      }
+
+      // Normalize so the starting eigenvalue estimate is 1.
+      double scale = s[GA] + s[GB] > 0.0 ? 2.0/(s[GA] + s[GB]) : 1.0;
+      for( k = 0; k <= GB; ++k )
+         _cols[k][col] = static_cast<float>(s[k]*scale);
+   }
+
+   // Solve lanes [i, i+4) of the columns.
+   void _qcp( size_t i )
+   {
+      Float4 sxx = Float4::load(&_cols[SXX][i]), sxy = Float4::load(&_cols[SXY][i]), sxz = Float4::load(&_cols[SXZ][i]);
+      Float4 syx = Float4::load(&_cols[SYX][i]), syy = Float4::load(&_cols[SYY][i]), syz = Float4::load(&_cols[SYZ][i]);
+      Float4 szx = Float4::load(&_cols[SZX][i]), szy = Float4::load(&_cols[SZY][i]), szz = Float4::load(&_cols[SZZ][i]);
+      Float4 zero(0.f), two(2.f), eight(8.f);
+      int r, c;
+
+      // Horn's symmetric matrix, whose top eigenvector is the rotation (w,x,y,z).
+      Float4 n[4][4];
+      n[0][0] = sxx + syy + szz;
+      n[0][1] = syz - szy;
+      n[0][2] = szx - sxz;
+      n[0][3] = sxy - syx;
+      n[1][1] = sxx - syy - szz;
+      n[1][2] = sxy + syx;
+      n[1][3] = szx + sxz;
+      n[2][2] = syy - sxx - szz;
+      n[2][3] = syz + szy;
+      n[3][3] = szz - sxx - syy;
+      for( r = 1; r < 4; ++r )
+         for( c = 0; c < r; ++c )
+            n[r][c] = n[c][r];
+
+      // Characteristic polynomial x^4 + c2 x^2 + c1 x + c0.
+      Float4 c2 = zero - two*(sxx*sxx + sxy*sxy + sxz*sxz + syx*syx + syy*syy + syz*syz + szx*szx + szy*szy + szz*szz);
+      Float4 c1 = zero - eight*(sxx*(syy*szz - syz*szy) - sxy*(syx*szz - syz*szx) + sxz*(syx*szy - syy*szx));
+      Float4 c0 = _det4(n);
+
+      // Newton from above converges monotonically to the largest root.
+      Float4 lambda(1.f);
+      for( int it = 0; it < 12; ++it )
+      {
+         Float4 l2 = lambda*lambda;
+         Float4 f = l2*l2 + c2*l2 + c1*lambda + c0;
+         Float4 df = Float4(4.f)*l2*lambda + two*c2*lambda + c1;
+         Float4 ok = abs(df) > Float4(1e-12f);
+         lambda = select(ok, lambda - f/select(ok, df, Float4(1.f)), lambda);
+      }
+
+      for( r = 0; r < 4; ++r )
+         n[r][r] = n[r][r] - lambda;
+
+      // Any nonzero column of the adjugate of (N - lambda I) is the
+      // eigenvector. Take the largest for accuracy.
+      Float4 best[4], bestNorm(-1.f);
+      for( c = 0; c < 4; ++c )
+      {
+         Float4 col[4];
+         for( r = 0; r < 4; ++r )
+            col[r] = _cofactor(n, r, c);
+         Float4 norm = col[0]*col[0] + col[1]*col[1] + col[2]*col[2] + col[3]*col[3];
+         Float4 better = norm > bestNorm;
+         for( r = 0; r < 4; ++r )
+            best[r] = c == 0 ? col[r] : select(better, col[r], best[r]);
+         bestNorm = select(better, norm, bestNorm);
+      }
+
+      // Degenerate lanes (e.g. collinear markers) fall back to identity.
+      Float4 valid = bestNorm > Float4(1e-30f);
+      Float4 inv = Float4(1.f)/sqrt(select(valid, bestNorm, Float4(1.f)));
+      inv = copysign(inv, best[0]);
+      (select(valid, best[0]*inv, Float4(1.f))).store(&_cols[QW][i]);
+      (select(valid, best[1]*inv, zero)).store(&_cols[QX][i]);
+      (select(valid, best[2]*inv, zero)).store(&_cols[QY][i]);
+      (select(valid, best[3]*inv, zero)).store(&_cols[QZ][i]);
+   }
+
+   static Float4 _det3( Float4 const& a, Float4 const& b, Float4 const& c,
+                        Float4 const& d, Float4 const& e, Float4 const& f,
+                        Float4 const& g, Float4 const& h, Float4 const& k )
+   {
+      return a*(e*k - f*h) - b*(d*k - f*g) + c*(d*h - e*g);
+   }
+
+   // Signed cofactor (r, c) of a 4x4 matrix.
+   static Float4 _cofactor( Float4 const (&m)[4][4], int r, int c )
+   {
+      int rows[3], cols[3], i, j;
+      for( i = 0, j = 0; i < 4; ++i )
+         if( i != r )
+            rows[j++] = i;
+      for( i = 0, j = 0; i < 4; ++i )
+         if( i != c )
+            cols[j++] = i;
+
+      Float4 d = _det3(
+         m[rows[0]][cols[0]], m[rows[0]][cols[1]], m[rows[0]][cols[2]],
+         m[rows[1]][cols[0]], m[rows[1]][cols[1]], m[rows[1]][cols[2]],
+         m[rows[2]][cols[0]], m[rows[2]][cols[1]], m[rows[2]][cols[2]]
+      );
+      return (r+c) & 1 ? Float4(0.f) - d : d;
+   }
+
+   static Float4 _det4( Float4 const (&m)[4][4] )
+   {
+      return m[0][0]*_cofactor(m,0,0) + m[0][1]*_cofactor(m,0,1) + m[0][2]*_cofactor(m,0,2) + m[0][3]*_cofactor(m,0,3);
+   }
+
+   // Residuals of a fit, then drop the worst marker if it is an outlier.
+   void _reject( Problem& p, PoseFit& fit, bool allowReject )
+   {
+      std::vector<Point3f> const& a = p.tmpl->markers();
+      size_t k, worst = 0;
+      float worstErr = -1.f;
+      double sum = 0.0;
+
+      for( k = 0; k < a.size(); ++k )
+      {
+         if( !_finite(p.measured[k]) )
+            continue;
+         Point3f ra = fit.orientation.rotate(a[k]);
+         float dx = ra.x + fit.location.x - p.measured[k].x;
+         float dy = ra.y + fit.location.y - p.measured[k].y;
+         float dz = ra.z + fit.location.z - p.measured[k].z;
+         float e = sqrtf(dx*dx + dy*dy + dz*dz);
+         fit.residuals[k] = e;
+         if( !fit.inliers[k] )
+            continue;
+         sum += e*e;
+         if( e > worstErr )
+         {
+            worstErr = e;
+            worst = k;
+         }
+      }
+      fit.rmsError = static_cast<float>(sqrt(sum/fit.used));
+
+      p.dirty = allowReject && worstErr > _outlierThreshold && fit.used > 3;
+      if( p.dirty )
+      {
+         fit.inliers[worst] = 0;
+         --fit.used;
+         ++fit.rejected;
+      }
+   }
+};
+
+#endif /*POSESOLVER_H*/
@@ -0,0 +1,63 @@
+/*
+ * Probes.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+/*!
+ * \file Probes.h
+ * \brief USDT static tracepoints, under the provider \c natnet.
+ *
+ * Define \c NATNET_USDT before including any NatNetLinux header (or
+ * configure with \c -DWITH_USDT=ON) to compile the probes in. They need
+ * \c sys/sdt.h from SystemTap (\c systemtap-sdt-dev on Debian). Each probe
+ * is then a single \c nop until a tracer attaches to it. Without
+ * \c NATNET_USDT the macros expand to nothing and their arguments are not
+ * evaluated.
+ *
+ * Probes and arguments:
+ * - \c packet_received (bytes, message ID): FrameListener read a datagram.
+ * - \c frame_unpacked (frame number, rigid bodies, bytes): FrameListener
+ *   unpacked a frame.
+ * - \c frame_enqueued (frame number, frames buffered): a frame entered
+ *   the FrameListener buffer.
+ * - \c frame_overwritten (frame number): a frame was pushed out of the
+ *   full buffer before being popped.
+ * - \c frame_popped (frame number, frames left): a consumer popped a frame.
+ * - \c command_sent (message ID, bytes or -1): NatNetPacket::send() of
+ *   anything but a frame.
+ * - \c frame_sent (bytes or -1): NatNetPacket::send() of a
+ *   NAT_FRAMEOFDATA, e.g. by SyntheticServer or FrameRelay.
+ * - \c command_received (message ID, bytes): CommandListener received a
+ *   datagram.
+ *
+ * See \c tools/bpftrace for example scripts.
+ */
+
+#ifdef NATNET_USDT
+#include <sys/sdt.h>
+#define NATNET_PROBE1(name, a) DTRACE_PROBE1(natnet, name, a)
+#define NATNET_PROBE2(name, a, b) DTRACE_PROBE2(natnet, name, a, b)
+#define NATNET_PROBE3(name, a, b, c) DTRACE_PROBE3(natnet, name, a, b, c)
+#else
+#define NATNET_PROBE1(name, a) ((void)0)
+#define NATNET_PROBE2(name, a, b) ((void)0)
+#define NATNET_PROBE3(name, a, b, c) ((void)0)
+#endif
+
+#endif /*PROBES_H*/
@@ -0,0 +1,688 @@
+/*
+ * ProximityMonitor.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROXIMITYMONITOR_H
+#define PROXIMITYMONITOR_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameHandler.h>
+#include <NatNetLinux/PoseBatch.h>
+#include <NatNetLinux/SpatialHash.h>
+#include <boost/thread.hpp>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <math.h>
+
+/*!
+ * \brief A sphere or capsule attached to a rigid body.
+ * \author Philip G. Lee
+ *
+ * A capsule is every point within radius() of the segment from a() to b(),
+ * and a sphere is a capsule with a() == b(). Both ends are in the body's
+ * own coordinates.
+ */
+class BodyVolume
+{
+public:
+
+   //! \brief Sphere of \c radius about \c center, in body coordinates.
+   static BodyVolume sphere( Point3f const& center, float radius )
+   {
+      return BodyVolume(center, center, radius);
+   }
+
+   //! \brief Capsule of \c radius about the segment from \c a to \c b, in body coordinates.
+   static BodyVolume capsule( Point3f const& a, Point3f const& b, float radius )
+   {
+      return BodyVolume(a, b, radius);
+   }
+
+   //! \brief First end of the segment.
+   Point3f const& a() const { return _a; }
+   //! \brief Second end of the segment.
+   Point3f const& b() const { return _b; }
+   //! \brief Radius about the segment.
+   float radius() const { return _radius; }
+
+private:
+
+   BodyVolume( Point3f const& a, Point3f const& b, float radius ) :
+      _a(a),
+      _b(b),
+      _radius(radius)
+   {
+   }
+
+   Point3f _a;
+   Point3f _b;
+   float _radius;
+};
+
+/*!
+ * \brief Separation of two rigid bodies, and the thresholds it is within.
+ * \author Philip G. Lee
+ */
+class ProximityEvent
+{
+public:
+
+   //! \brief Default constructor
+   ProximityEvent() :
+      bodyA(0),
+      bodyB(0),
+      distance(0.f),
+      level(0),
+      previousLevel(0),
+      frameNum(0),
+      time(0.0)
+   {
+   }
+
+   //! \brief Smaller RigidBody::id() of the pair.
+   int bodyA;
+   //! \brief Larger RigidBody::id() of the pair.
+   int bodyB;
+   //! \brief Distance between the closest volumes. Negative if they overlap.
+   float distance;
+   //! \brief Number of thresholds the distance is below. See ProximityMonitor::setThresholds().
+   unsigned int level;
+   //! \brief The level before this event.
+   unsigned int previousLevel;
+   //! \brief MocapFrame::frameNum() of the frame that caused the event.
+   int frameNum;
+   //! \brief Arrival time in seconds of the frame that caused the event.
+   double time;
+
+   //! \brief True if the bodies came closer than another threshold.
+   bool closer() const { return level > previousLevel; }
+};
+
+/*!
+ * \brief Interface for receiving ProximityMonitor events.
+ * \author Philip G. Lee
+ */
+class ProximityHandler
+{
+public:
+
+   virtual ~ProximityHandler(){}
+
+   /*!
+    * \brief A pair of bodies crossed a threshold.
+    *
+    * Called from the thread that called \c ProximityMonitor::update(),
+    * normally the FrameListener's, so keep it short.
+    */
+   virtual void proximityChanged( ProximityEvent const& event ) = 0;
+};
+
+/*!
+ * \brief Watches the distances between rigid bodies for threshold crossings.
+ * \author Philip G. Lee
+ *
+ * Attach spheres and capsules to rigid bodies with attach(), choose the
+ * distances of interest with setThresholds(), and register this with
+ * \c FrameListener::addHandler(). Every frame, the volumes are moved with
+ * their bodies and ProximityHandler::proximityChanged() is called, still in
+ * the listening thread, for every pair of bodies whose level (the number of
+ * thresholds their separation is below) changed.
+ *
+ * Only nearby pairs are ever measured. The broad phase bounds each volume
+ * with a box grown by half the largest threshold, then finds overlapping
+ * boxes either by sweep and prune along x, which keeps its sort order from
+ * frame to frame so the sort is nearly linear, or with a SpatialHash over
+ * the volumes' bounding spheres, which suits scenes spread over a large
+ * area. The narrow phase is an exact segment to segment distance.
+ *
+ * Pairs with a body that is missing or not tracked in a frame keep their
+ * level until both are seen again.
+ */
+class ProximityMonitor : public FrameHandler
+{
+public:
+
+   //! \brief Broad phase algorithms.
+   enum BroadPhase
+   {
+      SWEEP_AND_PRUNE = 0,
+      SPATIAL_HASH    = 1
+   };
+
+   //! \brief Constructor
+   ProximityMonitor( BroadPhase broadPhase=SWEEP_AND_PRUNE ) :
+      _broadPhase(broadPhase),
+      _mutex(),
+      _thresholds(),
+      _hysteresis(0.f),
+      _volumes(),
+      _byBody(),
+      _handlers(),
+      _pairs(),
+      _order(),
+      _centers(),
+      _hash(),
+      _hashVolume(),
+      _bound(),
+      _candidates(),
+      _lastCandidates(0)
+   {
+   }
+
+   virtual ~ProximityMonitor(){}
+
+   /*!
+    * \brief Attach a volume to a rigid body. Thread-safe.
+    *
+    * A body may have any number of volumes; the distance between two bodies
+    * is the distance between their closest volumes.
+    */
+   void attach( int id, BodyVolume const& volume )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      Volume v(id, volume);
+      _byBody[id].push_back(_volumes.size());
+      _order.push_back(_volumes.size());
+      _volumes.push_back(v);
+   }
+
+   //! \brief Remove all volumes from a rigid body. Thread-safe.
+   void detach( int id )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      std::vector<Volume> volumes;
+      size_t i;
+
+      for( i = 0; i < _volumes.size(); ++i )
+         if( _volumes[i].body != id )
+            volumes.push_back(_volumes[i]);
+      _volumes.swap(volumes);
+
+      _byBody.clear();
+      _order.clear();
+      for( i = 0; i < _volumes.size(); ++i )
+      {
+         _byBody[_volumes[i].body].push_back(i);
+         _order.push_back(i);
+      }
+
+      std::map<BodyPair,PairState>::iterator it = _pairs.begin();
+      while( it != _pairs.end() )
+      {
+         if( it->first.first == id || it->first.second == id )
+            _pairs.erase(it++);
+         else
+            ++it;
+      }
+   }
+
+   /*!
+    * \brief Set the distances to report crossings of. Thread-safe.
+    *
+    * \param thresholds distances in any order. 0 reports contact.
+    * \param hysteresis a pair must separate this much beyond a threshold
+    *    before it is reported as having left it
+    */
+   void setThresholds( std::vector<float> const& thresholds, float hysteresis=0.f )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      _thresholds = thresholds;
+      std::sort(_thresholds.begin(), _thresholds.end(), std::greater<float>());
+      _hysteresis = hysteresis;
+      _pairs.clear();
+   }
+
+   //! \brief Receive events. Thread-safe.
+   void addHandler( ProximityHandler* handler )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      _handlers.push_back(handler);
+   }
+
+   //! \brief Stop receiving events. Thread-safe.
+   void removeHandler( ProximityHandler* handler )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      _handlers.erase(std::remove(_handlers.begin(), _handlers.end(), handler), _handlers.end());
+   }
+
+   /*!
+    * \brief Pairs of bodies currently within at least one threshold. Thread-safe.
+    *
+    * \param out output pairs, with previousLevel equal to level. Cleared first.
+    */
+   void closePairs( std::vector<ProximityEvent>& out ) const
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      out.clear();
+      std::map<BodyPair,PairState>::const_iterator it;
+      for( it = _pairs.begin(); it != _pairs.end(); ++it )
+         out.push_back(it->second.event);
+   }
+
+   //! \brief Volume pairs that passed the broad phase in the last update.
+   size_t lastCandidates() const
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      return _lastCandidates;
+   }
+
+   //! \brief Check the frame. Called by FrameListener.
+   virtual void handleFrame( MocapFrame const& frame, struct timespec const& ts )
+   {
+      update(frame, NatNet::seconds(ts));
+   }
+
+   /*!
+    * \brief Check the bodies in \c frame and dispatch events. Thread-safe.
+    *
+    * \param frame new frame
+    * \param t arrival time of the frame in seconds
+    */
+   void update( MocapFrame const& frame, double t )
+   {
+      std::vector<ProximityEvent> events;
+      std::vector<ProximityHandler*> handlers;
+
+      {
+         boost::mutex::scoped_lock lock(_mutex);
+         if( _thresholds.empty() || _volumes.empty() )
+            return;
+         _place(frame.rigidBodies());
+         if( _broadPhase == SWEEP_AND_PRUNE )
+            _sweepAndPrune();
+         else
+            _hashPairs();
+         _lastCandidates = _candidates.size();
+         _narrowPhase(frame.frameNum(), t, events);
+         handlers = _handlers;
+      }
+
+      for( size_t i = 0; i < events.size(); ++i )
+         for( size_t j = 0; j < handlers.size(); ++j )
+            handlers[j]->proximityChanged(events[i]);
+   }
+
+   /*!
+    * \brief Distance between two volumes in world coordinates.
+    *
+    * Negative if they overlap.
+    */
+   static float distance( Point3f const& a0, Point3f const& a1, float ra, Point3f const& b0, Point3f const& b1, float rb )
+   {
+      return sqrtf(_segmentDistance2(a0, a1, b0, b1)) - ra - rb;
+   }
+
+private:
+
+   typedef std::pair<int,int> BodyPair;
+
+   class Volume
+   {
+   public:
+      Volume( int id, BodyVolume const& v ) :
+         body(id), local(v), a(), b(), lo(), hi(), active(false)
+      {
+      }
+
+      int body;
+      BodyVolume local;
+      // World segment and grown bounding box, valid if active.
+      Point3f a;
+      Point3f b;
+      Point3f lo;
+      Point3f hi;
+      bool active;
+   };
+
+   class PairState
+   {
+   public:
+      ProximityEvent event;
+   };
+
+   class Candidate
+   {
+   public:
+      BodyPair bodies;
+      float distance;
+
+      bool operator<( Candidate const& o ) const
+      {
+         return bodies < o.bodies || (bodies == o.bodies && distance < o.distance);
+      }
+   };
+
+   BroadPhase _broadPhase;
+   mutable boost::mutex _mutex;
+   // Descending.
+   std::vector<float> _thresholds;
+   float _hysteresis;
+   std::vector<Volume> _volumes;
+   std::map< int,std::vector<size_t> > _byBody;
+   std::vector<ProximityHandler*> _handlers;
+   // Pairs within at least one threshold.
+   std::map<BodyPair,PairState> _pairs;
+
+   // Broad phase state. _order is kept sorted by box minimum x.
+   std::vector<size_t> _order;
+   PointArray _centers;
+   SpatialHash _hash;
+   std::vector<size_t> _hashVolume;
+   std::vector<float> _bound;
+   std::vector<Candidate> _candidates;
+   size_t _lastCandidates;
+
+   // Move volumes to their bodies' poses and bound them.
+   void _place( std::vector<RigidBody> const& bodies )
+   {
+      float grow = 0.5f*(_thresholds[0] + _hysteresis);
+      size_t i, j;
+
+      for( i = 0; i < _volumes.size(); ++i )
+         _volumes[i].active = false;
+
+      for( i = 0; i < bodies.size(); ++i )
+      {
+         if( !bodies[i].trackingValid() )
+            continue;
+         std::map< int,std::vector<size_t> >::const_iterator it = _byBody.find(bodies[i].id());
+         if( it == _byBody.end() )
+            continue;
+
+         Point3f loc = bodies[i].location();
+         Quaternion4f ori = bodies[i].orientation();
+         for( j = 0; j < it->second.size(); ++j )
+         {
+            Volume& v = _volumes[it->second[j]];
+            Point3f ra = ori.rotate(v.local.a());
+            Point3f rb = ori.rotate(v.local.b());
+            float r = v.local.radius() + grow;
+            v.a = Point3f(loc.x+ra.x, loc.y+ra.y, loc.z+ra.z);
+            v.b = Point3f(loc.x+rb.x, loc.y+rb.y, loc.z+rb.z);
+            v.lo = Point3f(std::min(v.a.x,v.b.x)-r, std::min(v.a.y,v.b.y)-r, std::min(v.a.z,v.b.z)-r);
+            v.hi = Point3f(std::max(v.a.x,v.b.x)+r, std::max(v.a.y,v.b.y)+r, std::max(v.a.z,v.b.z)+r);
+            v.active = true;
+         }
+      }
+   }
+
+   void _addCandidate( Volume const& u, Volume const& v )
+   {
+      Candidate c;
+      c.bodies = u.body < v.body ? BodyPair(u.body, v.body) : BodyPair(v.body, u.body);
+      c.distance = distance(u.a, u.b, u.local.radius(), v.a, v.b, v.local.radius());
+      _candidates.push_back(c);
+   }
+
+   // Inactive volumes sort last.
+   float _minX( size_t i ) const
+   {
+      return _volumes[i].active ? _volumes[i].lo.x : HUGE_VALF;
+   }
+
+   void _sweepAndPrune()
+   {
+      size_t i, j, n = _order.size();
+
+      // Insertion sort: boxes barely move between frames, so this is
+      // close to linear.
+      for( i = 1; i < n; ++i )
+      {
+         size_t v = _order[i];
+         float x = _minX(v);
+         for( j = i; j > 0 && _minX(_order[j-1]) > x; --j )
+            _order[j] = _order[j-1];
+         _order[j] = v;
+      }
+
+      _candidates.clear();
+      for( i = 0; i < n && _volumes[_order[i]].active; ++i )
+      {
+         Volume const& u = _volumes[_order[i]];
+         for( j = i+1; j < n && _volumes[_order[j]].active; ++j )
+         {
+            Volume const& v = _volumes[_order[j]];
+            if( v.lo.x > u.hi.x )
+               break;
+            if( u.body == v.body ||
+                v.lo.y > u.hi.y || u.lo.y > v.hi.y ||
+                v.lo.z > u.hi.z || u.lo.z > v.hi.z )
+               continue;
+            _addCandidate(u, v);
+         }
+      }
+   }
+
+   void _hashPairs()
+   {
+      size_t i;
+      float maxBound = 0.f;
+
+      _centers.clear();
+      _hashVolume.clear();
+      _bound.clear();
+      for( i = 0; i < _volumes.size(); ++i )
+      {
+         Volume const& v = _volumes[i];
+         if( !v.active )
+            continue;
+         float dx = v.hi.x-v.lo.x, dy = v.hi.y-v.lo.y, dz = v.hi.z-v.lo.z;
+         float bound = 0.5f*sqrtf(dx*dx + dy*dy + dz*dz);
+         _centers.push_back(Point3f(0.5f*(v.lo.x+v.hi.x), 0.5f*(v.lo.y+v.hi.y), 0.5f*(v.lo.z+v.hi.z)));
+         _hashVolume.push_back(i);
+         _bound.push_back(bound);
+         maxBound = std::max(maxBound, bound);
+      }
+
+      _candidates.clear();
+      if( maxBound <= 0.f )
+         return;
+      _hash.setCellSize(2.f*maxBound);
+      _hash.build(_centers);
+
+      std::vector<uint32_t> near;
+      for( i = 0; i < _centers.size(); ++i )
+      {
+         near.clear();
+         _hash.radius(_centers.get(i), _bound[i] + maxBound, near);
+         for( size_t k = 0; k < near.size(); ++k )
+         {
+            uint32_t j = near[k];
+            if( j <= i )
+               continue;
+            Volume const& u = _volumes[_hashVolume[i]];
+            Volume const& v = _volumes[_hashVolume[j]];
+            if( u.body == v.body ||
+                v.lo.x > u.hi.x || u.lo.x > v.hi.x ||
+                v.lo.y > u.hi.y || u.lo.y > v.hi.y ||
+                v.lo.z > u.hi.z || u.lo.z > v.hi.z )
+               continue;
+            _addCandidate(u, v);
+         }
+      }
+   }
+
+   // Closest distance between the active volumes of two bodies.
+   bool _bodyDistance( int a, int b, float& d ) const
+   {
+      std::map< int,std::vector<size_t> >::const_iterator ia = _byBody.find(a), ib = _byBody.find(b);
+      bool found = false;
+      if( ia == _byBody.end() || ib == _byBody.end() )
+         return false;
+      for( size_t i = 0; i < ia->second.size(); ++i )
+      for( size_t j = 0; j < ib->second.size(); ++j )
+      {
+         Volume const& u = _volumes[ia->second[i]];
+         Volume const& v = _volumes[ib->second[j]];
+         if( !u.active || !v.active )
+            continue;
+         float dij = distance(u.a, u.b, u.local.radius(), v.a, v.b, v.local.radius());
+         if( !found || dij < d )
+            d = dij;
+         found = true;
+      }
+      return found;
+   }
+
+   unsigned int _level( float d, unsigned int previous ) const
+   {
+      unsigned int level = 0;
+      for( size_t k = 0; k < _thresholds.size(); ++k )
+         if( d < _thresholds[k] + (k < previous ? _hysteresis : 0.f) )
+            ++level;
+      return level;
+   }
+
+   void _narrowPhase( int frameNum, double t, std::vector<ProximityEvent>& events )
+   {
+      std::map<BodyPair,PairState> pairs;
+      size_t i;
+
+      // Closest volume pair per body pair.
+      std::sort(_candidates.begin(), _candidates.end());
+      for( i = 0; i < _candidates.size(); ++i )
+      {
+         if( i > 0 && _candidates[i].bodies == _candidates[i-1].bodies )
+            continue;
+         _measure(_candidates[i].bodies, _candidates[i].distance, frameNum, t, pairs, events);
+      }
+
+      // Pairs that were close but no longer passed the broad phase.
+      std::map<BodyPair,PairState>::const_iterator it;
+      for( it = _pairs.begin(); it != _pairs.end(); ++it )
+      {
+         if( _isCandidate(it->first) )
+            continue;
+         float d = 0.f;
+         if( _bothActive(it->first) && _bodyDistance(it->first.first, it->first.second, d) )
+            _measure(it->first, d, frameNum, t, pairs, events);
+         else
+            pairs[it->first] = it->second;
+      }
+
+      _pairs.swap(pairs);
+   }
+
+   // _candidates must be sorted.
+   bool _isCandidate( BodyPair const& p ) const
+   {
+      Candidate c;
+      c.bodies = p;
+      c.distance = -HUGE_VALF;
+      std::vector<Candidate>::const_iterator it = std::lower_bound(_candidates.begin(), _candidates.end(), c);
+      return it != _candidates.end() && it->bodies == p;
+   }
+
+   bool _bothActive( BodyPair const& p ) const
+   {
+      return _active(p.first) && _active(p.second);
+   }
+
+   bool _active( int body ) const
+   {
+      std::map< int,std::vector<size_t> >::const_iterator it = _byBody.find(body);
+      return it != _byBody.end() && !it->second.empty() && _volumes[it->second[0]].active;
+   }
+
+   void _measure( BodyPair const& bodies, float d, int frameNum, double t, std::map<BodyPair,PairState>& pairs, std::vector<ProximityEvent>& events ) const
+   {
+      std::map<BodyPair,PairState>::const_iterator old = _pairs.find(bodies);
+      unsigned int previous = old == _pairs.end() ? 0 : old->second.event.level;
+
+      ProximityEvent e;
+      e.bodyA = bodies.first;
+      e.bodyB = bodies.second;
+      e.distance = d;
+      e.level = _level(d, previous);
+      e.previousLevel = previous;
+      e.frameNum = frameNum;
+      e.time = t;
+
+      if( e.level != previous )
+         events.push_back(e);
+      if( e.level > 0 )
+      {
+         e.previousLevel = e.level;
+         pairs[bodies].event = e;
+      }
+   }
+
+   // Squared distance between segments p1-q1 and p2-q2. From Ericson,
+   // Real-Time Collision Detection, section 5.1.9.
+   static float _segmentDistance2( Point3f const& p1, Point3f const& q1, Point3f const& p2, Point3f const& q2 )
+   {
+      float d1x = q1.x-p1.x, d1y = q1.y-p1.y, d1z = q1.z-p1.z;
+      float d2x = q2.x-p2.x, d2y = q2.y-p2.y, d2z = q2.z-p2.z;
+      float rx = p1.x-p2.x, ry = p1.y-p2.y, rz = p1.z-p2.z;
+      float a = d1x*d1x + d1y*d1y + d1z*d1z;
+      float e = d2x*d2x + d2y*d2y + d2z*d2z;
+      float f = d2x*rx + d2y*ry + d2z*rz;
+      float s, t;
+      const float eps = 1e-12f;
+
+      if( a <= eps && e <= eps )
+      {
+         s = t = 0.f;
+      }
+      else if( a <= eps )
+      {
+         s = 0.f;
+         t = _clamp(f/e);
+      }
+      else
+      {
+         float c = d1x*rx + d1y*ry + d1z*rz;
+         if( e <= eps )
+         {
+            t = 0.f;
+            s = _clamp(-c/a);
+         }
+         else
+         {
+            float b = d1x*d2x + d1y*d2y + d1z*d2z;
+            float denom = a*e - b*b;
+            s = denom > eps ? _clamp((b*f - c*e)/denom) : 0.f;
+            t = (b*s + f)/e;
+            if( t < 0.f )
+            {
+               t = 0.f;
+               s = _clamp(-c/a);
+            }
+            else if( t > 1.f )
+            {
+               t = 1.f;
+               s = _clamp((b-c)/a);
+            }
+         }
+      }
+
+      float dx = rx + d1x*s - d2x*t;
+      float dy = ry + d1y*s - d2y*t;
+      float dz = rz + d1z*s - d2z*t;
+      return dx*dx + dy*dy + dz*dz;
+   }
+
+   static float _clamp( float v )
+   {
+      return v < 0.f ? 0.f : (v > 1.f ? 1.f : v);
+   }
+};
+
+#endif /*PROXIMITYMONITOR_H*/
@@ -0,0 +1,491 @@
+/*
+ * Replayer.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REPLAYER_H
+#define REPLAYER_H
+
+#include <NatNetLinux/CaptureReader.h>
+#include <NatNetLinux/CompressedReader.h>
+#include <NatNetLinux/FrameListener.h>
+#include <NatNetLinux/LatencyHistogram.h>
+#include <boost/thread.hpp>
+#include <string>
+#include <algorithm>
+#include <limits.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/*!
+ * \brief Progress of a Replayer.
+ * \author Philip G. Lee
+ */
+class ReplayStats
+{
+public:
+
+   //! \brief Default constructor. Nothing replayed.
+   ReplayStats() :
+      packets(0),
+      bytes(0),
+      loops(0),
+      sendErrors(0),
+      elapsed(0.0),
+      recorded(0.0),
+      lateness()
+   {
+   }
+
+   //! \brief Datagrams, or frames of a compressed recording, replayed.
+   uint64_t packets;
+   //! \brief Bytes of datagrams replayed. None for a compressed recording.
+   uint64_t bytes;
+   //! \brief Passes over the range completed.
+   uint64_t loops;
+   //! \brief Datagrams that failed to send, or frames that could not be.
+   uint64_t sendErrors;
+   //! \brief Seconds spent replaying.
+   double elapsed;
+   //! \brief Seconds of recording replayed.
+   double recorded;
+   /*!
+    * \brief How late each datagram went out relative to its schedule.
+    *
+    * Empty with \c Replayer::MAX_THROUGHPUT, which has no schedule.
+    */
+   HistogramSnapshot lateness;
+
+   //! \brief Achieved datagrams per second.
+   double rate() const { return elapsed > 0.0 ? packets/elapsed : 0.0; }
+   //! \brief Achieved speed relative to the recording, e.g. 1 for real time.
+   double speed() const { return elapsed > 0.0 ? recorded/elapsed : 0.0; }
+
+   //! \brief One line with the packet count, rate, speed and lateness.
+   std::string summary() const
+   {
+      char buf[256];
+      int n = snprintf(buf, sizeof(buf), "packets=%llu rate=%.1f/s speed=%.3fx loops=%llu",
+         static_cast<unsigned long long>(packets), rate(), speed(), static_cast<unsigned long long>(loops));
+      if( sendErrors )
+         n += snprintf(buf + n, sizeof(buf) - n, " send_errors=%llu", static_cast<unsigned long long>(sendErrors));
+      if( lateness.count )
+         snprintf(buf + n, sizeof(buf) - n, " lateness: %s", lateness.summary().c_str());
+      return buf;
+   }
+};
+
+/*!
+ * \brief Replays a capture log into a FrameListener or onto a socket.
+ * \author Philip G. Lee
+ *
+ * Datagrams recorded by CaptureWriter are fed, in order, either to
+ * \c FrameListener::inject() or with \c sendto() to any address, e.g. a
+ * multicast group that other programs listen on. Frames recorded by
+ * CompressedWriter are fed to \c FrameListener::injectFrame(); they have
+ * no datagrams to send to a socket.
+ *
+ * With \c ORIGINAL timing each datagram goes out when it was recorded,
+ * relative to the first; \c SCALED divides those gaps by a speed factor;
+ * \c MAX_THROUGHPUT sends as fast as the target accepts them. To be on
+ * time without burning a core, the replayer sleeps until shortly before a
+ * datagram is due (200 us by default, see setSpinThreshold()) and spins on
+ * the clock for the rest. How late each datagram went out is recorded in
+ * ReplayStats::lateness.
+ *
+ * Frames fed to a listener are stamped with the replay time, so processing
+ * stages see a live-looking stream, unless setKeepTimestamps() asks for the
+ * recorded times.
+ */
+class Replayer
+{
+public:
+
+   //! \brief Replay speed.
+   enum Timing
+   {
+      ORIGINAL       = 0,
+      SCALED         = 1,
+      MAX_THROUGHPUT = 2
+   };
+
+   /*!
+    * \brief Constructor
+    *
+    * \param reader an open capture. Must outlive the replayer.
+    */
+   Replayer( CaptureReader const& reader ) :
+      _thread(0),
+      _capture(&reader),
+      _compressed(0),
+      _listener(0),
+      _sd(-1),
+      _timing(ORIGINAL),
+      _speed(1.0),
+      _loop(false),
+      _keepTimestamps(false),
+      _spinThreshold(200e-6),
+      _firstFrame(INT_MIN),
+      _lastFrame(INT_MAX),
+      _useStart(false),
+      _start(),
+      _compressedStart(),
+      _run(false),
+      _statsMutex(),
+      _stats(),
+      _lateness(),
+      _cursor(),
+      _packet(),
+      _compressedCursor(),
+      _frame()
+   {
+      memset(&_dest, 0, sizeof(_dest));
+      memset(&_frameTs, 0, sizeof(_frameTs));
+   }
+
+   /*!
+    * \brief Constructor
+    *
+    * \param reader an open compressed recording. Must outlive the replayer.
+    */
+   Replayer( CompressedReader const& reader ) :
+      _thread(0),
+      _capture(0),
+      _compressed(&reader),
+      _listener(0),
+      _sd(-1),
+      _timing(ORIGINAL),
+      _speed(1.0),
+      _loop(false),
+      _keepTimestamps(false),
+      _spinThreshold(200e-6),
+      _firstFrame(INT_MIN),
+      _lastFrame(INT_MAX),
+      _useStart(false),
+      _start(),
+      _compressedStart(reader.begin()),
+      _run(false),
+      _statsMutex(),
+      _stats(),
+      _lateness(),
+      _cursor(),
+      _packet(),
+      _compressedCursor(),
+      _frame()
+   {
+      memset(&_dest, 0, sizeof(_dest));
+      memset(&_frameTs, 0, sizeof(_frameTs));
+   }
+
+   ~Replayer()
+   {
+      if( running() )
+         stop();
+      join();
+      delete _thread;
+   }
+
+   //! \brief Feed datagrams to \c listener with FrameListener::inject(), or frames with injectFrame(). Its thread must not be running.
+   void setListener( FrameListener* listener )
+   {
+      _listener = listener;
+      _sd = -1;
+   }
+
+   //! \brief Send datagrams with \c sendto() on socket \c sd to \c dest. Not for compressed recordings.
+   void setSocket( int sd, struct sockaddr_in const& dest )
+   {
+      _listener = 0;
+      _sd = sd;
+      _dest = dest;
+   }
+
+   /*!
+    * \brief Set the replay speed.
+    *
+    * \param timing one of Timing
+    * \param speed speed factor for \c SCALED, e.g. 2 for twice as fast
+    */
+   void setTiming( Timing timing, double speed=1.0 )
+   {
+      _timing = timing;
+      _speed = (timing == SCALED && speed > 0.0) ? speed : 1.0;
+   }
+
+   //! \brief Start over at the beginning of the range when done, until stopped.
+   void setLoop( bool loop ) { _loop = loop; }
+
+   //! \brief Stamp frames fed to a listener with their recorded time, not the replay time.
+   void setKeepTimestamps( bool keep ) { _keepTimestamps = keep; }
+
+   //! \brief Seconds before a datagram is due at which to stop sleeping and spin.
+   void setSpinThreshold( double seconds ) { _spinThreshold = seconds; }
+
+   /*!
+    * \brief Replay only frames numbered \c firstFrame to \c lastFrame.
+    *
+    * Replay starts at the first frame numbered \c firstFrame or later (see
+    * CaptureReader::seekFrame()), and stops at the first frame numbered
+    * past \c lastFrame. Other datagrams in between are replayed too.
+    */
+   void setRange( int firstFrame, int lastFrame=INT_MAX )
+   {
+      _firstFrame = firstFrame;
+      _lastFrame = lastFrame;
+      _useStart = false;
+   }
+
+   /*!
+    * \brief Start replay at \c start rather than at the first frame of the range.
+    *
+    * E.g. \c reader.seekTime(t) or \c reader.seekTimecode(tc).
+    */
+   void seek( CaptureCursor const& start )
+   {
+      _start = start;
+      _useStart = true;
+   }
+
+   //! \brief seek() in a compressed recording, e.g. \c reader.seekTime(t).
+   void seek( CompressedCursor const& start )
+   {
+      _compressedStart = start;
+      _useStart = true;
+   }
+
+   //! \brief Replay in a new thread. Non-blocking.
+   void start()
+   {
+      _run = true;
+      _thread = new boost::thread( &Replayer::_work, this );
+   }
+
+   //! \brief Cause the replay to stop. Non-blocking.
+   void stop()
+   {
+      _run = false;
+   }
+
+   //! \brief Return true iff the replay is running. Non-blocking.
+   bool running()
+   {
+      return _run;
+   }
+
+   //! \brief Wait for the replay thread to finish. Blocking.
+   void join()
+   {
+      if(_thread)
+         _thread->join();
+   }
+
+   //! \brief Replay in the calling thread until done or stopped. Blocking.
+   void run()
+   {
+      _run = true;
+      _work();
+   }
+
+   //! \brief Progress so far. Thread-safe.
+   ReplayStats stats() const
+   {
+      _statsMutex.lock();
+         ReplayStats ret = _stats;
+      _statsMutex.unlock();
+      _lateness.snapshot(ret.lateness);
+      return ret;
+   }
+
+private:
+
+   boost::thread* _thread;
+   // One of these is set.
+   CaptureReader const* _capture;
+   CompressedReader const* _compressed;
+   FrameListener* _listener;
+   int _sd;
+   struct sockaddr_in _dest;
+   Timing _timing;
+   double _speed;
+   bool _loop;
+   bool _keepTimestamps;
+   double _spinThreshold;
+   int _firstFrame;
+   int _lastFrame;
+   bool _useStart;
+   CaptureCursor _start;
+   CompressedCursor _compressedStart;
+   bool _run;
+   mutable boost::mutex _statsMutex;
+   ReplayStats _stats;
+   mutable LatencyHistogram _lateness;
+
+   // The next datagram or frame, only used by the replay thread.
+   CaptureCursor _cursor;
+   CapturePacket _packet;
+   CompressedCursor _compressedCursor;
+   MocapFrame _frame;
+   struct timespec _frameTs;
+
+   static int64_t _monotonicNs()
+   {
+      struct timespec ts;
+      clock_gettime( CLOCK_MONOTONIC, &ts );
+      return CaptureFormat::toNs(ts);
+   }
+
+   // Sleep, then spin, until the monotonic clock reaches due. Returns
+   // false if stopped first.
+   bool _waitUntil( int64_t due )
+   {
+      int64_t spin = static_cast<int64_t>(_spinThreshold*1e9);
+      int64_t now = _monotonicNs();
+      // Sleep in steps of at most 0.1 s so stop() takes effect quickly.
+      while( _run && due - now > spin )
+      {
+         int64_t wake = std::min<int64_t>(due - spin, now + 100000000LL);
+         struct timespec ts = CaptureFormat::fromNs(wake);
+         clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0 );
+         now = _monotonicNs();
+      }
+      while( _run && now < due )
+         now = _monotonicNs();
+      return _run;
+   }
+
+   // Go to the start of the range.
+   void _rewind()
+   {
+      if( _capture )
+         _cursor = _useStart ? _start : _capture->seekFrame(_firstFrame);
+      else
+         _compressedCursor = _useStart ? _compressedStart : _compressed->seekFrame(_firstFrame);
+   }
+
+   // Read the next datagram or frame and when it was recorded. Returns
+   // false at the end of the range.
+   bool _next( int64_t& recorded )
+   {
+      if( _capture )
+      {
+         if( !_capture->next(_cursor, _packet) || (_packet.isFrame() && _packet.frameNum() > _lastFrame) )
+            return false;
+         recorded = CaptureFormat::toNs(_packet.ts);
+         return true;
+      }
+      if( !_compressed->next(_compressedCursor, _frame, _frameTs) || _frame.frameNum() > _lastFrame )
+         return false;
+      recorded = CaptureFormat::toNs(_frameTs);
+      return true;
+   }
+
+   void _send( ReplayStats& local )
+   {
+      struct timespec now;
+      if( _listener && !_keepTimestamps )
+         clock_gettime( CLOCK_REALTIME, &now );
+      if( _compressed )
+      {
+         if( _listener )
+            _listener->injectFrame(_frame, _keepTimestamps ? _frameTs : now);
+         else
+            ++local.sendErrors;
+         ++local.packets;
+         return;
+      }
+
+      CapturePacket const& p = _packet;
+      if( _listener )
+      {
+         PacketInfo info = p.info();
+         if( !_keepTimestamps )
+         {
+            info.ts = now;
+            info.kernelTimestamp = false;
+         }
+         _listener->inject(p.data, p.length, info);
+      }
+      else if( sendto(_sd, p.data, p.length, 0, (struct sockaddr*)&_dest, sizeof(_dest)) < 0 )
+         ++local.sendErrors;
+      ++local.packets;
+      local.bytes += p.length;
+   }
+
+   void _publish( ReplayStats const& local, int64_t begin )
+   {
+      _statsMutex.lock();
+         _stats = local;
+         _stats.elapsed = 1e-9*(_monotonicNs() - begin);
+      _statsMutex.unlock();
+   }
+
+   void _work()
+   {
+      ReplayStats local;
+      int64_t begin = _monotonicNs();
+
+      _lateness.reset();
+      _publish(local, begin);
+      while( _run )
+      {
+         bool first = true;
+         int64_t recorded = 0, recordBase = 0, localBase = 0, recordLast = 0;
+
+         _rewind();
+         while( _run && _next(recorded) )
+         {
+            if( first )
+            {
+               recordBase = recorded;
+               recordLast = recorded;
+               localBase = _monotonicNs();
+               first = false;
+            }
+            if( recorded > recordLast )
+            {
+               local.recorded += 1e-9*(recorded - recordLast);
+               recordLast = recorded;
+            }
+
+            if( _timing != MAX_THROUGHPUT )
+            {
+               int64_t due = localBase + static_cast<int64_t>((recorded - recordBase)/_speed);
+               if( !_waitUntil(due) )
+                  break;
+               int64_t late = _monotonicNs() - due;
+               _lateness.record(late > 0 ? static_cast<uint64_t>(late) : 0);
+            }
+            _send(local);
+
+            if( (local.packets & 255) == 0 )
+               _publish(local, begin);
+         }
+
+         if( !_run )
+            break;
+         ++local.loops;
+         // An empty range would loop without end.
+         if( !_loop || first )
+            break;
+      }
+      _publish(local, begin);
+      _run = false;
+   }
+};
+
+#endif /*REPLAYER_H*/
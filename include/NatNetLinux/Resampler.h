@@ -0,0 +1,349 @@
+/*
+ * Resampler.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/PoseHistory.h>
+#include <boost/thread.hpp>
+#include <boost/circular_buffer.hpp>
+#include <vector>
+#include <math.h>
+#include <time.h>
+
+/*!
+ * \brief A rigid body pose on the resampled clock.
+ * \author Philip G. Lee
+ */
+class ResampledPose
+{
+public:
+
+   //! \brief Default constructor
+   ResampledPose() :
+      id(-1),
+      location(),
+      orientation(),
+      valid(false),
+      extrapolated(false)
+   {
+   }
+
+   //! \brief RigidBody::id() of the body.
+   int id;
+   //! \brief Location at the sample time.
+   Point3f location;
+   //! \brief Orientation at the sample time.
+   Quaternion4f orientation;
+   //! \brief False if there was no usable data for this sample time.
+   bool valid;
+   //! \brief True if the sample time was past the newest buffered pose.
+   bool extrapolated;
+};
+
+/*!
+ * \brief All rigid body poses at one tick of the resampled clock.
+ * \author Philip G. Lee
+ */
+class ResampledFrame
+{
+public:
+
+   //! \brief Default constructor
+   ResampledFrame() :
+      tick(0.0),
+      time(0.0),
+      poses()
+   {
+   }
+
+   //! \brief Time of the tick in seconds (see NatNet::seconds()).
+   double tick;
+   //! \brief Time the poses describe, i.e. \c tick minus Resampler::delay().
+   double time;
+   //! \brief One pose per body in the history.
+   std::vector<ResampledPose> poses;
+};
+
+/*!
+ * \brief Produces rigid body poses on a fixed clock.
+ * \author Philip G. Lee
+ *
+ * Frames arrive at the camera rate with network jitter, but control loops
+ * want poses at their own fixed rate. This class samples a PoseHistory at
+ * any time: location is interpolated linearly and orientation by slerp
+ * between the buffered poses on either side.
+ *
+ * Poses are sampled delay() seconds in the past, which is the bound on the
+ * latency this stage adds. With a delay of about one camera period plus the
+ * jitter, almost every sample is an interpolation. When the newest buffered
+ * pose is older than the sample time, the last two poses are extrapolated
+ * instead, for at most maxExtrapolation() seconds, and the result is
+ * flagged as \c extrapolated. Past that the sample is flagged invalid.
+ *
+ * Either call sample() from your own loop, or start() a timer thread that
+ * samples every period and buffers the results for pop()/tryPop(), just
+ * like FrameListener.
+ */
+class Resampler
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param history pose history to sample. Must outlive this object.
+    * \param rate clock rate in Hz
+    * \param delay seconds to sample behind the clock
+    * \param maxExtrapolation maximum seconds to extrapolate past the newest pose
+    * \param bufferSize number of ticks buffered by the timer thread
+    */
+   Resampler(
+      PoseHistory const& history,
+      double rate=1000.0,
+      double delay=0.01,
+      double maxExtrapolation=0.05,
+      size_t bufferSize=64
+   ) :
+      _history(history),
+      _period(1.0/rate),
+      _delay(delay),
+      _maxExtrapolation(maxExtrapolation),
+      _thread(0),
+      _run(false),
+      _framesMutex(),
+      _frames(bufferSize),
+      _missedTicks(0)
+   {
+   }
+
+   ~Resampler()
+   {
+      if( running() )
+         stop();
+      join();
+      delete _thread;
+   }
+
+   //! \brief Clock period in seconds.
+   double period() const { return _period; }
+   //! \brief Seconds behind the clock at which poses are sampled.
+   double delay() const { return _delay; }
+   //! \brief Maximum seconds of extrapolation.
+   double maxExtrapolation() const { return _maxExtrapolation; }
+
+   /*!
+    * \brief Sample one body. Thread-safe.
+    *
+    * \param id RigidBody::id() of the body
+    * \param t time in seconds. The delay is \b not subtracted.
+    * \param out output pose
+    * \returns \c out.valid
+    */
+   bool sample( int id, double t, ResampledPose& out ) const
+   {
+      out = ResampledPose();
+      out.id = id;
+
+      if( _history.poseAt(id, t, out.location, out.orientation) )
+      {
+         out.valid = true;
+         return true;
+      }
+
+      // Either before the history, or after the newest pose.
+      std::vector<PoseSample> last;
+      _history.latest(id, 2, last);
+      if( last.empty() || t < last.back().time || t - last.back().time > _maxExtrapolation )
+         return false;
+
+      PoseSample const& b = last.back();
+      out.valid = true;
+      out.extrapolated = true;
+      if( last.size() < 2 || b.time <= last[0].time )
+      {
+         out.location = b.location;
+         out.orientation = b.orientation;
+         return true;
+      }
+
+      PoseSample const& a = last[0];
+      float s = static_cast<float>((t - a.time) / (b.time - a.time));
+      out.location = Point3f(
+         a.location.x + s*(b.location.x-a.location.x),
+         a.location.y + s*(b.location.y-a.location.y),
+         a.location.z + s*(b.location.z-a.location.z)
+      );
+      // slerp() with s > 1 continues along the same arc.
+      out.orientation = Quaternion4f::slerp(a.orientation, b.orientation, s);
+      return true;
+   }
+
+   /*!
+    * \brief Sample every body for the clock tick at \c tick. Thread-safe.
+    *
+    * \param tick clock time in seconds. Poses are sampled at \c tick - delay().
+    * \param out output frame
+    */
+   void sample( double tick, ResampledFrame& out ) const
+   {
+      std::vector<int> ids = _history.ids();
+      size_t i;
+
+      out.tick = tick;
+      out.time = tick - _delay;
+      out.poses.resize(ids.size());
+      for( i = 0; i < ids.size(); ++i )
+         sample(ids[i], out.time, out.poses[i]);
+   }
+
+   //! \brief Begin sampling in a new timer thread. Non-blocking.
+   void start()
+   {
+      _run = true;
+      _thread = new boost::thread( &Resampler::_work, this );
+   }
+
+   //! \brief Cause the timer thread to stop. Non-blocking.
+   void stop()
+   {
+      _run = false;
+   }
+
+   //! \brief Return true iff the timer thread is running. Non-blocking.
+   bool running()
+   {
+      return _run;
+   }
+
+   //! \brief Wait for the timer thread to stop. Blocking.
+   void join()
+   {
+      if(_thread)
+         _thread->join();
+   }
+
+   /*!
+    * \brief Get the oldest buffered tick and remove it. Thread-safe.
+    *
+    * Unlike FrameListener::pop(), this returns ticks oldest first, since a
+    * control loop usually wants every one of them.
+    *
+    * \param success if not null, set to false iff the buffer was empty
+    */
+   ResampledFrame pop( bool* success=0 )
+   {
+      ResampledFrame ret;
+      bool retSuccess = false;
+
+      _framesMutex.lock();
+      if( !_frames.empty() )
+      {
+         retSuccess = true;
+         ret = _frames.front();
+         _frames.pop_front();
+      }
+      _framesMutex.unlock();
+
+      if( success )
+         *success = retSuccess;
+      return ret;
+   }
+
+   //! \brief Like pop(), but fails instead of blocking on the lock.
+   ResampledFrame tryPop( bool* success=0 )
+   {
+      ResampledFrame ret;
+      bool retSuccess = false;
+
+      if( _framesMutex.try_lock() )
+      {
+         if( !_frames.empty() )
+         {
+            retSuccess = true;
+            ret = _frames.front();
+            _frames.pop_front();
+         }
+         _framesMutex.unlock();
+      }
+
+      if( success )
+         *success = retSuccess;
+      return ret;
+   }
+
+   //! \brief Number of ticks the timer thread skipped because it ran late.
+   unsigned long missedTicks() const
+   {
+      _framesMutex.lock();
+         unsigned long ret = _missedTicks;
+      _framesMutex.unlock();
+      return ret;
+   }
+
+private:
+
+   PoseHistory const& _history;
+   double _period;
+   double _delay;
+   double _maxExtrapolation;
+
+   boost::thread* _thread;
+   bool _run;
+   mutable boost::mutex _framesMutex;
+   boost::circular_buffer<ResampledFrame> _frames;
+   // Guarded by _framesMutex.
+   unsigned long _missedTicks;
+
+   void _work()
+   {
+      ResampledFrame frame;
+      struct timespec ts;
+      double next = ceil(NatNet::now()/_period)*_period;
+
+      while(_run)
+      {
+         // Sleep until an absolute time, so that the clock does not drift
+         // by the time spent sampling.
+         ts.tv_sec = static_cast<time_t>(next);
+         ts.tv_nsec = static_cast<long>((next - ts.tv_sec)*1e9);
+         if( clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, 0) != 0 )
+            continue;
+
+         sample(next, frame);
+         _framesMutex.lock();
+            _frames.push_back(frame);
+         _framesMutex.unlock();
+
+         // If we fell behind, skip ticks instead of bursting to catch up.
+         next += _period;
+         double now = NatNet::now();
+         if( now > next + _period )
+         {
+            double behind = floor((now - next)/_period);
+            _framesMutex.lock();
+               _missedTicks += static_cast<unsigned long>(behind);
+            _framesMutex.unlock();
+            next += behind*_period;
+         }
+      }
+   }
+};
+
+#endif /*RESAMPLER_H*/
@@ -0,0 +1,658 @@
+/*
+ * SessionScanner.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SESSIONSCANNER_H
+#define SESSIONSCANNER_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/LatencyHistogram.h>
+#include <NatNetLinux/TrajectoryReader.h>
+#include <NatNetLinux/CompressedReader.h>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <vector>
+#include <math.h>
+#include <stdint.h>
+
+/*!
+ * \brief Statistics of one rigid body over a run of frames.
+ * \author Philip G. Lee
+ *
+ * Summaries of consecutive runs of frames merge() into the summary of the
+ * whole run, exactly as if it had been scanned in one go: a gap or a
+ * velocity that spans the boundary is counted once. That is what lets
+ * SessionScanner scan partitions of a recording in parallel.
+ *
+ * A frame counts as valid if the body was in it and tracked. A gap is a
+ * run of invalid frames with valid frames on both sides. Speeds are taken
+ * between consecutive valid frames, from the server's capture times where
+ * there are any and the receive times otherwise.
+ */
+class BodySummary
+{
+public:
+
+   //! \brief Position at a point in time.
+   struct Sample
+   {
+      float x, y, z;
+      double t;
+   };
+
+   //! \brief Constructor. No frames.
+   BodySummary( int id=0 ) :
+      id(id),
+      frames(0),
+      validFrames(0),
+      errorSum(0.0),
+      gaps(0),
+      gapFrames(0),
+      longestGap(0),
+      speed(),
+      leading(0),
+      trailing(0)
+   {
+      memset(&first, 0, sizeof(first));
+      memset(&last, 0, sizeof(last));
+   }
+
+   //! \brief Rigid body ID.
+   int id;
+   //! \brief Frames covered, valid or not.
+   uint64_t frames;
+   //! \brief Frames in which the body was tracked.
+   uint64_t validFrames;
+   //! \brief Sum of the mean marker errors of the valid frames in meters.
+   double errorSum;
+   //! \brief Number of gaps.
+   uint64_t gaps;
+   //! \brief Frames in gaps.
+   uint64_t gapFrames;
+   //! \brief Frames in the longest gap.
+   uint64_t longestGap;
+   /*!
+    * \brief Speeds in nm/s, so that its "seconds" read as m/s.
+    *
+    * Buckets are about 3% wide, as in LatencyHistogram.
+    */
+   HistogramSnapshot speed;
+
+   //! \brief Invalid frames before the first valid one. All frames if none is valid.
+   uint64_t leading;
+   //! \brief Invalid frames after the last valid one. All frames if none is valid.
+   uint64_t trailing;
+   //! \brief First valid sample. Undefined if there is none.
+   Sample first;
+   //! \brief Last valid sample. Undefined if there is none.
+   Sample last;
+
+   //! \brief Fraction of the frames that are valid, or 0 without frames.
+   double validRatio() const { return frames ? static_cast<double>(validFrames)/frames : 0.0; }
+   //! \brief Mean marker error of the valid frames in meters, or 0 if none.
+   double meanMarkerError() const { return validFrames ? errorSum/validFrames : 0.0; }
+   //! \brief Speed in m/s below which a fraction \c q of the speeds fall.
+   double speedPercentile( double q ) const { return speed.percentile(q); }
+   //! \brief Mean speed in m/s.
+   double meanSpeed() const { return speed.mean(); }
+   //! \brief Largest speed in m/s.
+   double maxSpeed() const { return speed.maxSeconds(); }
+
+   //! \brief Add the next frame, at \c t seconds.
+   void add( bool valid, float x, float y, float z, float error, double t )
+   {
+      ++frames;
+      if( !valid )
+      {
+         if( !validFrames )
+            ++leading;
+         ++trailing;
+         return;
+      }
+
+      Sample s;
+      s.x = x;
+      s.y = y;
+      s.z = z;
+      s.t = t;
+      if( !validFrames )
+      {
+         first = s;
+         trailing = 0;
+      }
+      else
+         _join(s);
+      last = s;
+      ++validFrames;
+      errorSum += error;
+   }
+
+   //! \brief Add \c n invalid frames, e.g. for frames the body was not in.
+   void skip( uint64_t n )
+   {
+      frames += n;
+      if( !validFrames )
+         leading += n;
+      trailing += n;
+   }
+
+   //! \brief Add the frames summarized by \c later, which come right after these.
+   void merge( BodySummary const& later )
+   {
+      if( !later.frames )
+         return;
+      if( !later.validFrames )
+      {
+         skip(later.frames);
+         return;
+      }
+
+      if( validFrames )
+      {
+         trailing += later.leading;
+         _join(later.first);
+      }
+      else
+      {
+         leading += later.leading;
+         first = later.first;
+      }
+      frames += later.frames;
+      validFrames += later.validFrames;
+      errorSum += later.errorSum;
+      gaps += later.gaps;
+      gapFrames += later.gapFrames;
+      longestGap = std::max(longestGap, later.longestGap);
+      speed.merge(later.speed);
+      trailing = later.trailing;
+      last = later.last;
+   }
+
+private:
+
+   // Valid sample s follows the last one after trailing invalid frames.
+   void _join( Sample const& s )
+   {
+      if( trailing )
+      {
+         ++gaps;
+         gapFrames += trailing;
+         longestGap = std::max(longestGap, trailing);
+         trailing = 0;
+         return;
+      }
+
+      double dt = s.t - last.t;
+      if( dt <= 0.0 )
+         return;
+      double dx = s.x - last.x, dy = s.y - last.y, dz = s.z - last.z;
+      uint64_t v = static_cast<uint64_t>(1e9*sqrt(dx*dx + dy*dy + dz*dz)/dt + 0.5);
+      size_t b = LatencyHistogram::bucket(v);
+      if( speed.counts.size() <= b )
+         speed.counts.resize(b + 1, 0);
+      ++speed.counts[b];
+      ++speed.count;
+      speed.sum += v;
+      if( v > speed.max )
+         speed.max = v;
+   }
+};
+
+/*!
+ * \brief Statistics of every rigid body over a run of frames.
+ * \author Philip G. Lee
+ *
+ * Built a frame at a time with addFrame() and body(), or a body at a time
+ * for columnar stores, then finish()ed. Like BodySummary, summaries of
+ * consecutive runs merge() into the summary of the whole; a body missing
+ * from a run counts as invalid in all of its frames.
+ */
+class ScanSummary
+{
+public:
+
+   //! \brief Constructor. No frames.
+   ScanSummary() :
+      frames(0),
+      firstFrame(0),
+      lastFrame(0),
+      firstTimeNs(0),
+      lastTimeNs(0),
+      bodies()
+   {
+   }
+
+   //! \brief Number of frames.
+   uint64_t frames;
+   //! \brief Number of the first frame.
+   int firstFrame;
+   //! \brief Number of the last frame.
+   int lastFrame;
+   //! \brief Receive time of the first frame in ns since the epoch.
+   int64_t firstTimeNs;
+   //! \brief Receive time of the last frame in ns since the epoch.
+   int64_t lastTimeNs;
+   //! \brief Summary of each body, by ID.
+   std::map<int, BodySummary> bodies;
+
+   //! \brief Add a frame. Its bodies are added with body().
+   void addFrame( int frameNum, int64_t timeNs )
+   {
+      if( !frames )
+      {
+         firstFrame = frameNum;
+         firstTimeNs = timeNs;
+      }
+      lastFrame = frameNum;
+      lastTimeNs = timeNs;
+      ++frames;
+   }
+
+   /*!
+    * \brief Summary of body \c id, to add the body's value in frame \c row.
+    *
+    * Frames before \c row that the body has no value for are added as
+    * invalid. Rows count from 0 in this summary.
+    */
+   BodySummary& body( int id, uint64_t row )
+   {
+      std::map<int, BodySummary>::iterator it = bodies.find(id);
+      if( it == bodies.end() )
+         it = bodies.insert(std::make_pair(id, BodySummary(id))).first;
+      if( it->second.frames < row )
+         it->second.skip(row - it->second.frames);
+      return it->second;
+   }
+
+   //! \brief Add invalid frames to each body up to the last frame.
+   void finish()
+   {
+      std::map<int, BodySummary>::iterator it;
+      for( it = bodies.begin(); it != bodies.end(); ++it )
+         if( it->second.frames < frames )
+            it->second.skip(frames - it->second.frames);
+   }
+
+   //! \brief Add the frames summarized by \c later, which come right after these. Both finish()ed.
+   void merge( ScanSummary const& later )
+   {
+      if( !later.frames )
+         return;
+      if( !frames )
+      {
+         *this = later;
+         return;
+      }
+
+      std::map<int, BodySummary>::iterator it;
+      std::map<int, BodySummary>::const_iterator jt;
+      for( it = bodies.begin(); it != bodies.end(); ++it )
+         if( later.bodies.find(it->first) == later.bodies.end() )
+            it->second.skip(later.frames);
+      for( jt = later.bodies.begin(); jt != later.bodies.end(); ++jt )
+      {
+         it = bodies.find(jt->first);
+         if( it == bodies.end() )
+         {
+            it = bodies.insert(std::make_pair(jt->first, BodySummary(jt->first))).first;
+            it->second.skip(frames);
+         }
+         it->second.merge(jt->second);
+      }
+
+      frames += later.frames;
+      lastFrame = later.lastFrame;
+      lastTimeNs = later.lastTimeNs;
+   }
+};
+
+/*!
+ * \brief A recording split into partitions that can be scanned independently.
+ * \author Philip G. Lee
+ */
+class ScanSource
+{
+public:
+
+   virtual ~ScanSource() {}
+
+   //! \brief Number of partitions, in the order they were recorded.
+   virtual size_t numPartitions() const = 0;
+
+   /*!
+    * \brief Summarize partition \c i into \c out, which is empty.
+    *
+    * Called from several threads at once, for different partitions.
+    */
+   virtual void scan( size_t i, ScanSummary& out ) const = 0;
+};
+
+/*!
+ * \brief Scans a trajectory store by chunk or by time range.
+ * \author Philip G. Lee
+ *
+ * Only the frame columns and the body columns that are read are loaded
+ * from disk, a chunk at a time.
+ */
+class TrajectoryScanSource : public ScanSource
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param reader open store, which must outlive this
+    * \param window seconds of receive time per partition, or 0 for one
+    *    partition per chunk
+    */
+   TrajectoryScanSource( TrajectoryReader const& reader, double window=0.0 ) :
+      _reader(reader),
+      _windowNs(static_cast<int64_t>(window*1e9)),
+      _startNs(0),
+      _partitions(reader.numChunks())
+   {
+      if( _windowNs > 0 && reader.numChunks() )
+      {
+         _startNs = reader.chunkHeader(0).minTimeNs;
+         int64_t span = reader.chunkHeader(reader.numChunks() - 1).maxTimeNs - _startNs;
+         _partitions = static_cast<size_t>(span/_windowNs) + 1;
+      }
+   }
+
+   virtual size_t numPartitions() const { return _partitions; }
+
+   virtual void scan( size_t i, ScanSummary& out ) const
+   {
+      if( _windowNs <= 0 )
+      {
+         _scanChunk(i, 0, std::numeric_limits<int64_t>::max(), out);
+         out.finish();
+         return;
+      }
+
+      int64_t lo = _startNs + static_cast<int64_t>(i)*_windowNs;
+      int64_t hi = lo + _windowNs;
+      // First chunk that ends at or past the window.
+      size_t a = 0, b = _reader.numChunks();
+      while( a < b )
+      {
+         size_t mid = a + (b - a)/2;
+         if( _reader.chunkHeader(mid).maxTimeNs < lo )
+            a = mid + 1;
+         else
+            b = mid;
+      }
+      for( ; a < _reader.numChunks() && _reader.chunkHeader(a).minTimeNs < hi; ++a )
+         _scanChunk(a, lo, hi, out);
+      out.finish();
+   }
+
+private:
+
+   TrajectoryReader const& _reader;
+   int64_t _windowNs;
+   int64_t _startNs;
+   size_t _partitions;
+
+   // Add the rows of chunk i received in [lo, hi).
+   void _scanChunk( size_t i, int64_t lo, int64_t hi, ScanSummary& out ) const
+   {
+      std::vector<int> const& ids = _reader.bodies();
+      TrajectorySlice slice;
+      if( ids.empty() )
+         return;
+
+      _reader.chunkSlice(i, ids[0], slice);
+      size_t first = std::lower_bound(slice.timeNs.begin(), slice.timeNs.end(), lo) - slice.timeNs.begin();
+      size_t last = std::lower_bound(slice.timeNs.begin(), slice.timeNs.end(), hi) - slice.timeNs.begin();
+      uint64_t base = out.frames;
+      for( size_t r = first; r < last; ++r )
+         out.addFrame(slice.frameNum[r], slice.timeNs[r]);
+
+      for( size_t k = 0; k < ids.size(); ++k )
+      {
+         if( !_reader.chunkSlice(i, ids[k], slice) )
+            continue;
+         BodySummary& body = out.body(ids[k], base);
+         for( size_t r = first; r < last; ++r )
+         {
+            double t = slice.captureTime[r] > 0.0 ? slice.captureTime[r] : 1e-9*slice.timeNs[r];
+            body.add(slice.valid[r] != 0, slice.x[r], slice.y[r], slice.z[r], slice.markerError[r], t);
+         }
+      }
+   }
+};
+
+/*!
+ * \brief Scans a file written by CompressedWriter by block or by time range.
+ * \author Philip G. Lee
+ */
+class CompressedScanSource : public ScanSource
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param reader open file, which must outlive this
+    * \param window seconds of receive time per partition, or 0 for one
+    *    partition per block
+    */
+   CompressedScanSource( CompressedReader const& reader, double window=0.0 ) :
+      _reader(reader),
+      _windowNs(static_cast<int64_t>(window*1e9)),
+      _startNs(0),
+      _partitions(reader.numBlocks())
+   {
+      if( _windowNs > 0 && reader.numBlocks() )
+      {
+         _startNs = reader.blockHeader(0).firstTimeNs;
+         int64_t span = reader.blockHeader(reader.numBlocks() - 1).lastTimeNs - _startNs;
+         _partitions = static_cast<size_t>(span/_windowNs) + 1;
+      }
+   }
+
+   virtual size_t numPartitions() const { return _partitions; }
+
+   virtual void scan( size_t i, ScanSummary& out ) const
+   {
+      CompressedCursor c;
+      int64_t hi;
+      uint64_t frames = std::numeric_limits<uint64_t>::max();
+      if( _windowNs <= 0 )
+      {
+         c = _reader.begin(i);
+         hi = std::numeric_limits<int64_t>::max();
+         frames = _reader.blockHeader(i).frames;
+      }
+      else
+      {
+         int64_t lo = _startNs + static_cast<int64_t>(i)*_windowNs;
+         struct timespec ts;
+         ts.tv_sec = static_cast<time_t>(lo/1000000000LL);
+         ts.tv_nsec = static_cast<long>(lo%1000000000LL);
+         c = _reader.seekTime(ts);
+         hi = lo + _windowNs;
+      }
+
+      MocapFrame frame;
+      struct timespec ts;
+      while( out.frames < frames && _reader.next(c, frame, ts) )
+      {
+         int64_t timeNs = static_cast<int64_t>(ts.tv_sec)*1000000000LL + ts.tv_nsec;
+         if( timeNs >= hi )
+            break;
+         out.addFrame(frame.frameNum(), timeNs);
+         double t = frame.captureTime() > 0.0 ? frame.captureTime() : 1e-9*timeNs;
+         std::vector<RigidBody> const& rbs = frame.rigidBodies();
+         for( size_t k = 0; k < rbs.size(); ++k )
+         {
+            Point3f p = rbs[k].location();
+            out.body(rbs[k].id(), out.frames - 1).add(rbs[k].trackingValid(), p.x, p.y, p.z, rbs[k].meanMarkerError(), t);
+         }
+      }
+      out.finish();
+   }
+
+private:
+
+   CompressedReader const& _reader;
+   int64_t _windowNs;
+   int64_t _startNs;
+   size_t _partitions;
+};
+
+/*!
+ * \brief Receives the summary of each partition as SessionScanner merges it.
+ * \author Philip G. Lee
+ */
+class ScanHandler
+{
+public:
+
+   virtual ~ScanHandler() {}
+
+   //! \brief Partition \c i was scanned. Called in partition order, from the thread calling scan().
+   virtual void handlePartition( size_t i, ScanSummary const& partition ) = 0;
+};
+
+/*!
+ * \brief Scans a recording with a pool of threads.
+ * \author Philip G. Lee
+ *
+ * Each thread takes the next partition of the ScanSource and summarizes
+ * it. The calling thread merges the summaries in partition order, handing
+ * each to the ScanHandler first, so results stream out while the scan goes
+ * on. At most a few partitions per thread are scanned ahead of the merge,
+ * which bounds memory however long the recording is.
+ */
+class SessionScanner
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param threads number of threads scanning, or 0 for one per core
+    */
+   SessionScanner( unsigned int threads=0 ) :
+      _threads(threads ? threads : std::max(1u, boost::thread::hardware_concurrency())),
+      _handler(0),
+      _source(0),
+      _mutex(),
+      _cond(),
+      _next(0),
+      _merged(0),
+      _done()
+   {
+   }
+
+   //! \brief Number of threads scanning.
+   unsigned int threads() const { return _threads; }
+
+   //! \brief Handler of each partition summary, or 0 for none.
+   void setHandler( ScanHandler* handler ) { _handler = handler; }
+
+   //! \brief Scan every partition of \c source and return the merged summary. Blocking.
+   ScanSummary scan( ScanSource const& source )
+   {
+      ScanSummary total;
+      std::vector<boost::thread*> workers;
+      size_t n = source.numPartitions();
+
+      _source = &source;
+      _next = 0;
+      _merged = 0;
+      for( unsigned int i = 0; i < _threads; ++i )
+         workers.push_back(new boost::thread( &SessionScanner::_work, this ));
+
+      boost::unique_lock<boost::mutex> lock(_mutex);
+      while( _merged < n )
+      {
+         std::map<size_t, ScanSummary*>::iterator it;
+         while( (it = _done.find(_merged)) == _done.end() )
+            _cond.wait(lock);
+         ScanSummary* partial = it->second;
+         _done.erase(it);
+         lock.unlock();
+
+         if( _handler )
+            _handler->handlePartition(_merged, *partial);
+         total.merge(*partial);
+         delete partial;
+
+         lock.lock();
+         ++_merged;
+         _cond.notify_all();
+      }
+      lock.unlock();
+
+      for( size_t i = 0; i < workers.size(); ++i )
+      {
+         workers[i]->join();
+         delete workers[i];
+      }
+      _source = 0;
+      return total;
+   }
+
+private:
+
+   unsigned int _threads;
+   ScanHandler* _handler;
+   ScanSource const* _source;
+
+   // Guards the partition counters and _done.
+   boost::mutex _mutex;
+   boost::condition_variable _cond;
+   size_t _next;
+   size_t _merged;
+   std::map<size_t, ScanSummary*> _done;
+
+   // Partitions a thread may scan ahead of the merge.
+   size_t _ahead() const { return 4*_threads; }
+
+   void _work()
+   {
+      size_t n = _source->numPartitions();
+      boost::unique_lock<boost::mutex> lock(_mutex);
+      for(;;)
+      {
+         while( _next < n && _next >= _merged + _ahead() )
+            _cond.wait(lock);
+         if( _next >= n )
+            break;
+         size_t i = _next++;
+         lock.unlock();
+
+         ScanSummary* partial = new ScanSummary();
+         _source->scan(i, *partial);
+
+         lock.lock();
+         _done[i] = partial;
+         _cond.notify_all();
+      }
+   }
+
+   // Not copyable.
+   SessionScanner( SessionScanner const& );
+   SessionScanner& operator=( SessionScanner const& );
+};
+
+#endif /*SESSIONSCANNER_H*/
@@ -0,0 +1,214 @@
+/*
+ * Simd.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+// Define NATNET_NO_SIMD before including to force the portable fallback.
+#if defined(__SSE2__) && !defined(NATNET_NO_SIMD)
+#define NATNET_SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+
+/*!
+ * \brief Four packed floats.
+ * \author Philip G. Lee
+ *
+ * This is a thin wrapper around an SSE2 register, with a plain array
+ * fallback for targets without SSE2. The batch kernels are written once in
+ * terms of this class, and process four elements of a structure-of-arrays
+ * at a time.
+ *
+ * Comparisons return lane masks (all bits set or all bits clear) that are
+ * meant to be consumed by \c select(), \c any() and the bitwise operators.
+ */
+class Float4
+{
+public:
+
+   //! \brief Number of lanes.
+   static const size_t width = 4;
+
+#ifdef NATNET_SIMD_SSE2
+   __m128 v;
+
+   Float4() : v(_mm_setzero_ps()) {}
+   Float4( __m128 vv ) : v(vv) {}
+   //! \brief Broadcast \c a to every lane.
+   Float4( float a ) : v(_mm_set1_ps(a)) {}
+   Float4( float a, float b, float c, float d ) : v(_mm_setr_ps(a,b,c,d)) {}
+
+   //! \brief Load four floats. \c p need not be aligned.
+   static Float4 load( float const* p ) { return Float4(_mm_loadu_ps(p)); }
+   //! \brief Store four floats. \c p need not be aligned.
+   void store( float* p ) const { _mm_storeu_ps(p, v); }
+
+   Float4 operator+( Float4 const& o ) const { return Float4(_mm_add_ps(v,o.v)); }
+   Float4 operator-( Float4 const& o ) const { return Float4(_mm_sub_ps(v,o.v)); }
+   Float4 operator*( Float4 const& o ) const { return Float4(_mm_mul_ps(v,o.v)); }
+   Float4 operator/( Float4 const& o ) const { return Float4(_mm_div_ps(v,o.v)); }
+   Float4 operator-() const { return Float4(_mm_xor_ps(v, _mm_set1_ps(-0.f))); }
+
+   Float4 operator<( Float4 const& o ) const { return Float4(_mm_cmplt_ps(v,o.v)); }
+   Float4 operator<=( Float4 const& o ) const { return Float4(_mm_cmple_ps(v,o.v)); }
+   Float4 operator>( Float4 const& o ) const { return Float4(_mm_cmpgt_ps(v,o.v)); }
+   Float4 operator>=( Float4 const& o ) const { return Float4(_mm_cmpge_ps(v,o.v)); }
+   Float4 operator&( Float4 const& o ) const { return Float4(_mm_and_ps(v,o.v)); }
+   Float4 operator|( Float4 const& o ) const { return Float4(_mm_or_ps(v,o.v)); }
+
+   //! \brief Lane-wise square root.
+   friend Float4 sqrt( Float4 const& a ) { return Float4(_mm_sqrt_ps(a.v)); }
+   //! \brief Lane-wise minimum.
+   friend Float4 min( Float4 const& a, Float4 const& b ) { return Float4(_mm_min_ps(a.v,b.v)); }
+   //! \brief Lane-wise maximum.
+   friend Float4 max( Float4 const& a, Float4 const& b ) { return Float4(_mm_max_ps(a.v,b.v)); }
+   //! \brief Lane-wise absolute value.
+   friend Float4 abs( Float4 const& a ) { return Float4(_mm_andnot_ps(_mm_set1_ps(-0.f), a.v)); }
+   //! \brief Magnitude of \c a with the sign of \c s.
+   friend Float4 copysign( Float4 const& a, Float4 const& s )
+   {
+      __m128 const sign = _mm_set1_ps(-0.f);
+      return Float4(_mm_or_ps(_mm_andnot_ps(sign, a.v), _mm_and_ps(sign, s.v)));
+   }
+   //! \brief Lane-wise \c mask ? \c a : \c b.
+   friend Float4 select( Float4 const& mask, Float4 const& a, Float4 const& b )
+   {
+      return Float4(_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)));
+   }
+   //! \brief Bit \c i is set iff lane \c i of \c mask is set.
+   friend int movemask( Float4 const& mask ) { return _mm_movemask_ps(mask.v); }
+#else
+   float v[4];
+
+   Float4() { v[0] = v[1] = v[2] = v[3] = 0.f; }
+   Float4( float a ) { v[0] = v[1] = v[2] = v[3] = a; }
+   Float4( float a, float b, float c, float d ) { v[0]=a; v[1]=b; v[2]=c; v[3]=d; }
+
+   static Float4 load( float const* p ) { Float4 r; memcpy(r.v, p, sizeof(r.v)); return r; }
+   void store( float* p ) const { memcpy(p, v, sizeof(v)); }
+
+#define NATNET_FLOAT4_BINOP(op) \
+   Float4 operator op( Float4 const& o ) const \
+   { Float4 r; for( int i = 0; i < 4; ++i ) r.v[i] = v[i] op o.v[i]; return r; }
+   NATNET_FLOAT4_BINOP(+)
+   NATNET_FLOAT4_BINOP(-)
+   NATNET_FLOAT4_BINOP(*)
+   NATNET_FLOAT4_BINOP(/)
+#undef NATNET_FLOAT4_BINOP
+   Float4 operator-() const { return Float4(-v[0],-v[1],-v[2],-v[3]); }
+
+#define NATNET_FLOAT4_CMP(op) \
+   Float4 operator op( Float4 const& o ) const \
+   { Float4 r; for( int i = 0; i < 4; ++i ) r.v[i] = _maskLane(v[i] op o.v[i]); return r; }
+   NATNET_FLOAT4_CMP(<)
+   NATNET_FLOAT4_CMP(<=)
+   NATNET_FLOAT4_CMP(>)
+   NATNET_FLOAT4_CMP(>=)
+#undef NATNET_FLOAT4_CMP
+   Float4 operator&( Float4 const& o ) const { return _bitwise(o, 0); }
+   Float4 operator|( Float4 const& o ) const { return _bitwise(o, 1); }
+
+   friend Float4 sqrt( Float4 const& a ) { return Float4(sqrtf(a.v[0]),sqrtf(a.v[1]),sqrtf(a.v[2]),sqrtf(a.v[3])); }
+   friend Float4 min( Float4 const& a, Float4 const& b )
+   { Float4 r; for( int i = 0; i < 4; ++i ) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return r; }
+   friend Float4 max( Float4 const& a, Float4 const& b )
+   { Float4 r; for( int i = 0; i < 4; ++i ) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return r; }
+   friend Float4 abs( Float4 const& a ) { return Float4(fabsf(a.v[0]),fabsf(a.v[1]),fabsf(a.v[2]),fabsf(a.v[3])); }
+   friend Float4 copysign( Float4 const& a, Float4 const& s )
+   { Float4 r; for( int i = 0; i < 4; ++i ) r.v[i] = copysignf(a.v[i], s.v[i]); return r; }
+   friend Float4 select( Float4 const& mask, Float4 const& a, Float4 const& b )
+   {
+      Float4 r;
+      for( int i = 0; i < 4; ++i )
+         r.v[i] = _laneSet(mask.v[i]) ? a.v[i] : b.v[i];
+      return r;
+   }
+   friend int movemask( Float4 const& mask )
+   {
+      int r = 0;
+      for( int i = 0; i < 4; ++i )
+         r |= (_laneSet(mask.v[i]) ? 1 : 0) << i;
+      return r;
+   }
+
+private:
+
+   static float _maskLane( bool b )
+   {
+      unsigned int u = b ? 0xFFFFFFFFu : 0u;
+      float f;
+      memcpy(&f, &u, 4);
+      return f;
+   }
+
+   static bool _laneSet( float f )
+   {
+      unsigned int u;
+      memcpy(&u, &f, 4);
+      return (u & 0x80000000u) != 0;
+   }
+
+   Float4 _bitwise( Float4 const& o, int isOr ) const
+   {
+      Float4 r;
+      for( int i = 0; i < 4; ++i )
+      {
+         unsigned int a, b;
+         memcpy(&a, &v[i], 4);
+         memcpy(&b, &o.v[i], 4);
+         a = isOr ? (a|b) : (a&b);
+         memcpy(&r.v[i], &a, 4);
+      }
+      return r;
+   }
+public:
+#endif
+
+   //! \brief Load the first \c n (< 4) floats at \c p, zero-filling the rest.
+   static Float4 loadPartial( float const* p, size_t n )
+   {
+      float tmp[4] = {0.f, 0.f, 0.f, 0.f};
+      memcpy(tmp, p, n*sizeof(float));
+      return load(tmp);
+   }
+
+   //! \brief Store the first \c n (< 4) lanes to \c p.
+   void storePartial( float* p, size_t n ) const
+   {
+      float tmp[4];
+      store(tmp);
+      memcpy(p, tmp, n*sizeof(float));
+   }
+
+   //! \brief True iff any lane of \c mask is set.
+   friend bool any( Float4 const& mask ) { return movemask(mask) != 0; }
+
+   //! \brief Read lane \c i. Slow; meant for tails and debugging.
+   float lane( int i ) const
+   {
+      float tmp[4];
+      store(tmp);
+      return tmp[i];
+   }
+};
+
+#endif /*SIMD_H*/
@@ -0,0 +1,428 @@
+/*
+ * SpatialHash.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPATIALHASH_H
+#define SPATIALHASH_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/PoseBatch.h>
+#include <NatNetLinux/WorkerPool.h>
+#include <boost/bind/bind.hpp>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+
+/*!
+ * \brief Uniform-grid spatial hash over a set of points.
+ * \author Philip G. Lee
+ *
+ * Space is divided into cubic cells of side cellSize(), and cells are
+ * hashed into a table about twice the number of points. build() is a
+ * counting sort of the point indices by bucket, so it is O(n) with two
+ * passes over contiguous arrays and no per-point allocation. The points
+ * themselves are not copied; the PointArray must outlive the queries.
+ *
+ * Queries visit the cells overlapping the query ball, so they cost about
+ * the number of points in those cells. They work for any radius, but are
+ * fastest when the radius is close to the cell size. Distinct cells can
+ * share a bucket, so queries always check actual distances.
+ *
+ * Queries are const and safe to run from many threads at once. Large
+ * sets can be built with the threads of a WorkerPool.
+ */
+class SpatialHash
+{
+public:
+
+   //! \brief Constructor. \c cellSize should be about the typical query radius.
+   SpatialHash( float cellSize=0.05f ) :
+      _cellSize(cellSize),
+      _invCellSize(1.f/cellSize),
+      _mask(0),
+      _points(0),
+      _start(),
+      _index(),
+      _bucket(),
+      _counts()
+   {
+   }
+
+   //! \brief Side length of the grid cells.
+   float cellSize() const { return _cellSize; }
+
+   //! \brief Change the cell size. Takes effect at the next build().
+   void setCellSize( float cellSize )
+   {
+      _cellSize = cellSize;
+      _invCellSize = 1.f/cellSize;
+   }
+
+   //! \brief Number of points indexed.
+   size_t size() const { return _index.size(); }
+
+   /*!
+    * \brief Index \c points.
+    *
+    * \param points points to index. Must outlive the queries, and must not
+    *    change until the next build().
+    * \param pool threads to build with, or 0 to build on this thread only.
+    *    Only large sets are split, and the result is the same as a
+    *    single-threaded build.
+    */
+   void build( PointArray const& points, WorkerPool* pool=0 )
+   {
+      size_t i, n = points.size();
+      size_t tableSize = 16;
+
+      while( tableSize < 2*n )
+         tableSize <<= 1;
+      _mask = tableSize-1;
+      _points = &points;
+
+      _bucket.resize(n);
+      _index.resize(n);
+      _start.assign(tableSize+1, 0);
+
+      if( pool && pool->size() > 1 && n >= pool->size()*_minPointsPerThread() )
+      {
+         _buildParallel(*pool);
+         return;
+      }
+
+      for( i = 0; i < n; ++i )
+      {
+         _bucket[i] = _hash(_cell(points.x[i]), _cell(points.y[i]), _cell(points.z[i]));
+         ++_start[_bucket[i]+1];
+      }
+      for( i = 0; i < tableSize; ++i )
+         _start[i+1] += _start[i];
+
+      // Scatter, using _start as the insertion cursor and restoring it after.
+      for( i = 0; i < n; ++i )
+         _index[_start[_bucket[i]]++] = static_cast<uint32_t>(i);
+      for( i = tableSize; i > 0; --i )
+         _start[i] = _start[i-1];
+      _start[0] = 0;
+   }
+
+   /*!
+    * \brief Indices of all points within \c radius of \c p.
+    *
+    * \param p query point
+    * \param radius query radius
+    * \param out output point indices, in no particular order. Appended to.
+    */
+   void radius( Point3f const& p, float radius, std::vector<uint32_t>& out ) const
+   {
+      RadiusVisitor v(out);
+      visit(p, radius, v);
+   }
+
+   /*!
+    * \brief Index of the point nearest to \c p, within \c maxDist.
+    *
+    * \param p query point
+    * \param maxDist search radius
+    * \param index output index of the nearest point
+    * \param dist2 if not null, output squared distance to it
+    * \returns false if no point is within \c maxDist
+    */
+   bool nearest( Point3f const& p, float maxDist, uint32_t& index, float* dist2=0 ) const
+   {
+      NearestVisitor v(maxDist*maxDist);
+      visit(p, maxDist, v);
+      if( !v.found )
+         return false;
+      index = v.best;
+      if( dist2 )
+         *dist2 = v.bestD2;
+      return true;
+   }
+
+   /*!
+    * \brief The \c k points nearest to \c p, within \c maxDist.
+    *
+    * Searches balls of growing radius, starting at cellSize(), until \c k
+    * points are found or the radius reaches \c maxDist.
+    *
+    * \param p query point
+    * \param k number of points wanted
+    * \param maxDist search radius
+    * \param out output point indices, nearest first. Cleared first.
+    * \param dist2 if not null, output squared distances, parallel to \c out
+    * \returns number of points found, at most \c k
+    */
+   size_t nearest( Point3f const& p, size_t k, float maxDist, std::vector<uint32_t>& out, std::vector<float>* dist2=0 ) const
+   {
+      return nearestIf(p, k, maxDist, AcceptAll(), out, dist2);
+   }
+
+   /*!
+    * \brief Like nearest(), but only counts points for which \c accept(index) is true.
+    */
+   template<class Filter> size_t nearestIf( Point3f const& p, size_t k, float maxDist, Filter const& accept, std::vector<uint32_t>& out, std::vector<float>* dist2=0 ) const
+   {
+      std::vector< std::pair<float,uint32_t> > heap;
+      size_t i;
+
+      out.clear();
+      if( dist2 )
+         dist2->clear();
+      if( k == 0 )
+         return 0;
+
+      heap.reserve(k+1);
+      float r = std::min(_cellSize, maxDist);
+      while( true )
+      {
+         KnnVisitor<Filter> v(heap, k, accept);
+         heap.clear();
+         visit(p, r, v);
+         if( heap.size() == k || r >= maxDist )
+            break;
+         r = std::min(2.f*r, maxDist);
+      }
+
+      std::sort_heap(heap.begin(), heap.end());
+      for( i = 0; i < heap.size(); ++i )
+      {
+         out.push_back(heap[i].second);
+         if( dist2 )
+            dist2->push_back(heap[i].first);
+      }
+      return heap.size();
+   }
+
+   /*!
+    * \brief Call \c v(index, dist2) for every point within \c radius of \c p.
+    *
+    * \c Visitor is any type with an <tt>void operator()(uint32_t, float)</tt>.
+    */
+   template<class Visitor> void visit( Point3f const& p, float radius, Visitor& v ) const
+   {
+      if( !_points || _index.empty() )
+         return;
+
+      PointArray const& pts = *_points;
+      float const r2 = radius*radius;
+
+      // A ball covering more cells than there are buckets is cheaper to scan.
+      float span = 2.f*radius*_invCellSize + 1.f;
+      if( !(span*span*span <= static_cast<float>(_mask+1)) )
+      {
+         for( uint32_t i = 0; i < pts.size(); ++i )
+         {
+            float dx = pts.x[i]-p.x, dy = pts.y[i]-p.y, dz = pts.z[i]-p.z;
+            float d2 = dx*dx + dy*dy + dz*dz;
+            if( d2 <= r2 )
+               v(i, d2);
+         }
+         return;
+      }
+
+      int32_t x0 = _cell(p.x-radius), x1 = _cell(p.x+radius);
+      int32_t y0 = _cell(p.y-radius), y1 = _cell(p.y+radius);
+      int32_t z0 = _cell(p.z-radius), z1 = _cell(p.z+radius);
+
+      // Cells that share a bucket must only be scanned once. Small balls
+      // dedupe on the stack, large ones sort a list of their buckets.
+      size_t numCells = static_cast<size_t>(x1-x0+1)*(y1-y0+1)*(z1-z0+1);
+      uint32_t small[64];
+      std::vector<uint32_t> large;
+      uint32_t* buckets = small;
+      size_t numBuckets = 0;
+      if( numCells > 64 )
+      {
+         large.resize(numCells);
+         buckets = &large[0];
+      }
+
+      for( int32_t x = x0; x <= x1; ++x )
+      for( int32_t y = y0; y <= y1; ++y )
+      for( int32_t z = z0; z <= z1; ++z )
+      {
+         uint32_t b = _hash(x, y, z);
+         if( numCells <= 64 && std::find(buckets, buckets+numBuckets, b) != buckets+numBuckets )
+            continue;
+         buckets[numBuckets++] = b;
+      }
+      if( numCells > 64 )
+      {
+         std::sort(buckets, buckets+numBuckets);
+         numBuckets = std::unique(buckets, buckets+numBuckets) - buckets;
+      }
+
+      for( size_t j = 0; j < numBuckets; ++j )
+      {
+         uint32_t b = buckets[j];
+         for( uint32_t k = _start[b]; k < _start[b+1]; ++k )
+         {
+            uint32_t i = _index[k];
+            float dx = pts.x[i]-p.x, dy = pts.y[i]-p.y, dz = pts.z[i]-p.z;
+            float d2 = dx*dx + dy*dy + dz*dz;
+            if( d2 <= r2 )
+               v(i, d2);
+         }
+      }
+   }
+
+private:
+
+   struct RadiusVisitor
+   {
+      RadiusVisitor( std::vector<uint32_t>& o ) : out(o) {}
+      void operator()( uint32_t i, float ) { out.push_back(i); }
+      std::vector<uint32_t>& out;
+   };
+
+   struct NearestVisitor
+   {
+      NearestVisitor( float d2 ) : found(false), best(0), bestD2(d2) {}
+      void operator()( uint32_t i, float d2 )
+      {
+         if( d2 <= bestD2 )
+         {
+            found = true;
+            best = i;
+            bestD2 = d2;
+         }
+      }
+      bool found;
+      uint32_t best;
+      float bestD2;
+   };
+
+   struct AcceptAll
+   {
+      bool operator()( uint32_t ) const { return true; }
+   };
+
+   // Keeps the k nearest accepted points in a max-heap on distance.
+   template<class Filter> struct KnnVisitor
+   {
+      KnnVisitor( std::vector< std::pair<float,uint32_t> >& h, size_t kk, Filter const& f ) : heap(h), k(kk), accept(f) {}
+      void operator()( uint32_t i, float d2 )
+      {
+         if( !accept(i) )
+            return;
+         if( heap.size() == k )
+         {
+            if( d2 >= heap.front().first )
+               return;
+            std::pop_heap(heap.begin(), heap.end());
+            heap.pop_back();
+         }
+         heap.push_back(std::make_pair(d2, i));
+         std::push_heap(heap.begin(), heap.end());
+      }
+      std::vector< std::pair<float,uint32_t> >& heap;
+      size_t k;
+      Filter const& accept;
+   };
+
+   float _cellSize;
+   float _invCellSize;
+   uint32_t _mask;
+   PointArray const* _points;
+   // Bucket b holds _index[_start[b]] to _index[_start[b+1]-1].
+   std::vector<uint32_t> _start;
+   std::vector<uint32_t> _index;
+   // Scratch: bucket of each point during build().
+   std::vector<uint32_t> _bucket;
+   // Scratch: per-thread bucket counts, then cursors, in a parallel build().
+   std::vector<uint32_t> _counts;
+
+   static size_t _minPointsPerThread() { return 4096; }
+
+   int32_t _cell( float v ) const
+   {
+      return static_cast<int32_t>(floorf(v*_invCellSize));
+   }
+
+   // Each thread counts, then scatters, a contiguous chunk of the points.
+   // Cursors are laid out bucket-major, thread-minor, so each bucket ends up
+   // in index order exactly as in a serial build.
+   void _buildParallel( WorkerPool& pool )
+   {
+      size_t n = _index.size();
+      size_t tableSize = _mask+1;
+      size_t numThreads = pool.size();
+      size_t b, t;
+
+      _counts.assign(numThreads*tableSize, 0);
+      pool.run(boost::bind(&SpatialHash::_countChunk, this, boost::placeholders::_1, numThreads));
+
+      uint32_t offset = 0;
+      for( b = 0; b < tableSize; ++b )
+      {
+         _start[b] = offset;
+         for( t = 0; t < numThreads; ++t )
+         {
+            uint32_t c = _counts[t*tableSize+b];
+            _counts[t*tableSize+b] = offset;
+            offset += c;
+         }
+      }
+      _start[tableSize] = static_cast<uint32_t>(n);
+
+      pool.run(boost::bind(&SpatialHash::_scatterChunk, this, boost::placeholders::_1, numThreads));
+   }
+
+   void _chunk( size_t t, size_t numThreads, size_t& begin, size_t& end ) const
+   {
+      size_t n = _index.size();
+      begin = n*t/numThreads;
+      end = n*(t+1)/numThreads;
+   }
+
+   void _countChunk( size_t t, size_t numThreads )
+   {
+      PointArray const& pts = *_points;
+      uint32_t* counts = &_counts[t*(_mask+1)];
+      size_t i, begin, end;
+
+      _chunk(t, numThreads, begin, end);
+      for( i = begin; i < end; ++i )
+      {
+         _bucket[i] = _hash(_cell(pts.x[i]), _cell(pts.y[i]), _cell(pts.z[i]));
+         ++counts[_bucket[i]];
+      }
+   }
+
+   void _scatterChunk( size_t t, size_t numThreads )
+   {
+      uint32_t* cursor = &_counts[t*(_mask+1)];
+      size_t i, begin, end;
+
+      _chunk(t, numThreads, begin, end);
+      for( i = begin; i < end; ++i )
+         _index[cursor[_bucket[i]]++] = static_cast<uint32_t>(i);
+   }
+
+   uint32_t _hash( int32_t x, int32_t y, int32_t z ) const
+   {
+      uint32_t h =
+         (static_cast<uint32_t>(x) * 73856093u) ^
+         (static_cast<uint32_t>(y) * 19349663u) ^
+         (static_cast<uint32_t>(z) * 83492791u);
+      return h & _mask;
+   }
+};
+
+#endif /*SPATIALHASH_H*/
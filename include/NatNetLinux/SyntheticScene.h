@@ -0,0 +1,445 @@
+/*
+ * SyntheticScene.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYNTHETICSCENE_H
+#define SYNTHETICSCENE_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/DataDescriptions.h>
+#include <vector>
+#include <string>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+/*!
+ * \brief Deterministic motion capture data for testing without cameras.
+ * \author Philip G. Lee
+ *
+ * The scene has rigid bodies with markers, skeletons of rigid bodies,
+ * unidentified markers and labeled markers. Every object moves on a
+ * Lissajous curve about a fixed centre and rigid bodies also spin about a
+ * fixed axis, all with parameters drawn from a generator seeded with
+ * seed(). The state at time t is a pure function of the configuration,
+ * seed and t, so a receiver can regenerate any frame it is sent and
+ * compare.
+ *
+ * Each rigid body also has a marker set of the same name holding its
+ * markers, as Motive streams them. Rigid body and marker set names are
+ * "Body1", "Body2"..., skeletons are "Skeleton1"... and their bodies have
+ * IDs (skeleton ID << 16) | bone, also as Motive does.
+ *
+ * \code
+ * SyntheticScene scene;
+ * scene.setRigidBodies(20, 5);
+ * MocapFrame frame(2, 9);
+ * scene.frame(1, 1.0/120.0, frame);
+ * \endcode
+ */
+class SyntheticScene
+{
+public:
+
+   //! \brief Default constructor. 10 rigid bodies with 4 markers each, nothing else.
+   SyntheticScene( uint32_t seed=1 ) :
+      _seed(seed),
+      _numBodies(0),
+      _markersPerBody(0),
+      _numSkeletons(0),
+      _bodiesPerSkeleton(0),
+      _numUnidentified(0),
+      _numLabeled(0),
+      _dropout(0.0)
+   {
+      setRigidBodies(10, 4);
+   }
+
+   ~SyntheticScene(){}
+
+   //! \brief Seed of the motion parameters.
+   uint32_t seed() const { return _seed; }
+   //! \brief Number of rigid bodies, not counting skeleton bodies.
+   int rigidBodies() const { return _numBodies; }
+   //! \brief Markers on each rigid body.
+   int markersPerBody() const { return _markersPerBody; }
+   //! \brief Number of skeletons.
+   int skeletons() const { return _numSkeletons; }
+   //! \brief Rigid bodies in each skeleton.
+   int bodiesPerSkeleton() const { return _bodiesPerSkeleton; }
+   //! \brief Number of unidentified markers.
+   int unidentifiedMarkers() const { return _numUnidentified; }
+   //! \brief Number of labeled markers. Streamed in NatNet 2.3 and later.
+   int labeledMarkers() const { return _numLabeled; }
+   //! \brief Fraction of rigid body frames with tracking lost.
+   double dropout() const { return _dropout; }
+
+   //! \brief Set the seed() and regenerate every motion.
+   void setSeed( uint32_t seed )
+   {
+      _seed = seed;
+      _generate();
+   }
+
+   //! \brief Set the number of rigid bodies and the markers on each.
+   void setRigidBodies( int n, int markersPerBody )
+   {
+      _numBodies = std::max(n, 0);
+      _markersPerBody = std::max(markersPerBody, 0);
+      _generate();
+   }
+
+   //! \brief Set the number of skeletons and the rigid bodies in each.
+   void setSkeletons( int n, int bodiesPerSkeleton )
+   {
+      _numSkeletons = std::max(n, 0);
+      _bodiesPerSkeleton = std::max(bodiesPerSkeleton, 0);
+      _generate();
+   }
+
+   //! \brief Set the number of unidentified markers.
+   void setUnidentifiedMarkers( int n )
+   {
+      _numUnidentified = std::max(n, 0);
+      _generate();
+   }
+
+   //! \brief Set the number of labeled markers.
+   void setLabeledMarkers( int n )
+   {
+      _numLabeled = std::max(n, 0);
+      _generate();
+   }
+
+   /*!
+    * \brief Lose tracking of each rigid body in this fraction of frames.
+    *
+    * Which frames is a function of the frame number and body, so is
+    * deterministic too. A lost body is still sent with its pose, but with
+    * trackingValid() cleared and a mean marker error of 0.
+    */
+   void setDropout( double fraction ) { _dropout = std::min(std::max(fraction, 0.0), 1.0); }
+
+   /*!
+    * \brief Fill a frame with the scene at time t.
+    *
+    * The frame's NatNet version is kept and its contents replaced, reusing
+    * its storage when the frame is filled again. Latency is 0 and the
+    * timecode counts frames at 120 per second.
+    *
+    * \param frameNum frame number to give the frame
+    * \param t seconds since the start of the scene
+    * \param frame output frame
+    */
+   void frame( int frameNum, double t, MocapFrame& frame ) const
+   {
+      size_t i;
+      int m;
+
+      frame.setFrameNum(frameNum);
+      frame.setLatency(0.f);
+      frame.setTimecode(_smpte(frameNum), 0);
+      frame.setCaptureTime(0.0);
+
+      std::vector<MarkerSet>& sets = frame.markerSets();
+      std::vector<RigidBody>& bodies = frame.rigidBodies();
+      sets.resize(_numBodies);
+      bodies.resize(_numBodies);
+      for( i = 0; i < static_cast<size_t>(_numBodies); ++i )
+      {
+         RigidBody& b = bodies[i];
+         _body(_bodies[i], frameNum, t, b);
+         sets[i].setName(_bodyName(static_cast<int>(i)));
+         sets[i].markers() = b.markers();
+      }
+
+      std::vector<Skeleton>& skeletons = frame.skeletons();
+      skeletons.resize(_numSkeletons);
+      for( i = 0; i < static_cast<size_t>(_numSkeletons); ++i )
+      {
+         skeletons[i].setId(static_cast<int>(i) + 1);
+         std::vector<RigidBody>& bones = skeletons[i].rigidBodies();
+         bones.resize(_bodiesPerSkeleton);
+         for( m = 0; m < _bodiesPerSkeleton; ++m )
+            _body(_bones[i*_bodiesPerSkeleton + m], frameNum, t, bones[m]);
+      }
+
+      std::vector<Point3f>& unidentified = frame.unIdMarkers();
+      unidentified.resize(_numUnidentified);
+      for( m = 0; m < _numUnidentified; ++m )
+         unidentified[m] = _unidentified[m].at(t);
+
+      std::vector<LabeledMarker>& labeled = frame.labeledMarkers();
+      labeled.resize(_numLabeled);
+      for( m = 0; m < _numLabeled; ++m )
+      {
+         labeled[m].setId(m + 1);
+         labeled[m].setLocation(_labeled[m].at(t));
+         labeled[m].setSize(_markerSize());
+      }
+   }
+
+   /*!
+    * \brief Descriptions of the scene, as sent in a NAT_MODELDEF.
+    *
+    * One marker set per rigid body, the rigid bodies and, from NatNet 2.1,
+    * the skeletons. Rigid bodies have no parent and no offset; skeleton
+    * bodies are chained, each the parent of the next.
+    *
+    * \param out output descriptions
+    * \param nnMajor major version of NatNet to describe for
+    * \param nnMinor minor version of NatNet to describe for
+    */
+   void descriptions( DataDescriptions& out, char nnMajor, char nnMinor ) const
+   {
+      int i, j;
+      char name[32];
+
+      out.clear();
+      out.markerSets.resize(_numBodies);
+      out.rigidBodies.resize(_numBodies);
+      for( i = 0; i < _numBodies; ++i )
+      {
+         out.markerSets[i].name = _bodyName(i);
+         for( j = 0; j < _markersPerBody; ++j )
+         {
+            snprintf(name, sizeof(name), "Body%d_%d", i + 1, j + 1);
+            out.markerSets[i].markerNames.push_back(name);
+         }
+         out.rigidBodies[i].name = _bodyName(i);
+         out.rigidBodies[i].id = _bodies[i].id;
+      }
+
+      if( !(nnMajor > 2 || (nnMajor == 2 && nnMinor >= 1)) )
+         return;
+      out.skeletons.resize(_numSkeletons);
+      for( i = 0; i < _numSkeletons; ++i )
+      {
+         SkeletonDescription& skeleton = out.skeletons[i];
+         snprintf(name, sizeof(name), "Skeleton%d", i + 1);
+         skeleton.name = name;
+         skeleton.id = i + 1;
+         skeleton.rigidBodies.resize(_bodiesPerSkeleton);
+         for( j = 0; j < _bodiesPerSkeleton; ++j )
+         {
+            snprintf(name, sizeof(name), "Skeleton%d_%d", i + 1, j + 1);
+            skeleton.rigidBodies[j].name = name;
+            skeleton.rigidBodies[j].id = _bones[i*_bodiesPerSkeleton + j].id;
+            skeleton.rigidBodies[j].parentId = j == 0 ? -1 : _bones[i*_bodiesPerSkeleton + j - 1].id;
+         }
+      }
+   }
+
+private:
+
+   // Motion on a Lissajous curve.
+   struct Curve
+   {
+      float centre[3];
+      float amplitude[3];
+      float frequency[3];
+      float phase[3];
+
+      Point3f at( double t ) const
+      {
+         return Point3f(
+            centre[0] + amplitude[0]*static_cast<float>(sin(frequency[0]*t + phase[0])),
+            centre[1] + amplitude[1]*static_cast<float>(sin(frequency[1]*t + phase[1])),
+            centre[2] + amplitude[2]*static_cast<float>(sin(frequency[2]*t + phase[2]))
+         );
+      }
+   };
+
+   // A rigid body: a curve, a spin and marker offsets in the body frame.
+   struct Body
+   {
+      int id;
+      Curve curve;
+      float axis[3];
+      float spin;
+      float spinPhase;
+      float error;
+      std::vector<Point3f> offsets;
+   };
+
+   uint32_t _seed;
+   int _numBodies;
+   int _markersPerBody;
+   int _numSkeletons;
+   int _bodiesPerSkeleton;
+   int _numUnidentified;
+   int _numLabeled;
+   double _dropout;
+   std::vector<Body> _bodies;
+   std::vector<Body> _bones;
+   std::vector<Curve> _unidentified;
+   std::vector<Curve> _labeled;
+
+   // Diameter of every marker in metres.
+   static float _markerSize() { return 0.014f; }
+
+   // 32-bit mix of x, from a multiplicative hash.
+   static uint32_t _hash( uint32_t x )
+   {
+      x ^= x >> 16;
+      x *= 0x7feb352dU;
+      x ^= x >> 15;
+      x *= 0x846ca68bU;
+      x ^= x >> 16;
+      return x;
+   }
+
+   // Uniform in [a,b) from generator state s, which is advanced.
+   static float _uniform( uint32_t& s, float a, float b )
+   {
+      s = s*1664525U + 1013904223U;
+      return a + (b-a)*static_cast<float>(_hash(s) >> 8)/16777216.f;
+   }
+
+   static Curve _curve( uint32_t& s, float spread, float amplitude )
+   {
+      Curve c;
+      c.centre[0] = _uniform(s, -spread, spread);
+      c.centre[1] = _uniform(s, 0.5f, 1.5f);
+      c.centre[2] = _uniform(s, -spread, spread);
+      for( int k = 0; k < 3; ++k )
+      {
+         c.amplitude[k] = _uniform(s, 0.2f, 1.f)*amplitude;
+         c.frequency[k] = _uniform(s, 0.2f, 2.f);
+         c.phase[k] = _uniform(s, 0.f, 6.2831853f);
+      }
+      return c;
+   }
+
+   static Body _randomBody( uint32_t& s, int id, int markers, float spread, float amplitude )
+   {
+      Body b;
+      b.id = id;
+      b.curve = _curve(s, spread, amplitude);
+      float x = _uniform(s, -1.f, 1.f);
+      float y = _uniform(s, -1.f, 1.f);
+      float z = _uniform(s, -1.f, 1.f);
+      float norm = sqrtf(x*x + y*y + z*z);
+      if( norm < 1e-3f )
+      {
+         x = 0.f; y = 1.f; z = 0.f;
+         norm = 1.f;
+      }
+      b.axis[0] = x/norm;
+      b.axis[1] = y/norm;
+      b.axis[2] = z/norm;
+      b.spin = _uniform(s, -3.f, 3.f);
+      b.spinPhase = _uniform(s, 0.f, 6.2831853f);
+      b.error = _uniform(s, 1e-4f, 5e-4f);
+      for( int m = 0; m < markers; ++m )
+         b.offsets.push_back(Point3f(_uniform(s, -0.1f, 0.1f), _uniform(s, -0.1f, 0.1f), _uniform(s, -0.1f, 0.1f)));
+      return b;
+   }
+
+   // Draw every motion parameter again from the seed.
+   void _generate()
+   {
+      int i, j;
+      uint32_t s = _hash(_seed);
+
+      _bodies.clear();
+      for( i = 0; i < _numBodies; ++i )
+         _bodies.push_back(_randomBody(s, i + 1, _markersPerBody, 3.f, 1.f));
+
+      // Bones follow their skeleton's root at a fixed offset, each with its own spin.
+      _bones.clear();
+      for( i = 0; i < _numSkeletons; ++i )
+      {
+         Curve root = _curve(s, 3.f, 1.f);
+         for( j = 0; j < _bodiesPerSkeleton; ++j )
+         {
+            Body b = _randomBody(s, ((i + 1) << 16) | (j + 1), 0, 0.3f, 0.f);
+            for( int k = 0; k < 3; ++k )
+            {
+               b.curve.centre[k] = root.centre[k] + _uniform(s, -0.3f, 0.3f);
+               b.curve.amplitude[k] = root.amplitude[k];
+               b.curve.frequency[k] = root.frequency[k];
+               b.curve.phase[k] = root.phase[k];
+            }
+            _bones.push_back(b);
+         }
+      }
+
+      _unidentified.clear();
+      for( i = 0; i < _numUnidentified; ++i )
+         _unidentified.push_back(_curve(s, 3.f, 1.f));
+      _labeled.clear();
+      for( i = 0; i < _numLabeled; ++i )
+         _labeled.push_back(_curve(s, 3.f, 1.f));
+   }
+
+   void _body( Body const& b, int frameNum, double t, RigidBody& out ) const
+   {
+      Point3f p = b.curve.at(t);
+      float half = 0.5f*static_cast<float>(b.spin*t + b.spinPhase);
+      float sh = sinf(half);
+      Quaternion4f q(b.axis[0]*sh, b.axis[1]*sh, b.axis[2]*sh, cosf(half));
+
+      out.setId(b.id);
+      out.setLocation(p);
+      out.setOrientation(q);
+
+      std::vector<Point3f>& markers = out.markers();
+      std::vector<uint32_t>& ids = out.markerIds();
+      std::vector<float>& sizes = out.markerSizes();
+      markers.resize(b.offsets.size());
+      ids.resize(b.offsets.size());
+      sizes.resize(b.offsets.size());
+      for( size_t m = 0; m < b.offsets.size(); ++m )
+      {
+         Point3f r = q.rotate(b.offsets[m]);
+         markers[m] = Point3f(p.x + r.x, p.y + r.y, p.z + r.z);
+         ids[m] = static_cast<uint32_t>(m + 1);
+         sizes[m] = _markerSize();
+      }
+
+      bool valid = true;
+      if( _dropout > 0.0 )
+      {
+         uint32_t h = _hash(static_cast<uint32_t>(frameNum)*0x9e3779b9U ^ static_cast<uint32_t>(b.id) ^ _seed);
+         valid = static_cast<double>(h)/4294967296.0 >= _dropout;
+      }
+      out.setTrackingValid(valid);
+      out.setMeanMarkerError(valid ? b.error : 0.f);
+   }
+
+   // SMPTE timecode (hour, minute, second, frame bytes) of a frame at 120 Hz.
+   static uint32_t _smpte( int frameNum )
+   {
+      uint32_t f = static_cast<uint32_t>(std::max(frameNum, 0));
+      uint32_t frame = f % 120;
+      uint32_t second = (f / 120) % 60;
+      uint32_t minute = (f / 7200) % 60;
+      uint32_t hour = (f / 432000) % 24;
+      return (hour << 24) | (minute << 16) | (second << 8) | frame;
+   }
+
+   static std::string _bodyName( int i )
+   {
+      char name[32];
+      snprintf(name, sizeof(name), "Body%d", i + 1);
+      return name;
+   }
+};
+
+#endif /*SYNTHETICSCENE_H*/
@@ -0,0 +1,499 @@
+/*
+ * SyntheticServer.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYNTHETICSERVER_H
+#define SYNTHETICSERVER_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/NatNetPacket.h>
+#include <NatNetLinux/NatNetSender.h>
+#include <NatNetLinux/SyntheticScene.h>
+#include <NatNetLinux/DataDescriptions.h>
+#include <NatNetLinux/CaptureFormat.h>
+#include <NatNetLinux/LatencyHistogram.h>
+#include <boost/thread.hpp>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/*!
+ * \brief Progress of a SyntheticServer.
+ * \author Philip G. Lee
+ */
+class ServerStats
+{
+public:
+
+   //! \brief Default constructor. Nothing sent.
+   ServerStats() :
+      frames(0),
+      packets(0),
+      bytes(0),
+      sendErrors(0),
+      oversize(0),
+      pings(0),
+      modelDefs(0),
+      frameRequests(0),
+      unrecognized(0),
+      elapsed(0.0),
+      lateness()
+   {
+   }
+
+   //! \brief Frames of data streamed.
+   uint64_t frames;
+   //! \brief Datagrams of frame data sent, one per frame and destination.
+   uint64_t packets;
+   //! \brief Bytes of frame datagrams sent.
+   uint64_t bytes;
+   //! \brief Frame datagrams that failed to send.
+   uint64_t sendErrors;
+   //! \brief Frames or model definitions too large for one datagram, not sent.
+   uint64_t oversize;
+   //! \brief Pings answered.
+   uint64_t pings;
+   //! \brief Model definition requests answered.
+   uint64_t modelDefs;
+   //! \brief Frame of data requests answered.
+   uint64_t frameRequests;
+   //! \brief Requests answered with NAT_UNRECOGNIZED_REQUEST.
+   uint64_t unrecognized;
+   //! \brief Seconds spent streaming.
+   double elapsed;
+   /*!
+    * \brief How late each frame went out relative to its schedule.
+    *
+    * Empty when streaming as fast as possible, which has no schedule.
+    */
+   HistogramSnapshot lateness;
+
+   //! \brief Achieved frames per second.
+   double rate() const { return elapsed > 0.0 ? frames/elapsed : 0.0; }
+
+   //! \brief One line with the frame count, rates, commands and lateness.
+   std::string summary() const
+   {
+      char buf[384];
+      int n = snprintf(buf, sizeof(buf), "frames=%llu rate=%.1f/s %.2f MB/s pings=%llu modeldefs=%llu requests=%llu",
+         static_cast<unsigned long long>(frames), rate(), elapsed > 0.0 ? 1e-6*bytes/elapsed : 0.0,
+         static_cast<unsigned long long>(pings), static_cast<unsigned long long>(modelDefs),
+         static_cast<unsigned long long>(frameRequests));
+      if( sendErrors )
+         n += snprintf(buf + n, sizeof(buf) - n, " send_errors=%llu", static_cast<unsigned long long>(sendErrors));
+      if( oversize )
+         n += snprintf(buf + n, sizeof(buf) - n, " oversize=%llu", static_cast<unsigned long long>(oversize));
+      if( lateness.count )
+         snprintf(buf + n, sizeof(buf) - n, " lateness: %s", lateness.summary().c_str());
+      return buf;
+   }
+};
+
+/*!
+ * \brief A NatNet server streaming a SyntheticScene, for testing clients without cameras.
+ * \author Philip G. Lee
+ *
+ * One thread streams NAT_FRAMEOFDATA datagrams of the scene to every
+ * destination added with addDestination(), e.g. the multicast group
+ * 239.255.42.99 or a list of unicast clients, packed for the NatNet
+ * version given to the constructor. Another answers requests on the
+ * command socket: NAT_PING with a NAT_PINGRESPONSE carrying sender(),
+ * NAT_REQUEST_MODELDEF with the scene's data set descriptions,
+ * NAT_REQUEST_FRAMEOFDATA with the latest frame, and anything else with
+ * NAT_UNRECOGNIZED_REQUEST.
+ *
+ * Frame n (from 1) is the scene at time n*period(), so a client can
+ * regenerate what it should have received. Frames go out on a fixed
+ * schedule, sleeping until shortly before each is due and spinning for the
+ * rest as Replayer does, or as fast as the socket takes them with
+ * setRate(0), which is the way to find the rate at which a client stops
+ * keeping up. NatNet carries a payload length in 16 bits, so a frame of
+ * 65535 bytes or more, or one too large for a UDP datagram, is counted in
+ * ServerStats::oversize and not sent.
+ */
+class SyntheticServer
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param scene scene to stream. Must outlive the server and not change while it runs.
+    * \param nnMajor major version of NatNet to pack frames for
+    * \param nnMinor minor version of NatNet to pack frames for
+    */
+   SyntheticServer( SyntheticScene const& scene, unsigned char nnMajor=2, unsigned char nnMinor=9 ) :
+      _dataThread(0),
+      _commandThread(0),
+      _scene(&scene),
+      _nnMajor(nnMajor),
+      _nnMinor(nnMinor),
+      _dataSd(-1),
+      _commandSd(-1),
+      _destinations(),
+      _sender(),
+      _rate(120.0),
+      _clockRate(120.0),
+      _spinThreshold(200e-6),
+      _maxFrames(0),
+      _run(false),
+      _statsMutex(),
+      _stats(),
+      _lateness(),
+      _latestFrame(0)
+   {
+      _sender.setName("NatNetLinux SyntheticServer");
+      _sender.setVersion(0, 2);
+      _sender.setNatNetVersion(nnMajor, nnMinor);
+   }
+
+   ~SyntheticServer()
+   {
+      if( running() )
+         stop();
+      join();
+      delete _dataThread;
+      delete _commandThread;
+   }
+
+   //! \brief Major version of NatNet frames are packed for.
+   unsigned char nnMajor() const { return _nnMajor; }
+   //! \brief Minor version of NatNet frames are packed for.
+   unsigned char nnMinor() const { return _nnMinor; }
+
+   //! \brief Information sent in answer to a ping.
+   NatNetSender const& sender() const { return _sender; }
+   //! \brief Mutable sender().
+   NatNetSender& sender() { return _sender; }
+
+   /*!
+    * \brief Send frames with \c sendto() on socket \c sd.
+    *
+    * For multicast, set \c IP_MULTICAST_TTL, \c IP_MULTICAST_LOOP and
+    * \c IP_MULTICAST_IF on the socket as needed.
+    */
+   void setDataSocket( int sd ) { _dataSd = sd; }
+
+   //! \brief Send every frame to \c dest too. Call before start().
+   void addDestination( struct sockaddr_in const& dest ) { _destinations.push_back(dest); }
+
+   /*!
+    * \brief Answer requests arriving on socket \c sd.
+    *
+    * E.g. \c NatNet::createCommandSocket(addr, NatNet::commandPort). Without
+    * one, no requests are answered.
+    */
+   void setCommandSocket( int sd ) { _commandSd = sd; }
+
+   //! \brief Frames per second, or 0 for as fast as possible.
+   double rate() const { return _rate; }
+
+   /*!
+    * \brief Set the rate().
+    *
+    * With 0, frames still advance the scene by 1/120 s each (or by the last
+    * nonzero rate) so the motion is the same at any throughput.
+    */
+   void setRate( double hz )
+   {
+      _rate = std::max(hz, 0.0);
+      if( _rate > 0.0 )
+         _clockRate = _rate;
+   }
+
+   //! \brief Seconds of scene time per frame, 1/rate().
+   double period() const { return 1.0/_clockRate; }
+
+   //! \brief Seconds before a frame is due at which to stop sleeping and spin.
+   void setSpinThreshold( double seconds ) { _spinThreshold = seconds; }
+
+   //! \brief Stop after this many frames, or 0 to stream until stop().
+   void setMaxFrames( uint64_t n ) { _maxFrames = n; }
+
+   //! \brief Stream and answer requests in new threads. Non-blocking.
+   void start()
+   {
+      _run = true;
+      _dataThread = new boost::thread( &SyntheticServer::_work, this );
+      if( _commandSd >= 0 )
+         _commandThread = new boost::thread( &SyntheticServer::_commands, this );
+   }
+
+   //! \brief Cause the server to stop. Non-blocking.
+   void stop()
+   {
+      _run = false;
+   }
+
+   //! \brief Return true iff the server is running. Non-blocking.
+   bool running()
+   {
+      return _run;
+   }
+
+   //! \brief Wait for the server threads to finish. Blocking.
+   void join()
+   {
+      if( _dataThread )
+         _dataThread->join();
+      if( _commandThread )
+         _commandThread->join();
+   }
+
+   //! \brief Progress so far. Thread-safe.
+   ServerStats stats() const
+   {
+      _statsMutex.lock();
+         ServerStats ret = _stats;
+      _statsMutex.unlock();
+      _lateness.snapshot(ret.lateness);
+      return ret;
+   }
+
+   /*!
+    * \brief Pack frame \c frameNum of the scene into a NAT_FRAMEOFDATA packet.
+    *
+    * \param frameNum frame number, from 1
+    * \param frame scratch frame, with this server's version
+    * \param packet output packet
+    * \returns false if the frame does not fit in one datagram
+    */
+   bool packFrame( int frameNum, MocapFrame& frame, NatNetPacket& packet ) const
+   {
+      _scene->frame(frameNum, frameNum*period(), frame);
+      size_t n = frame.packedSize();
+      if( !packet.fits(n) )
+         return false;
+      frame.pack(packet.read<char>(0));
+      packet.setHeader(NatNetPacket::NAT_FRAMEOFDATA, static_cast<unsigned short>(n));
+      return true;
+   }
+
+private:
+
+   boost::thread* _dataThread;
+   boost::thread* _commandThread;
+   SyntheticScene const* _scene;
+   unsigned char _nnMajor;
+   unsigned char _nnMinor;
+   int _dataSd;
+   int _commandSd;
+   std::vector<struct sockaddr_in> _destinations;
+   NatNetSender _sender;
+   double _rate;
+   double _clockRate;
+   double _spinThreshold;
+   uint64_t _maxFrames;
+   bool _run;
+   mutable boost::mutex _statsMutex;
+   ServerStats _stats;
+   mutable LatencyHistogram _lateness;
+   // Number of the last frame sent, for NAT_REQUEST_FRAMEOFDATA.
+   int _latestFrame;
+
+   static int64_t _monotonicNs()
+   {
+      struct timespec ts;
+      clock_gettime( CLOCK_MONOTONIC, &ts );
+      return CaptureFormat::toNs(ts);
+   }
+
+   // Sleep, then spin, until the monotonic clock reaches due. Returns
+   // false if stopped first.
+   bool _waitUntil( int64_t due )
+   {
+      int64_t spin = static_cast<int64_t>(_spinThreshold*1e9);
+      int64_t now = _monotonicNs();
+      // Sleep in steps of at most 0.1 s so stop() takes effect quickly.
+      while( _run && due - now > spin )
+      {
+         int64_t wake = std::min<int64_t>(due - spin, now + 100000000LL);
+         struct timespec ts = CaptureFormat::fromNs(wake);
+         clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0 );
+         now = _monotonicNs();
+      }
+      while( _run && now < due )
+         now = _monotonicNs();
+      return _run;
+   }
+
+   void _publish( ServerStats const& local, int64_t begin )
+   {
+      _statsMutex.lock();
+         // The command thread's counters are kept in _stats.
+         _stats.frames = local.frames;
+         _stats.packets = local.packets;
+         _stats.bytes = local.bytes;
+         _stats.sendErrors = local.sendErrors;
+         _stats.oversize += local.oversize;
+         _stats.elapsed = 1e-9*(_monotonicNs() - begin);
+      _statsMutex.unlock();
+   }
+
+   void _work()
+   {
+      ServerStats local;
+      NatNetPacket packet;
+      MocapFrame frame(_nnMajor, _nnMinor);
+      int64_t begin = _monotonicNs();
+      int frameNum = 0;
+      size_t i;
+
+      _lateness.reset();
+      _publish(local, begin);
+      while( _run && (_maxFrames == 0 || local.frames < _maxFrames) )
+      {
+         ++frameNum;
+         if( _rate > 0.0 )
+         {
+            int64_t due = begin + static_cast<int64_t>(1e9*(frameNum - 1)/_rate);
+            if( !_waitUntil(due) )
+               break;
+            int64_t late = _monotonicNs() - due;
+            _lateness.record(late > 0 ? static_cast<uint64_t>(late) : 0);
+         }
+
+         ++local.frames;
+         if( !packFrame(frameNum, frame, packet) )
+            ++local.oversize;
+         else
+         {
+            for( i = 0; i < _destinations.size(); ++i )
+            {
+               int sent = packet.send(_dataSd, _destinations[i]);
+               if( sent < 0 )
+                  ++local.sendErrors;
+               else
+               {
+                  ++local.packets;
+                  local.bytes += static_cast<uint64_t>(sent);
+               }
+            }
+         }
+
+         _statsMutex.lock();
+            _latestFrame = frameNum;
+         _statsMutex.unlock();
+         if( (local.frames & 255) == 0 )
+         {
+            _publish(local, begin);
+            local.oversize = 0;
+         }
+      }
+      _publish(local, begin);
+      _run = false;
+   }
+
+   // Answer one request in nnp from the given address.
+   void _answer( NatNetPacket& nnp, struct sockaddr_in const& from, DataDescriptions const& descriptions, MocapFrame& frame )
+   {
+      int latestFrame;
+      size_t n;
+      NatNetPacket::NatNetMessageID reply;
+
+      switch( nnp.iMessage() )
+      {
+      case NatNetPacket::NAT_PING:
+         _sender.pack(nnp.read<char>(0));
+         nnp.setHeader(NatNetPacket::NAT_PINGRESPONSE, static_cast<unsigned short>(NatNetSender::packedSize()));
+         reply = NatNetPacket::NAT_PINGRESPONSE;
+         break;
+      case NatNetPacket::NAT_REQUEST_MODELDEF:
+         n = descriptions.packedSize(_nnMajor);
+         if( !nnp.fits(n) )
+         {
+            _statsMutex.lock();
+               ++_stats.oversize;
+            _statsMutex.unlock();
+            return;
+         }
+         descriptions.pack(nnp.read<char>(0), _nnMajor);
+         nnp.setHeader(NatNetPacket::NAT_MODELDEF, static_cast<unsigned short>(n));
+         reply = NatNetPacket::NAT_MODELDEF;
+         break;
+      case NatNetPacket::NAT_REQUEST_FRAMEOFDATA:
+         _statsMutex.lock();
+            latestFrame = std::max(_latestFrame, 1);
+         _statsMutex.unlock();
+         if( !packFrame(latestFrame, frame, nnp) )
+         {
+            _statsMutex.lock();
+               ++_stats.oversize;
+            _statsMutex.unlock();
+            return;
+         }
+         reply = NatNetPacket::NAT_FRAMEOFDATA;
+         break;
+      default:
+         nnp.setHeader(NatNetPacket::NAT_UNRECOGNIZED_REQUEST, 0);
+         reply = NatNetPacket::NAT_UNRECOGNIZED_REQUEST;
+         break;
+      }
+
+      nnp.send(_commandSd, from);
+      _statsMutex.lock();
+         if( reply == NatNetPacket::NAT_PINGRESPONSE )
+            ++_stats.pings;
+         else if( reply == NatNetPacket::NAT_MODELDEF )
+            ++_stats.modelDefs;
+         else if( reply == NatNetPacket::NAT_FRAMEOFDATA )
+            ++_stats.frameRequests;
+         else
+            ++_stats.unrecognized;
+      _statsMutex.unlock();
+   }
+
+   void _commands()
+   {
+      NatNetPacket nnp;
+      MocapFrame frame(_nnMajor, _nnMinor);
+      DataDescriptions descriptions;
+      struct sockaddr_in from;
+      socklen_t fromLength;
+      ssize_t len;
+      fd_set rfds;
+      struct timeval timeout;
+
+      _scene->descriptions(descriptions, _nnMajor, _nnMinor);
+      while( _run )
+      {
+         // Wake every 0.1 s to notice stop().
+         timeout.tv_sec = 0; timeout.tv_usec = 100000;
+         FD_ZERO(&rfds); FD_SET(_commandSd, &rfds);
+         if( select(_commandSd+1, &rfds, 0, 0, &timeout) <= 0 )
+            continue;
+
+         fromLength = sizeof(from);
+         len = recvfrom(
+            _commandSd,
+            nnp.rawPtr(), nnp.maxLength(),
+            0, reinterpret_cast<struct sockaddr*>(&from), &fromLength
+         );
+         if( len < 4 )
+            continue;
+         _answer(nnp, from, descriptions, frame);
+      }
+   }
+};
+
+#endif /*SYNTHETICSERVER_H*/
@@ -0,0 +1,156 @@
+/*
+ * TrajectoryFormat.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRAJECTORYFORMAT_H
+#define TRAJECTORYFORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*!
+ * \brief On-disk layout of columnar trajectory stores.
+ * \author Philip G. Lee
+ *
+ * A store is one file: a FileHeader followed by chunks. Each chunk holds
+ * up to \c chunkFrames consecutive frames as columns, so a query reads
+ * only the columns and chunks it needs:
+ *
+ * - a ChunkHeader with the number of rows and bodies and the range of
+ *   frame numbers and receive times in the chunk,
+ * - one BodyStats per rigid body seen in the chunk, with the extent of its
+ *   valid positions and marker errors and the offset of its columns,
+ * - the frame columns, one value per row: frame number (\c int32_t),
+ *   receive time in ns since the epoch (\c int64_t) and the server's
+ *   capture time in seconds (\c double, 0 before NatNet 2.x),
+ * - for each body, its columns: x, y, z, qx, qy, qz, qw and mean marker
+ *   error (\c float each), then validity (\c uint8_t, 1 if the body was in
+ *   the frame and tracked).
+ *
+ * Every column starts on an 8 byte boundary. A body that is missing from a
+ * frame has a row of zeros there. All values are in host byte order.
+ *
+ * Chunks are only ever appended whole, so a store whose writer was killed
+ * is read up to its last complete chunk.
+ *
+ * \sa TrajectoryWriter, TrajectoryReader
+ */
+class TrajectoryFormat
+{
+public:
+
+   enum
+   {
+      VERSION            = 1,
+      FILE_HEADER_BYTES  = 32,
+      CHUNK_HEADER_BYTES = 48,
+      BODY_STATS_BYTES   = 48
+   };
+
+   //! \brief Per-body columns, in the order they are stored.
+   enum BodyColumn
+   {
+      X                 = 0,
+      Y                 = 1,
+      Z                 = 2,
+      QX                = 3,
+      QY                = 4,
+      QZ                = 5,
+      QW                = 6,
+      MARKER_ERROR      = 7,
+      NUM_FLOAT_COLUMNS = 8
+   };
+
+   //! \brief Start of the file.
+   struct FileHeader
+   {
+      char magic[8];
+      uint32_t version;
+      uint32_t chunkFrames;
+      int64_t createdNs;
+      uint64_t reserved;
+   };
+
+   //! \brief Start of every chunk.
+   struct ChunkHeader
+   {
+      //! Bytes in the chunk, including this header.
+      uint64_t bytes;
+      uint32_t rows;
+      uint32_t numBodies;
+      int32_t minFrame;
+      int32_t maxFrame;
+      int64_t minTimeNs;
+      int64_t maxTimeNs;
+      uint64_t reserved;
+   };
+
+   //! \brief Statistics and location of one body's columns in a chunk.
+   struct BodyStats
+   {
+      int32_t id;
+      //! Rows in which the body is valid.
+      uint32_t validRows;
+      //! Extent of the valid positions. Undefined if validRows is 0.
+      float min[3];
+      float max[3];
+      //! Extent of the marker errors in valid rows.
+      float minError;
+      float maxError;
+      //! Offset of the body's first column from the start of the chunk.
+      uint64_t offset;
+   };
+
+   static char const* fileMagic() { return "NNTRJ\0\0\0"; }
+
+   //! \brief \c n rounded up to a multiple of 8.
+   static size_t pad( size_t n )
+   {
+      return (n + 7) & ~static_cast<size_t>(7);
+   }
+
+   //! \brief Bytes of the frame number column of a chunk.
+   static size_t frameColumnBytes( size_t rows ) { return pad(rows*sizeof(int32_t)); }
+   //! \brief Bytes of a float column of a chunk.
+   static size_t floatColumnBytes( size_t rows ) { return pad(rows*sizeof(float)); }
+   //! \brief Bytes of all the columns of one body in a chunk.
+   static size_t bodyBytes( size_t rows )
+   {
+      return NUM_FLOAT_COLUMNS*floatColumnBytes(rows) + pad(rows);
+   }
+
+   //! \brief Offset of the first frame column from the start of a chunk.
+   static size_t framesOffset( size_t numBodies )
+   {
+      return CHUNK_HEADER_BYTES + numBodies*BODY_STATS_BYTES;
+   }
+
+   //! \brief Offset of the first body's columns from the start of a chunk.
+   static size_t bodiesOffset( size_t rows, size_t numBodies )
+   {
+      return framesOffset(numBodies) + frameColumnBytes(rows) + rows*sizeof(int64_t) + rows*sizeof(double);
+   }
+
+   //! \brief Bytes of a whole chunk.
+   static size_t chunkBytes( size_t rows, size_t numBodies )
+   {
+      return bodiesOffset(rows, numBodies) + numBodies*bodyBytes(rows);
+   }
+};
+
+#endif /*TRAJECTORYFORMAT_H*/
@@ -0,0 +1,432 @@
+/*
+ * TrajectoryReader.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRAJECTORYREADER_H
+#define TRAJECTORYREADER_H
+
+#include <NatNetLinux/TrajectoryFormat.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*!
+ * \brief A read-only view of consecutive values of a column.
+ * \author Philip G. Lee
+ */
+template<class T>
+class ColumnSpan
+{
+public:
+
+   //! \brief Default constructor. Empty.
+   ColumnSpan() :
+      _data(0),
+      _size(0)
+   {
+   }
+
+   //! \brief Constructor
+   ColumnSpan( T const* data, size_t size ) :
+      _data(data),
+      _size(size)
+   {
+   }
+
+   //! \brief First value.
+   T const* data() const { return _data; }
+   //! \brief Number of values.
+   size_t size() const { return _size; }
+   //! \brief True if there are no values.
+   bool empty() const { return _size == 0; }
+   //! \brief Value \c i. Not checked.
+   T const& operator[]( size_t i ) const { return _data[i]; }
+   //! \brief First value, for iteration.
+   T const* begin() const { return _data; }
+   //! \brief Past the last value, for iteration.
+   T const* end() const { return _data + _size; }
+
+private:
+
+   T const* _data;
+   size_t _size;
+};
+
+/*!
+ * \brief Rows of one body in one chunk of a trajectory store.
+ * \author Philip G. Lee
+ *
+ * Every span has size() values, for the same frames. They point into the
+ * mapped store and are valid while the reader is open.
+ */
+class TrajectorySlice
+{
+public:
+
+   //! \brief Default constructor. Empty.
+   TrajectorySlice() :
+      chunk(0),
+      row(0)
+   {
+   }
+
+   //! \brief Chunk the rows are in.
+   size_t chunk;
+   //! \brief Row of the first value in the chunk.
+   size_t row;
+
+   //! \brief Frame numbers.
+   ColumnSpan<int32_t> frameNum;
+   //! \brief Receive times in ns since the epoch.
+   ColumnSpan<int64_t> timeNs;
+   //! \brief Capture times in seconds, as sent by the server.
+   ColumnSpan<double> captureTime;
+   //! \brief Positions and orientations.
+   ColumnSpan<float> x, y, z, qx, qy, qz, qw;
+   //! \brief Mean marker errors.
+   ColumnSpan<float> markerError;
+   //! \brief 1 where the body was in the frame and tracked, else 0.
+   ColumnSpan<uint8_t> valid;
+
+   //! \brief Number of rows.
+   size_t size() const { return frameNum.size(); }
+};
+
+/*!
+ * \brief Queries trajectory stores written by TrajectoryWriter.
+ * \author Philip G. Lee
+ *
+ * The store is memory-mapped and only the chunk headers are read when it
+ * is opened. A query skips chunks whose frame or time range, or whose list
+ * of bodies, rules them out, binary searches the frame or time column of
+ * the rest, and returns spans into the body's columns without copying.
+ * Only the pages of the columns actually read are loaded from disk.
+ *
+ * Time queries assume receive times increase through the store, and frame
+ * queries that frame numbers do.
+ *
+ * A store can be read while it is still being written, up to the last
+ * chunk complete when it was opened.
+ */
+class TrajectoryReader
+{
+public:
+
+   //! \brief Default constructor. Not open.
+   TrajectoryReader() :
+      _data(0),
+      _size(0),
+      _chunkFrames(0),
+      _chunks(),
+      _bodies(),
+      _frames(0)
+   {
+   }
+
+   ~TrajectoryReader()
+   {
+      close();
+   }
+
+   /*!
+    * \brief Map a store and read its chunk headers.
+    *
+    * \returns false if it is not a trajectory store
+    */
+   bool open( std::string const& path )
+   {
+      struct stat st;
+      TrajectoryFormat::FileHeader fh;
+
+      close();
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if( fd < 0 )
+         return false;
+      if( fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(fh) )
+      {
+         ::close(fd);
+         return false;
+      }
+      void* p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if( p == MAP_FAILED )
+         return false;
+
+      memcpy(&fh, p, sizeof(fh));
+      if( memcmp(fh.magic, TrajectoryFormat::fileMagic(), sizeof(fh.magic)) != 0 || fh.version != TrajectoryFormat::VERSION )
+      {
+         munmap(p, st.st_size);
+         return false;
+      }
+      _data = static_cast<char const*>(p);
+      _size = st.st_size;
+      _chunkFrames = fh.chunkFrames;
+
+      std::set<int> ids;
+      size_t off = TrajectoryFormat::FILE_HEADER_BYTES;
+      while( off + TrajectoryFormat::CHUNK_HEADER_BYTES <= _size )
+      {
+         Chunk c;
+         memcpy(&c.header, _data + off, sizeof(c.header));
+         if( c.header.rows == 0 || c.header.rows > _size || c.header.numBodies > _size
+            || c.header.bytes != TrajectoryFormat::chunkBytes(c.header.rows, c.header.numBodies)
+            || c.header.bytes > _size - off )
+            break;
+         c.offset = off;
+         _chunks.push_back(c);
+         if( !_checkBodies(_chunks.size() - 1) )
+         {
+            _chunks.pop_back();
+            break;
+         }
+         _frames += c.header.rows;
+         for( size_t i = 0; i < c.header.numBodies; ++i )
+            ids.insert(_stats(_chunks.size() - 1, i)->id);
+         off += c.header.bytes;
+      }
+      _bodies.assign(ids.begin(), ids.end());
+      return true;
+   }
+
+   //! \brief Unmap the store. Invalidates every slice read from it.
+   void close()
+   {
+      if( _data )
+         munmap(const_cast<char*>(_data), _size);
+      _data = 0;
+      _size = 0;
+      _chunkFrames = 0;
+      _chunks.clear();
+      _bodies.clear();
+      _frames = 0;
+   }
+
+   //! \brief True if a store is open.
+   bool isOpen() const { return _data != 0; }
+   //! \brief Frames per chunk the store was written with.
+   uint32_t chunkFrames() const { return _chunkFrames; }
+   //! \brief Number of complete chunks.
+   size_t numChunks() const { return _chunks.size(); }
+   //! \brief Number of frames in the complete chunks.
+   uint64_t numFrames() const { return _frames; }
+   //! \brief IDs of every body in the store, in increasing order.
+   std::vector<int> const& bodies() const { return _bodies; }
+
+   //! \brief Header of chunk \c i, with its row count and frame and time ranges.
+   TrajectoryFormat::ChunkHeader const& chunkHeader( size_t i ) const { return _chunks[i].header; }
+
+   /*!
+    * \brief Statistics of body \c id in chunk \c i, e.g. to skip chunks by position.
+    *
+    * \returns false if the body is not in the chunk
+    */
+   bool bodyStats( size_t i, int id, TrajectoryFormat::BodyStats& stats ) const
+   {
+      TrajectoryFormat::BodyStats const* s = _findBody(i, id);
+      if( !s )
+         return false;
+      memcpy(&stats, s, sizeof(stats));
+      return true;
+   }
+
+   /*!
+    * \brief Every row of chunk \c i, e.g. to scan a store one chunk at a time.
+    *
+    * The frame columns are always filled in. The body columns are only
+    * filled in if body \c id is in the chunk, and are empty otherwise.
+    *
+    * \returns false if the body is not in the chunk
+    */
+   bool chunkSlice( size_t i, int id, TrajectorySlice& slice ) const
+   {
+      _slice(i, _findBody(i, id), 0, _chunks[i].header.rows, slice);
+      return !slice.valid.empty();
+   }
+
+   /*!
+    * \brief Rows of body \c id received from \c t0 up to but not including \c t1.
+    *
+    * \param id rigid body ID
+    * \param t0 start time, from \c CLOCK_REALTIME
+    * \param t1 end time
+    * \param slices receives one slice per chunk with matching rows. Cleared first.
+    * \returns total rows in \c slices
+    */
+   size_t query( int id, struct timespec const& t0, struct timespec const& t1, std::vector<TrajectorySlice>& slices ) const
+   {
+      return _query(TIME, id, _toNs(t0), _toNs(t1), slices);
+   }
+
+   //! \brief query() with times in seconds, e.g. NatNet::seconds(). Good to about a microsecond.
+   size_t query( int id, double t0, double t1, std::vector<TrajectorySlice>& slices ) const
+   {
+      return _query(TIME, id, static_cast<int64_t>(t0*1e9), static_cast<int64_t>(t1*1e9), slices);
+   }
+
+   //! \brief Rows of body \c id in frames numbered \c firstFrame to \c lastFrame, like query().
+   size_t queryFrames( int id, int firstFrame, int lastFrame, std::vector<TrajectorySlice>& slices ) const
+   {
+      return _query(FRAME, id, firstFrame, static_cast<int64_t>(lastFrame) + 1, slices);
+   }
+
+private:
+
+   enum Key
+   {
+      FRAME,
+      TIME
+   };
+
+   struct Chunk
+   {
+      TrajectoryFormat::ChunkHeader header;
+      size_t offset;
+   };
+
+   char const* _data;
+   size_t _size;
+   uint32_t _chunkFrames;
+   std::vector<Chunk> _chunks;
+   std::vector<int> _bodies;
+   uint64_t _frames;
+
+   static int64_t _toNs( struct timespec const& ts )
+   {
+      return static_cast<int64_t>(ts.tv_sec)*1000000000LL + ts.tv_nsec;
+   }
+
+   // Body statistics entry j of chunk i.
+   TrajectoryFormat::BodyStats const* _stats( size_t i, size_t j ) const
+   {
+      return reinterpret_cast<TrajectoryFormat::BodyStats const*>(
+         _data + _chunks[i].offset + TrajectoryFormat::CHUNK_HEADER_BYTES + j*TrajectoryFormat::BODY_STATS_BYTES
+      );
+   }
+
+   // True if the bodies of chunk i are sorted and laid out as the writer does.
+   bool _checkBodies( size_t i ) const
+   {
+      TrajectoryFormat::ChunkHeader const& h = _chunks[i].header;
+      size_t offset = TrajectoryFormat::bodiesOffset(h.rows, h.numBodies);
+      for( size_t j = 0; j < h.numBodies; ++j )
+      {
+         if( _stats(i, j)->offset != offset || (j > 0 && _stats(i, j)->id <= _stats(i, j - 1)->id) )
+            return false;
+         offset += TrajectoryFormat::bodyBytes(h.rows);
+      }
+      return true;
+   }
+
+   // Binary search the bodies of chunk i, which are sorted by ID.
+   TrajectoryFormat::BodyStats const* _findBody( size_t i, int id ) const
+   {
+      size_t lo = 0, hi = _chunks[i].header.numBodies;
+      while( lo < hi )
+      {
+         size_t mid = lo + (hi - lo)/2;
+         TrajectoryFormat::BodyStats const* s = _stats(i, mid);
+         if( s->id == id )
+            return s;
+         if( s->id < id )
+            lo = mid + 1;
+         else
+            hi = mid;
+      }
+      return 0;
+   }
+
+   // Rows of body id in chunks with key in [lo, hi).
+   size_t _query( Key k, int id, int64_t lo, int64_t hi, std::vector<TrajectorySlice>& slices ) const
+   {
+      size_t total = 0;
+
+      slices.clear();
+      for( size_t i = 0; i < _chunks.size(); ++i )
+      {
+         TrajectoryFormat::ChunkHeader const& h = _chunks[i].header;
+         int64_t min = k == FRAME ? h.minFrame : h.minTimeNs;
+         int64_t max = k == FRAME ? h.maxFrame : h.maxTimeNs;
+         if( max < lo || min >= hi )
+            continue;
+         TrajectoryFormat::BodyStats const* s = _findBody(i, id);
+         if( !s )
+            continue;
+
+         size_t rows = h.rows;
+         char const* chunk = _data + _chunks[i].offset;
+         int32_t const* frames = reinterpret_cast<int32_t const*>(chunk + TrajectoryFormat::framesOffset(h.numBodies));
+         int64_t const* times = reinterpret_cast<int64_t const*>(
+            chunk + TrajectoryFormat::framesOffset(h.numBodies) + TrajectoryFormat::frameColumnBytes(rows)
+         );
+
+         size_t first, last;
+         if( k == FRAME )
+         {
+            first = std::lower_bound(frames, frames + rows, lo) - frames;
+            last = std::lower_bound(frames, frames + rows, hi) - frames;
+         }
+         else
+         {
+            first = std::lower_bound(times, times + rows, lo) - times;
+            last = std::lower_bound(times, times + rows, hi) - times;
+         }
+         if( first >= last )
+            continue;
+
+         slices.push_back(TrajectorySlice());
+         _slice(i, s, first, last - first, slices.back());
+         total += last - first;
+      }
+      return total;
+   }
+
+   // Rows first to first+n of chunk i, with the columns of body s if not null.
+   void _slice( size_t i, TrajectoryFormat::BodyStats const* s, size_t first, size_t n, TrajectorySlice& slice ) const
+   {
+      size_t rows = _chunks[i].header.rows;
+      char const* chunk = _data + _chunks[i].offset;
+      char const* frames = chunk + TrajectoryFormat::framesOffset(_chunks[i].header.numBodies);
+      int64_t const* times = reinterpret_cast<int64_t const*>(frames + TrajectoryFormat::frameColumnBytes(rows));
+      double const* captureTimes = reinterpret_cast<double const*>(times + rows);
+
+      slice = TrajectorySlice();
+      slice.chunk = i;
+      slice.row = first;
+      slice.frameNum = ColumnSpan<int32_t>(reinterpret_cast<int32_t const*>(frames) + first, n);
+      slice.timeNs = ColumnSpan<int64_t>(times + first, n);
+      slice.captureTime = ColumnSpan<double>(captureTimes + first, n);
+      if( !s )
+         return;
+
+      char const* body = chunk + s->offset;
+      size_t stride = TrajectoryFormat::floatColumnBytes(rows);
+      ColumnSpan<float>* columns[TrajectoryFormat::NUM_FLOAT_COLUMNS] = {
+         &slice.x, &slice.y, &slice.z, &slice.qx, &slice.qy, &slice.qz, &slice.qw, &slice.markerError
+      };
+      for( int c = 0; c < TrajectoryFormat::NUM_FLOAT_COLUMNS; ++c )
+         *columns[c] = ColumnSpan<float>(reinterpret_cast<float const*>(body + c*stride) + first, n);
+      slice.valid = ColumnSpan<uint8_t>(reinterpret_cast<uint8_t const*>(body + TrajectoryFormat::NUM_FLOAT_COLUMNS*stride) + first, n);
+   }
+};
+
+#endif /*TRAJECTORYREADER_H*/
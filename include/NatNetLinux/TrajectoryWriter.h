@@ -0,0 +1,399 @@
+/*
+ * TrajectoryWriter.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRAJECTORYWRITER_H
+#define TRAJECTORYWRITER_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameHandler.h>
+#include <NatNetLinux/TrajectoryFormat.h>
+#include <NatNetLinux/BackgroundFileWriter.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*!
+ * \brief Counters of a TrajectoryWriter.
+ * \author Philip G. Lee
+ */
+class TrajectoryStats
+{
+public:
+
+   //! \brief Default constructor. All zero.
+   TrajectoryStats() :
+      frames(0),
+      chunks(0),
+      bytes(0),
+      dropped(0),
+      writeErrors(0)
+   {
+   }
+
+   //! \brief Frames written to disk.
+   uint64_t frames;
+   //! \brief Chunks written to disk.
+   uint64_t chunks;
+   //! \brief Bytes written to disk.
+   uint64_t bytes;
+   //! \brief Frames dropped because the writer fell behind.
+   uint64_t dropped;
+   //! \brief Failed writes. The frames of a failed write are lost.
+   uint64_t writeErrors;
+};
+
+/*!
+ * \brief In-memory chunk of columns of a TrajectoryWriter.
+ * \author Philip G. Lee
+ */
+class TrajectoryChunk
+{
+public:
+
+   //! \brief The columns of one rigid body.
+   struct Body
+   {
+      std::vector<float> columns[TrajectoryFormat::NUM_FLOAT_COLUMNS];
+      std::vector<uint8_t> valid;
+
+      // Pad with invalid rows up to n.
+      void resize( size_t n, size_t capacity )
+      {
+         for( int i = 0; i < TrajectoryFormat::NUM_FLOAT_COLUMNS; ++i )
+         {
+            columns[i].reserve(capacity);
+            columns[i].resize(n, 0.f);
+         }
+         valid.reserve(capacity);
+         valid.resize(n, 0);
+      }
+
+      void append( RigidBody const& b )
+      {
+         Point3f const& p = b.location();
+         Quaternion4f const& q = b.orientation();
+         columns[TrajectoryFormat::X].push_back(p.x);
+         columns[TrajectoryFormat::Y].push_back(p.y);
+         columns[TrajectoryFormat::Z].push_back(p.z);
+         columns[TrajectoryFormat::QX].push_back(q.qx);
+         columns[TrajectoryFormat::QY].push_back(q.qy);
+         columns[TrajectoryFormat::QZ].push_back(q.qz);
+         columns[TrajectoryFormat::QW].push_back(q.qw);
+         columns[TrajectoryFormat::MARKER_ERROR].push_back(b.meanMarkerError());
+         valid.push_back(b.trackingValid() ? 1 : 0);
+      }
+   };
+
+   //! \brief Constructor. Empty, with room for \c capacity rows.
+   TrajectoryChunk( size_t capacity )
+   {
+      frameNum.reserve(capacity);
+      timeNs.reserve(capacity);
+      captureTime.reserve(capacity);
+   }
+
+   //! \brief True if it has no rows.
+   bool empty() const { return frameNum.empty(); }
+
+   //! \brief Make it empty, keeping the memory of the frame columns.
+   void clear()
+   {
+      frameNum.clear();
+      timeNs.clear();
+      captureTime.clear();
+      bodies.clear();
+   }
+
+   std::vector<int32_t> frameNum;
+   std::vector<int64_t> timeNs;
+   std::vector<double> captureTime;
+   // Sorted by ID, so the reader can binary search a chunk's bodies.
+   std::map<int,Body> bodies;
+};
+
+/*!
+ * \brief Stores the rigid bodies of decoded frames as columns.
+ * \author Philip G. Lee
+ *
+ * Register with \c FrameListener::addHandler() to store the frame number,
+ * receive time, capture time and every rigid body's pose, validity and
+ * marker error of each frame. See TrajectoryFormat for the file written
+ * and TrajectoryReader to query it.
+ *
+ * handleFrame() appends one row to the chunk being built in memory. When
+ * it holds \c chunkFrames rows, it is queued for a background thread that
+ * writes it out, and a new chunk is started, so the listener never waits
+ * for the disk. A partly filled chunk is written after \c flushInterval
+ * seconds, so chunks may be shorter. If the disk falls behind until
+ * \c maxChunks chunks are queued, frames are dropped and counted.
+ */
+class TrajectoryWriter : public FrameHandler, public BackgroundFileWriter<TrajectoryChunk>
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param path file to create
+    * \param chunkFrames frames per chunk, at most
+    * \param maxChunks chunks that may be queued for writing
+    * \param flushInterval seconds after which a partly filled chunk is written
+    */
+   TrajectoryWriter(
+      std::string const& path,
+      uint32_t chunkFrames=4096,
+      size_t maxChunks=16,
+      double flushInterval=5.0
+   ) :
+      BackgroundFileWriter<TrajectoryChunk>(maxChunks, flushInterval),
+      _path(path),
+      _chunkFrames(chunkFrames < 1 ? 1 : chunkFrames),
+      _stats(),
+      _fd(-1),
+      _end(0),
+      _buf()
+   {
+   }
+
+   ~TrajectoryWriter()
+   {
+      if( running() )
+         stop();
+      join();
+      if( _fd >= 0 )
+         ::close(_fd);
+   }
+
+   /*!
+    * \brief Create the file and start writing in a new thread. Non-blocking.
+    *
+    * \returns false if the file could not be created
+    */
+   bool start()
+   {
+      TrajectoryFormat::FileHeader fh;
+      struct timespec now;
+
+      if( _fill )
+         return false;
+      _fd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if( _fd < 0 )
+         return false;
+
+      clock_gettime( CLOCK_REALTIME, &now );
+      memset(&fh, 0, sizeof(fh));
+      memcpy(fh.magic, TrajectoryFormat::fileMagic(), sizeof(fh.magic));
+      fh.version = TrajectoryFormat::VERSION;
+      fh.chunkFrames = _chunkFrames;
+      fh.createdNs = static_cast<int64_t>(now.tv_sec)*1000000000LL + now.tv_nsec;
+      if( !writeAll(_fd, reinterpret_cast<char const*>(&fh), sizeof(fh)) )
+      {
+         ::close(_fd);
+         _fd = -1;
+         return false;
+      }
+      _end = sizeof(fh);
+
+      _startThread();
+      return true;
+   }
+
+   //! \brief Append a frame. Thread-safe, never waits for the disk.
+   virtual void handleFrame( MocapFrame const& frame, struct timespec const& ts )
+   {
+      std::vector<RigidBody> const& bodies = frame.rigidBodies();
+
+      _mutex.lock();
+      if( !_run )
+      {
+         _mutex.unlock();
+         return;
+      }
+      // A chunk left full because none was free is queued first.
+      if( _fill->frameNum.size() >= _chunkFrames && !_queueFill() )
+      {
+         ++_stats.dropped;
+         _mutex.unlock();
+         return;
+      }
+      TrajectoryChunk& c = *_fill;
+      size_t row = c.frameNum.size();
+      c.frameNum.push_back(frame.frameNum());
+      c.timeNs.push_back(static_cast<int64_t>(ts.tv_sec)*1000000000LL + ts.tv_nsec);
+      c.captureTime.push_back(frame.captureTime());
+      for( size_t i = 0; i < bodies.size(); ++i )
+      {
+         std::map<int,TrajectoryChunk::Body>::iterator it = c.bodies.find(bodies[i].id());
+         if( it == c.bodies.end() )
+         {
+            // First seen mid-chunk: invalid in the rows before.
+            it = c.bodies.insert(std::make_pair(bodies[i].id(), TrajectoryChunk::Body())).first;
+            it->second.resize(row, _chunkFrames);
+         }
+         else if( it->second.valid.size() > row )
+            continue; // Same ID twice in one frame. Keep the first.
+         it->second.append(bodies[i]);
+      }
+      // Bodies missing from this frame.
+      for( std::map<int,TrajectoryChunk::Body>::iterator it = c.bodies.begin(); it != c.bodies.end(); ++it )
+      {
+         if( it->second.valid.size() == row )
+            it->second.resize(row + 1, _chunkFrames);
+      }
+
+      if( c.frameNum.size() >= _chunkFrames )
+         _queueFill();
+      _mutex.unlock();
+   }
+
+   //! \brief Counters so far. Thread-safe.
+   TrajectoryStats stats() const
+   {
+      _mutex.lock();
+         TrajectoryStats ret = _stats;
+      _mutex.unlock();
+      return ret;
+   }
+
+private:
+
+   std::string _path;
+   uint32_t _chunkFrames;
+
+   // Guarded by _mutex.
+   TrajectoryStats _stats;
+
+   // Only used by the writing thread once started.
+   int _fd;
+   // End of the last complete chunk.
+   off_t _end;
+   std::vector<char> _buf;
+
+   virtual TrajectoryChunk* _newBuffer()
+   {
+      return new TrajectoryChunk(_chunkFrames);
+   }
+
+   // Lay out a chunk as in TrajectoryFormat, in _buf.
+   void _serialize( TrajectoryChunk const& c )
+   {
+      TrajectoryFormat::ChunkHeader h;
+      size_t rows = c.frameNum.size();
+      size_t numBodies = c.bodies.size();
+
+      _buf.assign(TrajectoryFormat::chunkBytes(rows, numBodies), 0);
+      char* base = &_buf[0];
+
+      memset(&h, 0, sizeof(h));
+      h.bytes = _buf.size();
+      h.rows = static_cast<uint32_t>(rows);
+      h.numBodies = static_cast<uint32_t>(numBodies);
+      h.minFrame = h.maxFrame = c.frameNum[0];
+      h.minTimeNs = h.maxTimeNs = c.timeNs[0];
+      for( size_t r = 1; r < rows; ++r )
+      {
+         h.minFrame = std::min(h.minFrame, c.frameNum[r]);
+         h.maxFrame = std::max(h.maxFrame, c.frameNum[r]);
+         h.minTimeNs = std::min(h.minTimeNs, c.timeNs[r]);
+         h.maxTimeNs = std::max(h.maxTimeNs, c.timeNs[r]);
+      }
+      memcpy(base, &h, sizeof(h));
+
+      char* p = base + TrajectoryFormat::framesOffset(numBodies);
+      memcpy(p, &c.frameNum[0], rows*sizeof(int32_t));
+      p += TrajectoryFormat::frameColumnBytes(rows);
+      memcpy(p, &c.timeNs[0], rows*sizeof(int64_t));
+      p += rows*sizeof(int64_t);
+      memcpy(p, &c.captureTime[0], rows*sizeof(double));
+
+      size_t offset = TrajectoryFormat::bodiesOffset(rows, numBodies);
+      char* stats = base + TrajectoryFormat::CHUNK_HEADER_BYTES;
+      for( std::map<int,TrajectoryChunk::Body>::const_iterator it = c.bodies.begin(); it != c.bodies.end(); ++it )
+      {
+         TrajectoryChunk::Body const& b = it->second;
+         TrajectoryFormat::BodyStats s;
+         memset(&s, 0, sizeof(s));
+         s.id = it->first;
+         s.offset = offset;
+         for( size_t r = 0; r < rows; ++r )
+         {
+            if( !b.valid[r] )
+               continue;
+            float err = b.columns[TrajectoryFormat::MARKER_ERROR][r];
+            for( int k = 0; k < 3; ++k )
+            {
+               float v = b.columns[k][r];
+               s.min[k] = s.validRows ? std::min(s.min[k], v) : v;
+               s.max[k] = s.validRows ? std::max(s.max[k], v) : v;
+            }
+            s.minError = s.validRows ? std::min(s.minError, err) : err;
+            s.maxError = s.validRows ? std::max(s.maxError, err) : err;
+            ++s.validRows;
+         }
+         memcpy(stats, &s, sizeof(s));
+         stats += TrajectoryFormat::BODY_STATS_BYTES;
+
+         p = base + offset;
+         for( int k = 0; k < TrajectoryFormat::NUM_FLOAT_COLUMNS; ++k )
+         {
+            memcpy(p, &b.columns[k][0], rows*sizeof(float));
+            p += TrajectoryFormat::floatColumnBytes(rows);
+         }
+         memcpy(p, &b.valid[0], rows);
+         offset += TrajectoryFormat::bodyBytes(rows);
+      }
+   }
+
+   virtual void _writeBuffer( TrajectoryChunk& c )
+   {
+      _serialize(c);
+      bool ok = writeAll(_fd, &_buf[0], _buf.size());
+      // Cut off what was written of a chunk that failed, so later chunks
+      // follow the last whole one instead of being hidden behind it.
+      if( ok )
+         _end += _buf.size();
+      else if( ftruncate(_fd, _end) == 0 )
+         lseek(_fd, _end, SEEK_SET);
+      _mutex.lock();
+      if( ok )
+      {
+         _stats.frames += c.frameNum.size();
+         ++_stats.chunks;
+         _stats.bytes += _buf.size();
+      }
+      else
+         ++_stats.writeErrors;
+      _mutex.unlock();
+   }
+
+   virtual void _finish()
+   {
+      if( ::close(_fd) != 0 )
+      {
+         _mutex.lock();
+            ++_stats.writeErrors;
+         _mutex.unlock();
+      }
+      _fd = -1;
+   }
+};
+
+#endif /*TRAJECTORYWRITER_H*/
@@ -0,0 +1,141 @@
+/*
+ * WorkerPool.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <vector>
+
+/*!
+ * \brief A fixed set of threads that run one task together, again and again.
+ * \author Philip G. Lee
+ *
+ * The threads are started once, at construction, and wait between tasks,
+ * so work that is split every frame does not pay for creating and joining
+ * threads every frame. run() hands the task to every thread, runs part 0
+ * itself, and returns when all parts are done.
+ */
+class WorkerPool
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param size number of parts each task is split into, counting the
+    *    thread calling run(). Starts \c size-1 threads.
+    */
+   WorkerPool( unsigned int size ) :
+      _size(size ? size : 1),
+      _mutex(),
+      _start(),
+      _finished(),
+      _task(),
+      _generation(0),
+      _remaining(0),
+      _stop(false),
+      _threads()
+   {
+      for( unsigned int t = 1; t < _size; ++t )
+         _threads.push_back(new boost::thread(&WorkerPool::_work, this, t));
+   }
+
+   //! \brief Stops and joins the threads.
+   ~WorkerPool()
+   {
+      {
+         boost::mutex::scoped_lock lock(_mutex);
+         _stop = true;
+         _start.notify_all();
+      }
+      for( size_t i = 0; i < _threads.size(); ++i )
+      {
+         _threads[i]->join();
+         delete _threads[i];
+      }
+   }
+
+   //! \brief Number of parts each task is split into.
+   unsigned int size() const { return _size; }
+
+   /*!
+    * \brief Call \c task(t) for every part \c t in [0,size()), and wait for all of them.
+    *
+    * Part 0 runs on the calling thread. Not safe to call from more than
+    * one thread at a time.
+    */
+   void run( boost::function<void (unsigned int)> const& task )
+   {
+      {
+         boost::mutex::scoped_lock lock(_mutex);
+         _task = task;
+         _remaining = _size-1;
+         ++_generation;
+         _start.notify_all();
+      }
+
+      task(0);
+
+      boost::mutex::scoped_lock lock(_mutex);
+      while( _remaining > 0 )
+         _finished.wait(lock);
+   }
+
+private:
+
+   unsigned int _size;
+   boost::mutex _mutex;
+   boost::condition_variable _start;
+   boost::condition_variable _finished;
+   boost::function<void (unsigned int)> _task;
+   // Incremented by each run(), so threads see a new task exactly once.
+   unsigned long _generation;
+   unsigned int _remaining;
+   bool _stop;
+   std::vector<boost::thread*> _threads;
+
+   void _work( unsigned int t )
+   {
+      unsigned long seen = 0;
+      boost::mutex::scoped_lock lock(_mutex);
+      for(;;)
+      {
+         while( !_stop && _generation == seen )
+            _start.wait(lock);
+         if( _stop )
+            break;
+         seen = _generation;
+         lock.unlock();
+
+         // run() leaves _task alone until every part is done.
+         _task(t);
+
+         lock.lock();
+         if( --_remaining == 0 )
+            _finished.notify_one();
+      }
+   }
+
+   // Not copyable.
+   WorkerPool( WorkerPool const& );
+   WorkerPool& operator=( WorkerPool const& );
+};
+
+#endif /*WORKERPOOL_H*/
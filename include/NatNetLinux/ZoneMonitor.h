@@ -0,0 +1,616 @@
+/*
+ * ZoneMonitor.h is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZONEMONITOR_H
+#define ZONEMONITOR_H
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameHandler.h>
+#include <NatNetLinux/FrameIndex.h>
+#include <NatNetLinux/PoseBatch.h>
+#include <NatNetLinux/Simd.h>
+#include <boost/thread.hpp>
+#include <boost/circular_buffer.hpp>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+
+/*!
+ * \brief A box or cylinder in the capture volume.
+ * \author Philip G. Lee
+ */
+class Zone
+{
+public:
+
+   //! \brief Shapes of zones.
+   enum Shape
+   {
+      BOX      = 0,
+      CYLINDER = 1
+   };
+
+   //! \brief Axis-aligned box from \c lo to \c hi.
+   static Zone box( Point3f const& lo, Point3f const& hi )
+   {
+      Point3f c(0.5f*(lo.x+hi.x), 0.5f*(lo.y+hi.y), 0.5f*(lo.z+hi.z));
+      Point3f h(0.5f*(hi.x-lo.x), 0.5f*(hi.y-lo.y), 0.5f*(hi.z-lo.z));
+      return Zone(BOX, c, Quaternion4f(0.f,0.f,0.f,1.f), h, true);
+   }
+
+   //! \brief Box about \c center, rotated by \c orientation, with the given half extents.
+   static Zone orientedBox( Point3f const& center, Quaternion4f const& orientation, Point3f const& halfExtents )
+   {
+      return Zone(BOX, center, orientation, halfExtents, false);
+   }
+
+   /*!
+    * \brief Cylinder about \c center, with its axis along the local y axis of \c orientation.
+    *
+    * \param center middle of the axis
+    * \param orientation rotation of the cylinder
+    * \param radius radius
+    * \param halfHeight half the length of the axis
+    */
+   static Zone cylinder( Point3f const& center, Quaternion4f const& orientation, float radius, float halfHeight )
+   {
+      return Zone(CYLINDER, center, orientation, Point3f(radius, halfHeight, radius), false);
+   }
+
+   //! \brief Cylinder about \c center with its axis along the world y axis.
+   static Zone cylinder( Point3f const& center, float radius, float halfHeight )
+   {
+      return Zone(CYLINDER, center, Quaternion4f(0.f,0.f,0.f,1.f), Point3f(radius, halfHeight, radius), true);
+   }
+
+   //! \brief Shape of the zone.
+   Shape shape() const { return _shape; }
+   //! \brief Center of the zone.
+   Point3f const& center() const { return _center; }
+   //! \brief Orientation of the zone.
+   Quaternion4f const& orientation() const { return _orientation; }
+   //! \brief Half extents of a box, or (radius, half height, radius) of a cylinder.
+   Point3f const& halfExtents() const { return _half; }
+
+   //! \brief True if \c p is inside the zone. Scalar; ZoneMonitor tests four points at a time.
+   bool contains( Point3f const& p ) const
+   {
+      Point3f d(p.x-_center.x, p.y-_center.y, p.z-_center.z);
+      Point3f l = _orientation.conjugate().rotate(d);
+      if( _shape == BOX )
+         return fabsf(l.x) <= _half.x && fabsf(l.y) <= _half.y && fabsf(l.z) <= _half.z;
+      return l.x*l.x + l.z*l.z <= _half.x*_half.x && fabsf(l.y) <= _half.y;
+   }
+
+private:
+
+   friend class ZoneMonitor;
+
+   Zone( Shape shape, Point3f const& c, Quaternion4f const& q, Point3f const& h, bool axisAligned ) :
+      _shape(shape),
+      _center(c),
+      _orientation(q),
+      _half(h),
+      _axisAligned(axisAligned)
+   {
+   }
+
+   Shape _shape;
+   Point3f _center;
+   Quaternion4f _orientation;
+   Point3f _half;
+   bool _axisAligned;
+};
+
+/*!
+ * \brief Something entered or left a zone.
+ * \author Philip G. Lee
+ */
+class ZoneEvent
+{
+public:
+
+   //! \brief Default constructor
+   ZoneEvent() :
+      zone(-1),
+      subject(),
+      entered(false),
+      expired(false),
+      location(),
+      frameNum(0),
+      time(0.0)
+   {
+   }
+
+   //! \brief ID returned by ZoneMonitor::addZone().
+   int zone;
+   //! \brief The rigid body, marker or bone.
+   IndexedPoint subject;
+   //! \brief True if it entered, false if it left.
+   bool entered;
+   //! \brief True if it left because it was not seen for ZoneMonitor::timeout().
+   bool expired;
+   //! \brief Its location. The last one seen if \c expired.
+   Point3f location;
+   //! \brief MocapFrame::frameNum() of the frame that caused the event.
+   int frameNum;
+   //! \brief Arrival time in seconds of the frame that caused the event.
+   double time;
+};
+
+/*!
+ * \brief Interface for receiving ZoneMonitor events.
+ * \author Philip G. Lee
+ */
+class ZoneHandler
+{
+public:
+
+   virtual ~ZoneHandler(){}
+
+   /*!
+    * \brief Something entered or left a zone.
+    *
+    * Called from the thread that called \c ZoneMonitor::update(), normally
+    * the FrameListener's, so keep it short.
+    */
+   virtual void zoneChanged( ZoneEvent const& event ) = 0;
+};
+
+/*!
+ * \brief Tracks which rigid bodies and markers are in which zones.
+ * \author Philip G. Lee
+ *
+ * Define boxes and cylinders with addZone() and register this with
+ * \c FrameListener::addHandler(). Every frame, the positions of the kinds
+ * selected at construction (see IndexedPoint::Kind) are tested against
+ * every zone, four positions at a time with Float4, and only changes of
+ * occupancy become events. Events go to every ZoneHandler, still in the
+ * listening thread, and, if the monitor has a queue, into a bounded queue
+ * for popEvent().
+ *
+ * Subjects are identified by their IndexedPoint, so pick kinds with a
+ * stable identity: rigid bodies, labeled markers and skeleton bones.
+ * A subject that is missing or untracked keeps its zones until it has not
+ * been seen for timeout() seconds, after which it leaves them with an
+ * \c expired event and is forgotten, so subjects that come and go, like
+ * labeled markers, do not pile up. With no timeout, a subject is forgotten
+ * once it is unseen and in no zone.
+ */
+class ZoneMonitor : public FrameHandler
+{
+public:
+
+   /*!
+    * \brief Constructor
+    *
+    * \param kinds mask of IndexedPoint::Kind to track
+    * \param queueSize capacity of the event queue. 0 disables it.
+    * \param timeout seconds after which an unseen subject leaves its zones.
+    *    0 means never.
+    */
+   ZoneMonitor( unsigned int kinds=IndexedPoint::RIGID_BODY|IndexedPoint::LABELED_MARKER, size_t queueSize=0, double timeout=0.5 ) :
+      _kinds(kinds),
+      _timeout(timeout),
+      _mutex(),
+      _zones(),
+      _ids(),
+      _nextId(0),
+      _words(0),
+      _subjects(),
+      _slots(),
+      _state(),
+      _handlers(),
+      _queue(queueSize),
+      _dropped(0),
+      _points(),
+      _info(),
+      _inside()
+   {
+   }
+
+   virtual ~ZoneMonitor(){}
+
+   //! \brief Seconds after which an unseen subject leaves its zones.
+   double timeout() const { return _timeout; }
+
+   /*!
+    * \brief Add a zone. Thread-safe.
+    *
+    * \returns an ID for the zone, never reused
+    */
+   int addZone( Zone const& zone )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      size_t slot = std::find(_ids.begin(), _ids.end(), -1) - _ids.begin();
+      if( slot == _ids.size() )
+      {
+         _zones.push_back(zone);
+         _ids.push_back(-1);
+         _resizeState();
+      }
+      else
+         _zones[slot] = zone;
+      _ids[slot] = _nextId;
+      return _nextId++;
+   }
+
+   /*!
+    * \brief Remove a zone, without events for its occupants. Thread-safe.
+    *
+    * \returns false if there is no such zone
+    */
+   bool removeZone( int id )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      std::vector<int>::iterator it = std::find(_ids.begin(), _ids.end(), id);
+      if( id < 0 || it == _ids.end() )
+         return false;
+
+      size_t slot = it - _ids.begin();
+      *it = -1;
+      for( size_t s = 0; s < _subjects.size(); ++s )
+         _state[s*_words + slot/32] &= ~(1u << (slot%32));
+      return true;
+   }
+
+   //! \brief Receive events. Thread-safe.
+   void addHandler( ZoneHandler* handler )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      _handlers.push_back(handler);
+   }
+
+   //! \brief Stop receiving events. Thread-safe.
+   void removeHandler( ZoneHandler* handler )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      _handlers.erase(std::remove(_handlers.begin(), _handlers.end(), handler), _handlers.end());
+   }
+
+   /*!
+    * \brief Take the oldest queued event. Thread-safe.
+    *
+    * \returns false if the queue is empty or disabled
+    */
+   bool popEvent( ZoneEvent& event )
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      if( _queue.empty() )
+         return false;
+      event = _queue.front();
+      _queue.pop_front();
+      return true;
+   }
+
+   //! \brief Events lost because the queue was full. Thread-safe.
+   unsigned long droppedEvents() const
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      return _dropped;
+   }
+
+   /*!
+    * \brief Subjects currently in a zone. Thread-safe.
+    *
+    * \param id zone ID
+    * \param out output subjects. Cleared first.
+    */
+   void occupants( int id, std::vector<IndexedPoint>& out ) const
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      out.clear();
+      std::vector<int>::const_iterator it = std::find(_ids.begin(), _ids.end(), id);
+      if( id < 0 || it == _ids.end() )
+         return;
+      size_t slot = it - _ids.begin();
+      for( size_t s = 0; s < _subjects.size(); ++s )
+         if( _state[s*_words + slot/32] & (1u << (slot%32)) )
+            out.push_back(_subjects[s].subject);
+   }
+
+   /*!
+    * \brief Zones a subject is in. Thread-safe.
+    *
+    * \param subject the subject
+    * \param out output zone IDs. Cleared first.
+    */
+   void zonesOf( IndexedPoint const& subject, std::vector<int>& out ) const
+   {
+      boost::mutex::scoped_lock lock(_mutex);
+      out.clear();
+      std::map<IndexedPoint,size_t>::const_iterator it = _slots.find(subject);
+      if( it == _slots.end() )
+         return;
+      for( size_t z = 0; z < _ids.size(); ++z )
+         if( _state[it->second*_words + z/32] & (1u << (z%32)) )
+            out.push_back(_ids[z]);
+   }
+
+   //! \brief Test the frame. Called by FrameListener.
+   virtual void handleFrame( MocapFrame const& frame, struct timespec const& ts )
+   {
+      update(frame, NatNet::seconds(ts));
+   }
+
+   /*!
+    * \brief Test the positions in \c frame and dispatch events. Thread-safe.
+    *
+    * \param frame new frame
+    * \param t arrival time of the frame in seconds
+    */
+   void update( MocapFrame const& frame, double t )
+   {
+      std::vector<ZoneEvent> events;
+      std::vector<ZoneHandler*> handlers;
+      size_t i, w;
+
+      {
+         boost::mutex::scoped_lock lock(_mutex);
+
+         IndexedFrame::gather(frame, _kinds, _points, _info);
+         _test();
+
+         ZoneEvent e;
+         e.frameNum = frame.frameNum();
+         e.time = t;
+         for( i = 0; i < _info.size(); ++i )
+         {
+            size_t s = _slot(_info[i]);
+            Subject& subj = _subjects[s];
+            subj.lastSeen = t;
+            subj.location = _points.get(i);
+
+            uint32_t const* now = &_inside[i*_words];
+            uint32_t* was = &_state[s*_words];
+            e.subject = subj.subject;
+            e.location = subj.location;
+            for( w = 0; w < _words; ++w )
+            {
+               _changes(w, now[w] ^ was[w], now[w], e, events);
+               was[w] = now[w];
+            }
+         }
+
+         _expire(t, e, events);
+
+         for( i = 0; i < events.size(); ++i )
+         {
+            if( _queue.capacity() == 0 )
+               break;
+            if( _queue.full() )
+               ++_dropped;
+            _queue.push_back(events[i]);
+         }
+         handlers = _handlers;
+      }
+
+      for( i = 0; i < events.size(); ++i )
+         for( size_t j = 0; j < handlers.size(); ++j )
+            handlers[j]->zoneChanged(events[i]);
+   }
+
+private:
+
+   class Subject
+   {
+   public:
+      Subject( IndexedPoint const& s ) : subject(s), location(), lastSeen(0.0) {}
+
+      IndexedPoint subject;
+      Point3f location;
+      double lastSeen;
+   };
+
+   unsigned int _kinds;
+   double _timeout;
+   mutable boost::mutex _mutex;
+
+   // Zone slots. A removed zone's slot has ID -1 and is reused.
+   std::vector<Zone> _zones;
+   std::vector<int> _ids;
+   int _nextId;
+   // 32-bit words per zone bit set.
+   size_t _words;
+
+   std::vector<Subject> _subjects;
+   std::map<IndexedPoint,size_t> _slots;
+   // Zone bit set of each subject.
+   std::vector<uint32_t> _state;
+
+   std::vector<ZoneHandler*> _handlers;
+   boost::circular_buffer<ZoneEvent> _queue;
+   unsigned long _dropped;
+
+   // Per-frame scratch: positions, their subjects, and their zone bit sets.
+   PointArray _points;
+   std::vector<IndexedPoint> _info;
+   std::vector<uint32_t> _inside;
+
+   size_t _slot( IndexedPoint const& p )
+   {
+      std::map<IndexedPoint,size_t>::iterator it = _slots.lower_bound(p);
+      if( it != _slots.end() && it->first == p )
+         return it->second;
+
+      size_t s = _subjects.size();
+      _slots.insert(it, std::make_pair(p, s));
+      _subjects.push_back(Subject(p));
+      _state.resize(_state.size() + _words, 0);
+      return s;
+   }
+
+   // Widen every bit set when the number of zone slots passes a multiple of 32.
+   void _resizeState()
+   {
+      size_t words = (_zones.size()+31)/32;
+      if( words == _words )
+         return;
+
+      std::vector<uint32_t> state(_subjects.size()*words, 0);
+      for( size_t s = 0; s < _subjects.size(); ++s )
+         for( size_t w = 0; w < _words; ++w )
+            state[s*words + w] = _state[s*_words + w];
+      _state.swap(state);
+      _words = words;
+   }
+
+   // Emit an event for every bit set in \c changed.
+   void _changes( size_t w, uint32_t changed, uint32_t now, ZoneEvent& e, std::vector<ZoneEvent>& events ) const
+   {
+      while( changed )
+      {
+         int b = _lowestBit(changed);
+         changed &= changed-1;
+         e.zone = _ids[w*32 + b];
+         e.entered = (now >> b) & 1u;
+         events.push_back(e);
+      }
+   }
+
+   // Take subjects unseen for longer than the timeout out of their zones,
+   // and forget them.
+   void _expire( double t, ZoneEvent& e, std::vector<ZoneEvent>& events )
+   {
+      size_t s = 0, w;
+
+      e.entered = false;
+      e.expired = true;
+      while( s < _subjects.size() )
+      {
+         Subject const& subj = _subjects[s];
+         uint32_t* state = &_state[s*_words];
+         if( t - subj.lastSeen <= _timeout )
+         {
+            ++s;
+            continue;
+         }
+
+         if( _timeout > 0.0 )
+         {
+            e.subject = subj.subject;
+            e.location = subj.location;
+            for( w = 0; w < _words; ++w )
+               _changes(w, state[w], 0u, e, events);
+         }
+         else
+         {
+            // No timeout: keep it as long as it is in a zone.
+            for( w = 0; w < _words && !state[w]; ++w )
+               ;
+            if( w < _words )
+            {
+               ++s;
+               continue;
+            }
+         }
+         _forget(s);
+      }
+      e.expired = false;
+   }
+
+   // Remove subject s, moving the last subject into its slot.
+   void _forget( size_t s )
+   {
+      size_t last = _subjects.size()-1;
+
+      _slots.erase(_subjects[s].subject);
+      if( s != last )
+      {
+         _subjects[s] = _subjects[last];
+         std::copy(_state.begin() + last*_words, _state.begin() + (last+1)*_words, _state.begin() + s*_words);
+         _slots[_subjects[s].subject] = s;
+      }
+      _subjects.pop_back();
+      _state.resize(last*_words);
+   }
+
+   static int _lowestBit( uint32_t v )
+   {
+      int b = 0;
+      while( !(v & 1u) )
+      {
+         v >>= 1;
+         ++b;
+      }
+      return b;
+   }
+
+   // Fill _inside with the zone bit set of every position.
+   void _test()
+   {
+      size_t n = _points.size();
+      size_t i, z;
+
+      _inside.assign(n*_words, 0);
+      for( z = 0; z < _zones.size(); ++z )
+      {
+         if( _ids[z] < 0 )
+            continue;
+
+         Zone const& zone = _zones[z];
+         uint32_t bit = 1u << (z%32);
+         uint32_t* inside = &_inside[z/32];
+
+         // Rows of the world-to-zone rotation.
+         Point3f ex = zone._orientation.rotate(Point3f(1.f,0.f,0.f));
+         Point3f ey = zone._orientation.rotate(Point3f(0.f,1.f,0.f));
+         Point3f ez = zone._orientation.rotate(Point3f(0.f,0.f,1.f));
+         Float4 r00(ex.x), r01(ex.y), r02(ex.z);
+         Float4 r10(ey.x), r11(ey.y), r12(ey.z);
+         Float4 r20(ez.x), r21(ez.y), r22(ez.z);
+         Float4 cx(zone._center.x), cy(zone._center.y), cz(zone._center.z);
+         Float4 hx(zone._half.x), hy(zone._half.y), hz(zone._half.z);
+         Float4 r2(zone._half.x*zone._half.x);
+
+         for( i = 0; i < n; i += Float4::width )
+         {
+            size_t rem = std::min(n-i, Float4::width);
+            Float4 dx = _ld(&_points.x[i], rem) - cx;
+            Float4 dy = _ld(&_points.y[i], rem) - cy;
+            Float4 dz = _ld(&_points.z[i], rem) - cz;
+            Float4 lx = dx, ly = dy, lz = dz;
+            if( !zone._axisAligned )
+            {
+               lx = r00*dx + r01*dy + r02*dz;
+               ly = r10*dx + r11*dy + r12*dz;
+               lz = r20*dx + r21*dy + r22*dz;
+            }
+
+            Float4 in;
+            if( zone._shape == Zone::BOX )
+               in = (abs(lx) <= hx) & (abs(ly) <= hy) & (abs(lz) <= hz);
+            else
+               in = (lx*lx + lz*lz <= r2) & (abs(ly) <= hy);
+
+            int m = movemask(in) & ((1 << rem) - 1);
+            for( ; m; m &= m-1 )
+               inside[(i + _lowestBit(m))*_words] |= bit;
+         }
+      }
+   }
+
+   static Float4 _ld( float const* p, size_t n )
+   {
+      return n == Float4::width ? Float4::load(p) : Float4::loadPartial(p, n);
+   }
+};
+
+#endif /*ZONEMONITOR_H*/
@@ -0,0 +1,195 @@
+/*
+ * CaptureReplay.cpp is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameListener.h>
+#include <NatNetLinux/CaptureReader.h>
+#include <NatNetLinux/CompressedReader.h>
+#include <NatNetLinux/Replayer.h>
+
+#include <boost/program_options.hpp>
+
+// Replays a capture log written by CaptureWriter, either onto the network
+// (e.g. the NatNet multicast group, for other programs to receive) or into
+// a FrameListener in this process, which is drained as fast as possible to
+// benchmark the receive path. A file written by CompressedWriter is
+// replayed into the FrameListener. Prints the achieved rate and timing error
+// every second, and the listener's stage latencies at the end.
+
+bool run = true;
+
+// End the program gracefully.
+void terminate(int)
+{
+   run = false;
+}
+
+int main( int argc, char* argv[] )
+{
+   namespace po = boost::program_options;
+
+   po::options_description desc("capture-replay: replays a NatNetLinux capture log\nOptions");
+   desc.add_options()
+      ("help", "Display help message")
+      ("capture,c", po::value<std::string>(), "Capture path prefix, as given to CaptureWriter, or compressed file")
+      ("speed", po::value<double>(), "Replay at this multiple of the recorded speed")
+      ("max", "Replay as fast as possible")
+      ("loop", "Start over at the end until ctrl-c")
+      ("first", po::value<int>(), "First frame number to replay")
+      ("last", po::value<int>(), "Last frame number to replay")
+      ("dest", po::value<std::string>(), "Send to this IPv4 address (e.g. 239.255.42.99) instead of an in-process FrameListener")
+      ("port", po::value<int>()->default_value(NatNet::dataPort), "Destination port")
+      ("local-addr,l", po::value<std::string>(), "Local interface for multicast")
+   ;
+
+   po::variables_map vm;
+   po::store(po::parse_command_line(argc,argv,desc), vm);
+   if( vm.count("help") || !vm.count("capture") )
+   {
+      std::cout << desc << std::endl;
+      return 1;
+   }
+
+   std::string path = vm["capture"].as<std::string>();
+   CaptureReader reader;
+   CompressedReader compressed;
+   unsigned char nnMajor, nnMinor;
+   Replayer* replayerPtr;
+   if( compressed.open(path) )
+   {
+      if( vm.count("dest") )
+      {
+         std::cerr << "ERROR: a compressed file can only be replayed in-process" << std::endl;
+         return 1;
+      }
+      printf("%lu frames in %lu blocks\n", static_cast<unsigned long>(compressed.numFrames()), static_cast<unsigned long>(compressed.numBlocks()));
+      nnMajor = compressed.nnMajor();
+      nnMinor = compressed.nnMinor();
+      replayerPtr = new Replayer(compressed);
+   }
+   else if( reader.open(path) )
+   {
+      printf("%lu packets in %lu segments\n", static_cast<unsigned long>(reader.numPackets()), static_cast<unsigned long>(reader.numSegments()));
+      // The listener unpacks with the version the capture was recorded with.
+      CapturePacket firstPacket;
+      CaptureCursor c = reader.begin();
+      reader.next(c, firstPacket);
+      nnMajor = firstPacket.nnMajor;
+      nnMinor = firstPacket.nnMinor;
+      replayerPtr = new Replayer(reader);
+   }
+   else
+   {
+      std::cerr << "ERROR: cannot open capture " << path << std::endl;
+      return 1;
+   }
+
+   Replayer& replayer = *replayerPtr;
+   if( vm.count("max") )
+      replayer.setTiming(Replayer::MAX_THROUGHPUT);
+   else if( vm.count("speed") )
+      replayer.setTiming(Replayer::SCALED, vm["speed"].as<double>());
+   replayer.setLoop(vm.count("loop") > 0);
+   replayer.setRange(
+      vm.count("first") ? vm["first"].as<int>() : INT_MIN,
+      vm.count("last") ? vm["last"].as<int>() : INT_MAX
+   );
+
+   int sd = -1;
+   FrameListener listener(-1, nnMajor, nnMinor, 1024);
+   if( vm.count("dest") )
+   {
+      struct sockaddr_in dest = NatNet::createAddress(
+         inet_addr(vm["dest"].as<std::string>().c_str()),
+         static_cast<uint16_t>(vm["port"].as<int>())
+      );
+      sd = socket(AF_INET, SOCK_DGRAM, 0);
+      unsigned char ttl = 1, loop = 1;
+      setsockopt(sd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+      setsockopt(sd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+      if( vm.count("local-addr") )
+      {
+         struct in_addr iface;
+         iface.s_addr = inet_addr(vm["local-addr"].as<std::string>().c_str());
+         setsockopt(sd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface));
+      }
+      replayer.setSocket(sd, dest);
+   }
+   else
+      replayer.setListener(&listener);
+
+   signal(SIGINT, terminate);
+   replayer.start();
+
+   double lastReport = NatNet::now();
+   uint64_t frames = 0;
+   bool valid;
+   bool more = true;
+   while( run && more )
+   {
+      more = replayer.running();
+      // Drain the listener like a consumer would.
+      if( sd < 0 )
+      {
+         do
+         {
+            listener.tryPop(&valid);
+            frames += valid;
+         } while( valid );
+      }
+      usleep(1000);
+
+      if( NatNet::now() - lastReport >= 1.0 )
+      {
+         lastReport = NatNet::now();
+         printf("%s\n", replayer.stats().summary().c_str());
+      }
+   }
+   replayer.stop();
+   replayer.join();
+
+   printf("\n%s\n", replayer.stats().summary().c_str());
+   if( sd >= 0 )
+      close(sd);
+   else
+   {
+      printf("frames popped: %lu\n", static_cast<unsigned long>(frames));
+      for( int i = 0; i < FrameListener::NUM_LATENCY_STAGES; ++i )
+      {
+         FrameListener::LatencyStage stage = static_cast<FrameListener::LatencyStage>(i);
+         HistogramSnapshot snapshot;
+         listener.latency(stage, snapshot);
+         printf("%s: %s\n", FrameListener::latencyStageName(stage), snapshot.summary().c_str());
+      }
+   }
+   delete replayerPtr;
+   return 0;
+}
@@ -0,0 +1,291 @@
+/*
+ * FrameCodecBench.cpp is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameCodec.h>
+#include <NatNetLinux/CaptureReader.h>
+
+// Benchmarks FrameEncoder and FrameDecoder: compression ratio, coding
+// speed and, in lossy mode, the largest error. Frames come from a capture
+// log if one is given, else from synthetic scenes of rigid bodies moving
+// smoothly with 0.1 mm of noise and occasional tracking loss.
+//
+// Usage: frame-codec-bench [frames] [rate] [capture]
+//
+// Configure with -DCMAKE_BUILD_TYPE=Release for meaningful timings.
+
+// Uniform in [a,b).
+static float uniform( float a, float b )
+{
+   return a + (b-a)*static_cast<float>(rand())/(static_cast<float>(RAND_MAX)+1.f);
+}
+
+// Bytes of a rigid body's markers, marker IDs and sizes at fixed width,
+// with their counts.
+static size_t markerBytes( RigidBody const& body )
+{
+   return 12 + 20*body.markers().size();
+}
+
+// Bytes of the stored values at fixed width: frame number, receive time,
+// timecode, subframe, latency and capture time, then per body its ID,
+// pose, marker error and a validity byte, then the other sections with
+// 4-byte counts.
+static size_t fixedBytes( MocapFrame const& frame )
+{
+   size_t i, j, n = 32 + 37*frame.rigidBodies().size();
+   for( i = 0; i < frame.markerSets().size(); ++i )
+      n += 8 + frame.markerSets()[i].name().size() + 12*frame.markerSets()[i].markers().size();
+   n += 4 + 12*frame.unIdMarkers().size();
+   for( i = 0; i < frame.rigidBodies().size(); ++i )
+      n += markerBytes(frame.rigidBodies()[i]);
+   for( i = 0; i < frame.skeletons().size(); ++i )
+   {
+      std::vector<RigidBody> const& bones = frame.skeletons()[i].rigidBodies();
+      n += 8;
+      for( j = 0; j < bones.size(); ++j )
+         n += 37 + markerBytes(bones[j]);
+   }
+   return n + 4 + 20*frame.labeledMarkers().size();
+}
+
+static void synthesize( std::vector<MocapFrame>& frames, std::vector<struct timespec>& times, size_t numBodies, int numFrames, double rate )
+{
+   std::vector<float> phase(numBodies), speed(numBodies);
+   std::vector<int> lostUntil(numBodies, -1);
+   for( size_t b = 0; b < numBodies; ++b )
+   {
+      phase[b] = uniform(0.f, 6.28f);
+      speed[b] = uniform(0.2f, 2.f);
+   }
+
+   double start = NatNet::now();
+   for( int f = 0; f < numFrames; ++f )
+   {
+      double t = f/rate;
+      MocapFrame frame(2, 6);
+      frame.setFrameNum(1000 + f);
+      frame.setTimecode(static_cast<uint32_t>(f/120), static_cast<uint32_t>(f%120));
+      frame.setLatency(static_cast<float>(t));
+      frame.setCaptureTime(start + t);
+      for( size_t b = 0; b < numBodies; ++b )
+      {
+         float a = static_cast<float>(speed[b]*t) + phase[b];
+         RigidBody body;
+         body.setId(static_cast<int>(b + 1));
+         body.setLocation(Point3f(
+            2.f*cosf(a) + uniform(-1e-4f, 1e-4f),
+            1.f + 0.5f*sinf(2.f*a) + uniform(-1e-4f, 1e-4f),
+            2.f*sinf(a) + uniform(-1e-4f, 1e-4f)
+         ));
+         float half = 0.5f*a;
+         body.setOrientation(Quaternion4f(0.f, sinf(half), 0.f, cosf(half)));
+         body.setMeanMarkerError(uniform(1e-4f, 3e-4f));
+         if( lostUntil[b] < f && uniform(0.f, 1.f) < 0.001f )
+            lostUntil[b] = f + 30;
+         body.setTrackingValid(f > lostUntil[b]);
+         frame.rigidBodies().push_back(body);
+      }
+      frames.push_back(frame);
+
+      // Up to 20 us of receive jitter.
+      int64_t ns = static_cast<int64_t>((start + t)*1e9) + rand()%20000;
+      struct timespec ts;
+      ts.tv_sec = static_cast<time_t>(ns/1000000000);
+      ts.tv_nsec = static_cast<long>(ns%1000000000);
+      times.push_back(ts);
+   }
+}
+
+// Unpacks every frame of data in a capture. Returns the datagram bytes.
+static size_t load( CaptureReader const& reader, std::vector<MocapFrame>& frames, std::vector<struct timespec>& times )
+{
+   NatNetPacket scratch;
+   CapturePacket p;
+   CaptureCursor c = reader.begin();
+   size_t bytes = 0;
+   while( reader.next(c, p) )
+   {
+      if( !p.isFrame() || p.length > scratch.maxLength() )
+         continue;
+      memcpy(scratch.rawPtr(), p.data, p.length);
+      MocapFrame frame(p.nnMajor, p.nnMinor);
+      if( !frame.unpack(scratch.rawPayloadPtr(), scratch.rawPtr() + p.length) )
+         continue;
+      frames.push_back(frame);
+      times.push_back(p.ts);
+      bytes += p.length;
+   }
+   return bytes;
+}
+
+static void bench( char const* label, FrameCodec const& codec, std::vector<MocapFrame> const& frames, std::vector<struct timespec> const& times, double rate, size_t datagramBytes )
+{
+   size_t n = frames.size();
+   size_t fixed = 0;
+   for( size_t i = 0; i < n; ++i )
+      fixed += fixedBytes(frames[i]);
+
+   // Blocks of 256 frames, as CompressedWriter writes by default.
+   std::vector<char> out;
+   out.reserve(fixed + 1024);
+   std::vector<size_t> blockEnds;
+   FrameEncoder encoder(codec);
+   double t0 = NatNet::now();
+   for( size_t i = 0; i < n; ++i )
+   {
+      if( i % 256 == 0 )
+      {
+         encoder.reset();
+         if( i > 0 )
+            blockEnds.push_back(out.size());
+      }
+      encoder.encode(frames[i], times[i], out);
+   }
+   blockEnds.push_back(out.size());
+   double encodeSeconds = NatNet::now() - t0;
+
+   FrameDecoder decoder(codec, frames[0].nnMajor(), frames[0].nnMinor());
+   MocapFrame frame;
+   struct timespec ts;
+   double maxPos = 0.0, maxQuat = 0.0;
+   size_t mismatches = 0;
+   char const* p = &out[0];
+   t0 = NatNet::now();
+   for( size_t i = 0; i < n; ++i )
+   {
+      if( i % 256 == 0 )
+         decoder.reset();
+      p = decoder.decode(p, &out[0] + blockEnds[i/256], frame, ts);
+      if( !p )
+      {
+         printf("decode failed at frame %lu\n", static_cast<unsigned long>(i));
+         return;
+      }
+      // The checks are cheap next to decoding, and are timed with it.
+      std::vector<RigidBody> const& a = frames[i].rigidBodies();
+      std::vector<RigidBody> const& b = frame.rigidBodies();
+      if( a.size() != b.size() || frame.frameNum() != frames[i].frameNum() || ts.tv_nsec != times[i].tv_nsec )
+      {
+         ++mismatches;
+         continue;
+      }
+      for( size_t k = 0; k < a.size(); ++k )
+      {
+         Point3f pa = a[k].location(), pb = b[k].location();
+         Quaternion4f qa = a[k].orientation(), qb = b[k].orientation();
+         maxPos = std::max(maxPos, static_cast<double>(std::max(fabsf(pa.x - pb.x), std::max(fabsf(pa.y - pb.y), fabsf(pa.z - pb.z)))));
+         // Compare up to sign.
+         float s = (qa.qx*qb.qx + qa.qy*qb.qy + qa.qz*qb.qz + qa.qw*qb.qw) < 0.f ? -1.f : 1.f;
+         maxQuat = std::max(maxQuat, static_cast<double>(std::max(
+            std::max(fabsf(qa.qx - s*qb.qx), fabsf(qa.qy - s*qb.qy)),
+            std::max(fabsf(qa.qz - s*qb.qz), fabsf(qa.qw - s*qb.qw))
+         )));
+         if( a[k].id() != b[k].id() || a[k].trackingValid() != b[k].trackingValid() )
+            ++mismatches;
+      }
+   }
+   double decodeSeconds = NatNet::now() - t0;
+
+   double recorded = n/rate;
+   char vsRaw[32] = "-";
+   if( datagramBytes )
+      snprintf(vsRaw, sizeof(vsRaw), "%.2fx", static_cast<double>(datagramBytes)/out.size());
+   printf(
+      "%-9s %9.1f %7.2fx %8s %10.0f %7.0fx %10.0f %7.0fx %9.2g %9.2g %6lu\n",
+      label,
+      static_cast<double>(out.size())/n,
+      static_cast<double>(fixed)/out.size(),
+      vsRaw,
+      n/encodeSeconds,
+      recorded/encodeSeconds,
+      n/decodeSeconds,
+      recorded/decodeSeconds,
+      maxPos,
+      maxQuat,
+      static_cast<unsigned long>(mismatches)
+   );
+}
+
+static void header()
+{
+   printf(
+      "%-9s %9s %8s %8s %10s %8s %10s %8s %9s %9s %6s\n",
+      "mode", "bytes/fr", "vs fixed", "vs raw", "enc fr/s", "enc rt", "dec fr/s", "dec rt", "max pos", "max quat", "errors"
+   );
+}
+
+int main( int argc, char* argv[] )
+{
+   int numFrames = argc > 1 ? atoi(argv[1]) : 24000;
+   double rate = argc > 2 ? atof(argv[2]) : 240.0;
+   FrameCodec lossless;
+   FrameCodec lossy(FrameCodec::LOSSY, 1e-5f, 16);
+
+#ifndef __OPTIMIZE__
+   printf("warning: unoptimized build, timings are not representative\n");
+#endif
+   printf("lossy: %.3g m position resolution (max error %.2g), %d bit quaternions (max error %.2g)\n",
+      lossy.positionResolution, lossy.maxPositionError(), lossy.quaternionBits, lossy.maxQuaternionError());
+   printf("'vs fixed' compares with the stored values at fixed width, 'vs raw' with the datagrams,\n");
+   printf("'rt' is the multiple of real time at %.0f Hz on one core\n\n", rate);
+
+   if( argc > 3 )
+   {
+      CaptureReader reader;
+      std::vector<MocapFrame> frames;
+      std::vector<struct timespec> times;
+      if( !reader.open(argv[3]) )
+      {
+         printf("cannot open capture %s\n", argv[3]);
+         return 1;
+      }
+      size_t bytes = load(reader, frames, times);
+      if( frames.empty() )
+      {
+         printf("no frames of data in %s\n", argv[3]);
+         return 1;
+      }
+      printf("%lu frames from %s\n", static_cast<unsigned long>(frames.size()), argv[3]);
+      header();
+      bench("lossless", lossless, frames, times, rate, bytes);
+      bench("lossy", lossy, frames, times, rate, bytes);
+      return 0;
+   }
+
+   size_t counts[] = {1, 10, 50, 200};
+   for( size_t c = 0; c < sizeof(counts)/sizeof(counts[0]); ++c )
+   {
+      std::vector<MocapFrame> frames;
+      std::vector<struct timespec> times;
+      srand(12345);
+      synthesize(frames, times, counts[c], numFrames, rate);
+      printf("%lu bodies, %d frames at %.0f Hz\n", static_cast<unsigned long>(counts[c]), numFrames, rate);
+      header();
+      bench("lossless", lossless, frames, times, rate, 0);
+      bench("lossy", lossy, frames, times, rate, 0);
+      printf("\n");
+   }
+   return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * FrameExport.cpp is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/CaptureReader.h>
+#include <NatNetLinux/CompressedReader.h>
+#include <NatNetLinux/FrameExporter.h>
+
+#include <boost/program_options.hpp>
+
+// Exports a capture log written by CaptureWriter, or a file written by
+// CompressedWriter, as CSV or JSON lines. See FrameExporter for the
+// layout. Prints the number of frames and the time taken to stderr.
+
+// Combine the flags named in a comma-separated list. Returns false on an unknown name.
+static bool parseFlags( std::string const& list, char const* const* names, unsigned int const* flags, unsigned int& out )
+{
+   out = 0;
+   size_t start = 0;
+   while( start <= list.size() )
+   {
+      size_t end = list.find(',', start);
+      if( end == std::string::npos )
+         end = list.size();
+      std::string name = list.substr(start, end - start);
+      int i;
+      for( i = 0; names[i]; ++i )
+         if( name == names[i] )
+            break;
+      if( !names[i] )
+      {
+         std::cerr << "ERROR: unknown name '" << name << "'" << std::endl;
+         return false;
+      }
+      out |= flags[i];
+      start = end + 1;
+   }
+   return true;
+}
+
+int main( int argc, char* argv[] )
+{
+   namespace po = boost::program_options;
+
+   static char const* const sectionNames[] = {
+      "marker-sets", "unidentified-markers", "rigid-bodies", "skeletons", "labeled-markers", "all", 0
+   };
+   static unsigned int const sectionFlags[] = {
+      FrameExporter::MARKER_SETS, FrameExporter::UNIDENTIFIED_MARKERS, FrameExporter::RIGID_BODIES,
+      FrameExporter::SKELETONS, FrameExporter::LABELED_MARKERS, FrameExporter::ALL_SECTIONS
+   };
+   static char const* const columnNames[] = {
+      "frame", "time", "latency", "timecode", "capture-time", "id", "name",
+      "position", "orientation", "error", "valid", "size", "all", 0
+   };
+   static unsigned int const columnFlags[] = {
+      FrameExporter::FRAME_NUM, FrameExporter::TIME, FrameExporter::LATENCY, FrameExporter::TIMECODE,
+      FrameExporter::CAPTURE_TIME, FrameExporter::ID, FrameExporter::NAME, FrameExporter::POSITION,
+      FrameExporter::ORIENTATION, FrameExporter::MARKER_ERROR, FrameExporter::VALID, FrameExporter::SIZE,
+      FrameExporter::ALL_COLUMNS
+   };
+
+   po::options_description desc("frame-export: exports a recording as CSV or JSON lines\nOptions");
+   desc.add_options()
+      ("help", "Display help message")
+      ("capture,c", po::value<std::string>(), "Capture path prefix, as given to CaptureWriter, or compressed file")
+      ("output,o", po::value<std::string>(), "Output file instead of stdout")
+      ("json", "Write JSON lines instead of CSV")
+      ("shortest", "Write floats with the fewest digits that read back exactly")
+      ("decimals", po::value<int>()->default_value(6), "Digits after the point otherwise")
+      ("sections", po::value<std::string>(), "Comma-separated: marker-sets, unidentified-markers, rigid-bodies, skeletons, labeled-markers, all (default)")
+      ("columns", po::value<std::string>(), "Comma-separated: frame, time, latency, timecode, capture-time, id, name, position, orientation, error, valid, size, all (default)")
+   ;
+
+   po::variables_map vm;
+   po::store(po::parse_command_line(argc,argv,desc), vm);
+   if( vm.count("help") || !vm.count("capture") )
+   {
+      std::cout << desc << std::endl;
+      return 1;
+   }
+
+   unsigned int sections = FrameExporter::ALL_SECTIONS;
+   unsigned int columns = FrameExporter::ALL_COLUMNS;
+   if( vm.count("sections") && !parseFlags(vm["sections"].as<std::string>(), sectionNames, sectionFlags, sections) )
+      return 1;
+   if( vm.count("columns") && !parseFlags(vm["columns"].as<std::string>(), columnNames, columnFlags, columns) )
+      return 1;
+
+   std::string path = vm["capture"].as<std::string>();
+   CaptureReader reader;
+   CompressedReader compressed;
+   bool isCompressed = compressed.open(path);
+   if( !isCompressed && !reader.open(path) )
+   {
+      std::cerr << "ERROR: cannot open capture " << path << std::endl;
+      return 1;
+   }
+
+   int fd = STDOUT_FILENO;
+   if( vm.count("output") )
+   {
+      fd = open(vm["output"].as<std::string>().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if( fd < 0 )
+      {
+         std::cerr << "ERROR: cannot create " << vm["output"].as<std::string>() << std::endl;
+         return 1;
+      }
+   }
+
+   FrameExporter exporter(fd, vm.count("json") ? FrameExporter::JSON_LINES : FrameExporter::CSV);
+   exporter.setFloatFormat(
+      vm.count("shortest") ? FrameExporter::SHORTEST : FrameExporter::FIXED,
+      vm["decimals"].as<int>()
+   );
+   exporter.setSections(sections);
+   exporter.setColumns(columns);
+   // Reading a file is faster than writing text: wait rather than drop.
+   exporter.setBlocking(true);
+   exporter.start();
+
+   double t0 = NatNet::now();
+   MocapFrame frame;
+   struct timespec ts;
+   unsigned long malformed = 0;
+   if( isCompressed )
+   {
+      CompressedCursor c = compressed.begin();
+      while( compressed.next(c, frame, ts) )
+         exporter.handleFrame(frame, ts);
+   }
+   else
+   {
+      NatNetPacket scratch;
+      CapturePacket p;
+      CaptureCursor c = reader.begin();
+      while( reader.next(c, p) )
+      {
+         if( !p.isFrame() || p.length > scratch.maxLength() )
+            continue;
+         memcpy(scratch.rawPtr(), p.data, p.length);
+         // Skip truncated datagrams, as FrameListener does.
+         if( p.length < 4 || p.length < 4u + scratch.nDataBytes() )
+         {
+            ++malformed;
+            continue;
+         }
+         MocapFrame unpacked(p.nnMajor, p.nnMinor);
+         if( !unpacked.unpack(scratch.rawPayloadPtr(), scratch.rawPtr() + p.length) )
+         {
+            ++malformed;
+            continue;
+         }
+         exporter.handleFrame(unpacked, p.ts);
+      }
+   }
+   exporter.stop();
+   exporter.join();
+   double seconds = NatNet::now() - t0;
+
+   ExportStats stats = exporter.stats();
+   if( malformed )
+      fprintf(stderr, "Skipped %lu malformed frames\n", malformed);
+   fprintf(stderr, "%lu frames, %lu bytes in %.3f s (%.0f frames/s)%s\n",
+      static_cast<unsigned long>(stats.frames),
+      static_cast<unsigned long>(stats.bytes),
+      seconds,
+      stats.frames/seconds,
+      stats.writeErrors ? ", WRITE ERRORS" : ""
+   );
+   if( fd != STDOUT_FILENO )
+      close(fd);
+   return stats.writeErrors ? 1 : 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * FrameExportBench.cpp is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameExporter.h>
+
+// Benchmarks FrameExporter against operator<< for MocapFrame. Every frame
+// has the given number of rigid bodies, and in the second scene also a
+// marker set, unidentified and labeled markers and skeletons. The
+// text goes to /dev/null through write(), so the cost of the system calls
+// is included. Reports microseconds per frame and the fraction of a core
+// needed at the frame rate.
+//
+// Usage: frame-export-bench [frames] [bodies] [rate]
+//
+// Configure with -DCMAKE_BUILD_TYPE=Release for meaningful timings.
+
+// Uniform in [a,b).
+static float uniform( float a, float b )
+{
+   return a + (b-a)*static_cast<float>(rand())/(static_cast<float>(RAND_MAX)+1.f);
+}
+
+static Point3f randomPoint()
+{
+   return Point3f(uniform(-3.f, 3.f), uniform(0.f, 2.f), uniform(-3.f, 3.f));
+}
+
+static RigidBody randomBody( int id )
+{
+   RigidBody body;
+   body.setId(id);
+   body.setLocation(randomPoint());
+   float h = uniform(0.f, 3.14f);
+   body.setOrientation(Quaternion4f(0.f, sinf(h), 0.f, cosf(h)));
+   body.setMeanMarkerError(uniform(1e-4f, 3e-4f));
+   body.setTrackingValid(uniform(0.f, 1.f) > 0.01f);
+   return body;
+}
+
+static void synthesize( std::vector<MocapFrame>& frames, int numFrames, int numBodies, bool full )
+{
+   srand(12345);
+   for( int f = 0; f < numFrames; ++f )
+   {
+      MocapFrame frame(2, 9);
+      frame.setFrameNum(1000 + f);
+      frame.setTimecode(static_cast<uint32_t>(f/120), static_cast<uint32_t>(f%120));
+      frame.setLatency(uniform(0.003f, 0.005f));
+      frame.setCaptureTime(1.7e9 + f/240.0);
+      for( int b = 0; b < numBodies; ++b )
+         frame.rigidBodies().push_back(randomBody(b + 1));
+      if( full )
+      {
+         MarkerSet set;
+         set.setName("Wand, \"left\"");
+         for( int m = 0; m < 20; ++m )
+            set.markers().push_back(randomPoint());
+         frame.markerSets().push_back(set);
+         for( int m = 0; m < 20; ++m )
+            frame.unIdMarkers().push_back(randomPoint());
+         for( int m = 0; m < 20; ++m )
+         {
+            LabeledMarker marker;
+            marker.setId(m + 1);
+            marker.setLocation(randomPoint());
+            marker.setSize(0.014f);
+            frame.labeledMarkers().push_back(marker);
+         }
+         for( int s = 0; s < 2; ++s )
+         {
+            Skeleton skeleton;
+            skeleton.setId(s + 1);
+            for( int b = 0; b < 21; ++b )
+               skeleton.rigidBodies().push_back(randomBody(b + 1));
+            frame.skeletons().push_back(skeleton);
+         }
+      }
+      frames.push_back(frame);
+   }
+}
+
+static struct timespec timeOf( int f )
+{
+   int64_t ns = 1700000000000000000LL + f*4166667LL;
+   struct timespec ts;
+   ts.tv_sec = static_cast<time_t>(ns/1000000000);
+   ts.tv_nsec = static_cast<long>(ns%1000000000);
+   return ts;
+}
+
+static void report( char const* label, double seconds, size_t bytes, size_t n, double rate )
+{
+   double perFrame = seconds/n;
+   char perFrameBytes[32] = "-";
+   if( bytes )
+      snprintf(perFrameBytes, sizeof(perFrameBytes), "%.0f", static_cast<double>(bytes)/n);
+   printf("%-22s %10.1f %10s %9.1f%%\n", label, 1e6*perFrame, perFrameBytes, 100.0*perFrame*rate);
+}
+
+static void benchStream( std::vector<MocapFrame> const& frames, double rate )
+{
+   std::ofstream out("/dev/null");
+   double t0 = NatNet::now();
+   for( size_t i = 0; i < frames.size(); ++i )
+      out << frames[i];
+   out.flush();
+   report("operator<<", NatNet::now() - t0, 0, frames.size(), rate);
+}
+
+static void benchExporter( char const* label, FrameExporter::Format format, FrameExporter::FloatFormat floats, std::vector<MocapFrame> const& frames, double rate )
+{
+   int fd = open("/dev/null", O_WRONLY);
+   FrameExporter exporter(fd, format);
+   exporter.setFloatFormat(floats);
+   TextBuffer buf(1 << 21);
+   size_t bytes = 0;
+
+   // As FrameExporter does, less the background thread.
+   double t0 = NatNet::now();
+   exporter.header(buf);
+   for( size_t i = 0; i < frames.size(); ++i )
+   {
+      exporter.format(frames[i], timeOf(static_cast<int>(i)), buf);
+      if( buf.size() >= (1 << 20) )
+      {
+         bytes += buf.size();
+         if( write(fd, buf.data(), buf.size()) < 0 )
+            perror("write");
+         buf.clear();
+      }
+   }
+   bytes += buf.size();
+   if( write(fd, buf.data(), buf.size()) < 0 )
+      perror("write");
+   report(label, NatNet::now() - t0, bytes, frames.size(), rate);
+   close(fd);
+}
+
+int main( int argc, char* argv[] )
+{
+   int numFrames = argc > 1 ? atoi(argv[1]) : 2400;
+   int numBodies = argc > 2 ? atoi(argv[2]) : 200;
+   double rate = argc > 3 ? atof(argv[3]) : 240.0;
+
+#ifndef __OPTIMIZE__
+   printf("warning: unoptimized build, timings are not representative\n");
+#endif
+   for( int full = 0; full < 2; ++full )
+   {
+      std::vector<MocapFrame> frames;
+      synthesize(frames, numFrames, numBodies, full != 0);
+      printf("%d frames of %d rigid bodies%s\n", numFrames, numBodies,
+         full ? ", 60 markers and 2 skeletons of 21 bodies" : "");
+      printf("%-22s %10s %10s %10s\n", "", "us/frame", "bytes/fr", "core");
+      benchStream(frames, rate);
+      benchExporter("CSV fixed", FrameExporter::CSV, FrameExporter::FIXED, frames, rate);
+      benchExporter("CSV shortest", FrameExporter::CSV, FrameExporter::SHORTEST, frames, rate);
+      benchExporter("JSON lines fixed", FrameExporter::JSON_LINES, FrameExporter::FIXED, frames, rate);
+      benchExporter("JSON lines shortest", FrameExporter::JSON_LINES, FrameExporter::SHORTEST, frames, rate);
+      printf("'core' is the fraction of one core needed at %.0f Hz; operator<< leaves out most fields\n\n", rate);
+   }
+   return 0;
+}
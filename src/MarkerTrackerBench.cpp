@@ -0,0 +1,125 @@
+/*
+ * MarkerTrackerBench.cpp is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <map>
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/MarkerTracker.h>
+
+// Benchmarks MarkerTracker on synthetic scenes of randomly moving markers,
+// for a range of marker counts, and checks how well it keeps identities.
+//
+// Usage: marker-tracker-bench [frames] [rate]
+//
+// Configure with -DCMAKE_BUILD_TYPE=Release for meaningful timings.
+
+// Uniform in [a,b).
+static float uniform( float a, float b )
+{
+   return a + (b-a)*static_cast<float>(rand())/(static_cast<float>(RAND_MAX)+1.f);
+}
+
+int main( int argc, char* argv[] )
+{
+   int numFrames = argc > 1 ? atoi(argv[1]) : 480;
+   double rate = argc > 2 ? atof(argv[2]) : 240.0;
+   double dt = 1.0/rate;
+   size_t counts[] = {100, 500, 1000, 2000, 5000, 10000};
+   size_t numCounts = sizeof(counts)/sizeof(counts[0]);
+
+#ifndef __OPTIMIZE__
+   printf("warning: unoptimized build, timings are not representative\n");
+#endif
+   printf("%d frames at %.0f Hz, markers in a 4 m cube moving up to 2 m/s, 0.5 mm noise, 1%% dropout\n", numFrames, rate);
+   printf("%8s %12s %12s %10s %10s\n", "markers", "us/frame", "budget used", "tracked", "switches");
+
+   for( size_t c = 0; c < numCounts; ++c )
+   {
+      size_t n = counts[c];
+      srand(12345);
+
+      std::vector<Point3f> pos(n), vel(n);
+      for( size_t i = 0; i < n; ++i )
+      {
+         pos[i] = Point3f(uniform(-2.f,2.f), uniform(0.f,4.f), uniform(-2.f,2.f));
+         vel[i] = Point3f(uniform(-2.f,2.f)/sqrtf(3.f), uniform(-2.f,2.f)/sqrtf(3.f), uniform(-2.f,2.f)/sqrtf(3.f));
+      }
+
+      MarkerTracker tracker(0.02f, 3, 5);
+      std::vector<Point3f> markers;
+      std::vector<size_t> truth;
+      std::vector<int> ids;
+      // Track id -> true marker, to count identity switches.
+      std::map<int,size_t> owner;
+      size_t tracked = 0, visible = 0, switches = 0;
+      double elapsed = 0.0;
+
+      for( int f = 0; f < numFrames; ++f )
+      {
+         markers.clear();
+         truth.clear();
+         for( size_t i = 0; i < n; ++i )
+         {
+            pos[i].x += vel[i].x*dt;
+            pos[i].y += vel[i].y*dt;
+            pos[i].z += vel[i].z*dt;
+            if( uniform(0.f,1.f) < 0.01f )
+               continue;
+            markers.push_back(Point3f(pos[i].x + uniform(-5e-4f,5e-4f), pos[i].y + uniform(-5e-4f,5e-4f), pos[i].z + uniform(-5e-4f,5e-4f)));
+            truth.push_back(i);
+         }
+
+         double t0 = NatNet::now();
+         tracker.update(markers, f*dt);
+         elapsed += NatNet::now() - t0;
+
+         tracker.assignment(ids);
+         for( size_t k = 0; k < ids.size(); ++k )
+         {
+            ++visible;
+            if( ids[k] < 0 )
+               continue;
+            ++tracked;
+            std::map<int,size_t>::iterator it = owner.find(ids[k]);
+            if( it == owner.end() )
+               owner[ids[k]] = truth[k];
+            else if( it->second != truth[k] )
+            {
+               ++switches;
+               it->second = truth[k];
+            }
+         }
+      }
+
+      double usPerFrame = 1e6*elapsed/numFrames;
+      printf(
+         "%8lu %12.1f %11.1f%% %9.2f%% %10lu\n",
+         static_cast<unsigned long>(n),
+         usPerFrame,
+         100.0*usPerFrame*1e-6/dt,
+         100.0*tracked/(visible ? visible : 1),
+         static_cast<unsigned long>(switches)
+      );
+   }
+
+   return 0;
+}
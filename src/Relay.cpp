@@ -0,0 +1,298 @@
+/*
+ * Relay.cpp is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/CommandListener.h>
+#include <NatNetLinux/FrameListener.h>
+#include <NatNetLinux/FrameRelay.h>
+
+#include <boost/program_options.hpp>
+
+// Listens to a NatNet stream and republishes only the selected rigid
+// bodies, skeletons, marker sets or sections, re-encoded as smaller
+// NatNet frames, to another multicast group or port or to unicast clients.
+// Bodies and skeletons are selected by ID or by name; names are looked up
+// in the model definition the server sends. Prints the relay's throughput,
+// size ratio and added latency every second.
+
+bool run = true;
+
+// End the program gracefully.
+void terminate(int)
+{
+   run = false;
+}
+
+// Parse "major.minor". Returns false if malformed.
+static bool parseVersion( std::string const& s, unsigned char& major, unsigned char& minor )
+{
+   int a, b;
+   char extra;
+   if( sscanf(s.c_str(), "%d.%d%c", &a, &b, &extra) != 2 || a < 0 || a > 255 || b < 0 || b > 255 )
+      return false;
+   major = static_cast<unsigned char>(a);
+   minor = static_cast<unsigned char>(b);
+   return true;
+}
+
+// True if s is a whole decimal integer, put in id.
+static bool parseId( std::string const& s, int& id )
+{
+   char* end;
+   long v = strtol(s.c_str(), &end, 10);
+   if( s.empty() || *end != '\0' )
+      return false;
+   id = static_cast<int>(v);
+   return true;
+}
+
+// Combine the flags named in a comma-separated list. Returns false on an unknown name.
+static bool parseSections( std::string const& list, unsigned int& out )
+{
+   static char const* const names[] = {
+      "marker-sets", "unidentified-markers", "rigid-bodies", "skeletons", "labeled-markers", "all", 0
+   };
+   static unsigned int const flags[] = {
+      FrameRelay::MARKER_SETS, FrameRelay::UNIDENTIFIED_MARKERS, FrameRelay::RIGID_BODIES,
+      FrameRelay::SKELETONS, FrameRelay::LABELED_MARKERS, FrameRelay::ALL_SECTIONS
+   };
+   out = 0;
+   size_t start = 0;
+   while( start <= list.size() )
+   {
+      size_t end = list.find(',', start);
+      if( end == std::string::npos )
+         end = list.size();
+      std::string name = list.substr(start, end - start);
+      int i;
+      for( i = 0; names[i]; ++i )
+         if( name == names[i] )
+            break;
+      if( !names[i] )
+      {
+         std::cerr << "ERROR: unknown section '" << name << "'" << std::endl;
+         return false;
+      }
+      out |= flags[i];
+      start = end + 1;
+   }
+   return true;
+}
+
+int main( int argc, char* argv[] )
+{
+   namespace po = boost::program_options;
+   typedef std::vector<std::string> Strings;
+
+   po::options_description desc("natnet-relay: republishes part of a NatNet stream\nOptions");
+   desc.add_options()
+      ("help", "Display help message")
+      ("local-addr,l", po::value<std::string>(), "Local IPv4 address")
+      ("server-addr,s", po::value<std::string>(), "Server IPv4 address, to learn the NatNet version and names")
+      ("natnet-version", po::value<std::string>(), "NatNet version of the stream, major.minor, instead of asking the server")
+      ("multicast-addr", po::value<std::string>()->default_value("239.255.42.99"), "Multicast group to listen to")
+      ("data-port", po::value<int>()->default_value(NatNet::dataPort), "Data port to listen on")
+      ("body,b", po::value<Strings>(), "Rigid body ID or name to relay, may be repeated")
+      ("skeleton", po::value<Strings>(), "Skeleton ID or name to relay, may be repeated")
+      ("marker-set", po::value<Strings>(), "Marker set name to relay, may be repeated")
+      ("sections", po::value<std::string>(), "Comma-separated: marker-sets, unidentified-markers, rigid-bodies, skeletons, labeled-markers, all. Defaults to those selected from, or all")
+      ("out-group", po::value<std::string>(), "Multicast group to republish to")
+      ("dest", po::value<Strings>(), "Unicast IPv4 address to republish to, may be repeated")
+      ("out-port", po::value<int>()->default_value(NatNet::dataPort), "Port to republish to")
+      ("out-version", po::value<std::string>(), "NatNet version to republish as, major.minor")
+      ("ttl", po::value<int>()->default_value(1), "Multicast TTL of republished frames")
+   ;
+
+   po::variables_map vm;
+   po::store(po::parse_command_line(argc,argv,desc), vm);
+   if( vm.count("help") || !vm.count("local-addr") || (!vm.count("out-group") && !vm.count("dest")) ||
+       (!vm.count("server-addr") && !vm.count("natnet-version")) )
+   {
+      std::cout << desc << std::endl;
+      return 1;
+   }
+
+   uint32_t localAddress = inet_addr(vm["local-addr"].as<std::string>().c_str());
+   uint32_t groupAddress = inet_addr(vm["multicast-addr"].as<std::string>().c_str());
+   uint16_t dataPort = static_cast<uint16_t>(vm["data-port"].as<int>());
+   uint16_t outPort = static_cast<uint16_t>(vm["out-port"].as<int>());
+   if( vm.count("out-group") && inet_addr(vm["out-group"].as<std::string>().c_str()) == groupAddress && outPort == dataPort )
+   {
+      std::cerr << "ERROR: republishing to the group and port listened to would loop" << std::endl;
+      return 1;
+   }
+
+   // Selection.
+   int sdOut = socket(AF_INET, SOCK_DGRAM, 0);
+   FrameRelay relay(sdOut);
+   unsigned int selected = 0;
+   int id;
+   size_t i;
+   if( vm.count("body") )
+   {
+      Strings const& bodies = vm["body"].as<Strings>();
+      for( i = 0; i < bodies.size(); ++i )
+      {
+         if( parseId(bodies[i], id) )
+            relay.selectRigidBody(id);
+         else
+            relay.selectRigidBody(bodies[i]);
+      }
+      selected |= FrameRelay::RIGID_BODIES | FrameRelay::MARKER_SETS;
+   }
+   if( vm.count("skeleton") )
+   {
+      Strings const& skeletons = vm["skeleton"].as<Strings>();
+      for( i = 0; i < skeletons.size(); ++i )
+      {
+         if( parseId(skeletons[i], id) )
+            relay.selectSkeleton(id);
+         else
+            relay.selectSkeleton(skeletons[i]);
+      }
+      selected |= FrameRelay::SKELETONS | FrameRelay::MARKER_SETS;
+   }
+   if( vm.count("marker-set") )
+   {
+      Strings const& sets = vm["marker-set"].as<Strings>();
+      for( i = 0; i < sets.size(); ++i )
+         relay.selectMarkerSet(sets[i]);
+      selected |= FrameRelay::MARKER_SETS;
+   }
+   unsigned int sections = selected ? selected : static_cast<unsigned int>(FrameRelay::ALL_SECTIONS);
+   if( vm.count("sections") && !parseSections(vm["sections"].as<std::string>(), sections) )
+      return 1;
+   relay.setSections(sections);
+
+   unsigned char outMajor, outMinor;
+   if( vm.count("out-version") )
+   {
+      if( !parseVersion(vm["out-version"].as<std::string>(), outMajor, outMinor) )
+      {
+         std::cerr << "ERROR: --out-version must be major.minor" << std::endl;
+         return 1;
+      }
+      relay.setOutputVersion(outMajor, outMinor);
+   }
+
+   // Destinations.
+   if( vm.count("dest") )
+   {
+      Strings const& dests = vm["dest"].as<Strings>();
+      for( i = 0; i < dests.size(); ++i )
+         relay.addDestination(NatNet::createAddress(inet_addr(dests[i].c_str()), outPort));
+   }
+   if( vm.count("out-group") )
+   {
+      unsigned char ttl = static_cast<unsigned char>(vm["ttl"].as<int>());
+      struct in_addr iface;
+      iface.s_addr = localAddress;
+      setsockopt(sdOut, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+      setsockopt(sdOut, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface));
+      relay.addDestination(NatNet::createAddress(inet_addr(vm["out-group"].as<std::string>().c_str()), outPort));
+   }
+
+   signal(SIGINT, terminate);
+
+   // Learn the version and names from the server, as simple-example does.
+   unsigned char nnMajor = 0, nnMinor = 0;
+   int sdCommand = -1;
+   CommandListener* commandListener = 0;
+   if( vm.count("server-addr") )
+   {
+      struct sockaddr_in serverCommands = NatNet::createAddress(
+         inet_addr(vm["server-addr"].as<std::string>().c_str()), NatNet::commandPort);
+      sdCommand = NatNet::createCommandSocket(localAddress, 0);
+      commandListener = new CommandListener(sdCommand);
+      commandListener->start();
+
+      NatNetPacket ping = NatNetPacket::pingPacket();
+      ping.send(sdCommand, serverCommands);
+      commandListener->getNatNetVersion(nnMajor, nnMinor);
+
+      NatNetPacket request;
+      request.setHeader(NatNetPacket::NAT_REQUEST_MODELDEF, 0);
+      request.send(sdCommand, serverCommands);
+      DataDescriptions descriptions;
+      double t0 = NatNet::now();
+      while( !commandListener->dataDescriptions(descriptions) && NatNet::now() - t0 < 2.0 )
+         usleep(10000);
+      relay.setDescriptions(descriptions);
+      printf("%lu rigid bodies, %lu skeletons, %lu marker sets described\n",
+         static_cast<unsigned long>(descriptions.rigidBodies.size()),
+         static_cast<unsigned long>(descriptions.skeletons.size()),
+         static_cast<unsigned long>(descriptions.markerSets.size()));
+   }
+   if( vm.count("natnet-version") && !parseVersion(vm["natnet-version"].as<std::string>(), nnMajor, nnMinor) )
+   {
+      std::cerr << "ERROR: --natnet-version must be major.minor" << std::endl;
+      return 1;
+   }
+   Strings unresolved = relay.unresolved();
+   for( i = 0; i < unresolved.size(); ++i )
+      std::cerr << "WARNING: no rigid body or skeleton named '" << unresolved[i] << "'" << std::endl;
+
+   int sdData = NatNet::createDataSocket(localAddress, dataPort, groupAddress);
+   FrameListener frameListener(sdData, nnMajor, nnMinor);
+   frameListener.addHandler(&relay);
+   frameListener.addPacketHandler(&relay);
+   frameListener.start();
+   printf("relaying NatNet %d.%d\n", nnMajor, nnMinor);
+
+   // Nothing to pop but the buffer; the relay works in the listener's thread.
+   bool valid;
+   double lastReport = NatNet::now();
+   while( run )
+   {
+      do
+         frameListener.tryPop(&valid);
+      while( valid );
+      usleep(10000);
+
+      if( NatNet::now() - lastReport >= 1.0 )
+      {
+         lastReport = NatNet::now();
+         printf("%s\n", relay.stats(true).summary().c_str());
+      }
+   }
+
+   frameListener.stop();
+   frameListener.join();
+   if( commandListener )
+   {
+      commandListener->stop();
+      commandListener->join();
+      delete commandListener;
+      close(sdCommand);
+   }
+   close(sdData);
+   close(sdOut);
+   return 0;
+}
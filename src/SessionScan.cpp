@@ -0,0 +1,170 @@
+/*
+ * SessionScan.cpp is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <stdio.h>
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/TrajectoryReader.h>
+#include <NatNetLinux/CompressedReader.h>
+#include <NatNetLinux/SessionScanner.h>
+
+#include <boost/program_options.hpp>
+
+// Summarizes every rigid body in a recording, either a trajectory store
+// written by TrajectoryWriter or a file written by CompressedWriter:
+// tracking validity, mean marker error, gaps and speed percentiles. The
+// recording is split by chunk, block or time range and scanned on every
+// core. With --scaling, the scan is timed with 1, 2, 4... threads.
+
+// Prints each partition's summary as it is merged.
+class PartitionPrinter : public ScanHandler
+{
+public:
+
+   virtual void handlePartition( size_t i, ScanSummary const& partition )
+   {
+      uint64_t valid = 0, total = 0;
+      std::map<int, BodySummary>::const_iterator it;
+      for( it = partition.bodies.begin(); it != partition.bodies.end(); ++it )
+      {
+         valid += it->second.validFrames;
+         total += it->second.frames;
+      }
+      printf("partition %lu: frames %d-%d (%lu), %lu bodies, %.2f%% valid\n",
+         static_cast<unsigned long>(i),
+         partition.firstFrame,
+         partition.lastFrame,
+         static_cast<unsigned long>(partition.frames),
+         static_cast<unsigned long>(partition.bodies.size()),
+         total ? 100.0*valid/total : 0.0
+      );
+   }
+};
+
+static void report( ScanSummary const& total )
+{
+   printf("%lu frames (%d-%d) over %.1f s\n",
+      static_cast<unsigned long>(total.frames),
+      total.firstFrame,
+      total.lastFrame,
+      1e-9*(total.lastTimeNs - total.firstTimeNs)
+   );
+   printf("%6s %8s %8s %9s %6s %7s %9s %9s %9s %9s\n",
+      "body", "valid%", "err mm", "gaps", "gap fr", "longest", "p50 m/s", "p95 m/s", "p99 m/s", "max m/s");
+   std::map<int, BodySummary>::const_iterator it;
+   for( it = total.bodies.begin(); it != total.bodies.end(); ++it )
+   {
+      BodySummary const& b = it->second;
+      printf("%6d %8.3f %8.3f %9lu %6lu %7lu %9.3f %9.3f %9.3f %9.3f\n",
+         b.id,
+         100.0*b.validRatio(),
+         1e3*b.meanMarkerError(),
+         static_cast<unsigned long>(b.gaps),
+         static_cast<unsigned long>(b.gapFrames),
+         static_cast<unsigned long>(b.longestGap),
+         b.speedPercentile(0.5),
+         b.speedPercentile(0.95),
+         b.speedPercentile(0.99),
+         b.maxSpeed()
+      );
+   }
+}
+
+int main( int argc, char* argv[] )
+{
+   namespace po = boost::program_options;
+
+   po::options_description desc("session-scan: summarizes the rigid bodies of a recording\nOptions");
+   desc.add_options()
+      ("help", "Display help message")
+      ("file,f", po::value<std::string>(), "Trajectory store or compressed file")
+      ("threads,t", po::value<unsigned int>()->default_value(0), "Threads scanning, 0 for one per core")
+      ("window,w", po::value<double>()->default_value(0.0), "Seconds per partition, 0 for one per chunk or block")
+      ("partitions", "Print each partition as it is merged")
+      ("scaling", "Time the scan with 1, 2, 4... threads up to --threads")
+   ;
+
+   po::variables_map vm;
+   po::store(po::parse_command_line(argc,argv,desc), vm);
+   if( vm.count("help") || !vm.count("file") )
+   {
+      std::cout << desc << std::endl;
+      return 1;
+   }
+
+   std::string path = vm["file"].as<std::string>();
+   double window = vm["window"].as<double>();
+   TrajectoryReader trajectory;
+   CompressedReader compressed;
+   ScanSource* source;
+   uint64_t bytes;
+   if( trajectory.open(path) )
+   {
+      source = new TrajectoryScanSource(trajectory, window);
+      bytes = 0;
+      for( size_t i = 0; i < trajectory.numChunks(); ++i )
+         bytes += trajectory.chunkHeader(i).bytes;
+   }
+   else if( compressed.open(path) )
+   {
+      source = new CompressedScanSource(compressed, window);
+      bytes = compressed.size();
+   }
+   else
+   {
+      std::cerr << "ERROR: cannot open recording " << path << std::endl;
+      return 1;
+   }
+
+   SessionScanner scanner(vm["threads"].as<unsigned int>());
+   PartitionPrinter printer;
+   printf("%lu partitions, %u threads\n", static_cast<unsigned long>(source->numPartitions()), scanner.threads());
+
+   if( vm.count("scaling") )
+   {
+      // The first pass also brings the file into the page cache.
+      printf("%8s %10s %12s %10s %8s\n", "threads", "seconds", "frames/s", "MB/s", "speedup");
+      double base = 0.0;
+      for( unsigned int n = 1; ; n = std::min(2*n, scanner.threads()) )
+      {
+         SessionScanner s(n);
+         s.scan(*source);
+         double t0 = NatNet::now();
+         ScanSummary total = s.scan(*source);
+         double seconds = NatNet::now() - t0;
+         if( n == 1 )
+            base = seconds;
+         printf("%8u %10.3f %12.0f %10.1f %7.2fx\n", n, seconds, total.frames/seconds, 1e-6*bytes/seconds, base/seconds);
+         if( n == scanner.threads() )
+            break;
+      }
+      printf("\n");
+   }
+
+   if( vm.count("partitions") )
+      scanner.setHandler(&printer);
+   double t0 = NatNet::now();
+   ScanSummary total = scanner.scan(*source);
+   double seconds = NatNet::now() - t0;
+   report(total);
+   printf("scanned in %.3f s, %.0f frames/s\n", seconds, total.frames/seconds);
+
+   delete source;
+   return 0;
+}
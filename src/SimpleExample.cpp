@@ -111,51 +111,22 @@ void printFrames(FrameListener& frameListener)
    }
 }
 
-// This thread loop collects inter-frame arrival statistics and prints a
-// histogram at the end. You can plot the data by copying it to a file
-// (say time.txt), and running gnuplot with the command:
-//     gnuplot> plot 'time.txt' using 1:2 title 'Time Stats' with bars
-void timeStats(FrameListener& frameListener, const float diffMin_ms = 0.5, const float diffMax_ms = 7.0, const int bins = 100)
+// This thread loop consumes frames until ctrl-c is pressed, then prints
+// latency percentiles for each stage of the frames' path through the
+// listener, including the inter-frame arrival time.
+void timeStats(FrameListener& frameListener)
 {
-   size_t hist[bins];
-   float diff_ms;
-   int bin;
-   struct timespec current;
-   struct timespec prev;
-   struct timespec tmp;
+   bool valid;
    
-   std::cout << std::endl << "Collecting inter-frame arrival statistics...press ctrl-c to finish." << std::endl;
+   std::cout << std::endl << "Collecting latency statistics...press ctrl-c to finish." << std::endl;
    
-   memset(hist, 0x00, sizeof(hist));
-   bool valid;
    Globals::run = true;
    while(Globals::run)
    {
-      while( true )
-      {
-         // Try to get a new frame from the listener.
-         prev = current;
-         tmp = frameListener.pop(&valid).second;
-         // Quit if the listener has no more frames.
-         if( !valid )
-            break;
-         
-         current = tmp;
-         
-         diff_ms =
-            std::abs(
-               (static_cast<float>(current.tv_sec)-static_cast<float>(prev.tv_sec))*1000.f
-                + (static_cast<float>(current.tv_nsec)-static_cast<float>(prev.tv_nsec))/1000000.f
-            );
-         
-         bin = (diff_ms-diffMin_ms)/(diffMax_ms-diffMin_ms) * (bins+1);
-         if( bin < 0 )
-            bin = 0;
-         else if( bin >= bins )
-            bin = bins-1;
-         
-         hist[bin] += 1;
-      }
+      // Empty the buffer.
+      do
+         frameListener.pop(&valid);
+      while( valid );
       
       // Sleep for a little while to simulate work :)
       usleep(1000);
@@ -163,9 +134,13 @@ void timeStats(FrameListener& frameListener, const float diffMin_ms = 0.5, const
    
    // Print the stats
    std::cout << std::endl << std::endl;
-   std::cout << "# Time diff (ms), Count" << std::endl;
-   for( bin = 0; bin < bins; ++bin )
-      std::cout << diffMin_ms+(diffMax_ms-diffMin_ms)*(0.5f+bin)/bins << ", " << hist[bin] << std::endl;
+   for( int i = 0; i < FrameListener::NUM_LATENCY_STAGES; ++i )
+   {
+      FrameListener::LatencyStage stage = static_cast<FrameListener::LatencyStage>(i);
+      HistogramSnapshot snapshot;
+      frameListener.latency(stage, snapshot);
+      std::cout << FrameListener::latencyStageName(stage) << ": " << snapshot.summary() << std::endl;
+   }
 }
 
 int main(int argc, char* argv[])
@@ -0,0 +1,353 @@
+/*
+ * SyntheticServer.cpp is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameListener.h>
+#include <NatNetLinux/SyntheticScene.h>
+#include <NatNetLinux/SyntheticServer.h>
+
+#include <boost/program_options.hpp>
+
+// A NatNet server without cameras. Streams a SyntheticScene of the given
+// size to the multicast group or to unicast destinations, packed for any
+// NatNet version, and answers pings, model definition and frame requests
+// on the command port. Prints the achieved rate every second.
+//
+// With --listen, frames go over the loopback to a FrameListener in this
+// process instead, which is drained and checked against the scene, and
+// --sweep doubles the rate every few seconds until the listener loses
+// frames or the server cannot keep up, to find the listener's saturation
+// point.
+
+bool run = true;
+
+// End the program gracefully.
+void terminate(int)
+{
+   run = false;
+}
+
+// Parse "major.minor". Returns false if malformed.
+static bool parseVersion( std::string const& s, unsigned char& major, unsigned char& minor )
+{
+   int a, b;
+   char extra;
+   if( sscanf(s.c_str(), "%d.%d%c", &a, &b, &extra) != 2 || a < 0 || a > 255 || b < 0 || b > 255 )
+      return false;
+   major = static_cast<unsigned char>(a);
+   minor = static_cast<unsigned char>(b);
+   return true;
+}
+
+// True if the rigid bodies of the two frames have the same IDs, poses and,
+// from NatNet 2.6, validity.
+static bool sameBodies( MocapFrame const& a, MocapFrame const& b )
+{
+   bool haveValid = a.nnMajor() > 2 || (a.nnMajor() == 2 && a.nnMinor() >= 6);
+   std::vector<RigidBody> const& ra = a.rigidBodies();
+   std::vector<RigidBody> const& rb = b.rigidBodies();
+   if( ra.size() != rb.size() )
+      return false;
+   for( size_t i = 0; i < ra.size(); ++i )
+   {
+      Point3f pa = ra[i].location(), pb = rb[i].location();
+      Quaternion4f qa = ra[i].orientation(), qb = rb[i].orientation();
+      if( ra[i].id() != rb[i].id() || (haveValid && ra[i].trackingValid() != rb[i].trackingValid()) ||
+          pa.x != pb.x || pa.y != pb.y || pa.z != pb.z ||
+          qa.qx != qb.qx || qa.qy != qb.qy || qa.qz != qb.qz || qa.qw != qb.qw )
+         return false;
+   }
+   return true;
+}
+
+// Result of streaming into an in-process listener for a while.
+struct ListenResult
+{
+   ServerStats server;
+   SequenceStats sequence;
+   uint64_t popped;
+   uint64_t mismatched;
+};
+
+// Stream at rate for the given seconds (or until ctrl-c) over the loopback
+// into a FrameListener, popping every frame and comparing it with the scene.
+static ListenResult listen( SyntheticScene const& scene, unsigned char nnMajor, unsigned char nnMinor, double rate, double seconds, size_t bufferSize, bool report )
+{
+   ListenResult result;
+   result.popped = 0;
+   result.mismatched = 0;
+
+   // Receive on an ephemeral loopback port with a large buffer.
+   int rsd = socket(AF_INET, SOCK_DGRAM, 0);
+   struct sockaddr_in addr = NatNet::createAddress(inet_addr("127.0.0.1"), 0);
+   socklen_t addrLength = sizeof(addr);
+   int rcvBufSize = 1 << 24;
+   setsockopt(rsd, SOL_SOCKET, SO_RCVBUF, &rcvBufSize, sizeof(rcvBufSize));
+   if( bind(rsd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 ||
+       getsockname(rsd, reinterpret_cast<struct sockaddr*>(&addr), &addrLength) < 0 )
+   {
+      perror("bind");
+      exit(1);
+   }
+   int ssd = socket(AF_INET, SOCK_DGRAM, 0);
+
+   FrameListener listener(rsd, nnMajor, nnMinor, bufferSize);
+   listener.start();
+
+   SyntheticServer server(scene, nnMajor, nnMinor);
+   server.setRate(rate);
+   server.setDataSocket(ssd);
+   server.addDestination(addr);
+   server.start();
+
+   MocapFrame expected(nnMajor, nnMinor);
+   double begin = NatNet::now();
+   double lastReport = begin;
+   double stopAt = 0.0;
+   bool valid;
+   while( true )
+   {
+      do
+      {
+         MocapFrame frame(listener.tryPop(&valid).first);
+         if( !valid )
+            break;
+         ++result.popped;
+         // The scene is a pure function of the frame number, so compare exactly.
+         scene.frame(frame.frameNum(), frame.frameNum()*server.period(), expected);
+         if( !sameBodies(frame, expected) )
+            ++result.mismatched;
+      } while( true );
+
+      double now = NatNet::now();
+      if( stopAt == 0.0 && (!run || (seconds > 0.0 && now - begin >= seconds)) )
+      {
+         // Give the listener a moment to drain what is in flight.
+         server.stop();
+         stopAt = now;
+      }
+      if( stopAt > 0.0 && now - stopAt >= 0.2 )
+         break;
+      if( report && now - lastReport >= 1.0 )
+      {
+         lastReport = now;
+         SequenceStats seq = listener.sequenceStats();
+         printf("%s received=%llu missing=%llu overwritten=%llu\n",
+            server.stats().summary().c_str(),
+            static_cast<unsigned long long>(seq.received),
+            static_cast<unsigned long long>(seq.missing),
+            static_cast<unsigned long long>(seq.overwritten));
+      }
+      usleep(200);
+   }
+   server.join();
+   listener.stop();
+   listener.join();
+
+   result.server = server.stats();
+   result.sequence = listener.sequenceStats();
+   close(ssd);
+   close(rsd);
+   return result;
+}
+
+int main( int argc, char* argv[] )
+{
+   namespace po = boost::program_options;
+
+   po::options_description desc("natnet-server: streams synthetic NatNet data\nOptions");
+   desc.add_options()
+      ("help", "Display help message")
+      ("local-addr,l", po::value<std::string>()->default_value("0.0.0.0"), "Local IPv4 address for the command port and multicast")
+      ("multicast-addr", po::value<std::string>()->default_value("239.255.42.99"), "Multicast group to stream to")
+      ("dest", po::value< std::vector<std::string> >(), "Stream to this unicast IPv4 address instead, may be repeated")
+      ("data-port", po::value<int>()->default_value(NatNet::dataPort), "Destination data port")
+      ("command-port", po::value<int>()->default_value(NatNet::commandPort), "Command port to answer on")
+      ("no-commands", "Do not open the command port")
+      ("natnet-version", po::value<std::string>()->default_value("2.9"), "NatNet version to pack for, major.minor")
+      ("rate,r", po::value<double>()->default_value(120.0), "Frames per second")
+      ("max", "Stream as fast as possible")
+      ("seconds", po::value<double>()->default_value(0.0), "Stop after this long, 0 to run until ctrl-c")
+      ("bodies", po::value<int>()->default_value(10), "Rigid bodies")
+      ("markers", po::value<int>()->default_value(4), "Markers on each rigid body")
+      ("skeletons", po::value<int>()->default_value(0), "Skeletons")
+      ("bones", po::value<int>()->default_value(21), "Rigid bodies in each skeleton")
+      ("unidentified", po::value<int>()->default_value(0), "Unidentified markers")
+      ("labeled", po::value<int>()->default_value(0), "Labeled markers")
+      ("dropout", po::value<double>()->default_value(0.0), "Fraction of frames each rigid body is untracked")
+      ("seed", po::value<unsigned int>()->default_value(1), "Seed of the motion")
+      ("listen", "Stream over the loopback into an in-process FrameListener")
+      ("sweep", "With --listen, double the rate from --rate until frames are lost")
+      ("step", po::value<double>()->default_value(2.0), "Seconds at each rate of --sweep")
+      ("buffer", po::value<size_t>()->default_value(64), "Frames in the FrameListener buffer")
+   ;
+
+   po::variables_map vm;
+   po::store(po::parse_command_line(argc,argv,desc), vm);
+   if( vm.count("help") )
+   {
+      std::cout << desc << std::endl;
+      return 1;
+   }
+
+   unsigned char nnMajor, nnMinor;
+   if( !parseVersion(vm["natnet-version"].as<std::string>(), nnMajor, nnMinor) )
+   {
+      std::cerr << "ERROR: --natnet-version must be major.minor" << std::endl;
+      return 1;
+   }
+
+   SyntheticScene scene(vm["seed"].as<unsigned int>());
+   scene.setRigidBodies(vm["bodies"].as<int>(), vm["markers"].as<int>());
+   scene.setSkeletons(vm["skeletons"].as<int>(), vm["bones"].as<int>());
+   scene.setUnidentifiedMarkers(vm["unidentified"].as<int>());
+   scene.setLabeledMarkers(vm["labeled"].as<int>());
+   scene.setDropout(vm["dropout"].as<double>());
+
+   double rate = vm.count("max") ? 0.0 : vm["rate"].as<double>();
+   double seconds = vm["seconds"].as<double>();
+
+   // Check the frame size once; every frame of the scene has the same.
+   MocapFrame first(nnMajor, nnMinor);
+   scene.frame(1, 0.0, first);
+   size_t frameBytes = first.packedSize();
+   printf("NatNet %d.%d, %lu bytes per frame\n", nnMajor, nnMinor, static_cast<unsigned long>(frameBytes));
+   if( frameBytes > 0xFFFF || frameBytes + 4 > NatNetPacket::maxDatagram() )
+   {
+      std::cerr << "ERROR: frames of " << frameBytes << " bytes do not fit in a NatNet datagram" << std::endl;
+      return 1;
+   }
+
+   signal(SIGINT, terminate);
+
+   if( vm.count("listen") )
+   {
+      size_t bufferSize = vm["buffer"].as<size_t>();
+      if( !vm.count("sweep") )
+      {
+         ListenResult r = listen(scene, nnMajor, nnMinor, rate, seconds, bufferSize, true);
+         printf("\n%s\npopped=%llu missing=%llu overwritten=%llu mismatched=%llu\n",
+            r.server.summary().c_str(),
+            static_cast<unsigned long long>(r.popped),
+            static_cast<unsigned long long>(r.sequence.missing),
+            static_cast<unsigned long long>(r.sequence.overwritten),
+            static_cast<unsigned long long>(r.mismatched));
+         return r.mismatched ? 1 : 0;
+      }
+
+      // Saturated when the listener loses more than 0.1% of frames, or the
+      // server cannot send at the rate asked for.
+      double step = vm["step"].as<double>();
+      if( rate <= 0.0 )
+         rate = 120.0;
+      printf("%12s %12s %12s %10s %10s %11s %10s\n", "target/s", "sent/s", "popped/s", "missing", "overwrit", "lateness99", "mismatch");
+      for( ; run; rate *= 2.0 )
+      {
+         ListenResult r = listen(scene, nnMajor, nnMinor, rate, step, bufferSize, false);
+         double sent = r.server.rate();
+         double lost = r.server.frames ? 1.0 - static_cast<double>(r.popped)/r.server.frames : 0.0;
+         printf("%12.0f %12.0f %12.0f %10llu %10llu %10.1fus %10llu\n",
+            rate, sent, r.popped/r.server.elapsed,
+            static_cast<unsigned long long>(r.sequence.missing),
+            static_cast<unsigned long long>(r.sequence.overwritten),
+            1e6*r.server.lateness.percentile(0.99),
+            static_cast<unsigned long long>(r.mismatched));
+         if( lost > 1e-3 )
+         {
+            printf("listener saturated: lost %.2f%% of frames at %.0f/s\n", 100.0*lost, sent);
+            break;
+         }
+         if( sent < 0.95*rate )
+         {
+            printf("server saturated at %.0f/s; the listener kept up\n", sent);
+            break;
+         }
+      }
+      return 0;
+   }
+
+   int ssd = socket(AF_INET, SOCK_DGRAM, 0);
+   uint32_t localAddress = inet_addr(vm["local-addr"].as<std::string>().c_str());
+   uint16_t dataPort = static_cast<uint16_t>(vm["data-port"].as<int>());
+
+   SyntheticServer server(scene, nnMajor, nnMinor);
+   server.setRate(rate);
+   server.setDataSocket(ssd);
+   if( vm.count("dest") )
+   {
+      std::vector<std::string> const& dests = vm["dest"].as< std::vector<std::string> >();
+      for( size_t i = 0; i < dests.size(); ++i )
+         server.addDestination(NatNet::createAddress(inet_addr(dests[i].c_str()), dataPort));
+   }
+   else
+   {
+      unsigned char ttl = 1, loop = 1;
+      setsockopt(ssd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+      setsockopt(ssd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+      if( localAddress != INADDR_ANY )
+      {
+         struct in_addr iface;
+         iface.s_addr = localAddress;
+         setsockopt(ssd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface));
+      }
+      server.addDestination(NatNet::createAddress(inet_addr(vm["multicast-addr"].as<std::string>().c_str()), dataPort));
+   }
+
+   int csd = -1;
+   if( !vm.count("no-commands") )
+   {
+      csd = NatNet::createCommandSocket(localAddress, static_cast<uint16_t>(vm["command-port"].as<int>()));
+      server.setCommandSocket(csd);
+   }
+
+   server.start();
+   double begin = NatNet::now();
+   double lastReport = begin;
+   while( run && server.running() )
+   {
+      usleep(10000);
+      double now = NatNet::now();
+      if( seconds > 0.0 && now - begin >= seconds )
+         break;
+      if( now - lastReport >= 1.0 )
+      {
+         lastReport = now;
+         printf("%s\n", server.stats().summary().c_str());
+      }
+   }
+   server.stop();
+   server.join();
+   printf("\n%s\n", server.stats().summary().c_str());
+
+   if( csd >= 0 )
+      close(csd);
+   close(ssd);
+   return 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * CaptureTest.cpp is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/CaptureWriter.h>
+#include <NatNetLinux/CaptureReader.h>
+#include <NatNetLinux/SyntheticScene.h>
+
+#include "Check.h"
+
+// Checks that CaptureReader reads back every datagram CaptureWriter wrote,
+// across several segments, that seeking by frame number and by time finds
+// the first matching record with or without the index files, also when
+// keys repeat, and that the writer stops when it cannot create a segment.
+
+// A datagram as the listener would have received it.
+struct Record
+{
+   std::vector<char> data;
+   PacketInfo info;
+};
+
+// Frames of data, with a ping now and then, 120 Hz apart. A stalled server
+// sends each frame number four times, with no SMPTE timecode.
+static void records( std::vector<Record>& out, bool stalled=false )
+{
+   SyntheticScene scene(5);
+   scene.setRigidBodies(4, 3);
+   scene.setLabeledMarkers(6);
+   NatNetPacket packet;
+
+   for( int f = 0; f < 400; ++f )
+   {
+      Record r;
+      r.info.ts = CaptureFormat::fromNs(1000000000000LL + f*8333333LL);
+      r.info.from.sin_family = AF_INET;
+      r.info.from.sin_port = htons(1511);
+      r.info.nnMajor = 2;
+      r.info.nnMinor = 9;
+
+      if( f % 25 == 10 )
+      {
+         packet = NatNetPacket::pingPacket();
+         r.data.resize(4);
+         memcpy(&r.data[0], packet.rawPtr(), 4);
+         out.push_back(r);
+         r.info.ts = CaptureFormat::fromNs(CaptureFormat::toNs(r.info.ts) + 1000);
+      }
+
+      MocapFrame frame(2, 9);
+      scene.frame(stalled ? 1000 + f/4 : 1000 + f, f/120.0, frame);
+      if( stalled )
+         frame.setTimecode(0, 0);
+      char* end = frame.pack(packet.rawPtr() + 4);
+      packet.setHeader(NatNetPacket::NAT_FRAMEOFDATA, static_cast<unsigned short>(end - packet.rawPtr() - 4));
+      r.data.resize(end - packet.rawPtr());
+      memcpy(&r.data[0], packet.rawPtr(), r.data.size());
+      out.push_back(r);
+   }
+}
+
+static bool write( std::string const& base, std::vector<Record> const& recs, uint64_t segmentBytes )
+{
+   CaptureWriter writer(base, segmentBytes, 1u<<20, 64, 16);
+   if( !writer.start() )
+      return false;
+   for( size_t i = 0; i < recs.size(); ++i )
+      writer.handlePacket(&recs[i].data[0], recs[i].data.size(), recs[i].info);
+   writer.stop();
+   writer.join();
+
+   CaptureStats stats = writer.stats();
+   CHECK(stats.packets == recs.size());
+   CHECK(stats.dropped == 0 && stats.writeErrors == 0);
+   CHECK(stats.segments > 2);
+   return true;
+}
+
+static bool sameRecord( CapturePacket const& p, Record const& r )
+{
+   return p.length == r.data.size()
+      && memcmp(p.data, &r.data[0], p.length) == 0
+      && p.ts.tv_sec == r.info.ts.tv_sec
+      && p.ts.tv_nsec == r.info.ts.tv_nsec
+      && p.srcPort == r.info.from.sin_port
+      && p.nnMajor == r.info.nnMajor
+      && p.nnMinor == r.info.nnMinor;
+}
+
+// Index of the record a cursor is at, or the number of records at the end.
+static size_t at( CaptureReader const& reader, CaptureCursor c )
+{
+   CapturePacket p;
+   size_t i = 0;
+   CaptureCursor it = reader.begin();
+   while( it != c && reader.next(it, p) )
+      ++i;
+   return i;
+}
+
+static int frameNum( Record const& r )
+{
+   int32_t ret = -1;
+   if( CaptureFormat::isFrame(&r.data[0], r.data.size()) )
+      memcpy(&ret, &r.data[4], 4);
+   return ret;
+}
+
+static void checkSeeks( CaptureReader const& reader, std::vector<Record> const& recs )
+{
+   size_t i, want;
+   int frames[] = { 900, 1000, 1001, 1016, 1017, 1234, 1399, 1400 };
+   for( i = 0; i < sizeof(frames)/sizeof(frames[0]); ++i )
+   {
+      for( want = 0; want < recs.size() && frameNum(recs[want]) < frames[i]; ++want )
+         ;
+      CHECK(at(reader, reader.seekFrame(frames[i])) == want);
+   }
+
+   for( i = 0; i < recs.size(); i += 37 )
+   {
+      CHECK(at(reader, reader.seekTime(recs[i].info.ts)) == i);
+      struct timespec just = CaptureFormat::fromNs(CaptureFormat::toNs(recs[i].info.ts) + 1);
+      CHECK(at(reader, reader.seekTime(just)) == i + 1);
+   }
+}
+
+// Repeated keys seek to the first record with the key, not to the index
+// entry nearest it.
+static void testRepeatedKeys()
+{
+   std::vector<Record> recs;
+   records(recs, true);
+
+   char dir[] = "/tmp/capture-test-XXXXXX";
+   CHECK(mkdtemp(dir) != 0);
+   std::string base = std::string(dir) + "/cap";
+   CHECK(write(base, recs, 32u<<10));
+
+   CaptureReader reader;
+   CHECK(reader.open(base));
+   CHECK(at(reader, reader.seekTimecode(0)) == 0);
+   CHECK(at(reader, reader.seekTimecode(0, 1)) == recs.size());
+
+   size_t want;
+   int frames[] = { 1000, 1001, 1004, 1050, 1099, 1100 };
+   for( size_t i = 0; i < sizeof(frames)/sizeof(frames[0]); ++i )
+   {
+      for( want = 0; want < recs.size() && frameNum(recs[want]) < frames[i]; ++want )
+         ;
+      CHECK(at(reader, reader.seekFrame(frames[i])) == want);
+   }
+   size_t segments = reader.numSegments();
+   reader.close();
+
+   for( size_t i = 0; i < segments; ++i )
+   {
+      unlink(CaptureFormat::segmentPath(base, i).c_str());
+      unlink(CaptureFormat::indexPath(base, i).c_str());
+   }
+   rmdir(dir);
+}
+
+static void testRoundTrip()
+{
+   std::vector<Record> recs;
+   records(recs);
+
+   char dir[] = "/tmp/capture-test-XXXXXX";
+   CHECK(mkdtemp(dir) != 0);
+   std::string base = std::string(dir) + "/cap";
+   CHECK(write(base, recs, 32u<<10));
+
+   CaptureReader reader;
+   CHECK(reader.open(base));
+   CHECK(reader.numPackets() == recs.size());
+   CHECK(reader.numIndexEntries() > 0);
+
+   CaptureCursor c = reader.begin();
+   CapturePacket p;
+   size_t i;
+   for( i = 0; reader.next(c, p); ++i )
+      CHECK(i < recs.size() && sameRecord(p, recs[i]));
+   CHECK(i == recs.size());
+   CHECK(c == reader.end());
+
+   checkSeeks(reader, recs);
+   size_t segments = reader.numSegments();
+   reader.close();
+
+   // Without the index files the reader builds the index itself.
+   for( i = 0; i < segments; ++i )
+      CHECK(unlink(CaptureFormat::indexPath(base, i).c_str()) == 0);
+   CHECK(reader.open(base));
+   CHECK(reader.numPackets() == recs.size());
+   checkSeeks(reader, recs);
+   reader.close();
+
+   for( i = 0; i < segments; ++i )
+      unlink(CaptureFormat::segmentPath(base, i).c_str());
+   rmdir(dir);
+}
+
+// A segment that cannot be created stops the writer, and counts what it lost.
+static void testSegmentError()
+{
+   std::vector<Record> recs;
+   records(recs);
+
+   char dir[] = "/tmp/capture-test-XXXXXX";
+   CHECK(mkdtemp(dir) != 0);
+   std::string base = std::string(dir) + "/cap";
+   // A directory where the second segment would go.
+   std::string blocked = CaptureFormat::segmentPath(base, 1);
+   CHECK(mkdir(blocked.c_str(), 0755) == 0);
+
+   CaptureWriter writer(base, 32u<<10, 1u<<20, 64, 16);
+   CHECK(writer.start());
+   for( size_t i = 0; i < recs.size(); ++i )
+      writer.handlePacket(&recs[i].data[0], recs[i].data.size(), recs[i].info);
+   for( int wait = 0; writer.running() && wait < 500; ++wait )
+      usleep(10000);
+   CHECK(!writer.running());
+   writer.join();
+
+   CaptureStats stats = writer.stats();
+   CHECK(stats.writeErrors > 0);
+   CHECK(stats.packets > 0 && stats.dropped > 0);
+   CHECK(stats.packets + stats.dropped == recs.size());
+
+   // What was written before the error reads back.
+   CaptureReader reader;
+   CHECK(reader.open(base));
+   CHECK(reader.numPackets() == stats.packets);
+   reader.close();
+
+   unlink(CaptureFormat::segmentPath(base, 0).c_str());
+   unlink(CaptureFormat::indexPath(base, 0).c_str());
+   rmdir(blocked.c_str());
+   rmdir(dir);
+}
+
+int main()
+{
+   testRoundTrip();
+   testRepeatedKeys();
+   testSegmentError();
+
+   printf("Capture: %d failures\n", failures);
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,308 @@
+/*
+ * FrameCodecTest.cpp is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <vector>
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameCodec.h>
+#include <NatNetLinux/CompressedWriter.h>
+#include <NatNetLinux/CompressedReader.h>
+#include <NatNetLinux/SyntheticScene.h>
+
+#include "Check.h"
+
+// Checks that LOSSLESS frames decode bit exact, including frames that list
+// the same rigid body ID more than once, that LOSSY poses stay within the
+// stated error bounds, and that files read back what was written.
+
+static bool sameBits( float a, float b )
+{
+   return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static bool sameBody( RigidBody const& a, RigidBody const& b )
+{
+   return a.id() == b.id()
+      && a.trackingValid() == b.trackingValid()
+      && sameBits(a.location().x, b.location().x)
+      && sameBits(a.location().y, b.location().y)
+      && sameBits(a.location().z, b.location().z)
+      && sameBits(a.orientation().qx, b.orientation().qx)
+      && sameBits(a.orientation().qy, b.orientation().qy)
+      && sameBits(a.orientation().qz, b.orientation().qz)
+      && sameBits(a.orientation().qw, b.orientation().qw)
+      && sameBits(a.meanMarkerError(), b.meanMarkerError());
+}
+
+static RigidBody body( int id, bool valid, int frame )
+{
+   RigidBody b;
+   b.setId(id);
+   b.setTrackingValid(valid);
+   b.setLocation(Point3f(0.001f*frame + id, -0.5f*id, 0.25f*frame));
+   b.setOrientation(Quaternion4f(0.1f*id, 0.01f*frame, 0.3f, 1.f));
+   b.setMeanMarkerError(1e-4f*(frame % 7));
+   return b;
+}
+
+// Body 2 is listed twice with every combination of validity flags, so both
+// copies flip the shared slot in the same frame.
+static void testDuplicateIds()
+{
+   int const ids[] = { 1, 2, 2, 3 };
+   size_t const numIds = sizeof(ids)/sizeof(ids[0]);
+   FrameEncoder encoder;
+   FrameDecoder decoder;
+   std::vector<char> data;
+   std::vector<MocapFrame> frames;
+   struct timespec ts;
+   int f;
+
+   for( f = 0; f < 64; ++f )
+   {
+      MocapFrame frame;
+      frame.setFrameNum(100 + f);
+      // Without the duplicate now and then, so the layout changes too.
+      for( size_t i = 0; i < numIds; ++i )
+         if( f % 5 != 4 || i != 2 )
+            frame.rigidBodies().push_back(body(ids[i], ((f >> i) & 1) == 0, f));
+      ts.tv_sec = 1000 + f/100;
+      ts.tv_nsec = (f % 100)*10000000L;
+      encoder.encode(frame, ts, data);
+      frames.push_back(frame);
+   }
+
+   char const* p = &data[0];
+   char const* end = p + data.size();
+   MocapFrame out;
+   for( f = 0; f < 64; ++f )
+   {
+      p = decoder.decode(p, end, out, ts);
+      CHECK(p != 0);
+      if( !p )
+         return;
+      CHECK(out.frameNum() == frames[f].frameNum());
+      std::vector<RigidBody> const& in = frames[f].rigidBodies();
+      CHECK(out.rigidBodies().size() == in.size());
+      for( size_t i = 0; i < in.size() && i < out.rigidBodies().size(); ++i )
+         CHECK(sameBody(out.rigidBodies()[i], in[i]));
+   }
+   CHECK(p == end);
+}
+
+// Frames of a scene with every section, whose sizes change now and then
+// and sometimes drop to nothing.
+static void sceneFrames( std::vector<MocapFrame>& frames, std::vector<struct timespec>& times )
+{
+   SyntheticScene scene(7);
+   scene.setRigidBodies(6, 4);
+   scene.setSkeletons(2, 5);
+   scene.setLabeledMarkers(9);
+   scene.setDropout(0.1);
+   for( int f = 0; f < 120; ++f )
+   {
+      if( f % 10 == 0 )
+         scene.setUnidentifiedMarkers((f/10) % 4 == 3 ? 0 : 3 + f/10);
+      if( f == 60 )
+         scene.setSkeletons(0, 0);
+      if( f == 90 )
+         scene.setSkeletons(3, 4);
+      MocapFrame frame(2, 9);
+      scene.frame(500 + f, f/120.0, frame);
+      frame.setLatency(0.001f*(f % 3));
+      frame.setCaptureTime(2000.0 + f/120.0);
+      frames.push_back(frame);
+      struct timespec ts;
+      ts.tv_sec = 1000;
+      ts.tv_nsec = f*8333333L;
+      times.push_back(ts);
+   }
+}
+
+// Packed the way the server sends it, so every section is compared.
+static bool samePacked( MocapFrame const& a, MocapFrame const& b )
+{
+   std::vector<char> pa(a.packedSize()), pb(b.packedSize());
+   if( pa.size() != pb.size() )
+      return false;
+   a.pack(&pa[0]);
+   b.pack(&pb[0]);
+   return pa == pb;
+}
+
+// LOSSLESS keeps every section of every frame exactly.
+static void testAllSections()
+{
+   std::vector<MocapFrame> frames;
+   std::vector<struct timespec> times;
+   sceneFrames(frames, times);
+
+   FrameEncoder encoder;
+   FrameDecoder decoder(FrameCodec(), 2, 9);
+   std::vector<char> data;
+   size_t f;
+   for( f = 0; f < frames.size(); ++f )
+      encoder.encode(frames[f], times[f], data);
+
+   char const* p = &data[0];
+   char const* end = p + data.size();
+   MocapFrame out;
+   struct timespec ts;
+   for( f = 0; f < frames.size(); ++f )
+   {
+      p = decoder.decode(p, end, out, ts);
+      CHECK(p != 0);
+      if( !p )
+         return;
+      CHECK(samePacked(out, frames[f]));
+      CHECK(out.captureTime() == frames[f].captureTime());
+      CHECK(ts.tv_sec == times[f].tv_sec && ts.tv_nsec == times[f].tv_nsec);
+   }
+   CHECK(p == end);
+}
+
+// LOSSY poses are within maxPositionError() and maxQuaternionError(), up to
+// float rounding, and everything else is exact.
+static void testLossyBound()
+{
+   std::vector<MocapFrame> frames;
+   std::vector<struct timespec> times;
+   sceneFrames(frames, times);
+
+   FrameCodec codec(FrameCodec::LOSSY, 1e-4f, 12, 1e-6f);
+   FrameEncoder encoder(codec);
+   FrameDecoder decoder(codec, 2, 9);
+   double posTol = codec.maxPositionError() + 1e-6;
+   double quatTol = codec.maxQuaternionError() + 1e-6;
+   double worstPos = 0.0, worstQuat = 0.0;
+   std::vector<char> data;
+   size_t f, i;
+   for( f = 0; f < frames.size(); ++f )
+      encoder.encode(frames[f], times[f], data);
+
+   char const* p = &data[0];
+   char const* end = p + data.size();
+   MocapFrame out;
+   struct timespec ts;
+   for( f = 0; f < frames.size(); ++f )
+   {
+      p = decoder.decode(p, end, out, ts);
+      CHECK(p != 0);
+      if( !p )
+         return;
+      std::vector<RigidBody> const& in = frames[f].rigidBodies();
+      CHECK(out.rigidBodies().size() == in.size());
+      for( i = 0; i < in.size() && i < out.rigidBodies().size(); ++i )
+      {
+         RigidBody const& a = in[i];
+         RigidBody const& b = out.rigidBodies()[i];
+         Point3f pa = a.location(), pb = b.location();
+         worstPos = std::max(worstPos, static_cast<double>(fabsf(pa.x - pb.x)));
+         worstPos = std::max(worstPos, static_cast<double>(fabsf(pa.y - pb.y)));
+         worstPos = std::max(worstPos, static_cast<double>(fabsf(pa.z - pb.z)));
+
+         // The decoded quaternion is normalized and may be negated.
+         Quaternion4f qa = a.orientation(), qb = b.orientation();
+         double norm = sqrt(static_cast<double>(qa.dot(qa)));
+         double sign = qa.dot(qb) < 0.f ? -1.0 : 1.0;
+         worstQuat = std::max(worstQuat, fabs(qa.qx/norm - sign*qb.qx));
+         worstQuat = std::max(worstQuat, fabs(qa.qy/norm - sign*qb.qy));
+         worstQuat = std::max(worstQuat, fabs(qa.qz/norm - sign*qb.qz));
+         worstQuat = std::max(worstQuat, fabs(qa.qw/norm - sign*qb.qw));
+
+         CHECK(a.id() == b.id() && a.trackingValid() == b.trackingValid());
+         CHECK(fabsf(a.meanMarkerError() - b.meanMarkerError()) <= 0.5e-6f + 1e-9f);
+         CHECK(a.markers().size() == b.markers().size());
+      }
+      CHECK(out.skeletons().size() == frames[f].skeletons().size());
+      for( i = 0; i < out.skeletons().size() && i < frames[f].skeletons().size(); ++i )
+         CHECK(out.skeletons()[i].rigidBodies().size() == frames[f].skeletons()[i].rigidBodies().size()
+            && sameBody(out.skeletons()[i].rigidBodies()[0], frames[f].skeletons()[i].rigidBodies()[0]));
+      CHECK(out.labeledMarkers().size() == frames[f].labeledMarkers().size());
+      CHECK(out.unIdMarkers().size() == frames[f].unIdMarkers().size());
+   }
+   CHECK(p == end);
+   CHECK(worstPos <= posTol);
+   CHECK(worstQuat <= quatTol);
+   // Rounding actually happened.
+   CHECK(worstPos > 0.0);
+}
+
+// CompressedWriter to CompressedReader through a file, with blocks shorter
+// than the frames so several are read, and a seek into the middle.
+static void testFileRoundTrip()
+{
+   std::vector<MocapFrame> frames;
+   std::vector<struct timespec> times;
+   sceneFrames(frames, times);
+
+   char path[] = "/tmp/frame-codec-test-XXXXXX";
+   int fd = mkstemp(path);
+   CHECK(fd >= 0);
+   if( fd < 0 )
+      return;
+   ::close(fd);
+
+   size_t f;
+   {
+      CompressedWriter writer(path, FrameCodec(), 32);
+      CHECK(writer.start());
+      for( f = 0; f < frames.size(); ++f )
+         writer.handleFrame(frames[f], times[f]);
+      writer.stop();
+      writer.join();
+      CompressedStats stats = writer.stats();
+      CHECK(stats.frames == frames.size());
+      CHECK(stats.dropped == 0 && stats.writeErrors == 0);
+   }
+
+   CompressedReader reader;
+   CHECK(reader.open(path));
+   CHECK(reader.numFrames() == frames.size());
+   CHECK(reader.numBlocks() == (frames.size() + 31)/32);
+   CHECK(reader.nnMajor() == 2 && reader.nnMinor() == 9);
+
+   CompressedCursor c = reader.begin();
+   MocapFrame out;
+   struct timespec ts;
+   for( f = 0; reader.next(c, out, ts); ++f )
+      CHECK(f < frames.size() && samePacked(out, frames[f]));
+   CHECK(f == frames.size());
+
+   c = reader.seekFrame(frames[77].frameNum());
+   CHECK(reader.next(c, out, ts) && samePacked(out, frames[77]));
+
+   reader.close();
+   unlink(path);
+}
+
+int main()
+{
+   testDuplicateIds();
+   testAllSections();
+   testLossyBound();
+   testFileRoundTrip();
+
+   printf("FrameCodec: %d failures\n", failures);
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * FrameSequencerTest.cpp is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameSequencer.h>
+
+#include "Check.h"
+
+// Checks the reorder buffer's latency bound and its continuity counters.
+
+static struct timespec at( double t )
+{
+   struct timespec ts;
+   ts.tv_sec = static_cast<time_t>(floor(t));
+   ts.tv_nsec = static_cast<long>((t - floor(t))*1e9);
+   return ts;
+}
+
+static void push( FrameSequencer& seq, int frameNum, double t, std::vector<FrameSequencer::Entry>& ready )
+{
+   MocapFrame frame;
+   frame.setFrameNum(frameNum);
+   seq.push(frame, at(t), ready);
+}
+
+// No frame is held longer than maxLatency after it arrived, even when a
+// later-arriving frame precedes it.
+static void testLatencyBound()
+{
+   double const t0 = 1000.0;
+   FrameSequencer seq(8, 0.005);
+   std::vector<FrameSequencer::Entry> ready;
+
+   push(seq, 4, t0 - 0.001, ready);
+   CHECK(ready.size() == 1);
+   ready.clear();
+
+   // 5 is missing; 7 arrives first, then 6.
+   push(seq, 7, t0, ready);
+   push(seq, 6, t0 + 0.004, ready);
+   CHECK(ready.empty());
+   CHECK(fabs(seq.deadline() - (t0 + 0.005)) < 1e-6);
+
+   seq.flush(t0 + 0.0049, ready);
+   CHECK(ready.empty());
+   seq.flush(t0 + 0.0051, ready);
+   CHECK(ready.size() == 2);
+   CHECK(ready.size() == 2 && ready[0].first.frameNum() == 6 && ready[1].first.frameNum() == 7);
+   CHECK(seq.deadline() < 0.0);
+   CHECK(seq.stats().missing == 1);
+   CHECK(seq.stats().gaps == 1);
+   CHECK(seq.stats().reordered == 1);
+}
+
+static void testLateAndDuplicates()
+{
+   FrameSequencer seq(4, 0.005);
+   std::vector<FrameSequencer::Entry> ready;
+   double t = 1000.0;
+   int f;
+
+   // Frames 0 to 99 without 10 and 95; the buffer gives up on each.
+   for( f = 0; f < 100; ++f, t += 0.01 )
+      if( f != 10 && f != 95 )
+         push(seq, f, t, ready);
+   seq.flush(t, ready);
+   CHECK(seq.stats().missing == 2);
+   CHECK(seq.stats().late == 0);
+
+   // Within 64 of the highest, 95 is known to be new: late, and no longer missing.
+   push(seq, 95, t, ready);
+   CHECK(seq.stats().late == 1);
+   CHECK(seq.stats().missing == 1);
+
+   // 95 again is a duplicate.
+   push(seq, 95, t, ready);
+   CHECK(seq.stats().duplicates == 1);
+   CHECK(seq.stats().late == 1);
+
+   // 20 again, 79 behind: maybe a duplicate, so missing stays.
+   push(seq, 20, t, ready);
+   CHECK(seq.stats().late == 2);
+   CHECK(seq.stats().missing == 1);
+
+   // Late and duplicate frames are dropped, so released numbers only increase.
+   for( size_t i = 1; i < ready.size(); ++i )
+      CHECK(ready[i].first.frameNum() > ready[i-1].first.frameNum());
+   CHECK(ready.size() == 98);
+}
+
+// With a depth of 0, everything is released at once.
+static void testObserveOnly()
+{
+   FrameSequencer seq;
+   std::vector<FrameSequencer::Entry> ready;
+
+   push(seq, 0, 1000.0, ready);
+   push(seq, 2, 1000.01, ready);
+   push(seq, 1, 1000.02, ready);
+   push(seq, 2, 1000.03, ready);
+   CHECK(ready.size() == 4);
+   CHECK(seq.stats().duplicates == 1);
+   CHECK(seq.stats().late == 1);
+   CHECK(seq.stats().gaps == 1);
+   CHECK(seq.stats().missing == 0);
+}
+
+// A frame number that never advances must not silence a buffered stream.
+static void testStalledFrameNumber()
+{
+   FrameSequencer seq(4, 0.005);
+   std::vector<FrameSequencer::Entry> ready;
+   double t = 1000.0;
+   int i;
+
+   // The first frame, then stallFrames()-1 repeats dropped as duplicates,
+   // then every further repeat released as it arrives.
+   for( i = 0; i < 20; ++i, t += 0.01 )
+      push(seq, 0, t, ready);
+   CHECK(static_cast<int>(ready.size()) == 20 - (FrameSequencer::stallFrames() - 1));
+   CHECK(static_cast<int>(seq.stats().duplicates) == FrameSequencer::stallFrames() - 1);
+   CHECK(seq.stats().stalled == ready.size() - 1);
+   CHECK(seq.deadline() < 0.0);
+
+   // Once the number advances, repeats are duplicates again.
+   ready.clear();
+   push(seq, 1, t, ready);
+   push(seq, 1, t + 0.01, ready);
+   push(seq, 2, t + 0.02, ready);
+   CHECK(ready.size() == 2);
+   CHECK(static_cast<int>(seq.stats().duplicates) == FrameSequencer::stallFrames());
+   CHECK(seq.stats().missing == 0);
+}
+
+int main()
+{
+   testLatencyBound();
+   testLateAndDuplicates();
+   testObserveOnly();
+   testStalledFrameNumber();
+
+   printf("FrameSequencer: %d failures\n", failures);
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * FrameTransformTest.cpp is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/FrameTransform.h>
+#include <NatNetLinux/SyntheticScene.h>
+
+#include "Check.h"
+
+// Checks that FrameTransform moves orientations consistently with points
+// under every signed axis permutation, with and without a rigid pose, and
+// that the batch apply() of a frame matches the scalar apply().
+
+static float const tol = 1e-4f;
+
+static bool near( Point3f const& a, Point3f const& b )
+{
+   return fabsf(a.x-b.x) < tol && fabsf(a.y-b.y) < tol && fabsf(a.z-b.z) < tol;
+}
+
+// Same rotation: q and -q are equivalent.
+static bool sameRotation( Quaternion4f const& a, Quaternion4f const& b )
+{
+   return fabsf(fabsf(a.dot(b)) - 1.f) < tol;
+}
+
+static Point3f add( Point3f const& a, Point3f const& b )
+{
+   return Point3f(a.x+b.x, a.y+b.y, a.z+b.z);
+}
+
+static float uniform( float lo, float hi )
+{
+   return lo + (hi-lo)*(rand()/static_cast<float>(RAND_MAX));
+}
+
+static Point3f randomPoint()
+{
+   return Point3f(uniform(-5.f,5.f), uniform(-5.f,5.f), uniform(-5.f,5.f));
+}
+
+// Normalized by the constructor.
+static Quaternion4f randomQuaternion()
+{
+   return Quaternion4f(uniform(-1.f,1.f), uniform(-1.f,1.f), uniform(-1.f,1.f), uniform(-1.f,1.f));
+}
+
+// A body offset v, remapped, and rotated by the transformed orientation,
+// lands where the transformed world offset does.
+static void checkRemap( int x, int y, int z, Point3f const& translation, Quaternion4f const& rotation )
+{
+   FrameTransform t(translation, rotation);
+   FrameTransform remap;
+   CHECK(t.setAxisRemap(x, y, z));
+   CHECK(remap.setAxisRemap(x, y, z));
+
+   for( int i = 0; i < 20; ++i )
+   {
+      Quaternion4f q = randomQuaternion();
+      Point3f v = randomPoint();
+      CHECK(near(add(t.apply(q).rotate(remap.apply(v)), translation), t.apply(q.rotate(v))));
+   }
+}
+
+static void testRemaps()
+{
+   int const perms[6][3] = { {1,2,3}, {1,3,2}, {2,1,3}, {2,3,1}, {3,1,2}, {3,2,1} };
+   int p, s;
+
+   for( p = 0; p < 6; ++p )
+   {
+      for( s = 0; s < 8; ++s )
+      {
+         int x = (s & 1) ? -perms[p][0] : perms[p][0];
+         int y = (s & 2) ? -perms[p][1] : perms[p][1];
+         int z = (s & 4) ? -perms[p][2] : perms[p][2];
+         checkRemap(x, y, z, Point3f(0.f,0.f,0.f), Quaternion4f());
+         checkRemap(x, y, z, randomPoint(), randomQuaternion());
+      }
+   }
+
+   FrameTransform t;
+   CHECK(!t.setAxisRemap(1, 1, 3));
+   CHECK(!t.setAxisRemap(0, 2, 3));
+   CHECK(!t.setAxisRemap(1, 2, 4));
+}
+
+// The batch path over a whole frame agrees with the scalar one.
+static void testFrame()
+{
+   SyntheticScene scene(3);
+   scene.setRigidBodies(9, 3);
+   MocapFrame before(2, 9);
+   scene.frame(100, 0.5, before);
+
+   FrameTransform t(randomPoint(), randomQuaternion(), 1000.f);
+   CHECK(t.setAxisRemap(2, -3, 1));
+   MocapFrame after = before;
+   t.apply(after);
+
+   std::vector<RigidBody> const& a = before.rigidBodies();
+   std::vector<RigidBody> const& b = after.rigidBodies();
+   CHECK(a.size() == b.size() && a.size() == 9);
+   for( size_t i = 0; i < a.size() && i < b.size(); ++i )
+   {
+      Point3f want = t.apply(a[i].location());
+      CHECK(fabsf(b[i].location().x - want.x) < 1e-2f);
+      CHECK(fabsf(b[i].location().y - want.y) < 1e-2f);
+      CHECK(fabsf(b[i].location().z - want.z) < 1e-2f);
+      CHECK(sameRotation(b[i].orientation(), t.apply(a[i].orientation())));
+   }
+}
+
+int main()
+{
+   srand(1);
+   testRemaps();
+   testFrame();
+
+   printf("FrameTransform: %d failures\n", failures);
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * PackTest.cpp is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/NatNetSender.h>
+#include <NatNetLinux/DataDescriptions.h>
+#include <NatNetLinux/SyntheticScene.h>
+
+#include "Check.h"
+
+// Checks that pack() writes exactly the layout unpack() reads, for every
+// NatNet version whose layout differs: a packed frame unpacks to its
+// packedSize() and packs again byte for byte. The scene has every section
+// and drops tracking now and then, so validity flags take both values.
+// A truncated frame, or one with a huge or negative count, fails to unpack
+// without reading past the end of its buffer.
+
+static unsigned char const versions[][2] = {
+   {1,4}, {2,0}, {2,1}, {2,3}, {2,5}, {2,6}, {2,9}, {3,0}
+};
+static size_t const numVersions = sizeof(versions)/sizeof(versions[0]);
+
+static void testFrames( unsigned char nnMajor, unsigned char nnMinor )
+{
+   SyntheticScene scene(3);
+   scene.setRigidBodies(5, 4);
+   scene.setSkeletons(2, 6);
+   scene.setUnidentifiedMarkers(7);
+   scene.setLabeledMarkers(11);
+   scene.setDropout(0.2);
+
+   for( int f = 0; f < 50; ++f )
+   {
+      MocapFrame frame(nnMajor, nnMinor);
+      scene.frame(f + 1, f/120.0, frame);
+      frame.setLatency(0.002f*f);
+
+      std::vector<char> packed(frame.packedSize());
+      char* end = frame.pack(&packed[0]);
+      CHECK(end == &packed[0] + packed.size());
+
+      MocapFrame unpacked(nnMajor, nnMinor);
+      CHECK(unpacked.unpack(&packed[0], &packed[0] + packed.size()) == &packed[0] + packed.size());
+      CHECK(unpacked.frameNum() == f + 1);
+      CHECK(unpacked.rigidBodies().size() == 5);
+
+      std::vector<char> repacked(unpacked.packedSize());
+      CHECK(repacked.size() == packed.size());
+      if( repacked.size() != packed.size() )
+         return;
+      unpacked.pack(&repacked[0]);
+      CHECK(repacked == packed);
+   }
+}
+
+static void testTruncated( unsigned char nnMajor, unsigned char nnMinor )
+{
+   SyntheticScene scene(3);
+   scene.setRigidBodies(2, 3);
+   scene.setSkeletons(1, 2);
+   scene.setUnidentifiedMarkers(2);
+   scene.setLabeledMarkers(2);
+
+   MocapFrame frame(nnMajor, nnMinor);
+   scene.frame(1, 0.0, frame);
+   std::vector<char> packed(frame.packedSize());
+   frame.pack(&packed[0]);
+
+   // Each prefix in a buffer of its own size, so reading past it is an error
+   // under a memory checker.
+   for( size_t n = 0; n < packed.size(); ++n )
+   {
+      std::vector<char> prefix(packed.begin(), packed.begin() + n);
+      MocapFrame unpacked(nnMajor, nnMinor);
+      CHECK(unpacked.unpack(prefix.empty() ? 0 : &prefix[0], prefix.empty() ? 0 : &prefix[0] + n) == 0);
+   }
+
+   // The marker set count follows the frame number.
+   int const counts[] = { 0x7fffffff, -1, 1000 };
+   for( size_t i = 0; i < sizeof(counts)/sizeof(counts[0]); ++i )
+   {
+      std::vector<char> bad(packed);
+      memcpy(&bad[4], &counts[i], 4);
+      MocapFrame unpacked(nnMajor, nnMinor);
+      CHECK(unpacked.unpack(&bad[0], &bad[0] + bad.size()) == 0);
+   }
+}
+
+static void testDescriptions( unsigned char nnMajor, unsigned char nnMinor )
+{
+   SyntheticScene scene(3);
+   scene.setSkeletons(2, 3);
+   DataDescriptions d;
+   scene.descriptions(d, nnMajor, nnMinor);
+   // Marker positions and labels are only sent from 3.0.
+   d.rigidBodies[0].markerOffsets.push_back(Point3f(0.01f, 0.02f, 0.03f));
+   d.rigidBodies[0].markerOffsets.push_back(Point3f(-0.01f, 0.f, 0.05f));
+   d.rigidBodies[0].markerLabels.push_back(4);
+   d.rigidBodies[0].markerLabels.push_back(5);
+
+   std::vector<char> packed(d.packedSize(nnMajor));
+   CHECK(d.pack(&packed[0], nnMajor) == &packed[0] + packed.size());
+
+   DataDescriptions unpacked;
+   CHECK(unpacked.unpack(&packed[0], &packed[0] + packed.size(), nnMajor) == &packed[0] + packed.size());
+   CHECK(unpacked.rigidBodies.size() == d.rigidBodies.size());
+   // Names are only sent from 2.0.
+   CHECK(nnMajor < 2 || unpacked.rigidBodyName(d.rigidBodies[1].id) == d.rigidBodies[1].name);
+
+   std::vector<char> repacked(unpacked.packedSize(nnMajor));
+   CHECK(repacked.size() == packed.size());
+   if( repacked.size() != packed.size() )
+      return;
+   unpacked.pack(&repacked[0], nnMajor);
+   CHECK(repacked == packed);
+}
+
+static void testSender( unsigned char nnMajor, unsigned char nnMinor )
+{
+   NatNetSender sender;
+   sender.setName("PackTest");
+   sender.setVersion(1, 2, 3, 4);
+   sender.setNatNetVersion(nnMajor, nnMinor);
+
+   std::vector<char> packed(NatNetSender::packedSize()), repacked(NatNetSender::packedSize());
+   CHECK(sender.pack(&packed[0]) == &packed[0] + packed.size());
+   NatNetSender unpacked;
+   unpacked.unpack(&packed[0]);
+   CHECK(unpacked.name() == "PackTest");
+   CHECK(unpacked.natNetVersion()[0] == nnMajor && unpacked.natNetVersion()[1] == nnMinor);
+   unpacked.pack(&repacked[0]);
+   CHECK(repacked == packed);
+}
+
+int main()
+{
+   for( size_t i = 0; i < numVersions; ++i )
+   {
+      testFrames(versions[i][0], versions[i][1]);
+      testTruncated(versions[i][0], versions[i][1]);
+      testDescriptions(versions[i][0], versions[i][1]);
+      testSender(versions[i][0], versions[i][1]);
+   }
+
+   printf("Pack: %d failures\n", failures);
+   return failures ? 1 : 0;
+}
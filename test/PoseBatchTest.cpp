@@ -0,0 +1,329 @@
+/*
+ * PoseBatchTest.cpp is part of NatNetLinux, and is Copyright 2013-2014,
+ * Philip G. Lee <rocketman768@gmail.com>
+ *
+ * NatNetLinux is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NatNetLinux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NatNetLinux.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include <NatNetLinux/NatNet.h>
+#include <NatNetLinux/PoseBatch.h>
+
+#include "Check.h"
+
+// Checks every PoseBatch kernel against the scalar Quaternion4f/Point3f
+// code, and the scalar code against hand-worked rotations. Built twice, with
+// SSE2 and with NATNET_NO_SIMD. Sizes are not multiples of four so the
+// partial loads and stores are covered too.
+
+static float const tol = 1e-4f;
+
+static bool near( float a, float b )
+{
+   return fabsf(a-b) < tol;
+}
+
+static bool near( Point3f const& a, Point3f const& b )
+{
+   return near(a.x,b.x) && near(a.y,b.y) && near(a.z,b.z);
+}
+
+static bool near( Quaternion4f const& a, Quaternion4f const& b )
+{
+   return near(a.qx,b.qx) && near(a.qy,b.qy) && near(a.qz,b.qz) && near(a.qw,b.qw);
+}
+
+// Same rotation: q and -q are equivalent.
+static bool sameRotation( Quaternion4f const& a, Quaternion4f const& b )
+{
+   return near(fabsf(a.dot(b)), 1.f);
+}
+
+static Point3f add( Point3f const& a, Point3f const& b )
+{
+   return Point3f(a.x+b.x, a.y+b.y, a.z+b.z);
+}
+
+static Point3f sub( Point3f const& a, Point3f const& b )
+{
+   return Point3f(a.x-b.x, a.y-b.y, a.z-b.z);
+}
+
+static float uniform( float lo, float hi )
+{
+   return lo + (hi-lo)*(rand()/static_cast<float>(RAND_MAX));
+}
+
+static Point3f randomPoint()
+{
+   return Point3f(uniform(-5.f,5.f), uniform(-5.f,5.f), uniform(-5.f,5.f));
+}
+
+// Normalized by the constructor.
+static Quaternion4f randomQuaternion()
+{
+   return Quaternion4f(uniform(-1.f,1.f), uniform(-1.f,1.f), uniform(-1.f,1.f), uniform(-1.f,1.f));
+}
+
+static PoseArray randomPoses( size_t n )
+{
+   PoseArray a;
+   for( size_t i = 0; i < n; ++i )
+      a.push_back(randomPoint(), randomQuaternion());
+   return a;
+}
+
+// Hand-worked cases that pin the Quaternion4f conventions.
+static void testScalar()
+{
+   float const h = sqrtf(0.5f);
+   Quaternion4f z90(0.f, 0.f, h, h);
+   Quaternion4f x90(h, 0.f, 0.f, h);
+
+   // 90 degrees about z takes x to y, and y to -x.
+   CHECK(near(z90.rotate(Point3f(1.f,0.f,0.f)), Point3f(0.f,1.f,0.f)));
+   CHECK(near(z90.rotate(Point3f(0.f,1.f,0.f)), Point3f(-1.f,0.f,0.f)));
+   // 90 degrees about x takes y to z.
+   CHECK(near(x90.rotate(Point3f(0.f,1.f,0.f)), Point3f(0.f,0.f,1.f)));
+
+   // A*B means B, then A.
+   Point3f p(0.f,1.f,0.f);
+   CHECK(near((x90*z90).rotate(p), x90.rotate(z90.rotate(p))));
+   CHECK(near((z90*x90).rotate(p), z90.rotate(x90.rotate(p))));
+   CHECK(near(z90*z90, Quaternion4f(0.f,0.f,1.f,0.f)));
+
+   for( int i = 0; i < 100; ++i )
+   {
+      Quaternion4f q = randomQuaternion();
+      Quaternion4f r = randomQuaternion();
+
+      CHECK(near(q*q.conjugate(), Quaternion4f()));
+      CHECK(near(q/q, Quaternion4f()));
+      CHECK(near((q*r)/r, q));
+      CHECK(near(q/r, q*r.conjugate()));
+
+      // rotate() agrees with the sandwich product q*v*q^-1.
+      Point3f v = randomPoint();
+      float mag = sqrtf(v.x*v.x + v.y*v.y + v.z*v.z);
+      Quaternion4f vq(v.x/mag, v.y/mag, v.z/mag, 0.f);
+      Quaternion4f s = q*vq*q.conjugate();
+      CHECK(near(q.rotate(v), Point3f(mag*s.qx, mag*s.qy, mag*s.qz)));
+
+      // slerp() hits both ends and the midpoint.
+      CHECK(sameRotation(Quaternion4f::slerp(q, r, 0.f), q));
+      CHECK(sameRotation(Quaternion4f::slerp(q, r, 1.f), r));
+      Quaternion4f m = Quaternion4f::slerp(q, r, 0.5f);
+      CHECK(near(fabsf(m.dot(q)), fabsf(m.dot(r))));
+   }
+}
+
+static void testPoses( size_t n )
+{
+   PoseArray a = randomPoses(n);
+   PoseArray b = randomPoses(n);
+   PoseArray out;
+   size_t i;
+
+   PoseBatch::compose(a, b, out);
+   CHECK(out.size() == n);
+   for( i = 0; i < n; ++i )
+   {
+      CHECK(near(out.orientation(i), a.orientation(i)*b.orientation(i)));
+      CHECK(near(out.location(i), add(a.location(i), a.orientation(i).rotate(b.location(i)))));
+   }
+
+   PoseBatch::inverse(a, out);
+   for( i = 0; i < n; ++i )
+   {
+      Quaternion4f qi = a.orientation(i).conjugate();
+      CHECK(near(out.orientation(i), qi));
+      CHECK(near(out.location(i), sub(Point3f(0.f,0.f,0.f), qi.rotate(a.location(i)))));
+   }
+
+   PoseBatch::relative(a, b, out);
+   for( i = 0; i < n; ++i )
+   {
+      Quaternion4f qi = a.orientation(i).conjugate();
+      CHECK(near(out.orientation(i), qi*b.orientation(i)));
+      CHECK(near(out.location(i), qi.rotate(sub(b.location(i), a.location(i)))));
+   }
+
+   // Output aliasing an input.
+   PoseArray c = a;
+   PoseBatch::compose(c, b, c);
+   PoseBatch::compose(a, b, out);
+   for( i = 0; i < n; ++i )
+      CHECK(near(c.orientation(i), out.orientation(i)) && near(c.location(i), out.location(i)));
+
+   Quaternion4f left = randomQuaternion(), right = randomQuaternion();
+   c = a;
+   PoseBatch::rotateOrientations(left, right, c);
+   for( i = 0; i < n; ++i )
+   {
+      CHECK(near(c.orientation(i), left*a.orientation(i)*right));
+      CHECK(near(c.location(i), a.location(i)));
+   }
+
+   std::vector<float> t(n);
+   for( i = 0; i < n; ++i )
+      t[i] = uniform(0.f, 1.f);
+   // Make some pairs nearly equal, for the linear fallback.
+   if( n > 2 )
+      b.set(1, b.location(1), a.orientation(1));
+   PoseBatch::slerp(a, b, t, out);
+   for( i = 0; i < n; ++i )
+   {
+      CHECK(near(out.orientation(i), Quaternion4f::slerp(a.orientation(i), b.orientation(i), t[i])));
+      Point3f d = sub(b.location(i), a.location(i));
+      CHECK(near(out.location(i), add(a.location(i), Point3f(t[i]*d.x, t[i]*d.y, t[i]*d.z))));
+   }
+
+   c = a;
+   for( i = 0; i < n; ++i )
+   {
+      c.qx[i] *= 3.f; c.qy[i] *= 3.f; c.qz[i] *= 3.f; c.qw[i] *= 3.f;
+   }
+   PoseBatch::normalize(c);
+   for( i = 0; i < n; ++i )
+      CHECK(near(c.orientation(i), a.orientation(i)));
+}
+
+static void testPoints( size_t n )
+{
+   PoseArray poses = randomPoses(n);
+   PointArray in;
+   PointArray out;
+   size_t i;
+
+   for( i = 0; i < n; ++i )
+      in.push_back(randomPoint());
+
+   PoseBatch::transformPoints(poses, in, out);
+   CHECK(out.size() == n);
+   for( i = 0; i < n; ++i )
+      CHECK(near(out.get(i), add(poses.orientation(i).rotate(in.get(i)), poses.location(i))));
+
+   Point3f loc = randomPoint();
+   Quaternion4f ori = randomQuaternion();
+   PoseBatch::transformPoints(loc, ori, in, out);
+   for( i = 0; i < n; ++i )
+      CHECK(near(out.get(i), add(ori.rotate(in.get(i)), loc)));
+
+   PoseBatch::rotatePoints(ori, in, out);
+   for( i = 0; i < n; ++i )
+      CHECK(near(out.get(i), ori.rotate(in.get(i))));
+}
+
+static void testConversions( size_t n )
+{
+   PoseArray a = randomPoses(n);
+   PoseArray back(n);
+   Matrix3Array m;
+   size_t i;
+
+   PoseBatch::toMatrices(a, m);
+   CHECK(m.size() == n);
+   for( i = 0; i < n; ++i )
+   {
+      // Columns are the rotated basis vectors.
+      Quaternion4f q = a.orientation(i);
+      Point3f ex = q.rotate(Point3f(1.f,0.f,0.f));
+      Point3f ey = q.rotate(Point3f(0.f,1.f,0.f));
+      Point3f ez = q.rotate(Point3f(0.f,0.f,1.f));
+      CHECK(near(Point3f(m.m[0][i], m.m[3][i], m.m[6][i]), ex));
+      CHECK(near(Point3f(m.m[1][i], m.m[4][i], m.m[7][i]), ey));
+      CHECK(near(Point3f(m.m[2][i], m.m[5][i], m.m[8][i]), ez));
+   }
+
+   PoseBatch::fromMatrices(m, back);
+   for( i = 0; i < n; ++i )
+      CHECK(sameRotation(back.orientation(i), a.orientation(i)));
+
+   std::vector<float> roll, pitch, yaw;
+   PoseBatch::toEuler(a, roll, pitch, yaw);
+   CHECK(roll.size() == n && pitch.size() == n && yaw.size() == n);
+   for( i = 0; i < n; ++i )
+   {
+      // yaw about z, then pitch about y, then roll about x.
+      Quaternion4f qz(0.f, 0.f, sinf(0.5f*yaw[i]), cosf(0.5f*yaw[i]));
+      Quaternion4f qy(0.f, sinf(0.5f*pitch[i]), 0.f, cosf(0.5f*pitch[i]));
+      Quaternion4f qx(sinf(0.5f*roll[i]), 0.f, 0.f, cosf(0.5f*roll[i]));
+      CHECK(sameRotation(qz*qy*qx, a.orientation(i)));
+   }
+
+   PoseBatch::fromEuler(roll, pitch, yaw, back);
+   for( i = 0; i < n; ++i )
+      CHECK(sameRotation(back.orientation(i), a.orientation(i)));
+}
+
+// Rotations at or near a half turn, where w is about 0 and the matrix's
+// antisymmetric part says nothing about the signs of x, y and z.
+static void testHalfTurns()
+{
+   float const axes[][3] = {
+      { 1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, { 0.f, 0.f, 1.f },
+      { 1.f, 1.f, 0.f }, { 1.f, -1.f, 0.f }, { 0.f, 1.f, -1.f },
+      { 1.f, 1.f, 1.f }, { -1.f, 2.f, 3.f }, { 3.f, -2.f, 0.5f }
+   };
+   float const angles[] = { 3.14159265f, 3.1f, 3.14f };
+   PoseArray a, back;
+   Matrix3Array m;
+   size_t i, j;
+
+   for( i = 0; i < sizeof(axes)/sizeof(axes[0]); ++i )
+   {
+      float len = sqrtf(axes[i][0]*axes[i][0] + axes[i][1]*axes[i][1] + axes[i][2]*axes[i][2]);
+      for( j = 0; j < sizeof(angles)/sizeof(angles[0]); ++j )
+      {
+         float s = sinf(0.5f*angles[j])/len;
+         a.push_back(Point3f(0.f,0.f,0.f), Quaternion4f(s*axes[i][0], s*axes[i][1], s*axes[i][2], cosf(0.5f*angles[j])));
+      }
+   }
+
+   PoseBatch::toMatrices(a, m);
+   PoseBatch::fromMatrices(m, back);
+   CHECK(back.size() == a.size());
+   for( i = 0; i < a.size(); ++i )
+   {
+      CHECK(sameRotation(back.orientation(i), a.orientation(i)));
+      CHECK(back.qw[i] >= 0.f);
+   }
+}
+
+int main()
+{
+   size_t const sizes[] = { 1, 3, 4, 13, 64 };
+   size_t k;
+
+   srand(1);
+   testScalar();
+   testHalfTurns();
+   for( k = 0; k < sizeof(sizes)/sizeof(sizes[0]); ++k )
+   {
+      testPoses(sizes[k]);
+      testPoints(sizes[k]);
+      testConversions(sizes[k]);
+   }
+
+#ifdef NATNET_SIMD_SSE2
+   printf("PoseBatch (SSE2): %d failures\n", failures);
+#else
+   printf("PoseBatch (portable): %d failures\n", failures);
+#endif
+   return failures ? 1 : 0;
+}